@@ -9,7 +9,7 @@
 
 #include "types.h"
 
-#define PICOM_BACKEND_MAJOR (1UL)
+#define PICOM_BACKEND_MAJOR (2UL)
 #define PICOM_BACKEND_MINOR (0UL)
 #define PICOM_BACKEND_MAKE_VERSION(major, minor) ((major) * 1000 + (minor))
 
@@ -176,6 +176,10 @@ enum backend_quirk {
 	/// Backend cannot do blur quickly. The compositor will avoid using blur to create
 	/// shadows on this backend
 	BACKEND_QUIRK_SLOW_BLUR = 1 << 0,
+	/// The back buffer is shown on screen as it's being rendered to. The compositor
+	/// should render into an intermediate image, and copy that into the back buffer
+	/// in one go.
+	BACKEND_QUIRK_FRONT_BUFFER = 1 << 1,
 };
 
 struct backend_operations {
@@ -238,6 +242,16 @@ struct backend_operations {
 	bool (*blit)(struct backend_base *backend_data, ivec2 origin, image_handle target,
 	             const struct backend_blit_args *args) __attribute__((nonnull(1, 3, 4)));
 
+	/// Do several blits into the same target image, in order. The result must be the
+	/// same as calling `blit` with `origins[i]` and `args[i]` for each `i`, but the
+	/// backend can merge the blits into fewer draws.
+	///
+	/// Optional, `blit` is called for each of them if this is not available.
+	bool (*blit_many)(struct backend_base *backend_data, image_handle target,
+	                  unsigned count, const ivec2 origins[count],
+	                  const struct backend_blit_args *const args[count])
+	    __attribute__((nonnull(1, 2, 4, 5)));
+
 	/// Blur a given region of a source image and store the result in the
 	/// target image.
 	///
@@ -342,11 +356,26 @@ struct backend_operations {
 	///
 	/// @param backend_data backend data
 	/// @param pixmap       X pixmap to bind
+	/// @param size         size of the pixmap. The caller should already know it,
+	///                     so binding doesn't need a round trip to the X server.
 	/// @param fmt          information of the pixmap's visual
 	/// @return             backend specific image handle for the pixmap. May be
 	///                     NULL.
 	image_handle (*bind_pixmap)(struct backend_base *backend_data, xcb_pixmap_t pixmap,
-	                            struct xvisual_info fmt) __attribute__((nonnull(1)));
+	                            ivec2 size, struct xvisual_info fmt)
+	    __attribute__((nonnull(1)));
+
+	/// Notify the backend that the content of the X pixmap bound to `image` has
+	/// changed, so anything the backend derived from the content of `image` is no
+	/// longer valid. Changes made by the backend itself, i.e. rendering into
+	/// `image`, are not reported.
+	///
+	/// Optional.
+	///
+	/// @param backend_data backend data
+	/// @param image        an image returned by `bind_pixmap`
+	void (*pixmap_damaged)(struct backend_base *backend_data, image_handle image)
+	    __attribute__((nonnull(1, 2)));
 
 	/// Acquire the image handle of the back buffer.
 	///
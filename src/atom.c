@@ -141,7 +141,7 @@ void destroy_atoms(struct atom *a) {
 	free(a);
 }
 
-#if defined(UNIT_TEST) || defined(CONFIG_FUZZER)
+#if defined(UNIT_TEST) || defined(CONFIG_FUZZER) || defined(CONFIG_BENCHMARK)
 
 static inline int mock_atom_getter(struct cache *cache, const char *atom_name attr_unused,
                                    size_t atom_len attr_unused, struct cache_handle **value,
@@ -81,13 +81,29 @@ bool backend_can_present(struct backend_info *info) {
 	return info->can_present;
 }
 
+/// Maximum number of blits `backend_execute` passes to `blit_many` at once.
+#define BACKEND_BLIT_BATCH_SIZE 32
+
 /// Execute a list of backend commands on the backend
 /// @param target     the image to render into
 /// @param root_image the image containing the desktop background
 bool backend_execute(struct backend_base *backend, image_handle target, unsigned ncmds,
                      const struct backend_command cmds[ncmds]) {
+	// Consecutive blits are collected, and executed together if the backend supports
+	// that.
+	ivec2 origins[BACKEND_BLIT_BATCH_SIZE];
+	const struct backend_blit_args *blits[BACKEND_BLIT_BATCH_SIZE];
+	unsigned nblits = 0;
 	bool succeeded = true;
 	for (auto cmd = &cmds[0]; succeeded && cmd != &cmds[ncmds]; cmd++) {
+		if (nblits > 0 && cmd->op != BACKEND_COMMAND_BLIT) {
+			succeeded = backend->ops.blit_many(backend, target, nblits,
+			                                   origins, blits);
+			nblits = 0;
+			if (!succeeded) {
+				break;
+			}
+		}
 		switch (cmd->op) {
 		case BACKEND_COMMAND_BLIT:
 			if (!pixman_region32_not_empty(cmd->blit.target_mask)) {
@@ -96,8 +112,18 @@ bool backend_execute(struct backend_base *backend, image_handle target, unsigned
 			if (cmd->blit.opacity < 1. / MAX_ALPHA) {
 				continue;
 			}
-			succeeded =
-			    backend->ops.blit(backend, cmd->origin, target, &cmd->blit);
+			if (backend->ops.blit_many == NULL) {
+				succeeded = backend->ops.blit(backend, cmd->origin,
+				                              target, &cmd->blit);
+				break;
+			}
+			origins[nblits] = cmd->origin;
+			blits[nblits++] = &cmd->blit;
+			if (nblits == BACKEND_BLIT_BATCH_SIZE) {
+				succeeded = backend->ops.blit_many(backend, target, nblits,
+				                                   origins, blits);
+				nblits = 0;
+			}
 			break;
 		case BACKEND_COMMAND_COPY_AREA:
 			if (!pixman_region32_not_empty(cmd->copy_area.region)) {
@@ -118,6 +144,10 @@ bool backend_execute(struct backend_base *backend, image_handle target, unsigned
 		default: assert(false);
 		}
 	}
+	if (succeeded && nblits > 0) {
+		succeeded =
+		    backend->ops.blit_many(backend, target, nblits, origins, blits);
+	}
 	return succeeded;
 }
 
@@ -126,6 +156,12 @@ static inline const char *render_command_source_name(enum backend_command_source
 	case BACKEND_COMMAND_SOURCE_WINDOW: return "window";
 	case BACKEND_COMMAND_SOURCE_WINDOW_SAVED: return "window_saved";
 	case BACKEND_COMMAND_SOURCE_SHADOW: return "shadow";
+	case BACKEND_COMMAND_SOURCE_SHADOW_CORNER: return "shadow_corner";
+	case BACKEND_COMMAND_SOURCE_SHADOW_TOP: return "shadow_top";
+	case BACKEND_COMMAND_SOURCE_SHADOW_BOTTOM: return "shadow_bottom";
+	case BACKEND_COMMAND_SOURCE_SHADOW_LEFT: return "shadow_left";
+	case BACKEND_COMMAND_SOURCE_SHADOW_RIGHT: return "shadow_right";
+	case BACKEND_COMMAND_SOURCE_SHADOW_CENTER: return "shadow_center";
 	case BACKEND_COMMAND_SOURCE_BACKGROUND: return "background";
 	}
 	unreachable();
@@ -22,9 +22,23 @@ enum backend_command_source {
 	BACKEND_COMMAND_SOURCE_WINDOW,
 	BACKEND_COMMAND_SOURCE_WINDOW_SAVED,
 	BACKEND_COMMAND_SOURCE_SHADOW,
+	/// Slices of a shadow drawn in nine slices, see `shadow_tile_size`. All four
+	/// corners share the same source image.
+	BACKEND_COMMAND_SOURCE_SHADOW_CORNER,
+	BACKEND_COMMAND_SOURCE_SHADOW_TOP,
+	BACKEND_COMMAND_SOURCE_SHADOW_BOTTOM,
+	BACKEND_COMMAND_SOURCE_SHADOW_LEFT,
+	BACKEND_COMMAND_SOURCE_SHADOW_RIGHT,
+	BACKEND_COMMAND_SOURCE_SHADOW_CENTER,
 	BACKEND_COMMAND_SOURCE_BACKGROUND,
 };
 
+/// Whether `source` is a shadow, or a slice of one.
+static inline bool backend_command_source_is_shadow(enum backend_command_source source) {
+	return source >= BACKEND_COMMAND_SOURCE_SHADOW &&
+	       source <= BACKEND_COMMAND_SOURCE_SHADOW_CENTER;
+}
+
 // TODO(yshui) might need better names
 
 struct backend_command {
@@ -58,24 +58,87 @@ solid_picture(struct x_connection *c, bool argb, double a, double r, double g, d
 	return picture;
 }
 
+/// Number of fractional bits in the fixed-point kernel sums used for shadow generation.
+#define SHADOW_FIXED_SHIFT 16
+
+/// Convert a fixed-point kernel sum, already scaled by the shadow opacity, to a pixel
+/// value. `full` is the sum of the whole kernel.
+static inline uint8_t shadow_pixel_value(int32_t sum, int32_t full) {
+	return (uint8_t)(clamp(sum, 0, full) >> SHADOW_FIXED_SHIFT);
+}
+
+/// Fill a row of the shadow. `row_sum[x]` is the sum of the kernel columns [0, x) over
+/// the kernel rows covering this row of the shadow, so `row_sum[0]` is always 0.
+static void shadow_fill_row(uint8_t *restrict out, const int32_t *restrict row_sum,
+                            int d, int width, int32_t full) {
+	int swidth = width + d - 1;
+	if (width < d - 1) {
+		// Every pixel is covered by a different range of kernel columns.
+		for (int x = 0; x < swidth; x++) {
+			int xs = normalize_i_range(d - x - 1, 0, d),
+			    xe = normalize_i_range(d - x - 1 + width, 0, d);
+			out[x] = shadow_pixel_value(row_sum[xe] - row_sum[xs], full);
+		}
+		return;
+	}
+
+	// Pixel x on the left is covered by the kernel columns [d - 1 - x, d), pixel x
+	// on the right by [0, swidth - x), and the ones in the middle by all columns.
+	for (int x = 0; x < d - 1; x++) {
+		out[x] = shadow_pixel_value(row_sum[d] - row_sum[d - 1 - x], full);
+	}
+	memset(out + d - 1, shadow_pixel_value(row_sum[d], full), (size_t)(width - d + 1));
+	for (int x = 0; x < d - 1; x++) {
+		out[width + x] = shadow_pixel_value(row_sum[d - 1 - x], full);
+	}
+}
+
+/// Fill `data` with the shadow of a `width` x `height` window, i.e. the window convolved
+/// with `kernel`, multiplied by `opacity`.
+///
+/// Kernel sums are looked up in a summed area table of fixed-point integers, which is
+/// scaled by opacity beforehand. Only the rows near the top and bottom edges are
+/// computed, the rows in the middle are all the same so they are copied; and within a
+/// row, the run of pixels covered by the whole kernel is filled with `memset`.
+static void shadow_fill(uint8_t *data, size_t stride, const conv *kernel, double opacity,
+                        int width, int height) {
+	int d = kernel->w;
+	int swidth = width + d - 1, sheight = height + d - 1;
+	double scale = opacity * 255.0 * (1 << SHADOW_FIXED_SHIFT);
+	// sat[y * (d + 1) + x] is the sum of the kernel in [0, x) x [0, y)
+	auto sat = ccalloc((d + 1) * (d + 1), int32_t);
+	for (int y = 1; y <= d; y++) {
+		for (int x = 1; x <= d; x++) {
+			sat[y * (d + 1) + x] =
+			    (int32_t)(kernel->rsum[(y - 1) * d + x - 1] * scale + 0.5);
+		}
+	}
+	auto full = (int32_t)(scale + 0.5);
+	auto row_sum = ccalloc(d + 1, int32_t);
+
+	// Rows in [mid_start, mid_end) are covered by every row of the kernel.
+	int mid_start = min2(d - 1, sheight), mid_end = max2(height, mid_start);
+	for (int y = 0; y < sheight; y++) {
+		if (y > mid_start && y < mid_end) {
+			memcpy(data + (size_t)y * stride,
+			       data + (size_t)mid_start * stride, (size_t)swidth);
+			continue;
+		}
+		int ys = normalize_i_range(d - y - 1, 0, d),
+		    ye = normalize_i_range(d - y - 1 + height, 0, d);
+		for (int x = 0; x <= d; x++) {
+			row_sum[x] = sat[ye * (d + 1) + x] - sat[ys * (d + 1) + x];
+		}
+		shadow_fill_row(data + (size_t)y * stride, row_sum, d, width, full);
+	}
+	free(row_sum);
+	free(sat);
+}
+
 xcb_image_t *make_shadow(struct x_connection *c, const conv *kernel, double opacity,
                          int width, int height) {
-	/*
-	 * We classify shadows into 4 kinds of regions
-	 *    r = shadow radius
-	 * (0, 0) is the top left of the window itself
-	 *         -r     r      width-r  width+r
-	 *       -r +-----+---------+-----+
-	 *          |  1  |    2    |  1  |
-	 *        r +-----+---------+-----+
-	 *          |  2  |    3    |  2  |
-	 * height-r +-----+---------+-----+
-	 *          |  1  |    2    |  1  |
-	 * height+r +-----+---------+-----+
-	 */
 	xcb_image_t *ximage;
-	const double *shadow_sum = kernel->rsum;
-	assert(shadow_sum);
+	assert(kernel->rsum);
 	// We only support square kernels for shadow
 	assert(kernel->w == kernel->h);
 	int d = kernel->w;
@@ -93,102 +156,7 @@ xcb_image_t *make_shadow(struct x_connection *c, const conv *kernel, double opac
 		return 0;
 	}
 
-	unsigned char *data = ximage->data;
-	long long sstride = ximage->stride;
-
-	// If the window body is smaller than the kernel, we do convolution directly
-	if (width < r * 2 && height < r * 2) {
-		for (int y = 0; y < sheight; y++) {
-			for (int x = 0; x < swidth; x++) {
-				double sum = sum_kernel_normalized(
-				    kernel, d - x - 1, d - y - 1, width, height);
-				data[y * sstride + x] = (uint8_t)(sum * 255.0 * opacity);
-			}
-		}
-		return ximage;
-	}
-
-	if (height < r * 2) {
-		// Implies width >= r * 2
-		// If the window height is smaller than the kernel, we divide
-		// the window like this:
-		// -r     r         width-r  width+r
-		// +------+-------------+------+
-		// |      |             |      |
-		// +------+-------------+------+
-		for (int y = 0; y < sheight; y++) {
-			for (int x = 0; x < r * 2; x++) {
-				double sum = sum_kernel_normalized(kernel, d - x - 1,
-				                                   d - y - 1, d, height) *
-				             255.0 * opacity;
-				data[y * sstride + x] = (uint8_t)sum;
-				data[y * sstride + swidth - x - 1] = (uint8_t)sum;
-			}
-		}
-		for (int y = 0; y < sheight; y++) {
-			double sum = sum_kernel_normalized(kernel, 0, d - y - 1, d, height) *
-			             255.0 * opacity;
-			memset(&data[y * sstride + r * 2], (uint8_t)sum,
-			       (size_t)(width - 2 * r));
-		}
-		return ximage;
-	}
-	if (width < r * 2) {
-		// Similarly, for width smaller than kernel
-		for (int y = 0; y < r * 2; y++) {
-			for (int x = 0; x < swidth; x++) {
-				double sum = sum_kernel_normalized(kernel, d - x - 1,
-				                                   d - y - 1, width, d) *
-				             255.0 * opacity;
-				data[y * sstride + x] = (uint8_t)sum;
-				data[(sheight - y - 1) * sstride + x] = (uint8_t)sum;
-			}
-		}
-		for (int x = 0; x < swidth; x++) {
-			double sum = sum_kernel_normalized(kernel, d - x - 1, 0, width, d) *
-			             255.0 * opacity;
-			for (int y = r * 2; y < height; y++) {
-				data[y * sstride + x] = (uint8_t)sum;
-			}
-		}
-		return ximage;
-	}
-
-	// Implies: width >= r * 2 && height >= r * 2
-
-	// Fill part 3
-	for (int y = r; y < height + r; y++) {
-		memset(data + sstride * y + r, (uint8_t)(255 * opacity), (size_t)width);
-	}
-
-	// Part 1
-	for (int y = 0; y < r * 2; y++) {
-		for (int x = 0; x < r * 2; x++) {
-			double tmpsum = shadow_sum[y * d + x] * opacity * 255.0;
-			data[y * sstride + x] = (uint8_t)tmpsum;
-			data[(sheight - y - 1) * sstride + x] = (uint8_t)tmpsum;
-			data[(sheight - y - 1) * sstride + (swidth - x - 1)] = (uint8_t)tmpsum;
-			data[y * sstride + (swidth - x - 1)] = (uint8_t)tmpsum;
-		}
-	}
-
-	// Part 2, top/bottom
-	for (int y = 0; y < r * 2; y++) {
-		double tmpsum = shadow_sum[d * y + d - 1] * opacity * 255.0;
-		memset(&data[y * sstride + r * 2], (uint8_t)tmpsum, (size_t)(width - r * 2));
-		memset(&data[(sheight - y - 1) * sstride + r * 2], (uint8_t)tmpsum,
-		       (size_t)(width - r * 2));
-	}
-
-	// Part 2, left/right
-	for (int x = 0; x < r * 2; x++) {
-		double tmpsum = shadow_sum[d * (d - 1) + x] * opacity * 255.0;
-		for (int y = r * 2; y < height; y++) {
-			data[y * sstride + x] = (uint8_t)tmpsum;
-			data[y * sstride + (swidth - x - 1)] = (uint8_t)tmpsum;
-		}
-	}
-
+	shadow_fill(ximage->data, ximage->stride, kernel, opacity, width, height);
 	return ximage;
 }
 
@@ -197,7 +165,7 @@ xcb_image_t *make_shadow(struct x_connection *c, const conv *kernel, double opac
  */
 bool build_shadow(struct x_connection *c, double opacity, const int width,
                   const int height, const conv *kernel, xcb_render_picture_t shadow_pixel,
-                  xcb_pixmap_t *pixmap) {
+                  xcb_pixmap_t *pixmap, ivec2 *size) {
 	xcb_image_t *shadow_image = NULL;
 	xcb_pixmap_t shadow_pixmap = XCB_NONE, shadow_pixmap_argb = XCB_NONE;
 	xcb_render_picture_t shadow_picture = XCB_NONE, shadow_picture_argb = XCB_NONE;
@@ -262,6 +230,7 @@ bool build_shadow(struct x_connection *c, double opacity, const int width,
 	                     shadow_image->height);
 
 	*pixmap = shadow_pixmap_argb;
+	*size = (ivec2){.width = shadow_image->width, .height = shadow_image->height};
 
 	xcb_free_gc(c->c, gc);
 	xcb_image_destroy(shadow_image);
@@ -419,3 +388,148 @@ void init_backend_base(struct backend_base *base, session_t *ps) {
 uint32_t backend_no_quirks(struct backend_base *base attr_unused) {
 	return 0;
 }
+
+/// The straightforward way of generating shadows, `shadow_fill` is tested and benchmarked
+/// against this.
+static void attr_unused shadow_fill_reference(uint8_t *data, long long sstride,
+                                              const conv *kernel, double opacity,
+                                              int width, int height) {
+	const double *shadow_sum = kernel->rsum;
+	int d = kernel->w;
+	int r = d / 2;
+	int swidth = width + r * 2, sheight = height + r * 2;
+
+	// If the window body is smaller than the kernel, we do convolution directly
+	if (width < r * 2 && height < r * 2) {
+		for (int y = 0; y < sheight; y++) {
+			for (int x = 0; x < swidth; x++) {
+				double sum = sum_kernel_normalized(
+				    kernel, d - x - 1, d - y - 1, width, height);
+				data[y * sstride + x] = (uint8_t)(sum * 255.0 * opacity);
+			}
+		}
+		return;
+	}
+
+	if (height < r * 2) {
+		// Implies width >= r * 2
+		// If the window height is smaller than the kernel, we divide
+		// the window like this:
+		// -r     r         width-r  width+r
+		// +------+-------------+------+
+		// |      |             |      |
+		// +------+-------------+------+
+		for (int y = 0; y < sheight; y++) {
+			for (int x = 0; x < r * 2; x++) {
+				double sum = sum_kernel_normalized(kernel, d - x - 1,
+				                                   d - y - 1, d, height) *
+				             255.0 * opacity;
+				data[y * sstride + x] = (uint8_t)sum;
+				data[y * sstride + swidth - x - 1] = (uint8_t)sum;
+			}
+		}
+		for (int y = 0; y < sheight; y++) {
+			double sum = sum_kernel_normalized(kernel, 0, d - y - 1, d, height) *
+			             255.0 * opacity;
+			memset(&data[y * sstride + r * 2], (uint8_t)sum,
+			       (size_t)(width - 2 * r));
+		}
+		return;
+	}
+	if (width < r * 2) {
+		// Similarly, for width smaller than kernel
+		for (int y = 0; y < r * 2; y++) {
+			for (int x = 0; x < swidth; x++) {
+				double sum = sum_kernel_normalized(kernel, d - x - 1,
+				                                   d - y - 1, width, d) *
+				             255.0 * opacity;
+				data[y * sstride + x] = (uint8_t)sum;
+				data[(sheight - y - 1) * sstride + x] = (uint8_t)sum;
+			}
+		}
+		for (int x = 0; x < swidth; x++) {
+			double sum = sum_kernel_normalized(kernel, d - x - 1, 0, width, d) *
+			             255.0 * opacity;
+			for (int y = r * 2; y < height; y++) {
+				data[y * sstride + x] = (uint8_t)sum;
+			}
+		}
+		return;
+	}
+
+	// Implies: width >= r * 2 && height >= r * 2
+
+	// Fill part 3
+	for (int y = r; y < height + r; y++) {
+		memset(data + sstride * y + r, (uint8_t)(255 * opacity), (size_t)width);
+	}
+
+	// Part 1
+	for (int y = 0; y < r * 2; y++) {
+		for (int x = 0; x < r * 2; x++) {
+			double tmpsum = shadow_sum[y * d + x] * opacity * 255.0;
+			data[y * sstride + x] = (uint8_t)tmpsum;
+			data[(sheight - y - 1) * sstride + x] = (uint8_t)tmpsum;
+			data[(sheight - y - 1) * sstride + (swidth - x - 1)] = (uint8_t)tmpsum;
+			data[y * sstride + (swidth - x - 1)] = (uint8_t)tmpsum;
+		}
+	}
+
+	// Part 2, top/bottom
+	for (int y = 0; y < r * 2; y++) {
+		double tmpsum = shadow_sum[d * y + d - 1] * opacity * 255.0;
+		memset(&data[y * sstride + r * 2], (uint8_t)tmpsum, (size_t)(width - r * 2));
+		memset(&data[(sheight - y - 1) * sstride + r * 2], (uint8_t)tmpsum,
+		       (size_t)(width - r * 2));
+	}
+
+	// Part 2, left/right
+	for (int x = 0; x < r * 2; x++) {
+		double tmpsum = shadow_sum[d * (d - 1) + x] * opacity * 255.0;
+		for (int y = r * 2; y < height; y++) {
+			data[y * sstride + x] = (uint8_t)tmpsum;
+			data[y * sstride + (swidth - x - 1)] = (uint8_t)tmpsum;
+		}
+	}
+
+}
+
+#ifdef CONFIG_BENCHMARK
+void backend_shadow_fill(uint8_t *data, size_t stride, const conv *kernel, double opacity,
+                         int width, int height) {
+	shadow_fill(data, stride, kernel, opacity, width, height);
+}
+
+void backend_shadow_fill_reference(uint8_t *data, size_t stride, const conv *kernel,
+                                   double opacity, int width, int height) {
+	shadow_fill_reference(data, (long long)stride, kernel, opacity, width, height);
+}
+#endif
+
+TEST_CASE(shadow_fill_matches_reference) {
+	// Window sizes smaller than, around, and much larger than the kernel.
+	const ivec2 sizes[] = {{4, 4},     {4, 300},   {300, 4},
+	                       {30, 30},   {400, 300}, {1920, 1080}};
+	auto kernel = gaussian_kernel_autodetect_deviation(12);
+	sum_kernel_preprocess(kernel);
+	int d = kernel->w;
+	for (size_t i = 0; i < ARR_SIZE(sizes); i++) {
+		int swidth = sizes[i].width + d - 1, sheight = sizes[i].height + d - 1;
+		auto expected = ccalloc(swidth * sheight, uint8_t);
+		auto actual = ccalloc(swidth * sheight, uint8_t);
+		shadow_fill_reference(expected, swidth, kernel, 0.75, sizes[i].width,
+		                      sizes[i].height);
+		shadow_fill(actual, (size_t)swidth, kernel, 0.75, sizes[i].width,
+		            sizes[i].height);
+
+		// Fixed-point rounding can make a difference of 1.
+		int max_diff = 0;
+		for (int j = 0; j < swidth * sheight; j++) {
+			max_diff = max2(max_diff, abs(expected[j] - actual[j]));
+		}
+		free(expected);
+		free(actual);
+		TEST_TRUE(max_diff <= 1);
+	}
+	free_conv(kernel);
+}
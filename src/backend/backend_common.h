@@ -27,8 +27,11 @@ struct dual_kawase_params {
 
 xcb_image_t *make_shadow(struct x_connection *c, const conv *kernel, double opacity,
                          int width, int height);
+/// Build a shadow pixmap for a window of size `width` x `height`. The size of the
+/// returned pixmap, which includes the shadow radius, is stored in `size`.
 bool build_shadow(struct x_connection *, double opacity, int width, int height,
-                  const conv *kernel, xcb_render_picture_t shadow_pixel, xcb_pixmap_t *pixmap);
+                  const conv *kernel, xcb_render_picture_t shadow_pixel,
+                  xcb_pixmap_t *pixmap, ivec2 *size);
 
 xcb_render_picture_t
 solid_picture(struct x_connection *, bool argb, double a, double r, double g, double b);
@@ -39,3 +42,14 @@ struct conv **generate_blur_kernel(enum blur_method method, void *args, int *ker
 struct dual_kawase_params *generate_dual_kawase_params(void *args);
 
 uint32_t backend_no_quirks(struct backend_base *base attr_unused);
+
+#ifdef CONFIG_BENCHMARK
+/// Fill in the shadow of a window of size `width` x `height`, as `make_shadow` does.
+/// `data` must be big enough to hold the shadow, including its radius.
+void backend_shadow_fill(uint8_t *data, size_t stride, const conv *kernel, double opacity,
+                         int width, int height);
+/// Same as `backend_shadow_fill`, but with the straightforward implementation
+/// `backend_shadow_fill` is compared against.
+void backend_shadow_fill_reference(uint8_t *data, size_t stride, const conv *kernel,
+                                   double opacity, int width, int height);
+#endif
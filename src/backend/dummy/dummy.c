@@ -105,6 +105,7 @@ bool dummy_blur(struct backend_base *base, ivec2 origin attr_unused, image_handl
 }
 
 image_handle dummy_bind_pixmap(struct backend_base *base, xcb_pixmap_t pixmap,
+                               ivec2 size attr_unused,
                                struct xvisual_info fmt attr_unused) {
 	auto dummy = (struct dummy_data *)base;
 	struct dummy_image *img = NULL;
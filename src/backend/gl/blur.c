@@ -5,28 +5,41 @@
 
 #include "gl_common.h"
 
+/// Number of texture sets kept in the pool of a blur context. Enough for a few blurred
+/// windows of different sizes, so a frame doesn't have to reallocate textures.
+#define GL_BLUR_POOL_SIZE 4
+/// Granularity of the sizes of pooled blur textures.
+#define GL_BLUR_SIZE_CLASS 256
+
+/// Temporary textures used for blurring a region, and the fbos used to render into them.
+struct gl_blur_textures {
+	/// Size class of the textures, a multiple of `GL_BLUR_SIZE_CLASS`. Textures in
+	/// this set can be used for blurring regions up to this size.
+	ivec2 size;
+	GLuint *textures;
+	/// Dimensions of each texture. For kernel blur they are all `size`, for
+	/// dual-kawase each texture is a quarter of the previous one.
+	/// Turns out calling glTexImage to resize is expensive, so we avoid that.
+	ivec2 *texture_sizes;
+	GLuint *fbos;
+	/// Value of `gl_blur_context::uses` when this set was last used.
+	uint64_t last_used;
+};
+
 struct gl_blur_context {
 	enum blur_method method;
 	struct gl_shader *blur_shader;
 
-	/// Temporary textures used for blurring
-	GLuint *blur_textures;
+	/// Number of temporary textures and fbos needed for blurring
 	int blur_texture_count;
-	/// Temporary fbos used for blurring
-	GLuint *blur_fbos;
 	int blur_fbo_count;
 
-	/// Cached dimensions of each blur_texture. They are the same size as the target,
-	/// so they are always big enough without resizing.
-	/// Turns out calling glTexImage to resize is expensive, so we avoid that.
-	struct texture_size {
-		int width;
-		int height;
-	} *texture_sizes;
-
-	/// Cached dimensions of the offscreen framebuffer. It's the same size as the
-	/// target but is expanded in either direction by resize_width / resize_height.
-	int fb_width, fb_height;
+	/// Temporary textures used for blurring. They cover the bounding box of the
+	/// blurred region, not the whole source image, so they are kept in a small pool
+	/// of sets of different sizes.
+	struct gl_blur_textures pool[GL_BLUR_POOL_SIZE];
+	/// Number of times textures were taken from `pool`.
+	uint64_t uses;
 
 	/// How much do we need to resize the damaged region for blurring.
 	int resize_width, resize_height;
@@ -43,16 +56,18 @@ struct gl_blur_context {
 /**
  * Blur contents in a particular region.
  */
-static bool gl_kernel_blur(double opacity, struct gl_blur_context *bctx,
-                           const struct backend_mask_image *mask, const GLuint vao[2],
-                           const int vao_nelems[2], struct gl_texture *source,
+static bool gl_kernel_blur(struct gl_data *gd, double opacity,
+                           struct gl_blur_context *bctx,
+                           const struct gl_blur_textures *textures,
+                           const struct backend_mask_image *mask, const GLuint vao[3],
+                           const int vao_nelems[3], struct gl_texture *source,
                            GLuint blur_sampler, GLuint target_fbo, GLuint default_mask) {
 	int curr = 0;
 	for (int i = 0; i < bctx->npasses; ++i) {
 		auto p = &bctx->blur_shader[i];
 		assert(p->prog);
 
-		assert(bctx->blur_textures[curr]);
+		assert(textures->textures[curr]);
 
 		// The origin to use when sampling from the source texture
 		GLint tex_width, tex_height;
@@ -63,16 +78,15 @@ static bool gl_kernel_blur(double opacity, struct gl_blur_context *bctx,
 			tex_width = source->width;
 			tex_height = source->height;
 		} else {
-			src_texture = bctx->blur_textures[curr];
-			auto src_size = bctx->texture_sizes[curr];
+			src_texture = textures->textures[curr];
+			auto src_size = textures->texture_sizes[curr];
 			tex_width = src_size.width;
 			tex_height = src_size.height;
 		}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, src_texture);
-		glBindSampler(0, blur_sampler);
-		glUseProgram(p->prog);
+		gl_bind_texture(gd, 0, src_texture);
+		gl_bind_sampler(gd, 0, blur_sampler);
+		gl_use_program(gd, p->prog);
 		if (p->uniform_bitmask & (1 << UNIFORM_PIXEL_NORM_LOC)) {
 			// If the last pass is a trivial blend pass, it will not have
 			// pixel_norm.
@@ -80,8 +94,7 @@ static bool gl_kernel_blur(double opacity, struct gl_blur_context *bctx,
 			            1.0F / (GLfloat)tex_height);
 		}
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, default_mask);
+		gl_bind_texture(gd, 1, default_mask);
 
 		glUniform1i(UNIFORM_MASK_TEX_LOC, 1);
 		glUniform2f(UNIFORM_MASK_OFFSET_LOC, 0.0F, 0.0F);
@@ -92,17 +105,17 @@ static bool gl_kernel_blur(double opacity, struct gl_blur_context *bctx,
 		GLsizei nelems;
 
 		if (i < bctx->npasses - 1) {
-			assert(bctx->blur_fbos[0]);
-			assert(bctx->blur_textures[!curr]);
+			assert(textures->fbos[0]);
+			assert(textures->textures[!curr]);
 
 			// not last pass, draw into framebuffer, with resized regions
-			glBindVertexArray(vao[1]);
-			nelems = vao_nelems[1];
-			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_fbos[0]);
+			gl_bind_vertex_array(gd, i == 0 ? vao[1] : vao[2]);
+			nelems = vao_nelems[i == 0 ? 1 : 2];
+			gl_bind_draw_framebuffer(gd, textures->fbos[0]);
 
 			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-			                       GL_TEXTURE_2D, bctx->blur_textures[!curr], 0);
-			glDrawBuffer(GL_COLOR_ATTACHMENT0);
+			                       GL_TEXTURE_2D, textures->textures[!curr],
+			                       0);
 			if (!gl_check_fb_complete(GL_FRAMEBUFFER)) {
 				return false;
 			}
@@ -114,17 +127,16 @@ static bool gl_kernel_blur(double opacity, struct gl_blur_context *bctx,
 			if (mask != NULL) {
 				auto inner = (struct gl_texture *)mask->image;
 				log_trace("Mask texture is %d", inner->texture);
-				glActiveTexture(GL_TEXTURE1);
-				glBindTexture(GL_TEXTURE_2D, inner->texture);
+				gl_bind_texture(gd, 1, inner->texture);
 				glUniform1i(UNIFORM_MASK_INVERTED_LOC, mask->inverted);
 				glUniform1f(UNIFORM_MASK_CORNER_RADIUS_LOC,
 				            (float)mask->corner_radius);
 				glUniform2f(UNIFORM_MASK_OFFSET_LOC, (float)(mask->origin.x),
 				            (float)(mask->origin.y));
 			}
-			glBindVertexArray(vao[0]);
+			gl_bind_vertex_array(gd, vao[0]);
 			nelems = vao_nelems[0];
-			glBindFramebuffer(GL_FRAMEBUFFER, target_fbo);
+			gl_bind_draw_framebuffer(gd, target_fbo);
 
 			glUniform1f(UNIFORM_OPACITY_LOC, (float)opacity);
 		}
@@ -142,12 +154,14 @@ static bool gl_kernel_blur(double opacity, struct gl_blur_context *bctx,
 
 /// Do dual-kawase blur.
 ///
-/// @param vao two vertex array objects.
+/// @param vao three vertex array objects.
 ///            [0]: for sampling from blurred result into the target fbo.
 ///            [1]: for sampling from the source texture into blurred textures.
-bool gl_dual_kawase_blur(double opacity, struct gl_blur_context *bctx,
-                         const struct backend_mask_image *mask, const GLuint vao[2],
-                         const int vao_nelems[2], struct gl_texture *source,
+///            [2]: for sampling between blurred textures.
+bool gl_dual_kawase_blur(struct gl_data *gd, double opacity, struct gl_blur_context *bctx,
+                         const struct gl_blur_textures *textures,
+                         const struct backend_mask_image *mask, const GLuint vao[3],
+                         const int vao_nelems[3], struct gl_texture *source,
                          GLuint blur_sampler, GLuint target_fbo, GLuint default_mask) {
 	int iterations = bctx->blur_texture_count;
 	int scale_factor = 1;
@@ -155,9 +169,8 @@ bool gl_dual_kawase_blur(double opacity, struct gl_blur_context *bctx,
 	// Kawase downsample pass
 	auto down_pass = &bctx->blur_shader[0];
 	assert(down_pass->prog);
-	glUseProgram(down_pass->prog);
+	gl_use_program(gd, down_pass->prog);
 
-	glBindVertexArray(vao[1]);
 	int nelems = vao_nelems[1];
 
 	for (int i = 0; i < iterations; ++i) {
@@ -172,22 +185,22 @@ bool gl_dual_kawase_blur(double opacity, struct gl_blur_context *bctx,
 			src_texture = source->texture;
 			tex_width = source->width;
 			tex_height = source->height;
+			gl_bind_vertex_array(gd, vao[1]);
 		} else {
 			// copy from previous pass
-			src_texture = bctx->blur_textures[i - 1];
-			auto src_size = bctx->texture_sizes[i - 1];
+			src_texture = textures->textures[i - 1];
+			auto src_size = textures->texture_sizes[i - 1];
 			tex_width = src_size.width;
 			tex_height = src_size.height;
+			gl_bind_vertex_array(gd, vao[2]);
 		}
 
 		assert(src_texture);
-		assert(bctx->blur_fbos[i]);
+		assert(textures->fbos[i]);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, src_texture);
-		glBindSampler(0, blur_sampler);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_fbos[i]);
-		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+		gl_bind_texture(gd, 0, src_texture);
+		gl_bind_sampler(gd, 0, blur_sampler);
+		gl_bind_draw_framebuffer(gd, textures->fbos[i]);
 
 		glUniform1f(UNIFORM_SCALE_LOC, (GLfloat)scale_factor);
 
@@ -200,10 +213,9 @@ bool gl_dual_kawase_blur(double opacity, struct gl_blur_context *bctx,
 	// Kawase upsample pass
 	auto up_pass = &bctx->blur_shader[1];
 	assert(up_pass->prog);
-	glUseProgram(up_pass->prog);
+	gl_use_program(gd, up_pass->prog);
 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, default_mask);
+	gl_bind_texture(gd, 1, default_mask);
 
 	glUniform1i(UNIFORM_MASK_TEX_LOC, 1);
 	glUniform2f(UNIFORM_MASK_OFFSET_LOC, 0.0F, 0.0F);
@@ -215,40 +227,39 @@ bool gl_dual_kawase_blur(double opacity, struct gl_blur_context *bctx,
 		// Scale output width / height back by two in each iteration
 		scale_factor >>= 1;
 
-		const GLuint src_texture = bctx->blur_textures[i];
+		const GLuint src_texture = textures->textures[i];
 		assert(src_texture);
 
 		// Calculate normalized half-width/-height of a src pixel
-		auto src_size = bctx->texture_sizes[i];
+		auto src_size = textures->texture_sizes[i];
 		int tex_width = src_size.width;
 		int tex_height = src_size.height;
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, src_texture);
-		glBindSampler(0, blur_sampler);
+		gl_bind_texture(gd, 0, src_texture);
+		gl_bind_sampler(gd, 0, blur_sampler);
 
 		if (i > 0) {
-			assert(bctx->blur_fbos[i - 1]);
+			assert(textures->fbos[i - 1]);
 
 			// not last pass, draw into next framebuffer
-			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_fbos[i - 1]);
-			glDrawBuffer(GL_COLOR_ATTACHMENT0);
+			gl_bind_vertex_array(gd, vao[2]);
+			nelems = vao_nelems[2];
+			gl_bind_draw_framebuffer(gd, textures->fbos[i - 1]);
 		} else {
 			// last pass, draw directly into the target fbo
 			if (mask != NULL) {
 				auto inner = (struct gl_texture *)mask->image;
 				log_trace("Mask texture is %d", inner->texture);
-				glActiveTexture(GL_TEXTURE1);
-				glBindTexture(GL_TEXTURE_2D, inner->texture);
+				gl_bind_texture(gd, 1, inner->texture);
 				glUniform1i(UNIFORM_MASK_INVERTED_LOC, mask->inverted);
 				glUniform1f(UNIFORM_MASK_CORNER_RADIUS_LOC,
 				            (float)mask->corner_radius);
 				glUniform2f(UNIFORM_MASK_OFFSET_LOC, (float)(mask->origin.x),
 				            (float)(mask->origin.y));
 			}
-			glBindVertexArray(vao[0]);
+			gl_bind_vertex_array(gd, vao[0]);
 			nelems = vao_nelems[0];
-			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_fbo);
+			gl_bind_draw_framebuffer(gd, target_fbo);
 
 			glUniform1f(UNIFORM_OPACITY_LOC, (GLfloat)opacity);
 		}
@@ -263,54 +274,113 @@ bool gl_dual_kawase_blur(double opacity, struct gl_blur_context *bctx,
 	return true;
 }
 
-static bool
-gl_blur_context_preallocate_textures(struct gl_blur_context *bctx, ivec2 source_size) {
-	if (source_size.width != bctx->fb_width || source_size.height != bctx->fb_height) {
-		// Resize the temporary textures used for blur in case the root
-		// size changed
-		bctx->fb_width = source_size.width;
-		bctx->fb_height = source_size.height;
-
-		for (int i = 0; i < bctx->blur_texture_count; ++i) {
-			auto tex_size = bctx->texture_sizes + i;
-			if (bctx->method == BLUR_METHOD_DUAL_KAWASE) {
-				// Use smaller textures for each iteration (quarter of the
-				// previous texture)
-				tex_size->width = 1 + ((bctx->fb_width - 1) >> (i + 1));
-				tex_size->height = 1 + ((bctx->fb_height - 1) >> (i + 1));
-			} else {
-				tex_size->width = bctx->fb_width;
-				tex_size->height = bctx->fb_height;
-			}
+static void gl_blur_textures_release(struct gl_data *gd,
+                                     const struct gl_blur_context *bctx,
+                                     struct gl_blur_textures *textures) {
+	if (textures->textures) {
+		gl_delete_textures(gd, bctx->blur_texture_count, textures->textures);
+		free(textures->textures);
+	}
+	if (textures->fbos) {
+		gl_delete_framebuffers(gd, bctx->blur_fbo_count, textures->fbos);
+		free(textures->fbos);
+	}
+	free(textures->texture_sizes);
+	*textures = (struct gl_blur_textures){};
+}
 
-			glBindTexture(GL_TEXTURE_2D, bctx->blur_textures[i]);
-			GLint format;
-			switch (bctx->format) {
-			case BACKEND_IMAGE_FORMAT_PIXMAP_HIGH: format = GL_RGBA16; break;
-			case BACKEND_IMAGE_FORMAT_PIXMAP: format = GL_RGBA8; break;
-			case BACKEND_IMAGE_FORMAT_MASK: format = GL_R8; break;
-			default: unreachable();
-			}
-			glTexImage2D(GL_TEXTURE_2D, 0, format, tex_size->width,
-			             tex_size->height, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
-
-			if (bctx->method == BLUR_METHOD_DUAL_KAWASE) {
-				// Attach texture to FBO target
-				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, bctx->blur_fbos[i]);
-				glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER,
-				                       GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-				                       bctx->blur_textures[i], 0);
-				if (!gl_check_fb_complete(GL_FRAMEBUFFER)) {
-					glBindFramebuffer(GL_FRAMEBUFFER, 0);
-					return false;
-				}
+/// Allocate a set of blur textures big enough for blurring a region of `size`.
+static bool gl_blur_textures_init(struct gl_data *gd, const struct gl_blur_context *bctx,
+                                  struct gl_blur_textures *textures, ivec2 size) {
+	textures->size = (ivec2){
+	    .width = (size.width + GL_BLUR_SIZE_CLASS - 1) / GL_BLUR_SIZE_CLASS *
+	             GL_BLUR_SIZE_CLASS,
+	    .height = (size.height + GL_BLUR_SIZE_CLASS - 1) / GL_BLUR_SIZE_CLASS *
+	              GL_BLUR_SIZE_CLASS,
+	};
+	textures->textures = ccalloc(bctx->blur_texture_count, GLuint);
+	textures->texture_sizes = ccalloc(bctx->blur_texture_count, ivec2);
+	textures->fbos = ccalloc(bctx->blur_fbo_count, GLuint);
+	glGenTextures(bctx->blur_texture_count, textures->textures);
+	glGenFramebuffers(bctx->blur_fbo_count, textures->fbos);
+	for (int i = 0; i < bctx->blur_fbo_count; ++i) {
+		if (!textures->fbos[i]) {
+			log_error("Failed to generate framebuffer objects for blur");
+			return false;
+		}
+	}
+
+	for (int i = 0; i < bctx->blur_texture_count; ++i) {
+		auto tex_size = textures->texture_sizes + i;
+		if (bctx->method == BLUR_METHOD_DUAL_KAWASE) {
+			// Use smaller textures for each iteration (quarter of the
+			// previous texture)
+			tex_size->width = 1 + ((textures->size.width - 1) >> (i + 1));
+			tex_size->height = 1 + ((textures->size.height - 1) >> (i + 1));
+		} else {
+			*tex_size = textures->size;
+		}
+
+		gl_bind_texture(gd, 0, textures->textures[i]);
+		GLint format;
+		switch (bctx->format) {
+		case BACKEND_IMAGE_FORMAT_PIXMAP_HIGH: format = GL_RGBA16; break;
+		case BACKEND_IMAGE_FORMAT_PIXMAP: format = GL_RGBA8; break;
+		case BACKEND_IMAGE_FORMAT_MASK: format = GL_R8; break;
+		default: unreachable();
+		}
+		glTexImage2D(GL_TEXTURE_2D, 0, format, tex_size->width, tex_size->height,
+		             0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+	}
+
+	for (int i = 0; i < bctx->blur_fbo_count; ++i) {
+		// Draw buffer is a state of the framebuffer, so this only needs to be set
+		// once.
+		gl_bind_draw_framebuffer(gd, textures->fbos[i]);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+		if (bctx->method == BLUR_METHOD_DUAL_KAWASE) {
+			// Attach texture to FBO target
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			                       GL_TEXTURE_2D, textures->textures[i], 0);
+			if (!gl_check_fb_complete(GL_FRAMEBUFFER)) {
+				return false;
 			}
 		}
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 	}
 	return true;
 }
 
+/// Get a set of blur textures big enough for blurring a region of `size`. The smallest
+/// such set in the pool is used, if there is none, the least recently used set is
+/// replaced.
+static struct gl_blur_textures *
+gl_blur_context_get_textures(struct gl_data *gd, struct gl_blur_context *bctx,
+                             ivec2 size) {
+	struct gl_blur_textures *best = NULL, *lru = &bctx->pool[0];
+	for (int i = 0; i < GL_BLUR_POOL_SIZE; i++) {
+		auto textures = &bctx->pool[i];
+		if (textures->textures != NULL && textures->size.width >= size.width &&
+		    textures->size.height >= size.height &&
+		    (best == NULL || textures->size.width * textures->size.height <
+		                         best->size.width * best->size.height)) {
+			best = textures;
+		}
+		if (textures->last_used < lru->last_used) {
+			lru = textures;
+		}
+	}
+	if (best == NULL) {
+		gl_blur_textures_release(gd, bctx, lru);
+		if (!gl_blur_textures_init(gd, bctx, lru, size)) {
+			gl_blur_textures_release(gd, bctx, lru);
+			return NULL;
+		}
+		best = lru;
+	}
+	best->last_used = ++bctx->uses;
+	return best;
+}
+
 bool gl_blur(struct backend_base *base, ivec2 origin, image_handle target_,
              const struct backend_blur_args *args) {
 	auto gd = (struct gl_data *)base;
@@ -326,113 +396,103 @@ bool gl_blur(struct backend_base *base, ivec2 origin, image_handle target_,
 	const rect_t *extent = pixman_region32_extents(args->target_mask);
 	int width = extent->x2 - extent->x1, height = extent->y2 - extent->y1;
 	if (width == 0 || height == 0) {
+		pixman_region32_fini(&reg_blur_resized);
 		return true;
 	}
 
+	// Blur passes only cover the bounding box of the resized region. For dual-kawase,
+	// the box is aligned to the downsampling, so blurring parts of a region separately
+	// gives the same result as blurring it all at once.
+	int align = bctx->method == BLUR_METHOD_DUAL_KAWASE ? 1 << bctx->blur_texture_count
+	                                                     : 1;
+	const rect_t *extent_resized = pixman_region32_extents(&reg_blur_resized);
+	ivec2 box_origin = {
+	    .x = extent_resized->x1 & ~(align - 1),
+	    .y = extent_resized->y1 & ~(align - 1),
+	};
+	ivec2 box_size = {
+	    .width = ((extent_resized->x2 + align - 1) & ~(align - 1)) - box_origin.x,
+	    .height = ((extent_resized->y2 + align - 1) & ~(align - 1)) - box_origin.y,
+	};
+	auto textures = gl_blur_context_get_textures(gd, bctx, box_size);
+	if (textures == NULL) {
+		pixman_region32_fini(&reg_blur_resized);
+		return false;
+	}
+	pixman_region32_translate(&reg_blur_resized, -box_origin.x, -box_origin.y);
+
 	int nrects, nrects_resized;
 	const rect_t *rects = pixman_region32_rectangles(args->target_mask, &nrects),
 	             *rects_resized =
 	                 pixman_region32_rectangles(&reg_blur_resized, &nrects_resized);
 	if (!nrects || !nrects_resized) {
+		pixman_region32_fini(&reg_blur_resized);
 		return true;
 	}
 
-	if (!gl_blur_context_preallocate_textures(
-	        bctx, (ivec2){source->width, source->height})) {
-		return false;
-	}
-
-	// Original region for the final compositing step from blur result to target.
-	auto coord = ccalloc(nrects * 16, GLfloat);
-	auto indices = ccalloc(nrects * 6, GLuint);
-	gl_mask_rects_to_coords(origin, nrects, rects, SCALE_IDENTITY, coord, indices);
+	// Original region for the final compositing step from blur result to target,
+	// followed by the resized region for sampling from source texture, and for
+	// sampling between blur textures. Blur textures are addressed relative to the
+	// box. All are uploaded together, see `gl_upload_vertices`.
+	auto coord = gl_vertex_scratch(gd, nrects + 2 * nrects_resized);
+	auto coord_resized = coord + nrects * 16;
+	auto coord_local = coord_resized + nrects_resized * 16;
+	gl_mask_rects_to_coords(ivec2_add(origin, box_origin), nrects, rects,
+	                        SCALE_IDENTITY, coord);
 	if (!target->y_inverted) {
 		gl_y_flip_target(nrects, coord, target->height);
 	}
-
-	// Resize region for sampling from source texture, and for blur passes
-	auto coord_resized = ccalloc(nrects_resized * 16, GLfloat);
-	auto indices_resized = ccalloc(nrects_resized * 6, GLuint);
-	gl_mask_rects_to_coords(origin, nrects_resized, rects_resized, SCALE_IDENTITY,
-	                        coord_resized, indices_resized);
+	gl_mask_rects_to_coords(ivec2_sub(origin, box_origin), nrects_resized,
+	                        rects_resized, SCALE_IDENTITY, coord_resized);
+	gl_mask_rects_to_coords((ivec2){}, nrects_resized, rects_resized, SCALE_IDENTITY,
+	                        coord_local);
 	pixman_region32_fini(&reg_blur_resized);
 	// FIXME(yshui) In theory we should handle blurring a non-y-inverted source, but
 	// we never actually use that capability anywhere.
 	assert(source->y_inverted);
 
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-	glBindVertexArray(gd->vertex_array_objects[0]);
-	glBindBuffer(GL_ARRAY_BUFFER, gd->buffer_objects[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->buffer_objects[1]);
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord) * nrects * 16, coord, GL_STREAM_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(*indices) * nrects * 6,
-	             indices, GL_STREAM_DRAW);
-	glEnableVertexAttribArray(vert_coord_loc);
-	glEnableVertexAttribArray(vert_in_texcoord_loc);
-	glVertexAttribPointer(vert_coord_loc, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4, NULL);
-	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_FLOAT, GL_FALSE,
-	                      sizeof(GLfloat) * 4, (void *)(sizeof(GLfloat) * 2));
-
-	glBindVertexArray(gd->vertex_array_objects[1]);
-	glBindBuffer(GL_ARRAY_BUFFER, gd->buffer_objects[2]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->buffer_objects[3]);
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord_resized) * nrects_resized * 16,
-	             coord_resized, GL_STREAM_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	             (long)sizeof(*indices_resized) * nrects_resized * 6, indices_resized,
-	             GL_STREAM_DRAW);
-	glEnableVertexAttribArray(vert_coord_loc);
-	glEnableVertexAttribArray(vert_in_texcoord_loc);
-	glVertexAttribPointer(vert_coord_loc, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4, NULL);
-	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_FLOAT, GL_FALSE,
-	                      sizeof(GLfloat) * 4, (void *)(sizeof(GLfloat) * 2));
-
-	int vao_nelems[2] = {nrects * 6, nrects_resized * 6};
+	gl_blend_func(gd, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	auto offset = gl_upload_vertices(
+	    gd, coord, (GLsizeiptr)sizeof(*coord) * (nrects + 2 * nrects_resized) * 16);
+	GLintptr offsets[3] = {
+	    offset,
+	    offset + (GLintptr)sizeof(*coord) * nrects * 16,
+	    offset + (GLintptr)sizeof(*coord) * (nrects + nrects_resized) * 16,
+	};
+	for (int i = 0; i < 3; i++) {
+		gl_bind_vertex_array(gd, gd->vertex_array_objects[i]);
+		gl_bind_quad_indices(gd, max2(nrects, nrects_resized));
+		glVertexAttribPointer(vert_coord_loc, 2, GL_FLOAT, GL_FALSE,
+		                      sizeof(GLfloat) * 4, (void *)offsets[i]);
+		glVertexAttribPointer(
+		    vert_in_texcoord_loc, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat) * 4,
+		    (void *)(offsets[i] + (GLintptr)sizeof(GLfloat) * 2));
+	}
+
+	int vao_nelems[3] = {nrects * 6, nrects_resized * 6, nrects_resized * 6};
+
+	// The blurred result is sampled relative to the box, so is the mask.
+	struct backend_mask_image mask = {};
+	const struct backend_mask_image *mask_ptr = NULL;
+	if (args->source_mask != NULL) {
+		mask = *args->source_mask;
+		mask.origin = ivec2_sub(mask.origin, box_origin);
+		mask_ptr = &mask;
+	}
 
 	auto target_fbo = gl_bind_image_to_fbo(gd, (image_handle)target);
 	if (bctx->method == BLUR_METHOD_DUAL_KAWASE) {
-		ret = gl_dual_kawase_blur(args->opacity, bctx, args->source_mask,
+		ret = gl_dual_kawase_blur(gd, args->opacity, bctx, textures, mask_ptr,
 		                          gd->vertex_array_objects, vao_nelems, source,
 		                          gd->samplers[GL_SAMPLER_BLUR], target_fbo,
 		                          gd->default_mask_texture);
 	} else {
-		ret = gl_kernel_blur(args->opacity, bctx, args->source_mask,
+		ret = gl_kernel_blur(gd, args->opacity, bctx, textures, mask_ptr,
 		                     gd->vertex_array_objects, vao_nelems, source,
 		                     gd->samplers[GL_SAMPLER_BLUR], target_fbo,
 		                     gd->default_mask_texture);
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// Invalidate buffer data
-	glBindBuffer(GL_ARRAY_BUFFER, gd->buffer_objects[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->buffer_objects[1]);
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord) * nrects * 16, NULL, GL_STREAM_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(*indices) * nrects * 6, NULL,
-	             GL_STREAM_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, gd->buffer_objects[2]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->buffer_objects[3]);
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord_resized) * nrects_resized * 16,
-	             NULL, GL_STREAM_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	             (long)sizeof(*indices_resized) * nrects_resized * 6, NULL,
-	             GL_STREAM_DRAW);
-
-	// Cleanup vertex array states
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-	glUseProgram(0);
-
-	free(indices);
-	free(coord);
-	free(indices_resized);
-	free(coord_resized);
-
 	gl_check_err();
 	return ret;
 }
@@ -445,7 +505,7 @@ static inline void gl_free_blur_shader(struct gl_shader *shader) {
 	shader->prog = 0;
 }
 
-void gl_destroy_blur_context(backend_t *base attr_unused, void *ctx) {
+void gl_destroy_blur_context(backend_t *base, void *ctx) {
 	auto bctx = (struct gl_blur_context *)ctx;
 	// Free GLSL shaders/programs
 	for (int i = 0; i < bctx->npasses; ++i) {
@@ -453,16 +513,8 @@ void gl_destroy_blur_context(backend_t *base attr_unused, void *ctx) {
 	}
 	free(bctx->blur_shader);
 
-	if (bctx->blur_texture_count && bctx->blur_textures) {
-		glDeleteTextures(bctx->blur_texture_count, bctx->blur_textures);
-		free(bctx->blur_textures);
-	}
-	if (bctx->blur_texture_count && bctx->texture_sizes) {
-		free(bctx->texture_sizes);
-	}
-	if (bctx->blur_fbo_count && bctx->blur_fbos) {
-		glDeleteFramebuffers(bctx->blur_fbo_count, bctx->blur_fbos);
-		free(bctx->blur_fbos);
+	for (int i = 0; i < GL_BLUR_POOL_SIZE; i++) {
+		gl_blur_textures_release((struct gl_data *)base, bctx, &bctx->pool[i]);
 	}
 
 	bctx->blur_texture_count = 0;
@@ -476,7 +528,8 @@ void gl_destroy_blur_context(backend_t *base attr_unused, void *ctx) {
 /**
  * Initialize GL blur filters.
  */
-bool gl_create_kernel_blur_context(void *blur_context, GLfloat *projection,
+bool gl_create_kernel_blur_context(struct gl_data *gd, void *blur_context,
+                                   GLfloat *projection,
                                    enum blur_method method, void *args) {
 	bool success = false;
 	auto ctx = (struct gl_blur_context *)blur_context;
@@ -628,9 +681,8 @@ bool gl_create_kernel_blur_context(void *blur_context, GLfloat *projection,
 		glBindFragDataLocation(pass->prog, 0, "out_color");
 
 		// Setup projection matrix
-		glUseProgram(pass->prog);
+		gl_use_program(gd, pass->prog);
 		glUniformMatrix4fv(UNIFORM_PROJECTION_LOC, 1, false, projection);
-		glUseProgram(0);
 
 		ctx->resize_width += kern->w / 2;
 		ctx->resize_height += kern->h / 2;
@@ -645,9 +697,8 @@ bool gl_create_kernel_blur_context(void *blur_context, GLfloat *projection,
 		    (const char *[]){blend_with_mask_frag, masking_glsl, NULL});
 
 		// Setup projection matrix
-		glUseProgram(pass->prog);
+		gl_use_program(gd, pass->prog);
 		glUniformMatrix4fv(UNIFORM_PROJECTION_LOC, 1, false, projection);
-		glUseProgram(0);
 
 		ctx->npasses = 2;
 	} else {
@@ -672,7 +723,8 @@ out:
 	return success;
 }
 
-bool gl_create_dual_kawase_blur_context(void *blur_context, GLfloat *projection,
+bool gl_create_dual_kawase_blur_context(struct gl_data *gd, void *blur_context,
+                                        GLfloat *projection,
                                         enum blur_method method, void *args) {
 	bool success = false;
 	auto ctx = (struct gl_blur_context *)blur_context;
@@ -742,9 +794,8 @@ bool gl_create_dual_kawase_blur_context(void *blur_context, GLfloat *projection,
 		glBindFragDataLocation(down_pass->prog, 0, "out_color");
 
 		// Setup projection matrix
-		glUseProgram(down_pass->prog);
+		gl_use_program(gd, down_pass->prog);
 		glUniformMatrix4fv(UNIFORM_PROJECTION_LOC, 1, false, projection);
-		glUseProgram(0);
 	}
 
 	// Dual-kawase upsample shader / program
@@ -801,9 +852,8 @@ bool gl_create_dual_kawase_blur_context(void *blur_context, GLfloat *projection,
 		glBindFragDataLocation(up_pass->prog, 0, "out_color");
 
 		// Setup projection matrix
-		glUseProgram(up_pass->prog);
+		gl_use_program(gd, up_pass->prog);
 		glUniformMatrix4fv(UNIFORM_PROJECTION_LOC, 1, false, projection);
-		glUseProgram(0);
 	}
 
 	success = true;
@@ -844,33 +894,18 @@ void *gl_create_blur_context(backend_t *base, enum blur_method method,
 	                                   {-1, -1, 0, 1}};
 
 	if (method == BLUR_METHOD_DUAL_KAWASE) {
-		success = gl_create_dual_kawase_blur_context(ctx, projection_matrix[0],
+		success = gl_create_dual_kawase_blur_context(gd, ctx, projection_matrix[0],
 		                                             method, args);
 	} else {
-		success =
-		    gl_create_kernel_blur_context(ctx, projection_matrix[0], method, args);
+		success = gl_create_kernel_blur_context(gd, ctx, projection_matrix[0],
+		                                        method, args);
 	}
 	if (!success || ctx->method == BLUR_METHOD_NONE) {
 		goto out;
 	}
 
-	// Texture size will be defined by gl_blur
-	ctx->blur_textures = ccalloc(ctx->blur_texture_count, GLuint);
-	ctx->texture_sizes = ccalloc(ctx->blur_texture_count, struct texture_size);
+	// Textures are allocated by gl_blur, sized for the regions being blurred
 	ctx->format = format;
-	glGenTextures(ctx->blur_texture_count, ctx->blur_textures);
-
-	// Generate FBO and textures when needed
-	ctx->blur_fbos = ccalloc(ctx->blur_fbo_count, GLuint);
-	glGenFramebuffers(ctx->blur_fbo_count, ctx->blur_fbos);
-
-	for (int i = 0; i < ctx->blur_fbo_count; ++i) {
-		if (!ctx->blur_fbos[i]) {
-			log_error("Failed to generate framebuffer objects for blur");
-			success = false;
-			goto out;
-		}
-	}
 
 out:
 	if (!success) {
@@ -234,24 +234,16 @@ end:
 	return &gd->gl.base;
 }
 
-static image_handle
-egl_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt) {
+static image_handle egl_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, ivec2 size,
+                                    struct xvisual_info fmt) {
 	struct egl_data *gd = (void *)base;
 	EGLImage *eglpixmap = NULL;
 
-	auto r =
-	    xcb_get_geometry_reply(base->c->c, xcb_get_geometry(base->c->c, pixmap), NULL);
-	if (!r) {
-		log_error("Invalid pixmap %#010x", pixmap);
-		return NULL;
-	}
-
 	log_trace("Binding pixmap %#010x", pixmap);
 	auto inner = ccalloc(1, struct gl_texture);
 	inner->format = BACKEND_IMAGE_FORMAT_PIXMAP;
-	inner->width = r->width;
-	inner->height = r->height;
-	free(r);
+	inner->width = size.width;
+	inner->height = size.height;
 
 	log_debug("depth %d", fmt.visual_depth);
 
@@ -273,9 +265,8 @@ egl_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt) {
 	// Create texture
 	inner->user_data = eglpixmap;
 	inner->texture = gl_new_texture();
-	glBindTexture(GL_TEXTURE_2D, inner->texture);
+	gl_bind_texture(&gd->gl, 0, inner->texture);
 	glEGLImageTargetTexStorageEXT(GL_TEXTURE_2D, *eglpixmap, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
 
 	gl_check_err();
 	return (image_handle)inner;
@@ -356,6 +347,7 @@ const struct backend_operations egl_ops = {
     .apply_alpha = gl_apply_alpha,
     .back_buffer = gl_back_buffer,
     .blit = gl_blit,
+    .blit_many = gl_blit_many,
     .blur = gl_blur,
     .bind_pixmap = egl_bind_pixmap,
     .clear = gl_clear,
@@ -364,6 +356,7 @@ const struct backend_operations egl_ops = {
     .is_format_supported = gl_is_format_supported,
     .image_capabilities = gl_image_capabilities,
     .new_image = gl_new_image,
+    .pixmap_damaged = gl_pixmap_damaged,
     .present = egl_present,
     .quirks = backend_no_quirks,
     .version = egl_version,
@@ -21,9 +21,22 @@
 
 #include "gl_common.h"
 
+/// Size of a vertex drawn with `gl_data::blit_vertex_array`, a vertex coordinate
+/// followed by a texture coordinate.
+#define GL_BLIT_VERTEX_STRIDE ((GLsizeiptr)sizeof(GLfloat) * 4)
+
 void gl_prepare(backend_t *base, const region_t *reg attr_unused) {
 	auto gd = (struct gl_data *)base;
 	glBeginQuery(GL_TIME_ELAPSED, gd->frame_timing[gd->current_frame_timing]);
+
+	// Start the frame with a fresh vertex buffer, so the GPU can keep reading the
+	// vertices of the last frame while we write new ones.
+	if (gd->vertex_buffer_used > 0) {
+		gl_bind_array_buffer(gd, gd->vertex_buffer);
+		glBufferData(GL_ARRAY_BUFFER, gd->vertex_buffer_size, NULL,
+		             GL_STREAM_DRAW);
+		gd->vertex_buffer_used = 0;
+	}
 }
 
 GLuint gl_create_shader(GLenum shader_type, const char *shader_str) {
@@ -180,162 +193,144 @@ void gl_destroy_window_shader(backend_t *backend_data attr_unused, void *shader)
 	free(shader);
 }
 
-/*
- * @brief Implements recursive part of gl_average_texture_color.
- *
- * @note In order to reduce number of textures which needs to be
- * allocated and deleted during this recursive render
- * we reuse the same two textures for render source and
- * destination simply by alternating between them.
- * Unfortunately on first iteration source_texture might
- * be read-only. In this case we will select auxiliary_texture as
- * destination_texture in order not to touch that read-only source
- * texture in following render iteration.
- * Otherwise we simply will switch source and destination textures
- * between each other on each render iteration.
- */
-static GLuint
-_gl_average_texture_color(GLuint source_texture, GLuint destination_texture,
-                          GLuint auxiliary_texture, GLuint fbo, int width, int height) {
-	const int max_width = 1;
-	const int max_height = 1;
-	const int from_width = next_power_of_two(width);
-	const int from_height = next_power_of_two(height);
-	const int to_width = from_width > max_width ? from_width / 2 : from_width;
-	const int to_height = from_height > max_height ? from_height / 2 : from_height;
+/// Make sure `scratch` is at least `width` x `height` large. Its content is lost if it
+/// has to grow.
+static bool
+gl_average_scratch_reserve(struct gl_data *gd, struct gl_texture *scratch, int width,
+                           int height) {
+	if (scratch->texture != 0 && scratch->width >= width && scratch->height >= height) {
+		return true;
+	}
+	if (scratch->texture == 0) {
+		scratch->texture = gl_new_texture();
+		if (!scratch->texture) {
+			return false;
+		}
+	}
+	scratch->width = max2(scratch->width, width);
+	scratch->height = max2(scratch->height, height);
+	gl_bind_texture(gd, 0, scratch->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, scratch->width, scratch->height, 0, GL_BGR,
+	             GL_UNSIGNED_BYTE, NULL);
+	return true;
+}
 
+/// Scale the `width` x `height` region at the top left of `source` down to the
+/// `to_width` x `to_height` region at the top left of `destination`, with linear
+/// filtering.
+static void gl_average_reduce(struct gl_data *gd, const struct gl_texture *source,
+                              int width, int height, GLuint destination, int to_width,
+                              int to_height) {
 	// Prepare coordinates
-	GLint coord[] = {
+	GLfloat coord[] = {
 	    // top left
 	    0, 0,        // vertex coord
 	    0, 0,        // texture coord
 
 	    // top right
-	    to_width, 0,        // vertex coord
-	    width, 0,           // texture coord
+	    (GLfloat)to_width, 0,        // vertex coord
+	    (GLfloat)width, 0,           // texture coord
 
 	    // bottom right
-	    to_width, to_height,        // vertex coord
-	    width, height,              // texture coord
+	    (GLfloat)to_width, (GLfloat)to_height,        // vertex coord
+	    (GLfloat)width, (GLfloat)height,              // texture coord
 
 	    // bottom left
-	    0, to_height,        // vertex coord
-	    0, height,           // texture coord
+	    0, (GLfloat)to_height,        // vertex coord
+	    0, (GLfloat)height,           // texture coord
 	};
-	glBufferSubData(GL_ARRAY_BUFFER, 0, (long)sizeof(*coord) * 16, coord);
-
-	// Prepare framebuffer for new render iteration
-	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-	                       destination_texture, 0);
-	gl_check_fb_complete(GL_FRAMEBUFFER);
-
-	// Bind source texture as downscaling shader uniform input
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, source_texture);
-	glBindSampler(0, 0);
-
-	// Render into framebuffer
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
-
-	// Have we downscaled enough?
-	GLuint result;
-	if (to_width > max_width || to_height > max_height) {
-		GLuint new_source_texture = destination_texture;
-		GLuint new_destination_texture =
-		    auxiliary_texture != 0 ? auxiliary_texture : source_texture;
-		result = _gl_average_texture_color(
-		    new_source_texture, new_destination_texture, 0, fbo, to_width, to_height);
-	} else {
-		result = destination_texture;
+	auto offset = gl_upload_vertices(gd, coord, (long)sizeof(coord));
+
+	if (gd->state.temp_fbo_texture != destination) {
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		                       GL_TEXTURE_2D, destination, 0);
+		gl_check_fb_complete(GL_DRAW_FRAMEBUFFER);
+		gd->state.temp_fbo_texture = destination;
 	}
 
-	return result;
+	// Texture coordinates are normalized by the size of the whole source texture,
+	// which for the scratch textures can be larger than the region we read from.
+	glUniform2f(UNIFORM_TEXSIZE_LOC, (GLfloat)source->width, (GLfloat)source->height);
+	gl_bind_texture(gd, 0, source->texture);
+	glDrawElementsBaseVertex(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL,
+	                         (GLint)(offset / GL_BLIT_VERTEX_STRIDE));
+}
+
+/// Halve a dimension of a reduction step, after rounding it up to a power of two.
+static inline int gl_average_next_size(int size) {
+	size = next_power_of_two(size);
+	return size > 1 ? size / 2 : size;
 }
 
 /*
  * @brief Builds a 1x1 texture which has color corresponding to the average of all
- * pixels of img by recursively rendering into texture of quarter the size (half
+ * pixels of img by repeatedly rendering into texture of quarter the size (half
  * width and half height).
+ *
+ * The result is cached in img->average_texture until the content of img changes,
+ * either because img is rendered into, or because the X pixmap it's bound to is
+ * damaged (see gl_pixmap_damaged). The intermediate steps are rendered into the
+ * scratch textures shared by all images, alternating between the two of them, so
+ * only the first two steps, which are at most a quarter and a sixteenth of the size
+ * of img, need space.
+ *
  * Returned texture must not be deleted, since it's owned by the gl_image. It will be
- * deleted when the gl_image is released.
+ * deleted when the gl_image is released. Returns 0 if the texture couldn't be
+ * created.
  */
 static GLuint gl_average_texture_color(struct gl_data *gd, struct gl_texture *img) {
-	// Prepare textures which will be used for destination and source of rendering
-	// during downscaling.
-	const int texture_count = ARR_SIZE(img->auxiliary_texture);
-	if (!img->auxiliary_texture[0]) {
-		assert(!img->auxiliary_texture[1]);
-		glGenTextures(texture_count, img->auxiliary_texture);
-		glActiveTexture(GL_TEXTURE0);
-		for (int i = 0; i < texture_count; i++) {
-			glBindTexture(GL_TEXTURE_2D, img->auxiliary_texture[i]);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-			glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR,
-			                 (GLint[]){0, 0, 0, 0});
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, img->width, img->height,
-			             0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
+	if (img->average_valid) {
+		return img->average_texture;
+	}
+	if (!img->average_texture) {
+		img->average_texture = gl_new_texture();
+		if (!img->average_texture) {
+			return 0;
 		}
+		gl_bind_texture(gd, 0, img->average_texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, 1, 1, 0, GL_BGR, GL_UNSIGNED_BYTE,
+		             NULL);
 	}
 
 	// Prepare framebuffer used for rendering and bind it
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gd->temp_fbo);
-	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	gl_bind_draw_framebuffer(gd, gd->temp_fbo);
 
 	// Enable shaders
-	glUseProgram(gd->brightness_shader.prog);
-	glUniform2f(UNIFORM_TEXSIZE_LOC, (GLfloat)img->width, (GLfloat)img->height);
-
-	// Prepare vertex attributes
-	glBindVertexArray(gd->vertex_array_objects[0]);
-	glBindBuffer(GL_ARRAY_BUFFER, gd->buffer_objects[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->buffer_objects[1]);
-	glEnableVertexAttribArray(vert_coord_loc);
-	glEnableVertexAttribArray(vert_in_texcoord_loc);
-	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 4, NULL);
-	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_INT, GL_FALSE,
-	                      sizeof(GLint) * 4, (void *)(sizeof(GLint) * 2));
-
-	// Allocate buffers for render input
-	GLint coord[16] = {0};
-	GLuint indices[] = {0, 1, 2, 2, 3, 0};
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord) * 16, coord, GL_STREAM_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(*indices) * 6, indices,
-	             GL_STREAM_DRAW);
-
-	// Do actual recursive render to 1x1 texture
-	GLuint result_texture = _gl_average_texture_color(
-	    img->texture, img->auxiliary_texture[0], img->auxiliary_texture[1],
-	    gd->temp_fbo, img->width, img->height);
-
-	// Cleanup vertex attributes
-	glDisableVertexAttribArray(vert_coord_loc);
-	glDisableVertexAttribArray(vert_in_texcoord_loc);
-
-	// Invalidate buffer data
-	glBufferData(GL_ARRAY_BUFFER, (long)sizeof(*coord) * 16, NULL, GL_STREAM_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(*indices) * 6, NULL, GL_STREAM_DRAW);
-
-	// Cleanup buffers
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
-	// Cleanup shaders
-	glUseProgram(0);
-
-	// Cleanup framebuffers
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	glDrawBuffer(GL_BACK);
+	gl_use_program(gd, gd->brightness_shader.prog);
+	gl_bind_sampler(gd, 0, gd->samplers[GL_SAMPLER_BLUR]);
+
+	// Vertices are uploaded for each step
+	gl_bind_vertex_array(gd, gd->blit_vertex_array);
+	gl_bind_quad_indices(gd, 1);
+
+	const struct gl_texture *source = img;
+	int width = img->width, height = img->height;
+	for (int step = 0;; step++) {
+		int to_width = gl_average_next_size(width);
+		int to_height = gl_average_next_size(height);
+		if (to_width == 1 && to_height == 1) {
+			gl_average_reduce(gd, source, width, height, img->average_texture,
+			                  to_width, to_height);
+			break;
+		}
 
-	// Cleanup render textures
-	glBindTexture(GL_TEXTURE_2D, 0);
+		auto scratch = &gd->average_scratch[step % 2];
+		if (!gl_average_scratch_reserve(gd, scratch, to_width, to_height)) {
+			return 0;
+		}
+		gl_average_reduce(gd, source, width, height, scratch->texture, to_width,
+		                  to_height);
+		source = scratch;
+		width = to_width;
+		height = to_height;
+	}
 
 	gl_check_err();
 
-	return result_texture;
+	img->average_valid = true;
+	return img->average_texture;
 }
+
 struct gl_texture_unit {
 	GLuint texture;
 	GLuint sampler;
@@ -353,40 +348,19 @@ struct gl_uniform_value {
 	};
 };
 
-struct gl_vertex_attrib {
-	GLenum type;
-	GLuint loc;
-	void *offset;
-};
-
-struct gl_vertex_attribs_definition {
-	GLsizeiptr stride;
-	unsigned count;
-	struct gl_vertex_attrib attribs[];
-};
-
-static const struct gl_vertex_attribs_definition gl_blit_vertex_attribs = {
-    .stride = sizeof(GLfloat) * 4,
-    .count = 2,
-    .attribs = {{GL_FLOAT, vert_coord_loc, NULL},
-                {GL_FLOAT, vert_in_texcoord_loc, ((GLfloat *)NULL) + 2}},
-};
-
 /**
  * Render a region with texture data.
  *
  * @param target_fbo   the FBO to render into
  * @param nrects       number of rectangles to render
- * @param coord        GL vertices
- * @param indices      GL indices
- * @param vert_attribs vertex attributes layout in `coord`
+ * @param coord        GL vertices, 4 for each rectangle, in the layout generated by
+ *                     `gl_mask_rects_to_coords`
  * @param shader       shader to use
  * @param nuniforms    number of uniforms for `shader`
  * @param uniforms     uniforms for `shader`
  */
 static void
-gl_blit_inner(struct gl_data *gd, GLuint target_fbo, int nrects, GLfloat *coord,
-              GLuint *indices, const struct gl_vertex_attribs_definition *vert_attribs,
+gl_blit_inner(struct gl_data *gd, GLuint target_fbo, int nrects, const GLfloat *coord,
               const struct gl_shader *shader, int nuniforms,
               struct gl_uniform_value *uniforms) {
 	// FIXME(yshui) breaks when `mask` and `img` doesn't have the same y_inverted
@@ -395,11 +369,10 @@ gl_blit_inner(struct gl_data *gd, GLuint target_fbo, int nrects, GLfloat *coord,
 	log_trace("Blitting %d rectangles", nrects);
 	assert(shader);
 	assert(shader->prog);
-	glUseProgram(shader->prog);
+	gl_use_program(gd, shader->prog);
 	// TEXTURE0 reserved for the default texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	GLuint texture_unit = GL_TEXTURE1;
+	gl_bind_texture(gd, 0, 0);
+	GLuint texture_unit = 1;
 	for (int i = 0; i < nuniforms; i++) {
 		if (!(shader->uniform_bitmask & (1 << i))) {
 			continue;
@@ -412,10 +385,9 @@ gl_blit_inner(struct gl_data *gd, GLuint target_fbo, int nrects, GLfloat *coord,
 			if (uniform->tu.texture == 0) {
 				glUniform1i(i, 0);
 			} else {
-				glActiveTexture(texture_unit);
-				glBindTexture(GL_TEXTURE_2D, uniform->tu.texture);
-				glBindSampler(texture_unit - GL_TEXTURE0, uniform->tu.sampler);
-				glUniform1i(i, (GLint)(texture_unit - GL_TEXTURE0));
+				gl_bind_texture(gd, texture_unit, uniform->tu.texture);
+				gl_bind_sampler(gd, texture_unit, uniform->tu.sampler);
+				glUniform1i(i, (GLint)texture_unit);
 				texture_unit += 1;
 			}
 			break;
@@ -432,51 +404,17 @@ gl_blit_inner(struct gl_data *gd, GLuint target_fbo, int nrects, GLfloat *coord,
 	// log_trace("Draw: %d, %d, %d, %d -> %d, %d (%d, %d) z %d\n",
 	//          x, y, width, height, dx, dy, ptex->width, ptex->height, z);
 
-	glBindVertexArray(gd->vertex_array_objects[0]);
-
-	glBindBuffer(GL_ARRAY_BUFFER, gd->buffer_objects[0]);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->buffer_objects[1]);
-	glBufferData(GL_ARRAY_BUFFER, vert_attribs->stride * nrects * 4, coord, GL_STREAM_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(*indices) * nrects * 6,
-	             indices, GL_STREAM_DRAW);
-	for (unsigned i = 0; i < vert_attribs->count; i++) {
-		auto attrib = &vert_attribs->attribs[i];
-		glEnableVertexAttribArray(attrib->loc);
-		glVertexAttribPointer(attrib->loc, 2, attrib->type, GL_FALSE,
-		                      (GLsizei)vert_attribs->stride, attrib->offset);
-	}
-
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_fbo);
-	glDrawElements(GL_TRIANGLES, nrects * 6, GL_UNSIGNED_INT, NULL);
-
-	glDisableVertexAttribArray(vert_coord_loc);
-	glDisableVertexAttribArray(vert_in_texcoord_loc);
-
-	// Invalidate buffer data
-	glBufferData(GL_ARRAY_BUFFER, vert_attribs->stride * nrects * 4, NULL, GL_STREAM_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long)sizeof(*indices) * nrects * 6, NULL,
-	             GL_STREAM_DRAW);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-
-	// Cleanup
-	for (GLuint i = GL_TEXTURE1; i < texture_unit; i++) {
-		glActiveTexture(i);
-		glBindTexture(GL_TEXTURE_2D, 0);
-	}
-	glActiveTexture(GL_TEXTURE0);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	glDrawBuffer(GL_BACK);
-
-	glUseProgram(0);
-
+	gl_bind_vertex_array(gd, gd->blit_vertex_array);
+	auto offset = gl_upload_vertices(gd, coord, GL_BLIT_VERTEX_STRIDE * nrects * 4);
+	gl_bind_quad_indices(gd, nrects);
+	gl_bind_draw_framebuffer(gd, target_fbo);
+	glDrawElementsBaseVertex(GL_TRIANGLES, nrects * 6, GL_UNSIGNED_INT, NULL,
+	                         (GLint)(offset / GL_BLIT_VERTEX_STRIDE));
 	gl_check_err();
 }
 
 void gl_mask_rects_to_coords(ivec2 origin, int nrects, const rect_t *rects, vec2 scale,
-                             GLfloat *coord, GLuint *indices) {
+                             GLfloat *coord) {
 	for (ptrdiff_t i = 0; i < nrects; i++) {
 		// Rectangle in source image coordinates
 		rect_t rect_src = region_translate_rect(rects[i], ivec2_neg(origin));
@@ -498,12 +436,105 @@ void gl_mask_rects_to_coords(ivec2 origin, int nrects, const rect_t *rects, vec2
 		       }),
 		       sizeof(GLint[2]) * 8);
 		// clang-format on
+	}
+}
+
+GLfloat *gl_vertex_scratch(struct gl_data *gd, int nrects) {
+	if (nrects > gd->vertex_scratch_rects) {
+		gd->vertex_scratch_rects = max2(nrects, 2 * gd->vertex_scratch_rects);
+		gd->vertex_scratch =
+		    crealloc(gd->vertex_scratch, gd->vertex_scratch_rects * 16);
+	}
+	return gd->vertex_scratch;
+}
+
+/// Initial size of the vertex buffer.
+#define GL_MIN_VERTEX_BUFFER_SIZE ((GLsizeiptr)64 * 1024)
+
+GLintptr gl_upload_vertices(struct gl_data *gd, const void *data, GLsizeiptr size) {
+	// Keep every upload aligned, as some drivers are slow with unaligned vertex
+	// attributes. This also makes every upload start at a whole vertex of
+	// `blit_vertex_array`.
+	const GLsizeiptr alignment = GL_BLIT_VERTEX_STRIDE;
+	gl_bind_array_buffer(gd, gd->vertex_buffer);
+	if (gd->vertex_buffer_used + size > gd->vertex_buffer_size) {
+		// Out of space. Orphan the buffer and start over from the beginning, the
+		// driver gives us new storage while draws using the old one finish. Grow
+		// the buffer so this doesn't happen again in the next frame.
+		gd->vertex_buffer_size = max2(2 * gd->vertex_buffer_size,
+		                              max2(size, GL_MIN_VERTEX_BUFFER_SIZE));
+		glBufferData(GL_ARRAY_BUFFER, gd->vertex_buffer_size, NULL,
+		             GL_STREAM_DRAW);
+		gd->vertex_buffer_used = 0;
+	}
+
+	GLintptr offset = gd->vertex_buffer_used;
+	// Nothing in [offset, offset + size) has been used since the buffer was last
+	// orphaned, so there is no need to wait for the GPU.
+	void *dst = glMapBufferRange(
+	    GL_ARRAY_BUFFER, offset, size,
+	    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (dst != NULL) {
+		memcpy(dst, data, (size_t)size);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	} else {
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+	}
+	gd->vertex_buffer_used += (size + alignment - 1) / alignment * alignment;
+	return offset;
+}
+
+void gl_bind_quad_indices(struct gl_data *gd, int nquads) {
+	if (nquads <= gd->index_buffer_quads) {
+		return;
+	}
 
+	assert(gd->state.vertex_array != 0 && gd->state.vertex_array != GL_STATE_UNKNOWN);
+	gd->index_buffer_quads = max2(nquads, 2 * gd->index_buffer_quads);
+	auto indices = ccalloc(gd->index_buffer_quads * 6, GLuint);
+	for (int i = 0; i < gd->index_buffer_quads; i++) {
 		GLuint u = (GLuint)(i * 4);
 		memcpy(&indices[i * 6],
 		       ((GLuint[]){u + 0, u + 1, u + 2, u + 2, u + 3, u + 0}),
 		       sizeof(GLuint) * 6);
 	}
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+	             (GLsizeiptr)sizeof(GLuint) * gd->index_buffer_quads * 6, indices,
+	             GL_STATIC_DRAW);
+	free(indices);
+}
+
+void gl_state_invalidate(struct gl_data *gd) {
+	// Every field is a GLuint or GLenum, setting all bytes to 0xff sets them all to
+	// GL_STATE_UNKNOWN.
+	memset(&gd->state, 0xff, sizeof(gd->state));
+}
+
+void gl_delete_textures(struct gl_data *gd, int n, const GLuint *textures) {
+	// Deleting a texture unbinds it, and its name can be reused for a new texture.
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < GL_STATE_TEXTURE_UNITS; j++) {
+			if (gd->state.textures[j] == textures[i]) {
+				gd->state.textures[j] = GL_STATE_UNKNOWN;
+			}
+		}
+		if (gd->state.temp_fbo_texture == textures[i]) {
+			gd->state.temp_fbo_texture = GL_STATE_UNKNOWN;
+		}
+	}
+	glDeleteTextures(n, textures);
+}
+
+void gl_delete_framebuffers(struct gl_data *gd, int n, const GLuint *fbos) {
+	for (int i = 0; i < n; i++) {
+		if (gd->state.draw_framebuffer == fbos[i]) {
+			gd->state.draw_framebuffer = GL_STATE_UNKNOWN;
+		}
+		if (gd->state.read_framebuffer == fbos[i]) {
+			gd->state.read_framebuffer = GL_STATE_UNKNOWN;
+		}
+	}
+	glDeleteFramebuffers(n, fbos);
 }
 
 /// Flip the texture coordinates returned by `gl_mask_rects_to_coords` vertically relative
@@ -523,11 +554,12 @@ static inline void gl_y_flip_texture(int nrects, GLfloat *coord, GLint texture_h
 	}
 }
 
-/// Lower `struct backend_blit_args` into a list of GL coordinates, vertex indices, a
-/// shader, and uniforms.
+/// Lower `struct backend_blit_args` into a list of GL coordinates, a shader, and
+/// uniforms. The coordinates are put in the vertex scratch buffer after its first
+/// `first_rect` rectangles, which are kept.
 static int
 gl_lower_blit_args(struct gl_data *gd, ivec2 origin, const struct backend_blit_args *args,
-                   GLfloat **coord, GLuint **indices, struct gl_shader **shader,
+                   int first_rect, GLfloat **coord, struct gl_shader **shader,
                    struct gl_uniform_value *uniforms) {
 	auto img = (struct gl_texture *)args->source_image;
 	int nrects;
@@ -537,9 +569,8 @@ gl_lower_blit_args(struct gl_data *gd, ivec2 origin, const struct backend_blit_a
 		// Nothing to paint
 		return 0;
 	}
-	*coord = ccalloc(nrects * 16, GLfloat);
-	*indices = ccalloc(nrects * 6, GLuint);
-	gl_mask_rects_to_coords(origin, nrects, rects, args->scale, *coord, *indices);
+	*coord = gl_vertex_scratch(gd, first_rect + nrects) + first_rect * 16;
+	gl_mask_rects_to_coords(origin, nrects, rects, args->scale, *coord);
 	if (!img->y_inverted) {
 		gl_y_flip_texture(nrects, *coord, img->height);
 	}
@@ -607,49 +638,115 @@ gl_lower_blit_args(struct gl_data *gd, ivec2 origin, const struct backend_blit_a
 	return nrects;
 }
 
-bool gl_blit(backend_t *base, ivec2 origin, image_handle target_,
-             const struct backend_blit_args *args) {
-	auto gd = (struct gl_data *)base;
-	auto source = (struct gl_texture *)args->source_image;
-	auto target = (struct gl_texture *)target_;
-
-	if (source == &gd->back_image) {
-		log_error("Trying to blit from the back texture, this is not allowed");
+static bool gl_uniform_value_eq(const struct gl_uniform_value *a,
+                                const struct gl_uniform_value *b) {
+	if (a->type != b->type) {
 		return false;
 	}
+	switch (a->type) {
+	case 0: return true;
+	case GL_TEXTURE_2D:
+		return a->tu.texture == b->tu.texture && a->tu.sampler == b->tu.sampler;
+	case GL_INT: return a->i == b->i;
+	case GL_FLOAT: return a->f == b->f;
+	case GL_INT_VEC2: return a->i2[0] == b->i2[0] && a->i2[1] == b->i2[1];
+	case GL_FLOAT_VEC2: return a->f2[0] == b->f2[0] && a->f2[1] == b->f2[1];
+	case GL_FLOAT_VEC4: return memcmp(a->f4, b->f4, sizeof(a->f4)) == 0;
+	default: unreachable();
+	}
+}
 
-	GLfloat *coord;
-	GLuint *indices;
-	struct gl_shader *shader;
-	struct gl_uniform_value uniforms[NUMBER_OF_UNIFORMS] = {};
-	int nrects =
-	    gl_lower_blit_args(gd, origin, args, &coord, &indices, &shader, uniforms);
-	if (nrects == 0) {
-		return true;
+/// Whether two blits can be done with one draw, i.e. they use the same shader with the
+/// same uniforms.
+static bool gl_blit_can_merge(const struct gl_shader *shader_a,
+                              const struct gl_uniform_value *uniforms_a,
+                              const struct gl_shader *shader_b,
+                              const struct gl_uniform_value *uniforms_b) {
+	if (shader_a != shader_b) {
+		return false;
 	}
-	if (!target->y_inverted) {
-		log_trace("Flipping target texture");
-		gl_y_flip_target(nrects, coord, target->height);
+	for (int i = 0; i < NUMBER_OF_UNIFORMS; i++) {
+		if ((shader_a->uniform_bitmask & (1U << i)) &&
+		    !gl_uniform_value_eq(&uniforms_a[i], &uniforms_b[i])) {
+			return false;
+		}
 	}
+	return true;
+}
 
-	auto fbo = gl_bind_image_to_fbo(gd, target_);
-	// X pixmap is in premultiplied alpha, so we might just as well use it too.
-	// Thanks to derhass for help.
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-	gl_blit_inner(gd, fbo, nrects, coord, indices, &gl_blit_vertex_attribs, shader,
-	              NUMBER_OF_UNIFORMS, uniforms);
+bool gl_blit_many(backend_t *base, image_handle target_, unsigned count,
+                  const ivec2 origins[count],
+                  const struct backend_blit_args *const args[count]) {
+	auto gd = (struct gl_data *)base;
+	auto target = (struct gl_texture *)target_;
 
-	free(indices);
-	free(coord);
+	// Blits are lowered one by one, as long as they can be merged with the ones
+	// before them, their vertices are collected in the vertex scratch buffer, and
+	// they are drawn together.
+	struct gl_shader *shader = NULL;
+	struct gl_uniform_value uniforms[2][NUMBER_OF_UNIFORMS];
+	int pending = 0, total_rects = 0;
+	for (unsigned i = 0; i < count; i++) {
+		if (args[i]->source_image == (image_handle)&gd->back_image) {
+			log_error("Trying to blit from the back texture, this is not "
+			          "allowed");
+			return false;
+		}
+
+		GLfloat *coord;
+		struct gl_shader *next_shader;
+		auto next_uniforms = uniforms[!pending];
+		memset(next_uniforms, 0, sizeof(uniforms[0]));
+		int nrects = gl_lower_blit_args(gd, origins[i], args[i], total_rects,
+		                                &coord, &next_shader, next_uniforms);
+		if (nrects == 0) {
+			continue;
+		}
+		if (!target->y_inverted) {
+			log_trace("Flipping target texture");
+			gl_y_flip_target(nrects, coord, target->height);
+		}
+		if (total_rects > 0 && !gl_blit_can_merge(shader, uniforms[pending],
+		                                          next_shader, next_uniforms)) {
+			// Draw what we have, and move the vertices of this blit to the
+			// front of the scratch buffer.
+			auto fbo = gl_bind_image_to_fbo(gd, target_);
+			gl_blend_func(gd, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+			gl_blit_inner(gd, fbo, total_rects, gd->vertex_scratch, shader,
+			              NUMBER_OF_UNIFORMS, uniforms[pending]);
+			memmove(gd->vertex_scratch, coord,
+			        sizeof(GLfloat) * 16 * (size_t)nrects);
+			total_rects = 0;
+		}
+		if (total_rects == 0) {
+			shader = next_shader;
+			pending = !pending;
+		}
+		total_rects += nrects;
+	}
+
+	if (total_rects > 0) {
+		auto fbo = gl_bind_image_to_fbo(gd, target_);
+		// X pixmap is in premultiplied alpha, so we might just as well use it too.
+		// Thanks to derhass for help.
+		gl_blend_func(gd, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+		gl_blit_inner(gd, fbo, total_rects, gd->vertex_scratch, shader,
+		              NUMBER_OF_UNIFORMS, uniforms[pending]);
+	}
 	return true;
 }
 
+bool gl_blit(backend_t *base, ivec2 origin, image_handle target,
+             const struct backend_blit_args *args) {
+	return gl_blit_many(base, target, 1, &origin, &args);
+}
+
 /// Copy areas by glBlitFramebuffer. This is only used to copy data from the back
 /// buffer.
 static bool gl_copy_area_blit_fbo(struct gl_data *gd, ivec2 origin, image_handle target,
                                   const region_t *region) {
 	gl_bind_image_to_fbo(gd, target);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	gl_bind_read_framebuffer(gd, 0);
 
 	int nrects;
 	const rect_t *rects = pixman_region32_rectangles(region, &nrects);
@@ -683,9 +780,8 @@ static bool gl_copy_area_draw(struct gl_data *gd, ivec2 origin,
 		return true;
 	}
 
-	auto coord = ccalloc(16 * nrects, GLfloat);
-	auto indices = ccalloc(6 * nrects, GLuint);
-	gl_mask_rects_to_coords(origin, nrects, rects, SCALE_IDENTITY, coord, indices);
+	auto coord = gl_vertex_scratch(gd, nrects);
+	gl_mask_rects_to_coords(origin, nrects, rects, SCALE_IDENTITY, coord);
 	if (!target->y_inverted) {
 		gl_y_flip_target(nrects, coord, target->height);
 	}
@@ -695,11 +791,8 @@ static bool gl_copy_area_draw(struct gl_data *gd, ivec2 origin,
 	                         .tu = {source->texture, gd->samplers[GL_SAMPLER_EDGE]}},
 	};
 	auto fbo = gl_bind_image_to_fbo(gd, target_handle);
-	glBlendFunc(GL_ONE, GL_ZERO);
-	gl_blit_inner(gd, fbo, nrects, coord, indices, &gl_blit_vertex_attribs, shader,
-	              ARR_SIZE(uniforms), uniforms);
-	free(indices);
-	free(coord);
+	gl_blend_func(gd, GL_ONE, GL_ZERO);
+	gl_blit_inner(gd, fbo, nrects, coord, shader, ARR_SIZE(uniforms), uniforms);
 	return true;
 }
 
@@ -795,13 +888,18 @@ xcb_pixmap_t gl_release_image(backend_t *base, image_handle image) {
 	}
 	assert(inner->user_data == NULL);
 
-	glDeleteTextures(1, &inner->texture);
-	glDeleteTextures(2, inner->auxiliary_texture);
+	gl_delete_textures(gd, 1, &inner->texture);
+	gl_delete_textures(gd, 1, &inner->average_texture);
 	free(inner);
 	gl_check_err();
 	return pixmap;
 }
 
+void gl_pixmap_damaged(backend_t *base attr_unused, image_handle image) {
+	auto inner = (struct gl_texture *)image;
+	inner->average_valid = false;
+}
+
 static inline void gl_init_uniform_bitmask(struct gl_shader *shader) {
 	GLint number_of_uniforms = 0;
 	glGetProgramiv(shader->prog, GL_ACTIVE_UNIFORMS, &number_of_uniforms);
@@ -814,7 +912,9 @@ static inline void gl_init_uniform_bitmask(struct gl_shader *shader) {
 	}
 }
 
-static bool gl_create_window_shader_inner(struct gl_shader *out_shader, const char *source) {
+static bool gl_create_window_shader_inner(struct gl_data *gd,
+                                          struct gl_shader *out_shader,
+                                          const char *source) {
 	const char *vert[2] = {vertex_shader, NULL};
 	const char *frag[] = {blit_shader_glsl, masking_glsl, source, NULL};
 
@@ -833,9 +933,8 @@ static bool gl_create_window_shader_inner(struct gl_shader *out_shader, const ch
 	                                   {0, 0, 0, 0},
 	                                   {-1, -1, 0, 1}};
 
-	glUseProgram(out_shader->prog);
+	gl_use_program(gd, out_shader->prog);
 	glUniformMatrix4fv(UNIFORM_PROJECTION_LOC, 1, false, projection_matrix[0]);
-	glUseProgram(0);
 
 	gl_init_uniform_bitmask(out_shader);
 	gl_check_err();
@@ -843,9 +942,9 @@ static bool gl_create_window_shader_inner(struct gl_shader *out_shader, const ch
 	return true;
 }
 
-void *gl_create_window_shader(backend_t *backend_data attr_unused, const char *source) {
+void *gl_create_window_shader(backend_t *backend_data, const char *source) {
 	auto ret = ccalloc(1, struct gl_shader);
-	if (!gl_create_window_shader_inner(ret, source)) {
+	if (!gl_create_window_shader_inner((struct gl_data *)backend_data, ret, source)) {
 		free(ret);
 		return NULL;
 	}
@@ -872,17 +971,46 @@ static const struct {
     [GL_SAMPLER_BORDER] = {GL_NEAREST, GL_CLAMP_TO_BORDER},
 };
 
+/// Bind `vertex_array`, and set up the states shared by all of our vertex arrays: they
+/// all use the shared index buffer, and have both vertex attributes enabled.
+static void gl_init_vertex_array(struct gl_data *gd, GLuint vertex_array) {
+	gl_bind_vertex_array(gd, vertex_array);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gd->index_buffer);
+	glEnableVertexAttribArray(vert_coord_loc);
+	glEnableVertexAttribArray(vert_in_texcoord_loc);
+}
+
 bool gl_init(struct gl_data *gd, session_t *ps) {
 	if (!epoxy_has_gl_extension("GL_ARB_explicit_uniform_location")) {
 		log_error("GL_ARB_explicit_uniform_location support is required but "
 		          "missing.");
 		return false;
 	}
+	if (epoxy_gl_version() < 32 &&
+	    !epoxy_has_gl_extension("GL_ARB_draw_elements_base_vertex")) {
+		log_error("GL_ARB_draw_elements_base_vertex support is required but "
+		          "missing.");
+		return false;
+	}
+	gl_state_invalidate(gd);
 	glGenQueries(2, gd->frame_timing);
 	gd->current_frame_timing = 0;
 
-	glGenBuffers(4, gd->buffer_objects);
-	glGenVertexArrays(2, gd->vertex_array_objects);
+	glGenBuffers(1, &gd->vertex_buffer);
+	glGenBuffers(1, &gd->index_buffer);
+	glGenVertexArrays(ARR_SIZE(gd->vertex_array_objects), gd->vertex_array_objects);
+	glGenVertexArrays(1, &gd->blit_vertex_array);
+	gd->vertex_buffer_size = gd->vertex_buffer_used = 0;
+	gd->index_buffer_quads = 0;
+	for (size_t i = 0; i < ARR_SIZE(gd->vertex_array_objects); i++) {
+		gl_init_vertex_array(gd, gd->vertex_array_objects[i]);
+	}
+	gl_init_vertex_array(gd, gd->blit_vertex_array);
+	gl_bind_array_buffer(gd, gd->vertex_buffer);
+	glVertexAttribPointer(vert_coord_loc, 2, GL_FLOAT, GL_FALSE,
+	                      (GLsizei)GL_BLIT_VERTEX_STRIDE, NULL);
+	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_FLOAT, GL_FALSE,
+	                      (GLsizei)GL_BLIT_VERTEX_STRIDE, ((GLfloat *)NULL) + 2);
 
 	// Initialize GL data structure
 	glDisable(GL_DEPTH_TEST);
@@ -908,6 +1036,9 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 	glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
 	glGenFramebuffers(1, &gd->temp_fbo);
+	// Draw buffer is a state of the framebuffer, so this only needs to be set once.
+	gl_bind_draw_framebuffer(gd, gd->temp_fbo);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
 
 	gd->default_mask_texture = gl_new_texture();
 	if (!gd->default_mask_texture) {
@@ -915,13 +1046,12 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 		return false;
 	}
 
-	glBindTexture(GL_TEXTURE_2D, gd->default_mask_texture);
+	gl_bind_texture(gd, 0, gd->default_mask_texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, 1, 1, 0, GL_RED, GL_UNSIGNED_BYTE,
 	             (GLubyte[]){0xff});
-	glBindTexture(GL_TEXTURE_2D, 0);
 
 	// Initialize shaders
-	if (!gl_create_window_shader_inner(&gd->default_shader, blit_shader_default)) {
+	if (!gl_create_window_shader_inner(gd, &gd->default_shader, blit_shader_default)) {
 		log_error("Failed to create window shaders");
 		return false;
 	}
@@ -937,9 +1067,8 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 	gd->fill_shader.prog = gl_create_program_from_str(fill_vert, fill_frag);
 	gd->fill_shader.uniform_bitmask = (uint32_t)-1;        // make sure our uniforms
 	                                                       // are not ignored.
-	glUseProgram(gd->fill_shader.prog);
+	gl_use_program(gd, gd->fill_shader.prog);
 	glUniformMatrix4fv(UNIFORM_PROJECTION_LOC, 1, false, projection_matrix[0]);
-	glUseProgram(0);
 
 	gd->dithered_present = ps->o.dithered_present;
 	gd->copy_area_prog.prog = gl_create_program_from_strv(
@@ -952,7 +1081,7 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 	                                                          // uniforms are not
 	                                                          // ignored.
 
-	glUseProgram(gd->copy_area_prog.prog);
+	gl_use_program(gd, gd->copy_area_prog.prog);
 	glUniform1i(UNIFORM_TEX_LOC, 0);
 	glUniformMatrix4fv(UNIFORM_PROJECTION_LOC, 1, false, projection_matrix[0]);
 
@@ -965,7 +1094,7 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 	}
 	gd->copy_area_with_dither_prog.uniform_bitmask = (uint32_t)-1;
 
-	glUseProgram(gd->copy_area_with_dither_prog.prog);
+	gl_use_program(gd, gd->copy_area_with_dither_prog.prog);
 	glUniform1i(UNIFORM_TEX_LOC, 0);
 	glUniformMatrix4fv(UNIFORM_PROJECTION_LOC, 1, false, projection_matrix[0]);
 
@@ -975,10 +1104,9 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 		log_error("Failed to create the brightness shader");
 		return false;
 	}
-	glUseProgram(gd->brightness_shader.prog);
+	gl_use_program(gd, gd->brightness_shader.prog);
 	glUniform1i(UNIFORM_TEX_LOC, 0);
 	glUniformMatrix4fv(UNIFORM_PROJECTION_LOC, 1, false, projection_matrix[0]);
-	glUseProgram(0);
 
 	gd->back_image.width = ps->root_width;
 	gd->back_image.height = ps->root_height;
@@ -1034,16 +1162,25 @@ void gl_deinit(struct gl_data *gd) {
 	gd->fill_shader.prog = 0;
 	gd->brightness_shader.prog = 0;
 
-	glDeleteTextures(1, &gd->default_mask_texture);
+	gl_delete_textures(gd, 1, &gd->default_mask_texture);
+	for (size_t i = 0; i < ARR_SIZE(gd->average_scratch); i++) {
+		gl_delete_textures(gd, 1, &gd->average_scratch[i].texture);
+		gd->average_scratch[i] = (struct gl_texture){};
+	}
 
 	for (int i = 0; i < GL_MAX_SAMPLERS; i++) {
 		glDeleteSamplers(1, &gd->samplers[i]);
 	}
 
-	glDeleteFramebuffers(1, &gd->temp_fbo);
+	gl_delete_framebuffers(gd, 1, &gd->temp_fbo);
 
-	glDeleteBuffers(4, gd->buffer_objects);
-	glDeleteVertexArrays(2, gd->vertex_array_objects);
+	glDeleteBuffers(1, &gd->vertex_buffer);
+	glDeleteBuffers(1, &gd->index_buffer);
+	glDeleteVertexArrays(ARR_SIZE(gd->vertex_array_objects), gd->vertex_array_objects);
+	glDeleteVertexArrays(1, &gd->blit_vertex_array);
+	free(gd->vertex_scratch);
+	gd->vertex_scratch = NULL;
+	gd->vertex_scratch_rects = 0;
 
 	glDeleteQueries(2, gd->frame_timing);
 
@@ -1062,9 +1199,8 @@ GLuint gl_new_texture(void) {
 
 bool gl_clear(backend_t *backend_data, image_handle target, struct color color) {
 	auto gd = (struct gl_data *)backend_data;
-	auto fbo = gl_bind_image_to_fbo(gd, target);
+	gl_bind_image_to_fbo(gd, target);
 	auto target_image = (struct gl_texture *)target;
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
 	if (target_image->format == BACKEND_IMAGE_FORMAT_MASK) {
 		glClearColor((GLfloat)color.alpha, 0, 0, 1);
 	} else {
@@ -1072,7 +1208,6 @@ bool gl_clear(backend_t *backend_data, image_handle target, struct color color)
 		             (GLfloat)color.blue, (GLfloat)color.alpha);
 	}
 	glClear(GL_COLOR_BUFFER_BIT);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 	return true;
 }
 
@@ -1081,8 +1216,9 @@ image_handle gl_back_buffer(struct backend_base *base) {
 	return (image_handle)&gd->back_image;
 }
 
-image_handle gl_new_image(backend_t *backend_data attr_unused,
-                          enum backend_image_format format, ivec2 size) {
+image_handle gl_new_image(backend_t *backend_data, enum backend_image_format format,
+                          ivec2 size) {
+	auto gd = (struct gl_data *)backend_data;
 	auto tex = ccalloc(1, struct gl_texture);
 	log_trace("Creating texture %dx%d", size.width, size.height);
 	tex->format = format;
@@ -1099,8 +1235,7 @@ image_handle gl_new_image(backend_t *backend_data attr_unused,
 	case BACKEND_IMAGE_FORMAT_PIXMAP_HIGH: gl_format = GL_RGBA16; break;
 	case BACKEND_IMAGE_FORMAT_MASK: gl_format = GL_R8; break;
 	}
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, tex->texture);
+	gl_bind_texture(gd, 0, tex->texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, gl_format, size.width, size.height, 0, GL_RGBA,
 	             GL_UNSIGNED_BYTE, NULL);
 	if (format == BACKEND_IMAGE_FORMAT_MASK) {
@@ -1111,43 +1246,32 @@ image_handle gl_new_image(backend_t *backend_data attr_unused,
 		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR,
 		                 (GLfloat[]){0, 0, 0, 0});
 	}
-	glBindTexture(GL_TEXTURE_2D, 0);
 	return (image_handle)tex;
 }
 
 bool gl_apply_alpha(backend_t *base, image_handle target, double alpha, const region_t *reg_op) {
 	auto gd = (struct gl_data *)base;
-	static const struct gl_vertex_attribs_definition vertex_attribs = {
-	    .stride = sizeof(GLfloat) * 4,
-	    .count = 1,
-	    .attribs = {{GL_FLOAT, vert_coord_loc, NULL}},
-	};
 	if (alpha == 1.0 || !pixman_region32_not_empty(reg_op)) {
 		return true;
 	}
-	gl_bind_image_to_fbo(gd, target);
+	auto fbo = gl_bind_image_to_fbo(gd, target);
 	// Result color = 0 (GL_ZERO) + alpha (GL_CONSTANT_ALPHA) * original color
-	glBlendFunc(GL_ZERO, GL_CONSTANT_ALPHA);
+	gl_blend_func(gd, GL_ZERO, GL_CONSTANT_ALPHA);
 	glBlendColor(0, 0, 0, (GLclampf)alpha);
 
 	int nrects;
 	const rect_t *rect = pixman_region32_rectangles(reg_op, &nrects);
 
-	auto coord = ccalloc(nrects * 16, GLfloat);
-	auto indices = ccalloc(nrects * 6, GLuint);
+	auto coord = gl_vertex_scratch(gd, nrects);
 
 	struct gl_uniform_value uniforms[] = {
 	    [UNIFORM_COLOR_LOC] = {.type = GL_FLOAT_VEC4, .f4 = {0, 0, 0, 0}},
 	};
-	gl_mask_rects_to_coords_simple(nrects, rect, coord, indices);
-	gl_blit_inner(gd, gd->temp_fbo, nrects, coord, indices, &vertex_attribs,
-	              &gd->fill_shader, ARR_SIZE(uniforms), uniforms);
-	free(indices);
-	free(coord);
+	gl_mask_rects_to_coords_simple(nrects, rect, coord);
+	gl_blit_inner(gd, fbo, nrects, coord, &gd->fill_shader, ARR_SIZE(uniforms),
+	              uniforms);
 
 	gl_check_err();
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 	return true;
 }
 
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: MPL-2.0
 // Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
 #pragma once
+#include <assert.h>
 #include <epoxy/gl.h>
 #include <stdbool.h>
 #include <string.h>
@@ -60,8 +61,11 @@ struct gl_texture {
 	bool y_inverted;
 	xcb_pixmap_t pixmap;
 
-	// Textures for auxiliary uses.
-	GLuint auxiliary_texture[2];
+	/// A 1x1 texture holding the average color of this image, see
+	/// `gl_average_texture_color`. 0 if it hasn't been computed yet.
+	GLuint average_texture;
+	/// Whether `average_texture` is up to date with the content of this image.
+	bool average_valid;
 	void *user_data;
 };
 
@@ -80,6 +84,29 @@ enum gl_sampler {
 	GL_MAX_SAMPLERS = GL_SAMPLER_BLUR + 1,
 };
 
+/// Number of texture units whose bindings are tracked in `struct gl_state`.
+#define GL_STATE_TEXTURE_UNITS 8
+/// Value in `struct gl_state` meaning we don't know what is set.
+#define GL_STATE_UNKNOWN ((GLuint)-1)
+
+/// The bindings of the GL context, as last set through the `gl_bind_*` functions.
+/// Setting a binding to what it already is, is skipped. So these bindings must only be
+/// changed through those functions, or `gl_state_invalidate` has to be called after.
+struct gl_state {
+	GLuint program;
+	GLuint draw_framebuffer;
+	GLuint read_framebuffer;
+	/// The texture attached to the color attachment of `gl_data::temp_fbo`.
+	GLuint temp_fbo_texture;
+	GLuint vertex_array;
+	GLuint array_buffer;
+	/// Index of the active texture unit.
+	GLuint active_texture;
+	GLuint textures[GL_STATE_TEXTURE_UNITS];
+	GLuint samplers[GL_STATE_TEXTURE_UNITS];
+	GLenum blend_src, blend_dst;
+};
+
 struct gl_data {
 	struct backend_base base;
 	// If we are using proprietary NVIDIA driver
@@ -99,12 +126,32 @@ struct gl_data {
 	struct gl_shader copy_area_prog;
 	struct gl_shader copy_area_with_dither_prog;
 	GLuint samplers[GL_MAX_SAMPLERS];
-	GLuint buffer_objects[4];
-	GLuint vertex_array_objects[2];
+	/// Stream buffer the vertices of every draw in a frame are appended to, see
+	/// `gl_upload_vertices`.
+	GLuint vertex_buffer;
+	GLsizeiptr vertex_buffer_size, vertex_buffer_used;
+	/// Index buffer shared by all draws, holding the indices of `index_buffer_quads`
+	/// quads. The indices of a quad relative to its first vertex are always the same,
+	/// so they don't need to be uploaded for every draw.
+	GLuint index_buffer;
+	int index_buffer_quads;
+	GLuint vertex_array_objects[3];
+	/// Vertex array used for blits. Its attributes point to the start of
+	/// `vertex_buffer`, and draws select their vertices with a base vertex, so the
+	/// attributes never need to be specified again.
+	GLuint blit_vertex_array;
+	/// Scratch space vertices are generated into before they are uploaded, see
+	/// `gl_vertex_scratch`.
+	GLfloat *vertex_scratch;
+	int vertex_scratch_rects;
 
 	bool dithered_present;
 
 	GLuint default_mask_texture;
+	/// Textures the average color of an image is reduced through, shared by all
+	/// images. They only grow, and are large enough for the first two reduction
+	/// steps of the largest image reduced so far, see `gl_average_texture_color`.
+	struct gl_texture average_scratch[2];
 
 	/// Called when an gl_texture is decoupled from the texture it refers. Returns
 	/// the decoupled user_data
@@ -114,6 +161,8 @@ struct gl_data {
 	void (*release_user_data)(backend_t *base, struct gl_texture *);
 
 	struct log_target *logger;
+
+	struct gl_state state;
 };
 
 typedef struct session session_t;
@@ -129,16 +178,38 @@ void gl_prepare(backend_t *base, const region_t *reg);
 /// @param[in]  mask_origin origin of the mask in source coordinates
 /// @param[in]  nrects      number of rectangles
 /// @param[in]  rects       mask rectangles, in mask coordinates
-/// @param[out] coord       OpenGL vertex coordinates, suitable for creating VAO/VBO
-/// @param[out] indices     OpenGL vertex indices, suitable for creating VAO/VBO
+/// @param[out] coord       OpenGL vertex coordinates, 4 vertices per rectangle, to be
+///                         drawn with the indices from `gl_bind_quad_indices`
 void gl_mask_rects_to_coords(ivec2 origin, int nrects, const rect_t *rects, vec2 scale,
-                             GLfloat *coord, GLuint *indices);
+                             GLfloat *coord);
 /// Like `gl_mask_rects_to_coords`, but with `origin` is (0, 0).
-static inline void gl_mask_rects_to_coords_simple(int nrects, const rect_t *rects,
-                                                  GLfloat *coord, GLuint *indices) {
+static inline void
+gl_mask_rects_to_coords_simple(int nrects, const rect_t *rects, GLfloat *coord) {
 	return gl_mask_rects_to_coords((ivec2){0, 0}, nrects, rects, SCALE_IDENTITY,
-	                               coord, indices);
+	                               coord);
 }
+/// Get a scratch buffer big enough for the coordinates of `nrects` rectangles generated
+/// by `gl_mask_rects_to_coords`. The buffer is owned by `gd`, and only valid until the
+/// next call.
+GLfloat *gl_vertex_scratch(struct gl_data *gd, int nrects);
+/// Append `size` bytes of vertex data to the vertex buffer, and bind it to
+/// `GL_ARRAY_BUFFER`. Returns the offset of the data in the vertex buffer.
+///
+/// When the vertex buffer is full it's orphaned, and data uploaded before that is no
+/// longer available for new draws. So everything a draw needs has to be uploaded in
+/// one go, right before the draw.
+GLintptr gl_upload_vertices(struct gl_data *gd, const void *data, GLsizeiptr size);
+/// Make sure the shared index buffer has indices for at least `nquads` quads. Each quad
+/// is 4 vertices, drawn as 2 triangles, so `nquads` quads are drawn with `nquads * 6`
+/// indices. The index buffer is bound to `GL_ELEMENT_ARRAY_BUFFER` of all of our vertex
+/// arrays, one of them must be bound when this is called.
+void gl_bind_quad_indices(struct gl_data *gd, int nquads);
+/// Forget everything `gd->state` knows, the next binds will all be done.
+void gl_state_invalidate(struct gl_data *gd);
+/// Delete textures, and forget about them in `gd->state`.
+void gl_delete_textures(struct gl_data *gd, int n, const GLuint *textures);
+/// Delete framebuffers, and forget about them in `gd->state`.
+void gl_delete_framebuffers(struct gl_data *gd, int n, const GLuint *fbos);
 
 GLuint gl_create_shader(GLenum shader_type, const char *shader_str);
 GLuint gl_create_program(const GLuint *shaders, int nshaders);
@@ -151,8 +222,11 @@ bool gl_last_render_time(backend_t *backend_data, struct timespec *time);
 
 bool gl_blit(backend_t *base, ivec2 origin, image_handle target,
              const struct backend_blit_args *args);
-image_handle gl_new_image(backend_t *backend_data attr_unused,
-                          enum backend_image_format format, ivec2 size);
+bool gl_blit_many(backend_t *base, image_handle target, unsigned count,
+                  const ivec2 origins[count],
+                  const struct backend_blit_args *const args[count]);
+image_handle gl_new_image(backend_t *backend_data, enum backend_image_format format,
+                          ivec2 size);
 bool gl_clear(backend_t *backend_data, image_handle target, struct color color);
 
 void gl_root_change(backend_t *base, session_t *);
@@ -165,6 +239,7 @@ void gl_deinit(struct gl_data *gd);
 GLuint gl_new_texture(void);
 
 xcb_pixmap_t gl_release_image(backend_t *base, image_handle image);
+void gl_pixmap_damaged(backend_t *base, image_handle image);
 
 image_handle gl_clone(backend_t *base, image_handle image, const region_t *reg_visible);
 
@@ -193,19 +268,88 @@ static inline void gl_finish_render(struct gl_data *gd) {
 	gd->current_frame_timing ^= 1;
 }
 
+static inline void gl_use_program(struct gl_data *gd, GLuint program) {
+	if (gd->state.program != program) {
+		glUseProgram(program);
+		gd->state.program = program;
+	}
+}
+
+static inline void gl_bind_draw_framebuffer(struct gl_data *gd, GLuint fbo) {
+	if (gd->state.draw_framebuffer != fbo) {
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+		gd->state.draw_framebuffer = fbo;
+	}
+}
+
+static inline void gl_bind_read_framebuffer(struct gl_data *gd, GLuint fbo) {
+	if (gd->state.read_framebuffer != fbo) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		gd->state.read_framebuffer = fbo;
+	}
+}
+
+static inline void gl_bind_vertex_array(struct gl_data *gd, GLuint vertex_array) {
+	if (gd->state.vertex_array != vertex_array) {
+		glBindVertexArray(vertex_array);
+		gd->state.vertex_array = vertex_array;
+	}
+}
+
+static inline void gl_bind_array_buffer(struct gl_data *gd, GLuint buffer) {
+	if (gd->state.array_buffer != buffer) {
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		gd->state.array_buffer = buffer;
+	}
+}
+
+/// Bind `texture` to texture unit `unit`. `unit` is made the active texture unit, so
+/// the texture can be modified with calls like `glTexImage2D` afterwards.
+static inline void gl_bind_texture(struct gl_data *gd, GLuint unit, GLuint texture) {
+	assert(unit < GL_STATE_TEXTURE_UNITS);
+	if (gd->state.active_texture != unit) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		gd->state.active_texture = unit;
+	}
+	if (gd->state.textures[unit] != texture) {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		gd->state.textures[unit] = texture;
+	}
+}
+
+static inline void gl_bind_sampler(struct gl_data *gd, GLuint unit, GLuint sampler) {
+	assert(unit < GL_STATE_TEXTURE_UNITS);
+	if (gd->state.samplers[unit] != sampler) {
+		glBindSampler(unit, sampler);
+		gd->state.samplers[unit] = sampler;
+	}
+}
+
+static inline void gl_blend_func(struct gl_data *gd, GLenum src, GLenum dst) {
+	if (gd->state.blend_src != src || gd->state.blend_dst != dst) {
+		glBlendFunc(src, dst);
+		gd->state.blend_src = src;
+		gd->state.blend_dst = dst;
+	}
+}
+
 /// Return a FBO with `image` bound to the first color attachment. `GL_DRAW_FRAMEBUFFER`
 /// will be bound to the returned FBO.
 static inline GLuint gl_bind_image_to_fbo(struct gl_data *gd, image_handle image_) {
 	auto image = (struct gl_texture *)image_;
 	if (image == &gd->back_image) {
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		gl_bind_draw_framebuffer(gd, 0);
 		return 0;
 	}
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gd->temp_fbo);
-	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-	                       image->texture, 0);
-	CHECK(gl_check_fb_complete(GL_DRAW_FRAMEBUFFER));
-	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	gl_bind_draw_framebuffer(gd, gd->temp_fbo);
+	if (gd->state.temp_fbo_texture != image->texture) {
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		                       GL_TEXTURE_2D, image->texture, 0);
+		CHECK(gl_check_fb_complete(GL_DRAW_FRAMEBUFFER));
+		gd->state.temp_fbo_texture = image->texture;
+	}
+	// The image is about to be rendered into.
+	image->average_valid = false;
 	return gd->temp_fbo;
 }
 
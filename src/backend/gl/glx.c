@@ -158,9 +158,8 @@ static void glx_release_image(backend_t *base, struct gl_texture *tex) {
 	GLXPixmap *p = tex->user_data;
 	// Release binding
 	if (p && tex->texture) {
-		glBindTexture(GL_TEXTURE_2D, tex->texture);
+		gl_bind_texture((struct gl_data *)base, 0, tex->texture);
 		glXReleaseTexImageEXT(base->c->dpy, *p, GLX_FRONT_LEFT_EXT);
-		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 
 	// Free GLX Pixmap
@@ -354,8 +353,8 @@ end:
 	return &gd->gl.base;
 }
 
-static image_handle
-glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt) {
+static image_handle glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, ivec2 size,
+                                    struct xvisual_info fmt) {
 	GLXPixmap *glxpixmap = NULL;
 	auto gd = (struct _glx_data *)base;
 
@@ -364,19 +363,11 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt) {
 		return NULL;
 	}
 
-	auto r =
-	    xcb_get_geometry_reply(base->c->c, xcb_get_geometry(base->c->c, pixmap), NULL);
-	if (!r) {
-		log_error("Invalid pixmap %#010x", pixmap);
-		return NULL;
-	}
-
 	log_trace("Binding pixmap %#010x", pixmap);
 	auto inner = ccalloc(1, struct gl_texture);
-	inner->width = r->width;
-	inner->height = r->height;
+	inner->width = size.width;
+	inner->height = size.height;
 	inner->format = BACKEND_IMAGE_FORMAT_PIXMAP;
-	free(r);
 
 	struct glx_fbconfig_cache *cached_fbconfig = NULL;
 	HASH_FIND(hh, gd->cached_fbconfigs, &fmt, sizeof(fmt), cached_fbconfig);
@@ -434,9 +425,8 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt) {
 	// Create texture
 	inner->user_data = glxpixmap;
 	inner->texture = gl_new_texture();
-	glBindTexture(GL_TEXTURE_2D, inner->texture);
+	gl_bind_texture(&gd->gl, 0, inner->texture);
 	glXBindTexImageEXT(base->c->dpy, *glxpixmap, GLX_FRONT_LEFT_EXT, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
 
 	gl_check_err();
 	return (image_handle)inner;
@@ -521,6 +511,7 @@ const struct backend_operations glx_ops = {
     .back_buffer = gl_back_buffer,
     .bind_pixmap = glx_bind_pixmap,
     .blit = gl_blit,
+    .blit_many = gl_blit_many,
     .blur = gl_blur,
     .clear = gl_clear,
     .copy_area = gl_copy_area,
@@ -528,6 +519,7 @@ const struct backend_operations glx_ops = {
     .image_capabilities = gl_image_capabilities,
     .is_format_supported = gl_is_format_supported,
     .new_image = gl_new_image,
+    .pixmap_damaged = gl_pixmap_damaged,
     .present = glx_present,
     .quirks = backend_no_quirks,
     .version = glx_version,
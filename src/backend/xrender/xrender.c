@@ -24,6 +24,7 @@
 #include "picom.h"
 #include "region.h"
 #include "utils/kernel.h"
+#include "utils/list.h"
 #include "utils/misc.h"
 #include "x.h"
 
@@ -63,6 +64,26 @@ typedef struct xrender_data {
 	int buffer_age[2];
 	/// The back buffer we should be painting into
 	int curr_back;
+	/// Whether each back buffer has been presented, but the PresentCompleteNotify for
+	/// it hasn't been received yet. The X server might still read from it.
+	bool present_pending[2];
+	/// Serial of the last PresentPixmap request for each back buffer
+	uint32_t present_serial[2];
+	/// The last PresentPixmap request for each back buffer. Its sequence is set to 0
+	/// once we have checked for errors.
+	xcb_void_cookie_t present_cookie[2];
+	/// Serial to use for the next PresentPixmap request
+	uint32_t next_present_serial;
+	/// Whether the last completed present was a flip. If it was, the previously
+	/// presented buffer stays on screen until the next present completes.
+	bool last_present_flipped;
+	/// Requests marking the end of frames the X server hasn't finished yet. A list
+	/// of `struct xrender_present_request`, oldest first.
+	struct list_node present_requests;
+	/// When rendering of the current frame started, in nanoseconds.
+	uint64_t frame_start_ns;
+	/// How long the X server took to render the last finished frame, in nanoseconds.
+	uint64_t last_render_time_ns;
 	/// The corresponding pixmap to the back buffer
 	xcb_pixmap_t back_pixmap[2];
 	/// Pictures of pixel of different alpha value, used as a mask to
@@ -85,6 +106,31 @@ typedef struct xrender_data {
 	bool vsync;
 } xrender_data;
 
+/// Tracks the last request of a frame. Once the X server has processed it, it has also
+/// processed all the rendering requests for the frame.
+struct xrender_present_request {
+	struct x_async_request_base base;
+	/// Node in `xrender_data::present_requests`
+	struct list_node siblings;
+	/// The backend this request belongs to. NULL if the backend was destroyed before
+	/// the request completed.
+	struct xrender_data *xd;
+	uint64_t frame_start_ns;
+};
+
+/// Intermediate pictures used by `xrender_blur`, kept so they don't have to be created
+/// for every blur. They are as large as the largest blur done so far, and recreated when
+/// the format of the source image changes.
+struct xrender_blur_pool {
+	xcb_render_picture_t pict[2];
+	/// Index of the blur kernel currently set as the filter of each picture, or -1 if
+	/// the filter is "Nearest".
+	int filter[2];
+	xcb_render_pictformat_t pictfmt;
+	uint8_t depth;
+	ivec2 size;
+};
+
 struct xrender_blur_context {
 	enum blur_method method;
 	/// Blur kernels converted to X format
@@ -94,6 +140,8 @@ struct xrender_blur_context {
 
 	/// Number of blur kernels
 	int x_blur_kernel_count;
+
+	struct xrender_blur_pool pool;
 };
 
 struct xrender_rounded_rectangle_cache {
@@ -513,6 +561,77 @@ xrender_copy_area(struct backend_base *base, ivec2 origin, image_handle target_h
 	return true;
 }
 
+static void
+xrender_blur_pool_release(struct x_connection *c, struct xrender_blur_pool *pool) {
+	for (int i = 0; i < 2; i++) {
+		if (pool->pict[i] != XCB_NONE) {
+			x_free_picture(c, pool->pict[i]);
+			pool->pict[i] = XCB_NONE;
+		}
+	}
+	pool->size = (ivec2){0, 0};
+}
+
+/// Make sure the intermediate pictures in `pool` are at least as large as `size`, and
+/// have the same format as `source`.
+static bool
+xrender_blur_pool_ensure(struct x_connection *c, struct xrender_blur_pool *pool,
+                         const struct xrender_image_data_inner *source, ivec2 size) {
+	if (pool->pict[0] != XCB_NONE && pool->pictfmt == source->pictfmt &&
+	    pool->depth == source->depth) {
+		if (pool->size.width >= size.width && pool->size.height >= size.height) {
+			return true;
+		}
+		size.width = max2(size.width, pool->size.width);
+		size.height = max2(size.height, pool->size.height);
+	}
+	xrender_blur_pool_release(c, pool);
+
+	const uint32_t pic_attrs_mask = XCB_RENDER_CP_REPEAT;
+	const xcb_render_create_picture_value_list_t pic_attrs = {.repeat = XCB_RENDER_REPEAT_PAD};
+	for (int i = 0; i < 2; i++) {
+		pool->pict[i] = x_create_picture_with_pictfmt(
+		    c, size.width, size.height, source->pictfmt, source->depth,
+		    pic_attrs_mask, &pic_attrs);
+		pool->filter[i] = -1;
+		if (pool->pict[i] == XCB_NONE) {
+			xrender_blur_pool_release(c, pool);
+			return false;
+		}
+	}
+	pool->pictfmt = source->pictfmt;
+	pool->depth = source->depth;
+	pool->size = size;
+	return true;
+}
+
+/// Set the filter of `pict` to the blur kernel `kernel`, or to "Nearest" if `kernel` is
+/// -1.
+static void xrender_set_blur_filter(struct x_connection *c, xcb_render_picture_t pict,
+                                    const struct xrender_blur_context *bctx, int kernel) {
+	static const char *filter0 = "Nearest";        // The "null" filter
+	static const char *filter = "convolution";
+	if (kernel < 0) {
+		xcb_render_set_picture_filter(c->c, pict, to_u16_checked(strlen(filter0)),
+		                              filter0, 0, NULL);
+		return;
+	}
+	xcb_render_set_picture_filter(c->c, pict, to_u16_checked(strlen(filter)), filter,
+	                              to_u32_checked(bctx->x_blur_kernel[kernel]->size),
+	                              bctx->x_blur_kernel[kernel]->kernel);
+}
+
+/// Same as `xrender_set_blur_filter`, for the intermediate picture `i` in the pool of
+/// `bctx`. Filters are only sent if they are different from what's already set.
+static void xrender_blur_pool_set_filter(struct x_connection *c,
+                                         struct xrender_blur_context *bctx, int i,
+                                         int kernel) {
+	if (bctx->pool.filter[i] != kernel) {
+		xrender_set_blur_filter(c, bctx->pool.pict[i], bctx, kernel);
+		bctx->pool.filter[i] = kernel;
+	}
+}
+
 static bool xrender_blur(struct backend_base *base, ivec2 origin,
                          image_handle target_handle, const struct backend_blur_args *args) {
 	auto bctx = (struct xrender_blur_context *)args->blur_context;
@@ -534,22 +653,11 @@ static bool xrender_blur(struct backend_base *base, ivec2 origin,
 	const pixman_box32_t *extent_resized = pixman_region32_extents(&reg_op_resized);
 	auto const height_resized = to_u16_checked(extent_resized->y2 - extent_resized->y1);
 	auto const width_resized = to_u16_checked(extent_resized->x2 - extent_resized->x1);
-	static const char *filter0 = "Nearest";        // The "null" filter
-	static const char *filter = "convolution";
 
-	// Create a buffer for storing blurred picture, make it just big enough
-	// for the blur region
-	const uint32_t pic_attrs_mask = XCB_RENDER_CP_REPEAT;
-	const xcb_render_create_picture_value_list_t pic_attrs = {.repeat = XCB_RENDER_REPEAT_PAD};
-	xcb_render_picture_t tmp_picture[2] = {
-	    x_create_picture_with_pictfmt(xd->base.c, width_resized, height_resized,
-	                                  source->pictfmt, source->depth, pic_attrs_mask,
-	                                  &pic_attrs),
-	    x_create_picture_with_pictfmt(xd->base.c, width_resized, height_resized,
-	                                  source->pictfmt, source->depth, pic_attrs_mask,
-	                                  &pic_attrs)};
-
-	if (!tmp_picture[0] || !tmp_picture[1]) {
+	// Get buffers for storing blurred picture, they are at least big enough for the
+	// blur region. Only the top left part of them is used.
+	if (!xrender_blur_pool_ensure(c, &bctx->pool, source,
+	                              (ivec2){width_resized, height_resized})) {
 		log_error("Failed to build intermediate Picture.");
 		pixman_region32_fini(&reg_op_resized);
 		return false;
@@ -559,11 +667,10 @@ static bool xrender_blur(struct backend_base *base, ivec2 origin,
 	pixman_region32_init(&clip);
 	pixman_region32_copy(&clip, &reg_op_resized);
 	pixman_region32_translate(&clip, -extent_resized->x1, -extent_resized->y1);
-	x_set_picture_clip_region(c, tmp_picture[0], 0, 0, &clip);
-	x_set_picture_clip_region(c, tmp_picture[1], 0, 0, &clip);
+	x_set_picture_clip_region(c, bctx->pool.pict[0], 0, 0, &clip);
+	x_set_picture_clip_region(c, bctx->pool.pict[1], 0, 0, &clip);
 	pixman_region32_fini(&clip);
 
-	xcb_render_picture_t src_pict = source->pict;
 	auto mask_pict = xd->alpha_pict[(int)(args->opacity * MAX_ALPHA)];
 	bool mask_allocated = false;
 	ivec2 mask_pict_origin = {};
@@ -579,7 +686,7 @@ static bool xrender_blur(struct backend_base *base, ivec2 origin,
 		mask_pict_origin.x -= extent_resized->x1;
 		mask_pict_origin.y -= extent_resized->y1;
 	}
-	x_set_picture_clip_region(c, src_pict, 0, 0, &reg_op_resized);
+	x_set_picture_clip_region(c, source->pict, 0, 0, &reg_op_resized);
 	x_set_picture_clip_region(c, target->pict, 0, 0, args->target_mask);
 
 	// For more than 1 pass, we do:
@@ -587,39 +694,50 @@ static bool xrender_blur(struct backend_base *base, ivec2 origin,
 	//   -(pass n)-> tmp0 or tmp1 -(composite)-> target
 	// For 1 pass, we do:
 	//   source -(pass 1)-> tmp0 -(composite)-> target
-	xcb_render_picture_t dst_pict = tmp_picture[0];
+	//
+	// `src` and `dst` are indices into the pool, -1 means the source image.
+	int src = -1, dst = 0;
 	ivec2 src_origin = {.x = extent_resized->x1, .y = extent_resized->y1};
 	int npasses = bctx->x_blur_kernel_count;
 	for (int i = 0; i < npasses; i++) {
 		// Copy from source picture to destination. The filter must
 		// be applied on source picture, to get the nearby pixels outside the
 		// window.
-		xcb_render_set_picture_filter(c->c, src_pict,
-		                              to_u16_checked(strlen(filter)), filter,
-		                              to_u32_checked(bctx->x_blur_kernel[i]->size),
-		                              bctx->x_blur_kernel[i]->kernel);
+		auto src_pict = src < 0 ? source->pict : bctx->pool.pict[src];
+		if (src < 0) {
+			xrender_set_blur_filter(c, src_pict, bctx, i);
+		} else {
+			xrender_blur_pool_set_filter(c, bctx, src, i);
+		}
 
 		// clang-format off
-		xcb_render_composite(c->c, XCB_RENDER_PICT_OP_SRC, src_pict, XCB_NONE, dst_pict,
+		xcb_render_composite(c->c, XCB_RENDER_PICT_OP_SRC, src_pict, XCB_NONE,
+		    bctx->pool.pict[dst],
 		    to_i16_checked(src_origin.x)         , to_i16_checked(src_origin.y),
 		    0                                    , 0                           ,
 		    0                                    , 0                           ,
 		    width_resized                        , height_resized);
 		// clang-format on
 
-		// reset filter
-		xcb_render_set_picture_filter(
-		    c->c, src_pict, to_u16_checked(strlen(filter0)), filter0, 0, NULL);
+		if (src < 0) {
+			// reset filter, the source image is used elsewhere
+			xrender_set_blur_filter(c, src_pict, bctx, -1);
+		}
 
-		auto next_tmp = src_pict == source->pict ? tmp_picture[1] : src_pict;
-		src_pict = dst_pict;
-		dst_pict = next_tmp;
+		src = dst;
+		dst = 1 - dst;
 		src_origin = (ivec2){.x = 0, .y = 0};
 	}
 
-	// Finally, we composite the last pass to the target picture
+	// Finally, we composite the last pass to the target picture, without filter.
+	xcb_render_picture_t src_pict = source->pict;
+	if (src >= 0) {
+		xrender_blur_pool_set_filter(c, bctx, src, -1);
+		src_pict = bctx->pool.pict[src];
+	}
 	xcb_render_composite(
-	    c->c, XCB_RENDER_PICT_OP_OVER, src_pict, mask_pict, target->pict, 0, 0,
+	    c->c, XCB_RENDER_PICT_OP_OVER, src_pict, mask_pict, target->pict,
+	    to_i16_checked(src_origin.x), to_i16_checked(src_origin.y),
 	    to_i16_checked(-mask_pict_origin.x), to_i16_checked(-mask_pict_origin.y),
 	    to_i16_checked(origin.x + extent_resized->x1),
 	    to_i16_checked(origin.y + extent_resized->y1), width_resized, height_resized);
@@ -627,33 +745,18 @@ static bool xrender_blur(struct backend_base *base, ivec2 origin,
 	if (mask_allocated) {
 		x_free_picture(c, mask_pict);
 	}
-	x_free_picture(c, tmp_picture[0]);
-	x_free_picture(c, tmp_picture[1]);
 	pixman_region32_fini(&reg_op_resized);
 
 	xrender_record_back_damage(xd, target, args->target_mask);
 	return true;
 }
 
-static image_handle
-xrender_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt) {
-	xcb_generic_error_t *e;
-	auto r = xcb_get_geometry_reply(base->c->c, xcb_get_geometry(base->c->c, pixmap), &e);
-	if (!r) {
-		log_error("Invalid pixmap: %#010x", pixmap);
-		x_print_error(base->c, e->full_sequence, e->major_code, e->minor_code,
-		              e->error_code);
-		free(e);
-		return NULL;
-	}
-
+static image_handle xrender_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, ivec2 size,
+                                        struct xvisual_info fmt) {
 	auto img = ccalloc(1, struct xrender_image_data_inner);
 	img->depth = (uint8_t)fmt.visual_depth;
 	img->has_alpha = fmt.alpha_size > 0;
-	img->size = (ivec2){
-	    .width = r->width,
-	    .height = r->height,
-	};
+	img->size = size;
 	img->format = BACKEND_IMAGE_FORMAT_PIXMAP;
 	img->pixmap = pixmap;
 	xcb_render_create_picture_value_list_t pic_attrs = {.repeat = XCB_RENDER_REPEAT_NORMAL};
@@ -663,7 +766,6 @@ xrender_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fm
 	img->pictfmt = pictfmt_info->id;
 	assert(pictfmt_info->depth == img->depth);
 	img->is_pixmap_internal = false;
-	free(r);
 
 	if (img->pict == XCB_NONE) {
 		free(img);
@@ -691,6 +793,42 @@ static xcb_pixmap_t xrender_release_image(backend_t *base, image_handle image) {
 	return pixmap;
 }
 
+static inline uint64_t xrender_now_ns(void) {
+	auto now = get_time_timespec();
+	return (uint64_t)now.tv_sec * 1000000000UL + (uint64_t)now.tv_nsec;
+}
+
+/// Forget everything we know about the content of the back buffers. Used when we lost
+/// track of the presents, e.g. because of an X error.
+static void xrender_reset_back_buffers(struct xrender_data *xd) {
+	for (int i = 0; i < 2; i++) {
+		if (xd->present_cookie[i].sequence != 0) {
+			xcb_discard_reply(xd->base.c->c, xd->present_cookie[i].sequence);
+			xd->present_cookie[i].sequence = 0;
+		}
+		xd->buffer_age[i] = -1;
+		xd->present_pending[i] = false;
+	}
+}
+
+/// Check if the last PresentPixmap request for back buffer `i` failed, in which case
+/// there won't be a PresentCompleteNotify for it. This does a round trip if the X
+/// server hasn't processed the request yet.
+static bool xrender_check_present_request(struct xrender_data *xd, int i) {
+	if (xd->present_cookie[i].sequence == 0) {
+		return true;
+	}
+	auto e = xcb_request_check(xd->base.c->c, xd->present_cookie[i]);
+	xd->present_cookie[i].sequence = 0;
+	if (e) {
+		log_error("Failed to present pixmap");
+		free(e);
+		xrender_reset_back_buffers(xd);
+		return false;
+	}
+	return true;
+}
+
 static void xrender_deinit(backend_t *backend_data) {
 	auto xd = (struct xrender_data *)backend_data;
 	for (int i = 0; i < 256; i++) {
@@ -706,6 +844,13 @@ static void xrender_deinit(backend_t *backend_data) {
 		}
 	}
 	x_destroy_region(xd->base.c, xd->present_region);
+	xrender_reset_back_buffers(xd);
+	list_foreach_safe(struct xrender_present_request, i, &xd->present_requests,
+	                  siblings) {
+		// The request is freed when it completes.
+		list_remove(&i->siblings);
+		i->xd = NULL;
+	}
 	if (xd->present_event) {
 		xcb_unregister_for_special_event(xd->base.c->c, xd->present_event);
 	}
@@ -714,51 +859,131 @@ static void xrender_deinit(backend_t *backend_data) {
 	free(xd);
 }
 
-static bool xrender_present(struct backend_base *base) {
-	auto xd = (struct xrender_data *)base;
-	if (xd->vsync) {
-		// Make sure we got reply from PresentPixmap before waiting for events,
-		// to avoid deadlock
-		auto e = xcb_request_check(
-		    base->c->c,
-		    xcb_present_pixmap_checked(
-		        base->c->c, xd->target_win, xd->back_pixmap[xd->curr_back], 0, XCB_NONE,
-		        x_set_region(base->c, xd->present_region, &xd->back_damaged)
-		            ? xd->present_region
-		            : XCB_NONE,
-		        0, 0, XCB_NONE, XCB_NONE, XCB_NONE, 0, 0, 0, 0, 0, NULL));
-		if (e) {
-			log_error("Failed to present pixmap");
-			free(e);
+static void xrender_handle_present_event(struct xrender_data *xd,
+                                         xcb_present_generic_event_t *pev) {
+	// We only subscribed to the complete notify event.
+	assert(pev->evtype == XCB_PRESENT_COMPLETE_NOTIFY);
+	auto pcev = (xcb_present_complete_notify_event_t *)pev;
+	if (pcev->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP) {
+		return;
+	}
+	// log_trace("Present complete: %d %ld", pcev->mode, pcev->msc);
+	for (int i = 0; i < 2; i++) {
+		if (xd->present_pending[i] && xd->present_serial[i] == pcev->serial) {
+			// Already processed by the X server, so this doesn't block.
+			xrender_check_present_request(xd, i);
+			xd->present_pending[i] = false;
+			xd->last_present_flipped =
+			    pcev->mode == XCB_PRESENT_COMPLETE_MODE_FLIP;
+		}
+	}
+}
+
+/// Handle the PresentCompleteNotify events we have received so far. If `block` is true,
+/// wait until the current back buffer can be rendered into.
+static bool xrender_handle_present_events(struct xrender_data *xd, bool block) {
+	xcb_present_generic_event_t *pev;
+	while ((pev = (void *)xcb_poll_for_special_event(xd->base.c->c,
+	                                                 xd->present_event))) {
+		xrender_handle_present_event(xd, pev);
+		free(pev);
+	}
+
+	// The current back buffer is free once its own last present has completed.
+	// But if presents are done by flipping, the other buffer stays on screen, and
+	// the current one might still be scanned out, until the other's present
+	// completes too.
+	auto back = xd->curr_back;
+	while (block && (xd->present_pending[back] ||
+	                 (xd->last_present_flipped && xd->present_pending[1 - back]))) {
+		// Make sure the presents we are waiting for succeeded, otherwise we would
+		// be waiting forever.
+		if (!xrender_check_present_request(xd, back) ||
+		    !xrender_check_present_request(xd, 1 - back)) {
 			return false;
 		}
-		// TODO(yshui) don't block wait for present completion
-		auto pev = (xcb_present_generic_event_t *)xcb_wait_for_special_event(
-		    base->c->c, xd->present_event);
+		pev = (void *)xcb_wait_for_special_event(xd->base.c->c, xd->present_event);
 		if (!pev) {
 			// We don't know what happened, maybe X died
 			// But reset buffer age, so in case we do recover, we will
 			// render correctly.
-			xd->buffer_age[0] = xd->buffer_age[1] = -1;
+			xrender_reset_back_buffers(xd);
 			return false;
 		}
-		assert(pev->evtype == XCB_PRESENT_COMPLETE_NOTIFY);
-		auto pcev = (xcb_present_complete_notify_event_t *)pev;
-		// log_trace("Present complete: %d %ld", pcev->mode, pcev->msc);
-		xd->buffer_age[xd->curr_back] = 1;
+		xrender_handle_present_event(xd, pev);
+		free(pev);
+	}
+	return true;
+}
+
+static void
+xrender_handle_present_request(struct x_connection * /*c*/,
+                               struct x_async_request_base *req_base,
+                               const xcb_raw_generic_event_t *reply_or_error) {
+	auto req = (struct xrender_present_request *)req_base;
+	auto xd = req->xd;
+	if (xd != NULL) {
+		// Requests are completed in order.
+		assert(&req->siblings == xd->present_requests.next);
+		list_remove(&req->siblings);
+		// NoOperation never fails, `reply_or_error` is NULL if the X connection
+		// is closed, then the time doesn't matter.
+		xd->last_render_time_ns = xrender_now_ns() - req->frame_start_ns;
+	}
+	free(req);
+}
+
+static void xrender_prepare(struct backend_base *base, const region_t * /*reg_damage*/) {
+	auto xd = (struct xrender_data *)base;
+	if (xd->vsync) {
+		// `buffer_age` is not called if damage is not used.
+		xrender_handle_present_events(xd, true);
+	}
+	xd->frame_start_ns = xrender_now_ns();
+}
+
+static bool xrender_present(struct backend_base *base) {
+	auto xd = (struct xrender_data *)base;
+	auto req = ccalloc(1, struct xrender_present_request);
+	req->base.callback = xrender_handle_present_request;
+	req->base.no_reply = true;
+	req->xd = xd;
+	req->frame_start_ns = xd->frame_start_ns;
+	if (xd->vsync) {
+		// Don't wait for the present to complete, `xrender_prepare` will do
+		// that if we start rendering the next frame before it does.
+		auto back = xd->curr_back;
+		if (xd->present_cookie[back].sequence != 0) {
+			// We never waited for the last present of this buffer to
+			// complete, don't care about its errors anymore.
+			xcb_discard_reply(base->c->c, xd->present_cookie[back].sequence);
+		}
+		xd->present_serial[back] = xd->next_present_serial++;
+		xd->present_cookie[back] = xcb_present_pixmap_checked(
+		    base->c->c, xd->target_win, xd->back_pixmap[back],
+		    xd->present_serial[back], XCB_NONE,
+		    x_set_region(base->c, xd->present_region, &xd->back_damaged)
+		        ? xd->present_region
+		        : XCB_NONE,
+		    0, 0, XCB_NONE, XCB_NONE, XCB_NONE, 0, 0, 0, 0, 0, NULL);
+		xd->present_pending[back] = true;
+		xd->buffer_age[back] = 1;
 
 		// buffer_age < 0 means that back buffer is empty
-		if (xd->buffer_age[1 - xd->curr_back] > 0) {
-			xd->buffer_age[1 - xd->curr_back]++;
+		if (xd->buffer_age[1 - back] > 0) {
+			xd->buffer_age[1 - back]++;
 		}
-		if (pcev->mode == XCB_PRESENT_COMPLETE_MODE_FLIP) {
-			// We cannot use the pixmap we used anymore
-			xd->curr_back = 1 - xd->curr_back;
-			xd->back_image.pict = xd->back[xd->curr_back];
-		}
-		free(pev);
+		// The X server might read from the buffer we just presented until the
+		// present completes, so always switch to the other one.
+		xd->curr_back = 1 - back;
+		xd->back_image.pict = xd->back[xd->curr_back];
 	}
-	// Without vsync, we are rendering into the front buffer directly
+	// Without vsync, we are rendering into the front buffer directly, and there is
+	// nothing to present. Either way, the X server is done with this frame once
+	// it processed this request.
+	req->base.sequence = xcb_no_operation(base->c->c).sequence;
+	x_await_request(base->c, &req->base);
+	list_insert_before(&xd->present_requests, &req->siblings);
 	pixman_region32_clear(&xd->back_damaged);
 	return true;
 }
@@ -770,9 +995,25 @@ static int xrender_buffer_age(backend_t *backend_data) {
 		// content is always up to date. So buffer age is always 1.
 		return 1;
 	}
+	xrender_handle_present_events(xd, true);
 	return xd->buffer_age[xd->curr_back];
 }
 
+static bool xrender_last_render_time(backend_t *backend_data, struct timespec *ts) {
+	auto xd = (struct xrender_data *)backend_data;
+	if (!list_is_empty(&xd->present_requests)) {
+		return false;
+	}
+	if (xd->vsync) {
+		// Not needed for the render time, but keeps the buffer states up to
+		// date, so we are less likely to block in `xrender_buffer_age`.
+		xrender_handle_present_events(xd, false);
+	}
+	ts->tv_sec = (long)(xd->last_render_time_ns / 1000000000UL);
+	ts->tv_nsec = (long)(xd->last_render_time_ns % 1000000000UL);
+	return true;
+}
+
 static bool xrender_apply_alpha(struct backend_base *base, image_handle image,
                                 double alpha, const region_t *reg_op) {
 	auto xd = (struct xrender_data *)base;
@@ -837,8 +1078,9 @@ xrender_create_blur_context(backend_t *base attr_unused, enum blur_method method
 	return ret;
 }
 
-static void xrender_destroy_blur_context(backend_t *base attr_unused, void *ctx_) {
+static void xrender_destroy_blur_context(backend_t *base, void *ctx_) {
 	struct xrender_blur_context *ctx = ctx_;
+	xrender_blur_pool_release(base->c, &ctx->pool);
 	for (int i = 0; i < ctx->x_blur_kernel_count; i++) {
 		free(ctx->x_blur_kernel[i]);
 	}
@@ -865,6 +1107,7 @@ static backend_t *xrender_init(session_t *ps, xcb_window_t target) {
 	auto xd = ccalloc(1, struct xrender_data);
 	init_backend_base(&xd->base, ps);
 	xd->base.ops = xrender_ops;
+	list_init_head(&xd->present_requests);
 
 	for (int i = 0; i <= MAX_ALPHA; ++i) {
 		double o = (double)i / (double)MAX_ALPHA;
@@ -940,9 +1183,14 @@ static backend_t *xrender_init(session_t *ps, xcb_window_t target) {
 		}
 	}
 	xd->curr_back = 0;
+	// Assume the worst until we know how presents are done.
+	xd->last_present_flipped = true;
 	xd->back_image.pict = xd->vsync ? xd->back[xd->curr_back] : xd->target;
 
 	xd->quirks |= BACKEND_QUIRK_SLOW_BLUR;
+	if (!xd->vsync) {
+		xd->quirks |= BACKEND_QUIRK_FRONT_BUFFER;
+	}
 
 	return &xd->base;
 err:
@@ -1026,6 +1274,7 @@ const struct backend_operations xrender_ops = {
     .image_capabilities = xrender_image_capabilities,
     .is_format_supported = xrender_is_format_supported,
     .new_image = xrender_new_image,
+    .prepare = xrender_prepare,
     .present = xrender_present,
     .quirks = xrender_quirks,
     .version = xrender_version,
@@ -1037,6 +1286,7 @@ const struct backend_operations xrender_ops = {
     //             `render_shadow`, and `backend_compat_shadow_from_mask` for
     //             `shadow_from_mask`
     .buffer_age = xrender_buffer_age,
+    .last_render_time = xrender_last_render_time,
     .max_buffer_age = xrender_max_buffer_age,
     .create_blur_context = xrender_create_blur_context,
     .destroy_blur_context = xrender_destroy_blur_context,
@@ -0,0 +1,631 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+/// Offline frame replay benchmark.
+///
+/// Feeds a stream of window geometry, stacking and damage events through the CPU side
+/// of the renderer (layout, command building, damage calculation and culling), and
+/// executes the resulting render commands on the dummy backend. No X server or GPU is
+/// needed, so the numbers are repeatable and only reflect picom's own CPU cost.
+///
+/// Usage: frame_replay [--frames <n>] [trace...]
+///
+/// Without trace files, synthetic workloads with 10, 100 and 1000 windows are replayed.
+/// A trace file is plain text, with one event per line. Empty lines and lines starting
+/// with `#` are ignored:
+///
+///     size <width> <height>        screen size, defaults to 3840x2160
+///     map <id> <x> <y> <w> <h>     map a window, new windows are put on top
+///     unmap <id>
+///     move <id> <x> <y>
+///     resize <id> <w> <h>
+///     raise <id>
+///     lower <id>
+///     damage <id> <x> <y> <w> <h>  in window local coordinates
+///     frame                        render a frame
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uthash.h>
+
+#include <picom/backend.h>
+#include <picom/types.h>
+
+#include "backend/backend.h"
+#include "common.h"
+#include "log.h"
+#include "region.h"
+#include "renderer/command_builder.h"
+#include "renderer/damage.h"
+#include "renderer/layout.h"
+#include "renderer/renderer.h"
+#include "utils/dynarr.h"
+#include "utils/misc.h"
+#include "utils/str.h"
+#include "utils/uthash_extra.h"
+#include "wm/win.h"
+#include "wm/wm.h"
+#include "x.h"
+
+enum replay_event_type {
+	REPLAY_EVENT_MAP,
+	REPLAY_EVENT_UNMAP,
+	REPLAY_EVENT_MOVE,
+	REPLAY_EVENT_RESIZE,
+	REPLAY_EVENT_RAISE,
+	REPLAY_EVENT_LOWER,
+	REPLAY_EVENT_DAMAGE,
+	REPLAY_EVENT_FRAME,
+};
+
+struct replay_event {
+	enum replay_event_type type;
+	xcb_window_t id;
+	int x, y, width, height;
+};
+
+struct replay_trace {
+	char *name;
+	ivec2 size;
+	/// Number of `REPLAY_EVENT_FRAME` events.
+	unsigned frames;
+	/// Number of distinct windows
+	unsigned windows;
+	/// List of events, this is a dynarr.
+	struct replay_event *events;
+};
+
+/// Shadow radius of the windows in the replay.
+#define REPLAY_SHADOW_RADIUS 12
+
+/// X IDs only have 29 bits, so this is never going to clash with a window in the trace.
+#define REPLAY_ROOT_WINDOW ((xcb_window_t)0x20000000)
+
+struct replay_window {
+	xcb_window_t id;
+	struct win *w;
+	UT_hash_handle hh;
+};
+
+enum replay_stage {
+	REPLAY_STAGE_LAYOUT,
+	REPLAY_STAGE_COMMANDS,
+	REPLAY_STAGE_DAMAGE,
+	REPLAY_STAGE_CULL,
+	REPLAY_STAGE_EXECUTE,
+	REPLAY_STAGE_TOTAL,
+	NUM_OF_REPLAY_STAGES,
+};
+
+static const char *replay_stage_names[NUM_OF_REPLAY_STAGES] = {
+    [REPLAY_STAGE_LAYOUT] = "layout",     [REPLAY_STAGE_COMMANDS] = "commands",
+    [REPLAY_STAGE_DAMAGE] = "damage",     [REPLAY_STAGE_CULL] = "cull",
+    [REPLAY_STAGE_EXECUTE] = "execute",   [REPLAY_STAGE_TOTAL] = "total",
+};
+
+struct replay {
+	session_t ps;
+	struct backend_base *backend;
+	void *blur_context;
+	/// Only used for the shadow tiles, see `replay_prepare_commands`.
+	struct renderer *renderer;
+	struct wm *wm;
+	struct layout_manager *lm;
+	struct command_builder *cb;
+	struct replay_window *windows;
+	struct window_options default_options;
+	image_handle back_image;
+	image_handle root_image;
+	/// The replay has no X connection, so there are never any monitors.
+	struct x_monitors monitors;
+	/// Culled masks, see `commands_cull_with_damage`. This is a dynarr.
+	region_t *culled_masks;
+	/// Time spent in each stage for each frame, in nanoseconds. These are dynarrs.
+	uint64_t *samples[NUM_OF_REPLAY_STAGES];
+};
+
+static inline uint64_t replay_now_ns(void) {
+	auto now = get_time_timespec();
+	return (uint64_t)now.tv_sec * 1000000000UL + (uint64_t)now.tv_nsec;
+}
+
+/// Simple deterministic PRNG, so synthetic workloads are the same across runs.
+static inline unsigned replay_rand(uint64_t *state) {
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (unsigned)(*state >> 33);
+}
+
+static inline int replay_rand_range(uint64_t *state, int min, int max) {
+	return min + (int)(replay_rand(state) % (unsigned)(max - min));
+}
+
+/// Generate a synthetic workload with `nwindows` windows. Every frame, one window is
+/// being dragged around and a couple of windows update part of their content. Stacking
+/// order changes, and windows get unmapped and mapped again, every once in a while.
+static struct replay_trace replay_trace_synthetic(unsigned nwindows, unsigned nframes) {
+	struct replay_trace trace = {
+	    .name = NULL,
+	    .size = {.width = 3840, .height = 2160},
+	    .frames = nframes,
+	    .windows = nwindows,
+	    .events = dynarr_new(struct replay_event, nwindows + nframes * 4),
+	};
+	casprintf(&trace.name, "synthetic-%u", nwindows);
+	uint64_t seed = nwindows;
+	for (unsigned i = 0; i < nwindows; i++) {
+		struct replay_event ev = {
+		    .type = REPLAY_EVENT_MAP,
+		    .id = i + 1,
+		    .width = replay_rand_range(&seed, 100, 1200),
+		    .height = replay_rand_range(&seed, 100, 900),
+		};
+		ev.x = replay_rand_range(&seed, -ev.width / 2, trace.size.width - ev.width / 2);
+		ev.y = replay_rand_range(&seed, -ev.height / 2, trace.size.height - ev.height / 2);
+		dynarr_push(trace.events, ev);
+	}
+
+	xcb_window_t dragged = nwindows;
+	ivec2 dragged_pos = {.x = 0, .y = 0};
+	for (unsigned i = 0; i < nframes; i++) {
+		if (i % 120 == 0) {
+			dragged = (xcb_window_t)replay_rand_range(&seed, 1, (int)nwindows + 1);
+			dragged_pos = (ivec2){
+			    .x = replay_rand_range(&seed, 0, trace.size.width / 2),
+			    .y = replay_rand_range(&seed, 0, trace.size.height / 2),
+			};
+			dynarr_push(trace.events, ((struct replay_event){
+			                              .type = REPLAY_EVENT_RAISE,
+			                              .id = dragged,
+			                          }));
+		}
+		dragged_pos.x += replay_rand_range(&seed, -8, 9);
+		dragged_pos.y += replay_rand_range(&seed, -8, 9);
+		dynarr_push(trace.events, ((struct replay_event){
+		                              .type = REPLAY_EVENT_MOVE,
+		                              .id = dragged,
+		                              .x = dragged_pos.x,
+		                              .y = dragged_pos.y,
+		                          }));
+		for (int j = 0; j < 2; j++) {
+			dynarr_push(trace.events,
+			            ((struct replay_event){
+			                .type = REPLAY_EVENT_DAMAGE,
+			                .id = (xcb_window_t)replay_rand_range(
+			                    &seed, 1, (int)nwindows + 1),
+			                .x = replay_rand_range(&seed, 0, 100),
+			                .y = replay_rand_range(&seed, 0, 100),
+			                .width = replay_rand_range(&seed, 10, 200),
+			                .height = replay_rand_range(&seed, 10, 50),
+			            }));
+		}
+		if (i % 97 == 96) {
+			auto id = (xcb_window_t)replay_rand_range(&seed, 1, (int)nwindows + 1);
+			dynarr_push(trace.events, ((struct replay_event){
+			                              .type = REPLAY_EVENT_UNMAP,
+			                              .id = id,
+			                          }));
+			dynarr_push(trace.events, ((struct replay_event){
+			                              .type = REPLAY_EVENT_MAP,
+			                              .id = id,
+			                              .x = replay_rand_range(&seed, 0, 1000),
+			                              .y = replay_rand_range(&seed, 0, 1000),
+			                              .width = 800,
+			                              .height = 600,
+			                          }));
+		}
+		dynarr_push(trace.events, ((struct replay_event){.type = REPLAY_EVENT_FRAME}));
+	}
+	return trace;
+}
+
+static bool replay_trace_load(const char *path, struct replay_trace *trace) {
+	*trace = (struct replay_trace){
+	    .name = strdup(path),
+	    .size = {.width = 3840, .height = 2160},
+	    .events = dynarr_new(struct replay_event, 128),
+	};
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		log_error("Failed to open trace file %s", path);
+		return false;
+	}
+
+	char *line = NULL;
+	size_t line_cap = 0;
+	unsigned lineno = 0;
+	xcb_window_t max_id = 0;
+	bool ret = true;
+	while (getline(&line, &line_cap, f) != -1) {
+		lineno++;
+		char verb[16];
+		struct replay_event ev = {};
+		int n = sscanf(line, "%15s %u %d %d %d %d", verb, &ev.id, &ev.x, &ev.y,
+		               &ev.width, &ev.height);
+		if (n <= 0 || verb[0] == '#') {
+			continue;
+		}
+		int expected = 2;
+		if (strcmp(verb, "size") == 0) {
+			if (sscanf(line, "%15s %d %d", verb, &trace->size.width,
+			           &trace->size.height) != 3) {
+				expected = 3;
+				n = 0;
+			}
+			goto check;
+		}
+		if (strcmp(verb, "map") == 0) {
+			ev.type = REPLAY_EVENT_MAP;
+			expected = 6;
+		} else if (strcmp(verb, "unmap") == 0) {
+			ev.type = REPLAY_EVENT_UNMAP;
+		} else if (strcmp(verb, "move") == 0) {
+			ev.type = REPLAY_EVENT_MOVE;
+			expected = 4;
+		} else if (strcmp(verb, "resize") == 0) {
+			ev.type = REPLAY_EVENT_RESIZE;
+			ev.width = ev.x;
+			ev.height = ev.y;
+			expected = 4;
+		} else if (strcmp(verb, "raise") == 0) {
+			ev.type = REPLAY_EVENT_RAISE;
+		} else if (strcmp(verb, "lower") == 0) {
+			ev.type = REPLAY_EVENT_LOWER;
+		} else if (strcmp(verb, "damage") == 0) {
+			ev.type = REPLAY_EVENT_DAMAGE;
+			expected = 6;
+		} else if (strcmp(verb, "frame") == 0) {
+			ev.type = REPLAY_EVENT_FRAME;
+			expected = 1;
+			trace->frames++;
+		} else {
+			log_error("%s:%u: unknown event \"%s\"", path, lineno, verb);
+			ret = false;
+			break;
+		}
+	check:
+		if (n < expected) {
+			log_error("%s:%u: expected %d fields, got %d", path, lineno,
+			          expected, n);
+			ret = false;
+			break;
+		}
+		if (strcmp(verb, "size") == 0) {
+			continue;
+		}
+		if (ev.type != REPLAY_EVENT_FRAME &&
+		    (ev.id == XCB_NONE || ev.id >= REPLAY_ROOT_WINDOW)) {
+			log_error("%s:%u: invalid window id", path, lineno);
+			ret = false;
+			break;
+		}
+		max_id = max2(max_id, ev.id);
+		dynarr_push(trace->events, ev);
+	}
+	trace->windows = max_id;
+	free(line);
+	fclose(f);
+	return ret;
+}
+
+static void replay_trace_free(struct replay_trace *trace) {
+	free(trace->name);
+	dynarr_free_pod(trace->events);
+}
+
+static void replay_window_set_geometry(struct win *w, int x, int y, int width, int height) {
+	w->g = (struct win_geometry){
+	    .x = (int16_t)x,
+	    .y = (int16_t)y,
+	    .width = (uint16_t)max2(width, 1),
+	    .height = (uint16_t)max2(height, 1),
+	};
+	w->widthb = w->g.width;
+	w->heightb = w->g.height;
+	pixman_region32_fini(&w->bounding_shape);
+	pixman_region32_init_rect(&w->bounding_shape, 0, 0, (unsigned)w->widthb,
+	                          (unsigned)w->heightb);
+	w->shadow_dx = w->shadow_dy = -15;
+	w->shadow_width = w->widthb + REPLAY_SHADOW_RADIUS * 2;
+	w->shadow_height = w->heightb + REPLAY_SHADOW_RADIUS * 2;
+	win_mark_layout_dirty(w);
+}
+
+static struct win *replay_window_get(struct replay *r, xcb_window_t id) {
+	struct replay_window *rw = NULL;
+	HASH_FIND_INT(r->windows, &id, rw);
+	if (rw != NULL) {
+		return rw->w;
+	}
+
+	auto w = ccalloc(1, struct win);
+	w->tree_ref = wm_new_mock_toplevel(r->wm, id);
+	wm_ref_set(w->tree_ref, w);
+	w->state = WSTATE_UNMAPPED;
+	w->options = WIN_MAYBE_OPTIONS_DEFAULT;
+	w->options_override = WIN_MAYBE_OPTIONS_DEFAULT;
+	w->options_default = &r->default_options;
+	w->frame_opacity = 1;
+	w->shadow_opacity = 0.75;
+	// Mix in some translucent and blurred windows, so all the command types are
+	// exercised.
+	w->opacity = id % 4 == 0 ? 0.8 : 1;
+	if (id % 8 == 4) {
+		w->options.blur_background = TRI_TRUE;
+	}
+	pixman_region32_init(&w->bounding_shape);
+	pixman_region32_init(&w->damaged);
+	w->win_image = r->backend->ops.new_image(r->backend, BACKEND_IMAGE_FORMAT_PIXMAP,
+	                                         (ivec2){1, 1});
+	w->shadow_image = r->backend->ops.new_image(
+	    r->backend, BACKEND_IMAGE_FORMAT_PIXMAP, (ivec2){1, 1});
+
+	rw = ccalloc(1, struct replay_window);
+	rw->id = id;
+	rw->w = w;
+	HASH_ADD_INT(r->windows, id, rw);
+	return w;
+}
+
+static void replay_apply_event(struct replay *r, const struct replay_event *ev) {
+	auto w = replay_window_get(r, ev->id);
+	switch (ev->type) {
+	case REPLAY_EVENT_MAP:
+		replay_window_set_geometry(w, ev->x, ev->y, ev->width, ev->height);
+		w->state = WSTATE_MAPPED;
+		w->ever_damaged = true;
+		wm_stack_move_to_end(r->wm, w->tree_ref, false);
+		break;
+	case REPLAY_EVENT_UNMAP:
+		w->state = WSTATE_UNMAPPED;
+		w->ever_damaged = false;
+		win_mark_layout_dirty(w);
+		break;
+	case REPLAY_EVENT_MOVE:
+		replay_window_set_geometry(w, ev->x, ev->y, w->g.width, w->g.height);
+		break;
+	case REPLAY_EVENT_RESIZE:
+		replay_window_set_geometry(w, w->g.x, w->g.y, ev->width, ev->height);
+		break;
+	case REPLAY_EVENT_RAISE: wm_stack_move_to_end(r->wm, w->tree_ref, false); break;
+	case REPLAY_EVENT_LOWER: wm_stack_move_to_end(r->wm, w->tree_ref, true); break;
+	case REPLAY_EVENT_DAMAGE:
+		pixman_region32_union_rect(&w->damaged, &w->damaged, ev->x, ev->y,
+		                           (unsigned)ev->width, (unsigned)ev->height);
+		break;
+	case REPLAY_EVENT_FRAME:
+	default: unreachable();
+	}
+	while (wm_dequeue_change(r->wm).type != WM_TREE_CHANGE_NONE) {
+	}
+}
+
+/// Fill in the source images of the render commands, like `renderer_prepare_commands`.
+/// Windows in the replay always have their images ready, slices of nine-slice shadows
+/// use the renderer's shadow tiles.
+static bool replay_prepare_commands(struct replay *r, struct layout *layout) {
+	layout->commands[0].copy_area.source_image = r->root_image;
+
+	auto layer = layout->layers - 1;
+	auto layer_end = &layout->commands[layout->first_layer_start];
+	auto end = &layout->commands[layout->number_of_commands];
+	for (auto cmd = &layout->commands[1]; cmd != end; cmd++) {
+		if (cmd == layer_end) {
+			layer += 1;
+			layer_end = cmd + layer->number_of_commands;
+		}
+		if (cmd->op == BACKEND_COMMAND_BLUR) {
+			cmd->blur.blur_context = r->blur_context;
+			cmd->blur.source_image = r->back_image;
+		} else if (cmd->source == BACKEND_COMMAND_SOURCE_SHADOW) {
+			cmd->blit.source_image = layer->win->shadow_image;
+		} else if (backend_command_source_is_shadow(cmd->source)) {
+			auto corner_radius = layer->options.corner_radius;
+			if (!renderer_prepare_shadow_slice(r->renderer, r->backend,
+			                                   corner_radius, cmd)) {
+				return false;
+			}
+		} else {
+			cmd->blit.source_image = layer->win->win_image;
+		}
+	}
+	return true;
+}
+
+static void replay_render_frame(struct replay *r, ivec2 size) {
+	uint64_t t[NUM_OF_REPLAY_STAGES + 1];
+	ivec2 blur_size = {};
+	r->backend->ops.get_blur_size(r->blur_context, &blur_size.width, &blur_size.height);
+
+	t[0] = replay_now_ns();
+	layout_manager_append_layout(r->lm, r->wm, 0, size);
+	t[1] = replay_now_ns();
+
+	auto layout = layout_manager_layout(r->lm, 0);
+	auto prev_layout = layout_manager_max_buffer_age(r->lm) > 0
+	                       ? layout_manager_layout(r->lm, 1)
+	                       : NULL;
+	command_builder_build(r->cb, layout, prev_layout, false, false, false, 1.0,
+	                      &r->monitors, NULL);
+	t[2] = replay_now_ns();
+
+	region_t damage;
+	pixman_region32_init_rect(&damage, 0, 0, (unsigned)size.width, (unsigned)size.height);
+	auto buffer_age = r->backend->ops.buffer_age(r->backend);
+	if (buffer_age > 0 && (unsigned)buffer_age <= layout_manager_max_buffer_age(r->lm)) {
+		layout_manager_damage(r->lm, (unsigned)buffer_age, blur_size, &damage,
+		                      NULL);
+	}
+	t[3] = replay_now_ns();
+
+	dynarr_resize(r->culled_masks, layout->number_of_commands, pixman_region32_init,
+	              pixman_region32_fini);
+	commands_cull_with_damage(layout, &damage, blur_size, NULL, r->culled_masks);
+	t[4] = replay_now_ns();
+
+	if (!replay_prepare_commands(r, layout)) {
+		log_error("Failed to prepare render commands");
+	} else if (!backend_execute(r->backend, r->back_image,
+	                            layout->number_of_commands, layout->commands)) {
+		log_error("Failed to execute render commands");
+	}
+	commands_uncull(layout);
+	t[5] = replay_now_ns();
+	pixman_region32_fini(&damage);
+
+	for (int i = 0; i < REPLAY_STAGE_TOTAL; i++) {
+		dynarr_push(r->samples[i], t[i + 1] - t[i]);
+	}
+	dynarr_push(r->samples[REPLAY_STAGE_TOTAL], t[REPLAY_STAGE_TOTAL] - t[0]);
+}
+
+static int replay_compare_samples(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void replay_report(struct replay *r, const struct replay_trace *trace) {
+	printf("%s: %u windows, %u frames\n", trace->name, trace->windows, trace->frames);
+	printf("  %-10s %12s %12s %12s\n", "stage", "p50 (us)", "p99 (us)", "max (us)");
+	for (int i = 0; i < NUM_OF_REPLAY_STAGES; i++) {
+		auto samples = r->samples[i];
+		auto n = dynarr_len(samples);
+		if (n == 0) {
+			continue;
+		}
+		qsort(samples, n, sizeof(*samples), replay_compare_samples);
+		printf("  %-10s %12.2f %12.2f %12.2f\n", replay_stage_names[i],
+		       (double)samples[n / 2] / 1000., (double)samples[n * 99 / 100] / 1000.,
+		       (double)samples[n - 1] / 1000.);
+	}
+}
+
+static bool replay_init(struct replay *r) {
+	auto info = backend_find("dummy");
+	if (info == NULL) {
+		log_error("Dummy backend is not available");
+		return false;
+	}
+	r->backend = backend_init(info, &r->ps, XCB_NONE);
+	if (r->backend == NULL) {
+		return false;
+	}
+	r->blur_context = r->backend->ops.create_blur_context(
+	    r->backend, BLUR_METHOD_GAUSSIAN, BACKEND_IMAGE_FORMAT_PIXMAP, NULL);
+	r->renderer = renderer_new(r->backend, REPLAY_SHADOW_RADIUS,
+	                           (struct color){.alpha = 0.75}, false);
+	if (r->renderer == NULL) {
+		log_error("Failed to create the renderer");
+		r->backend->ops.destroy_blur_context(r->backend, r->blur_context);
+		r->backend->ops.deinit(r->backend);
+		return false;
+	}
+	r->back_image = r->backend->ops.new_image(r->backend, BACKEND_IMAGE_FORMAT_PIXMAP,
+	                                          (ivec2){1, 1});
+	r->root_image = r->backend->ops.new_image(r->backend, BACKEND_IMAGE_FORMAT_PIXMAP,
+	                                          (ivec2){1, 1});
+	r->default_options = (struct window_options){
+	    .opacity = 1,
+	    .dim = 0,
+	    .shader = NULL,
+	    .corner_radius = 0,
+	    .unredir = WINDOW_UNREDIR_WHEN_POSSIBLE_ELSE_TERMINATE,
+	    .transparent_clipping = false,
+	    .shadow = true,
+	    .invert_color = false,
+	    .blur_background = false,
+	    .fade = false,
+	    .clip_shadow_above = false,
+	    .paint = true,
+	    .full_shadow = false,
+	};
+	r->wm = wm_new();
+	wm_new_mock_root(r->wm, REPLAY_ROOT_WINDOW);
+	r->lm = layout_manager_new((unsigned)r->backend->ops.max_buffer_age(r->backend));
+	r->cb = command_builder_new();
+	r->monitors = (struct x_monitors){};
+	r->culled_masks = dynarr_new(region_t, 0);
+	for (int i = 0; i < NUM_OF_REPLAY_STAGES; i++) {
+		r->samples[i] = dynarr_new(uint64_t, 0);
+	}
+	return true;
+}
+
+static void replay_deinit(struct replay *r) {
+	layout_manager_free(r->lm);
+	command_builder_free(r->cb);
+	dynarr_free(r->culled_masks, pixman_region32_fini);
+	for (int i = 0; i < NUM_OF_REPLAY_STAGES; i++) {
+		dynarr_free_pod(r->samples[i]);
+	}
+	HASH_ITER2(r->windows, rw) {
+		auto w = rw->w;
+		r->backend->ops.release_image(r->backend, w->win_image);
+		r->backend->ops.release_image(r->backend, w->shadow_image);
+		pixman_region32_fini(&w->bounding_shape);
+		pixman_region32_fini(&w->damaged);
+		HASH_DEL(r->windows, rw);
+		free(rw);
+	}
+	// `wm_free` frees the `struct win`s for us.
+	wm_free(r->wm);
+	r->backend->ops.release_image(r->backend, r->back_image);
+	r->backend->ops.release_image(r->backend, r->root_image);
+	renderer_free(r->backend, r->renderer);
+	r->backend->ops.destroy_blur_context(r->backend, r->blur_context);
+	r->backend->ops.deinit(r->backend);
+}
+
+static bool replay_run(const struct replay_trace *trace) {
+	struct replay r = {};
+	if (!replay_init(&r)) {
+		return false;
+	}
+	for (size_t i = 0; i < dynarr_len(trace->events); i++) {
+		auto ev = &trace->events[i];
+		if (ev->type == REPLAY_EVENT_FRAME) {
+			replay_render_frame(&r, trace->size);
+		} else {
+			replay_apply_event(&r, ev);
+		}
+	}
+	replay_report(&r, trace);
+	replay_deinit(&r);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	unsigned frames = 1000;
+	int first_trace = 1;
+	if (argc > 2 && strcmp(argv[1], "--frames") == 0) {
+		int n = atoi(argv[2]);
+		if (n <= 0) {
+			fprintf(stderr, "Invalid number of frames: %s\n", argv[2]);
+			return 1;
+		}
+		frames = (unsigned)n;
+		first_trace = 3;
+	}
+
+	bool success = true;
+	if (first_trace >= argc) {
+		static const unsigned window_counts[] = {10, 100, 1000};
+		for (size_t i = 0; i < ARR_SIZE(window_counts); i++) {
+			auto trace = replay_trace_synthetic(window_counts[i], frames);
+			success = replay_run(&trace) && success;
+			replay_trace_free(&trace);
+		}
+		return success ? 0 : 1;
+	}
+	for (int i = first_trace; i < argc; i++) {
+		struct replay_trace trace;
+		if (replay_trace_load(argv[i], &trace)) {
+			success = replay_run(&trace) && success;
+		} else {
+			success = false;
+		}
+		replay_trace_free(&trace);
+	}
+	return success ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+/// Micro benchmarks of self-contained hot paths, timing optimized implementations
+/// against the straightforward ones they replace. Their results are checked to be the
+/// same by the unit tests, this only reports the timings.
+///
+/// Usage: micro_benchmark [--iterations <n>]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atom.h"
+#include "backend/backend_common.h"
+#include "c2.h"
+#include "common.h"
+#include "utils/kernel.h"
+#include "utils/list.h"
+#include "utils/misc.h"
+#include "wm/win.h"
+#include "wm/wm.h"
+
+static inline uint64_t micro_now_ns(void) {
+	auto now = get_time_timespec();
+	return (uint64_t)now.tv_sec * 1000000000UL + (uint64_t)now.tv_nsec;
+}
+
+/// Match many rules sharing a few leaves, like a configuration with rules for the same
+/// handful of applications in many options, by walking the condition trees and by
+/// running the compiled programs.
+static bool micro_c2_match(int iterations) {
+	const int number_of_rules = 128;
+	bool deprecated = false;
+	struct list_node list;
+	list_init_head(&list);
+	for (int i = 0; i < number_of_rules; i++) {
+		char rule[256];
+		snprintf(rule, sizeof(rule),
+		         "(class_g = \"App%d\" || name ^= \"App%d\") && !focused && "
+		         "window_type = \"normal\"",
+		         i % 16, i);
+		if (c2_parse(&list, rule, NULL, &deprecated) == NULL) {
+			c2_list_free(&list, NULL);
+			return false;
+		}
+	}
+
+	struct atom *atoms = init_mock_atoms();
+	struct c2_state *state = c2_state_new(atoms);
+	if (!c2_list_postprocess(state, NULL, &list)) {
+		c2_list_free(&list, NULL);
+		c2_state_free(state);
+		destroy_atoms(atoms);
+		return false;
+	}
+
+	struct wm *wm = wm_new();
+	struct win w = {
+	    .name = "App100 - Document",
+	    .class_general = "App4",
+	    .window_types = 1 << WINTYPE_NORMAL,
+	    .tree_ref = wm_new_mock_window(wm, 1),
+	};
+	size_t results_size = c2_state_slot_count(state) + 1;
+	auto results = ccalloc(results_size, uint8_t);
+	int tree_matches = 0, program_matches = 0;
+
+	auto start = micro_now_ns();
+	for (int n = 0; n < iterations; n++) {
+		c2_condition_list_foreach(&list, i) {
+			tree_matches += c2_match_tree(state, &w, i);
+		}
+	}
+	auto tree_time = micro_now_ns() - start;
+	start = micro_now_ns();
+	for (int n = 0; n < iterations; n++) {
+		// Start with nothing cached every time, only leaves shared between rules
+		// are reused.
+		memset(results, 0, results_size);
+		c2_condition_list_foreach(&list, i) {
+			program_matches += c2_match_program(state, &w, results, i);
+		}
+	}
+	auto program_time = micro_now_ns() - start;
+
+	printf("c2 match: tree walk %.1f ns/rule, compiled %.1f ns/rule\n",
+	       (double)tree_time / (iterations * number_of_rules),
+	       (double)program_time / (iterations * number_of_rules));
+
+	free(results);
+	c2_list_free(&list, NULL);
+	c2_state_free(state);
+	destroy_atoms(atoms);
+	wm_free_mock_window(wm, w.tree_ref);
+	wm_free(wm);
+	return tree_matches == program_matches;
+}
+
+/// Generate the shadows of windows smaller than, around, and much larger than the
+/// shadow kernel, with the straightforward implementation and with `shadow_fill`.
+static bool micro_shadow_fill(int iterations) {
+	const ivec2 sizes[] = {{4, 4},     {4, 300},   {300, 4},
+	                       {30, 30},   {400, 300}, {1920, 1080}};
+	auto kernel = gaussian_kernel_autodetect_deviation(12);
+	sum_kernel_preprocess(kernel);
+	int d = kernel->w;
+	for (size_t i = 0; i < ARR_SIZE(sizes); i++) {
+		int swidth = sizes[i].width + d - 1, sheight = sizes[i].height + d - 1;
+		auto data = ccalloc(swidth * sheight, uint8_t);
+
+		auto start = micro_now_ns();
+		for (int j = 0; j < iterations; j++) {
+			backend_shadow_fill_reference(data, (size_t)swidth, kernel, 0.75,
+			                              sizes[i].width, sizes[i].height);
+		}
+		auto reference_time = micro_now_ns() - start;
+		start = micro_now_ns();
+		for (int j = 0; j < iterations; j++) {
+			backend_shadow_fill(data, (size_t)swidth, kernel, 0.75,
+			                    sizes[i].width, sizes[i].height);
+		}
+		auto time = micro_now_ns() - start;
+		printf("shadow fill %dx%d: reference %.1f us, shadow_fill %.1f us\n",
+		       sizes[i].width, sizes[i].height,
+		       (double)reference_time / iterations / 1000,
+		       (double)time / iterations / 1000);
+		free(data);
+	}
+	free_conv(kernel);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	int iterations = 1000;
+	if (argc > 2 && strcmp(argv[1], "--iterations") == 0) {
+		iterations = atoi(argv[2]);
+		if (iterations <= 0) {
+			fprintf(stderr, "Invalid number of iterations: %s\n", argv[2]);
+			return 1;
+		}
+	}
+
+	bool success = micro_c2_match(iterations);
+	success = micro_shadow_fill(iterations) && success;
+	return success ? 0 : 1;
+}
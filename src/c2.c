@@ -27,6 +27,7 @@
 #include "compiler.h"
 #include "log.h"
 #include "test.h"
+#include "utils/dynarr.h"
 #include "utils/str.h"
 #include "utils/uthash_extra.h"
 #include "wm/win.h"
@@ -69,12 +70,39 @@ struct c2_tracked_property {
 	UT_hash_handle hh;
 	struct c2_tracked_property_key key;
 	unsigned int id;
+	/// Result slots of the conditions and leaves that use this property, a dynarr.
+	/// A window's cached results in these slots are invalidated when this property
+	/// changes.
+	unsigned int *dependents;
+};
+
+/// A condition tree node interned by its string representation.
+struct c2_interned_node {
+	UT_hash_handle hh;
+	char *key;
+	unsigned int slot;
 };
 
 struct c2_state {
 	struct c2_tracked_property *tracked_properties;
 	struct atom *atoms;
-	xcb_get_property_cookie_t *cookies;
+	/// Conditions and leaves seen during post-processing, identical ones share a
+	/// result slot.
+	struct c2_interned_node *interned_nodes;
+	/// Number of result slots assigned. Slots are numbered from 1.
+	unsigned int slot_count;
+	/// Bitmask of the predefined targets used by any condition.
+	uint32_t used_predefs;
+	/// For each predefined target, result slots of the conditions and leaves that
+	/// use it, a dynarr.
+	unsigned int *predef_dependents[32];
+};
+
+/// Result of a condition cached in `struct c2_window_state::results`.
+enum c2_cached_result {
+	C2_RESULT_UNKNOWN = 0,
+	C2_RESULT_FALSE,
+	C2_RESULT_TRUE,
 };
 
 // TODO(yshui) this has some overlap with winprop_t, consider merging them.
@@ -104,6 +132,8 @@ struct c2_property_value {
 		C2_PROPERTY_TYPE_NONE,
 	} type;
 	bool valid;
+	/// The property changed and its new value needs to be fetched. The old value is
+	/// used for matching until the new one arrives.
 	bool needs_update;
 };
 
@@ -193,7 +223,16 @@ struct c2_condition_node_leaf {
 		C2_L_PTINT,
 	} ptntype;
 	char *ptnstr;
+	/// Length of `ptnstr`.
+	size_t ptnlen;
 	long ptnint;
+	/// For `window_type` string patterns, the window types whose names match the
+	/// pattern. Only valid if `wintypes_resolved` is set.
+	uint32_t wintypes;
+	bool wintypes_resolved;
+	/// Slot of this leaf's result in the per-window result cache, shared by all
+	/// identical leaves. 0 if not assigned.
+	unsigned int slot;
 #ifdef CONFIG_REGEX_PCRE
 	pcre2_code *regex_pcre;
 	pcre2_match_data *regex_pcre_match;
@@ -217,11 +256,62 @@ static const c2_condition_node_leaf C2_LEAF_NODE_INIT = {
     .target_id = C2_L_INVALID_TARGET_ID,
 };
 
+/// Maximum stack depth of a compiled condition, i.e. how deeply XOR operators can be
+/// nested.
+#define C2_PROGRAM_MAX_STACK 16
+
+/// Opcodes of compiled conditions. A program computes its result in a single boolean
+/// register. AND and OR are turned into conditional jumps, so they short-circuit the
+/// same way c2_match_once does.
+enum c2_opcode {
+	/// Set the register to the result of `leaf`, negated if `neg` is set.
+	C2_OP_LEAF,
+	/// Set the register to true.
+	C2_OP_TRUE,
+	/// Negate the register.
+	C2_OP_NOT,
+	/// Continue at `target` if the register is true.
+	C2_OP_JUMP_IF_TRUE,
+	/// Continue at `target` if the register is false.
+	C2_OP_JUMP_IF_FALSE,
+	/// Push the register onto the stack.
+	C2_OP_PUSH,
+	/// Pop a value from the stack and xor it into the register.
+	C2_OP_POP_XOR,
+};
+
+struct c2_instruction {
+	enum c2_opcode op;
+	bool neg;
+	union {
+		c2_condition_node_leaf *leaf;
+		unsigned int target;
+	};
+};
+
 /// Linked list type of conditions.
 struct c2_condition {
 	c2_condition_node_ptr root;
 	void *data;
 	struct list_node siblings;
+	/// Index of this condition's result in the per-window result cache, assigned
+	/// during post-processing and shared by identical conditions. 0 if the condition
+	/// hasn't been post-processed, its results are not cached.
+	unsigned int slot;
+	/// `root` compiled into a flat program, a dynarr. NULL if the condition hasn't
+	/// been post-processed, or couldn't be compiled.
+	struct c2_instruction *program;
+};
+
+static_assert(C2_L_PROLE < 32, "Too many predefined targets for c2_state::used_predefs");
+
+/// Last seen values of the predefined targets of a window, used to find out which
+/// ones have changed since the last match.
+struct c2_predef_values {
+	/// Bitmask of the predefined targets that have a value recorded here.
+	uint32_t known;
+	int64_t numbers[C2_L_PROLE + 1];
+	char *strings[C2_L_PROLE + 1];
 };
 
 // clang-format off
@@ -335,6 +425,12 @@ static size_t c2_condition_node_to_str(c2_condition_node_ptr p, char *output, si
 static const char *c2_condition_node_to_str2(c2_condition_node_ptr ptr);
 static bool
 c2_tree_postprocess(struct c2_state *state, xcb_connection_t *c, c2_condition_node_ptr node);
+static void c2_window_state_check_predefs(const struct c2_state *state, struct win *w);
+static bool c2_string_op(const c2_condition_node_leaf *leaf, const char *target);
+static bool c2_match_once(const struct c2_state *state, const struct win *w,
+                          const c2_condition_node_ptr node);
+static bool c2_program_run(const struct c2_state *state, const struct win *w,
+                           uint8_t *results, const struct c2_instruction *program);
 
 /**
  * Wrapper of c2_free().
@@ -565,6 +661,145 @@ TEST_CASE(c2_parse) {
 	wm_free(wm);
 }
 
+TEST_CASE(c2_match_cache) {
+	bool deprecated = false;
+	struct list_node list;
+	list_init_head(&list);
+	auto by_name = c2_parse(&list, "name = \"xterm\"", NULL, &deprecated);
+	auto by_focus = c2_parse(&list, "focused", NULL, &deprecated);
+	TEST_NOTEQUAL(by_name, NULL);
+	TEST_NOTEQUAL(by_focus, NULL);
+
+	struct atom *atoms = init_mock_atoms();
+	struct c2_state *state = c2_state_new(atoms);
+	TEST_TRUE(c2_list_postprocess(state, NULL, &list));
+	TEST_EQUAL(state->slot_count, 2);
+
+	struct wm *wm = wm_new();
+	char name[] = "xterm";
+	struct win test_win = {
+	    .name = name,
+	    .tree_ref = wm_new_mock_window(wm, 1),
+	};
+	c2_window_state_init(state, &test_win.c2_state);
+	TEST_TRUE(c2_match(state, &test_win, &list, NULL));
+	TEST_EQUAL(test_win.c2_state.results[by_name->slot], C2_RESULT_TRUE);
+	TEST_EQUAL(test_win.c2_state.results[by_focus->slot], C2_RESULT_FALSE);
+
+	// Changing the name in place must still invalidate the cached result.
+	name[0] = 'y';
+	TEST_TRUE(!c2_match(state, &test_win, &list, NULL));
+	TEST_EQUAL(test_win.c2_state.results[by_name->slot], C2_RESULT_FALSE);
+
+	// Focus change only invalidates the condition using it.
+	test_win.a.map_state = XCB_MAP_STATE_VIEWABLE;
+	test_win.is_focused = true;
+	c2_window_state_check_predefs(state, &test_win);
+	TEST_EQUAL(test_win.c2_state.results[by_name->slot], C2_RESULT_FALSE);
+	TEST_EQUAL(test_win.c2_state.results[by_focus->slot], C2_RESULT_UNKNOWN);
+	TEST_TRUE(c2_match(state, &test_win, &list, NULL));
+
+	c2_window_state_destroy(state, &test_win.c2_state);
+	c2_list_free(&list, NULL);
+	c2_state_free(state);
+	destroy_atoms(atoms);
+	wm_free_mock_window(wm, test_win.tree_ref);
+	wm_free(wm);
+}
+
+TEST_CASE(c2_window_state_sync) {
+	bool deprecated = false;
+	struct list_node list, new_list;
+	list_init_head(&list);
+	list_init_head(&new_list);
+	auto by_name = c2_parse(&list, "name = \"xterm\"", NULL, &deprecated);
+	TEST_NOTEQUAL(by_name, NULL);
+
+	struct atom *atoms = init_mock_atoms();
+	struct c2_state *state = c2_state_new(atoms);
+	TEST_TRUE(c2_list_postprocess(state, NULL, &list));
+
+	struct wm *wm = wm_new();
+	char name[] = "xterm";
+	struct win test_win = {
+	    .name = name,
+	    .tree_ref = wm_new_mock_window(wm, 1),
+	};
+	c2_window_state_init(state, &test_win.c2_state);
+	TEST_TRUE(c2_match(state, &test_win, &list, NULL));
+
+	// Like a configuration reload, the same condition is parsed again along with a
+	// new one.
+	auto same_name = c2_parse(&new_list, "name = \"xterm\"", NULL, &deprecated);
+	auto by_class = c2_parse(&new_list, "class_g = \"XTerm\"", NULL, &deprecated);
+	TEST_NOTEQUAL(same_name, NULL);
+	TEST_NOTEQUAL(by_class, NULL);
+	TEST_TRUE(c2_list_postprocess(state, NULL, &new_list));
+	TEST_EQUAL(same_name->slot, by_name->slot);
+	TEST_EQUAL(state->slot_count, 2);
+
+	c2_window_state_sync(state, &test_win.c2_state);
+	TEST_EQUAL(test_win.c2_state.slot_count, 2);
+	TEST_EQUAL(test_win.c2_state.results[same_name->slot], C2_RESULT_TRUE);
+	TEST_EQUAL(test_win.c2_state.results[by_class->slot], C2_RESULT_UNKNOWN);
+	TEST_TRUE(c2_match(state, &test_win, &new_list, NULL));
+
+	c2_window_state_destroy(state, &test_win.c2_state);
+	c2_list_free(&list, NULL);
+	c2_list_free(&new_list, NULL);
+	c2_state_free(state);
+	destroy_atoms(atoms);
+	wm_free_mock_window(wm, test_win.tree_ref);
+	wm_free(wm);
+}
+
+TEST_CASE(c2_match_program_equivalence) {
+	// Many rules sharing a few leaves, so the compiled programs reuse the results of
+	// shared subexpressions. See benchmark/micro.c for timing this.
+	const int number_of_rules = 128;
+	bool deprecated = false;
+	struct list_node list;
+	list_init_head(&list);
+	for (int i = 0; i < number_of_rules; i++) {
+		char rule[256];
+		snprintf(rule, sizeof(rule),
+		         "(class_g = \"App%d\" || name ^= \"App%d\") && !focused && "
+		         "window_type = \"normal\"",
+		         i % 16, i);
+		TEST_NOTEQUAL(c2_parse(&list, rule, NULL, &deprecated), NULL);
+	}
+
+	struct atom *atoms = init_mock_atoms();
+	struct c2_state *state = c2_state_new(atoms);
+	TEST_TRUE(c2_list_postprocess(state, NULL, &list));
+
+	struct wm *wm = wm_new();
+	struct win test_win = {
+	    .name = "App100 - Document",
+	    .class_general = "App4",
+	    .window_types = 1 << WINTYPE_NORMAL,
+	    .tree_ref = wm_new_mock_window(wm, 1),
+	};
+	auto results = ccalloc(state->slot_count + 1, uint8_t);
+	int matches = 0;
+	list_foreach(c2_condition, i, &list, siblings) {
+		TEST_NOTEQUAL(i->program, NULL);
+		bool matched = c2_match_once(state, &test_win, i->root);
+		bool program_matched =
+		    c2_program_run(state, &test_win, results, i->program);
+		TEST_EQUAL(program_matched, matched);
+		matches += matched;
+	}
+	TEST_EQUAL(matches, 10);
+
+	free(results);
+	c2_list_free(&list, NULL);
+	c2_state_free(state);
+	destroy_atoms(atoms);
+	wm_free_mock_window(wm, test_win.tree_ref);
+	wm_free(wm);
+}
+
 #define c2_error(format, ...)                                                                \
 	do {                                                                                 \
 		log_error("Pattern \"%s\" pos %d: " format, pattern, offset, ##__VA_ARGS__); \
@@ -1105,6 +1340,7 @@ static int c2_parse_pattern(const char *pattern, int offset, c2_condition_node_p
 		++offset;
 		*ptptnstr = '\0';
 		pleaf->ptnstr = strdup(tptnstr);
+		pleaf->ptnlen = strlen(pleaf->ptnstr);
 		free(tptnstr);
 	}
 
@@ -1188,6 +1424,7 @@ static int c2_parse_legacy(const char *pattern, int offset, c2_condition_node_pt
 
 	// Copy the pattern
 	pleaf->ptnstr = strdup(pattern + offset);
+	pleaf->ptnlen = strlen(pleaf->ptnstr);
 
 	return offset;
 
@@ -1272,6 +1509,18 @@ c2_l_postprocess(struct c2_state *state, xcb_connection_t *c, c2_condition_node_
 #endif
 	}
 
+	// Names of the window types are constants, so which of them match the pattern
+	// can be decided now.
+	if (pleaf->predef == C2_L_PWINDOWTYPE && pleaf->ptntype == C2_L_PTSTRING) {
+		pleaf->wintypes = 0;
+		for (unsigned i = 0; i < NUM_WINTYPES; i++) {
+			if (c2_string_op(pleaf, WINTYPES[i].name)) {
+				pleaf->wintypes |= 1U << i;
+			}
+		}
+		pleaf->wintypes_resolved = true;
+	}
+
 	return true;
 }
 
@@ -1287,11 +1536,193 @@ c2_tree_postprocess(struct c2_state *state, xcb_connection_t *c, c2_condition_no
 	}
 }
 
+/// Find the result slot of `node`, allocating a new one if no identical node has
+/// been seen before. Nodes are identified by their string representation. Returns
+/// true if the slot is newly allocated.
+static bool
+c2_intern_node(struct c2_state *state, c2_condition_node_ptr node, unsigned int *slot) {
+	char key[4096];
+	auto len = c2_condition_node_to_str(node, key, sizeof(key));
+	if (len >= sizeof(key)) {
+		// Too long to be used as a key, don't share its slot.
+		*slot = ++state->slot_count;
+		return true;
+	}
+	key[len] = '\0';
+
+	struct c2_interned_node *interned;
+	HASH_FIND_STR(state->interned_nodes, key, interned);
+	if (interned) {
+		*slot = interned->slot;
+		return false;
+	}
+	interned = cmalloc(struct c2_interned_node);
+	interned->key = strdup(key);
+	interned->slot = ++state->slot_count;
+	HASH_ADD_KEYPTR(hh, state->interned_nodes, interned->key, len, interned);
+	*slot = interned->slot;
+	return true;
+}
+
+static void c2_add_dependent(unsigned int **dependents, unsigned int slot) {
+	if (*dependents == NULL) {
+		*dependents = dynarr_new(unsigned int, 4);
+	}
+	if (dynarr_find_pod(*dependents, slot) == -1) {
+		dynarr_push(*dependents, slot);
+	}
+}
+
+/// Get the list of slots to invalidate when the input of `leaf` changes. Returns NULL
+/// if the leaf's result never changes.
+static unsigned int **
+c2_leaf_dependents(struct c2_state *state, const c2_condition_node_leaf *leaf) {
+	if (leaf->predef != C2_L_PUNDEFINED) {
+		if (C2_PREDEFS[leaf->predef].deprecated) {
+			// Always false
+			return NULL;
+		}
+		state->used_predefs |= 1U << leaf->predef;
+		return &state->predef_dependents[leaf->predef];
+	}
+	if (leaf->target_id == C2_L_INVALID_TARGET_ID) {
+		return NULL;
+	}
+	HASH_ITER2(state->tracked_properties, p) {
+		if (p->id == leaf->target_id) {
+			return &p->dependents;
+		}
+	}
+	return NULL;
+}
+
+/// Assign result slots to the leaves of a condition, and record which properties and
+/// predefined targets the results of the leaves and the condition depend on.
+/// `condition_slot` is 0 if the condition shares its slot with an identical condition
+/// whose dependencies are already recorded.
+static void c2_tree_intern_leaves(struct c2_state *state, c2_condition_node_ptr node,
+                                  unsigned int condition_slot) {
+	switch (node.type) {
+	case C2_NODE_TYPE_TRUE: return;
+	case C2_NODE_TYPE_BRANCH:
+		if (node.b) {
+			c2_tree_intern_leaves(state, node.b->opr1, condition_slot);
+			c2_tree_intern_leaves(state, node.b->opr2, condition_slot);
+		}
+		return;
+	case C2_NODE_TYPE_LEAF: break;
+	default: unreachable();
+	}
+	if (node.l == NULL) {
+		return;
+	}
+
+	// Negation is applied by the program, so it's not part of the leaf's result.
+	node.neg = false;
+	bool new_leaf = c2_intern_node(state, node, &node.l->slot);
+	auto dependents = c2_leaf_dependents(state, node.l);
+	if (dependents == NULL) {
+		return;
+	}
+	if (new_leaf) {
+		c2_add_dependent(dependents, node.l->slot);
+	}
+	if (condition_slot != 0) {
+		c2_add_dependent(dependents, condition_slot);
+	}
+}
+
+/// Append the instructions evaluating `node` to `program`. `depth` is the number of
+/// values on the stack when these instructions run. Returns false if the node needs a
+/// deeper stack than the evaluator has.
+static bool
+c2_compile_node(c2_condition_node_ptr node, unsigned int depth, struct c2_instruction **program) {
+	switch (node.type) {
+	case C2_NODE_TYPE_TRUE:
+		dynarr_push(*program, ((struct c2_instruction){.op = C2_OP_TRUE}));
+		return true;
+	case C2_NODE_TYPE_LEAF:
+		// Like c2_match_once, a missing leaf is false regardless of negation.
+		dynarr_push(*program, ((struct c2_instruction){
+		                          .op = C2_OP_LEAF,
+		                          .neg = node.l != NULL && node.neg,
+		                          .leaf = node.l,
+		                      }));
+		return true;
+	case C2_NODE_TYPE_BRANCH: break;
+	default: unreachable();
+	}
+	if (node.b == NULL) {
+		dynarr_push(*program, ((struct c2_instruction){.op = C2_OP_LEAF, .leaf = NULL}));
+		return true;
+	}
+
+	switch (node.b->op) {
+	case C2_B_OAND:
+	case C2_B_OOR:;
+		if (!c2_compile_node(node.b->opr1, depth, program)) {
+			return false;
+		}
+		// Skip the second operand if the first one already decides the result.
+		auto jump = dynarr_len(*program);
+		dynarr_push(*program, ((struct c2_instruction){
+		                          .op = node.b->op == C2_B_OAND ? C2_OP_JUMP_IF_FALSE
+		                                                        : C2_OP_JUMP_IF_TRUE,
+		                      }));
+		if (!c2_compile_node(node.b->opr2, depth, program)) {
+			return false;
+		}
+		(*program)[jump].target = (unsigned int)dynarr_len(*program);
+		break;
+	case C2_B_OXOR:
+		if (depth >= C2_PROGRAM_MAX_STACK) {
+			return false;
+		}
+		if (!c2_compile_node(node.b->opr1, depth, program)) {
+			return false;
+		}
+		dynarr_push(*program, ((struct c2_instruction){.op = C2_OP_PUSH}));
+		if (!c2_compile_node(node.b->opr2, depth + 1, program)) {
+			return false;
+		}
+		dynarr_push(*program, ((struct c2_instruction){.op = C2_OP_POP_XOR}));
+		break;
+	default: unreachable();
+	}
+
+	if (node.neg) {
+		dynarr_push(*program, ((struct c2_instruction){.op = C2_OP_NOT}));
+	}
+	return true;
+}
+
+/// Compile a condition tree into a program. Returns NULL if the tree can't be
+/// compiled, in which case it has to be matched with c2_match_once.
+static struct c2_instruction *c2_compile(c2_condition_node_ptr root) {
+	auto program = dynarr_new(struct c2_instruction, 8);
+	if (!c2_compile_node(root, 0, &program)) {
+		log_warn("Condition %s is nested too deeply, it will be matched slowly.",
+		         c2_condition_node_to_str2(root));
+		dynarr_free_pod(program);
+		return NULL;
+	}
+	dynarr_shrink_to_fit(program);
+	return program;
+}
+
 bool c2_list_postprocess(struct c2_state *state, xcb_connection_t *c, struct list_node *list) {
 	list_foreach(c2_condition, i, list, siblings) {
 		if (!c2_tree_postprocess(state, c, i->root)) {
 			return false;
 		}
+		if (i->slot != 0) {
+			continue;
+		}
+		// Identical conditions, even if they are in different lists, share the
+		// same result, so only one of them is ever evaluated for a window.
+		bool new_condition = c2_intern_node(state, i->root, &i->slot);
+		c2_tree_intern_leaves(state, i->root, new_condition ? i->slot : 0);
+		i->program = c2_compile(i->root);
 	}
 	return true;
 }
@@ -1340,6 +1771,9 @@ void c2_free_condition(c2_condition *lp, c2_userdata_free f) {
 	}
 	lp->data = NULL;
 	c2_free(lp->root);
+	if (lp->program) {
+		dynarr_free_pod(lp->program);
+	}
 	free(lp);
 }
 
@@ -1563,50 +1997,63 @@ static inline bool c2_int_op(const c2_condition_node_leaf *leaf, int64_t target)
 	unreachable();
 }
 
+/// Get the value of a non-string predefined target. For `window_type`, this is the
+/// bitmask of window types.
+static int64_t c2_predef_number(const struct win *w, int predef) {
+	switch (predef) {
+	case C2_L_PX: return w->g.x;
+	case C2_L_PY: return w->g.y;
+	case C2_L_PX2: return w->g.x + w->widthb;
+	case C2_L_PY2: return w->g.y + w->heightb;
+	case C2_L_PWIDTH: return w->g.width;
+	case C2_L_PHEIGHT: return w->g.height;
+	case C2_L_PWIDTHB: return w->widthb;
+	case C2_L_PHEIGHTB: return w->heightb;
+	case C2_L_PBDW: return w->g.border_width;
+	case C2_L_PFULLSCREEN: return w->is_fullscreen;
+	case C2_L_PARGB: return win_has_alpha(w);
+	case C2_L_PFOCUSED:
+		return w->a.map_state == XCB_MAP_STATE_VIEWABLE && w->is_focused;
+	case C2_L_PGROUPFOCUSED:
+		return w->a.map_state == XCB_MAP_STATE_VIEWABLE && w->is_group_focused;
+	case C2_L_PWMWIN: return win_is_wmwin(w);
+	case C2_L_PBSHAPED: return w->bounding_shaped;
+	case C2_L_PROUNDED: return w->rounded_corners;
+	case C2_L_POVREDIR:
+		// When user wants to check override-redirect, they almost always
+		// want to check the client window, not the frame window. We
+		// don't track the override-redirect state of the client window
+		// directly, however we can assume if a window has a window
+		// manager frame around it, it's not override-redirect.
+		return w->a.override_redirect && wm_ref_client_of(w->tree_ref) == NULL;
+	case C2_L_PWINDOWTYPE: return w->window_types;
+	default: unreachable();
+	}
+}
+
+/// Get the value of a string predefined target, other than `window_type`.
+static const char *c2_predef_string(const struct win *w, int predef) {
+	switch (predef) {
+	case C2_L_PNAME: return w->name;
+	case C2_L_PCLASSG: return w->class_general;
+	case C2_L_PCLASSI: return w->class_instance;
+	case C2_L_PROLE: return w->role;
+	default: unreachable();
+	}
+}
+
+static inline bool c2_predef_is_string(int predef) {
+	return C2_PREDEFS[predef].is_string && predef != C2_L_PWINDOWTYPE;
+}
+
 static bool c2_match_once_leaf_int(const struct win *w, const c2_condition_node_leaf *leaf) {
 	// Get the value
 	if (leaf->predef != C2_L_PUNDEFINED) {
 		// A predefined target
-		int64_t predef_target = 0;
 		if (C2_PREDEFS[leaf->predef].deprecated) {
 			return false;
 		}
-
-		switch (leaf->predef) {
-		case C2_L_PX: predef_target = w->g.x; break;
-		case C2_L_PY: predef_target = w->g.y; break;
-		case C2_L_PX2: predef_target = w->g.x + w->widthb; break;
-		case C2_L_PY2: predef_target = w->g.y + w->heightb; break;
-		case C2_L_PWIDTH: predef_target = w->g.width; break;
-		case C2_L_PHEIGHT: predef_target = w->g.height; break;
-		case C2_L_PWIDTHB: predef_target = w->widthb; break;
-		case C2_L_PHEIGHTB: predef_target = w->heightb; break;
-		case C2_L_PBDW: predef_target = w->g.border_width; break;
-		case C2_L_PFULLSCREEN: predef_target = w->is_fullscreen; break;
-		case C2_L_PARGB: predef_target = win_has_alpha(w); break;
-		case C2_L_PFOCUSED:
-			predef_target =
-			    w->a.map_state == XCB_MAP_STATE_VIEWABLE && w->is_focused;
-			break;
-		case C2_L_PGROUPFOCUSED:
-			predef_target = w->a.map_state == XCB_MAP_STATE_VIEWABLE &&
-			                w->is_group_focused;
-			break;
-		case C2_L_PWMWIN: predef_target = win_is_wmwin(w); break;
-		case C2_L_PBSHAPED: predef_target = w->bounding_shaped; break;
-		case C2_L_PROUNDED: predef_target = w->rounded_corners; break;
-		case C2_L_POVREDIR:
-			// When user wants to check override-redirect, they almost always
-			// want to check the client window, not the frame window. We
-			// don't track the override-redirect state of the client window
-			// directly, however we can assume if a window has a window
-			// manager frame around it, it's not override-redirect.
-			predef_target = w->a.override_redirect &&
-			                wm_ref_client_of(w->tree_ref) == NULL;
-			break;
-		default: unreachable();
-		}
-		return c2_int_op(leaf, predef_target);
+		return c2_int_op(leaf, c2_predef_number(w, leaf->predef));
 	}
 
 	// A raw window property
@@ -1616,7 +2063,6 @@ static bool c2_match_once_leaf_int(const struct win *w, const c2_condition_node_
 		return false;
 	}
 	auto values = &w->c2_state.values[leaf->target_id];
-	assert(!values->needs_update);
 	if (!values->valid) {
 		log_verbose("Property %s not found on window %#010x (%s)", leaf->tgt,
 		            wm_ref_win_id(w->tree_ref), w->name);
@@ -1663,8 +2109,7 @@ static bool c2_string_op(const c2_condition_node_leaf *leaf, const char *target)
 		switch (leaf->match) {
 		case C2_L_MEXACT: return strcasecmp(target, leaf->ptnstr) == 0;
 		case C2_L_MCONTAINS: return strcasestr(target, leaf->ptnstr);
-		case C2_L_MSTART:
-			return strncasecmp(target, leaf->ptnstr, strlen(leaf->ptnstr)) == 0;
+		case C2_L_MSTART: return strncasecmp(target, leaf->ptnstr, leaf->ptnlen) == 0;
 		case C2_L_MWILDCARD: return !fnmatch(leaf->ptnstr, target, FNM_CASEFOLD);
 		default: unreachable();
 		}
@@ -1672,8 +2117,7 @@ static bool c2_string_op(const c2_condition_node_leaf *leaf, const char *target)
 		switch (leaf->match) {
 		case C2_L_MEXACT: return strcmp(target, leaf->ptnstr) == 0;
 		case C2_L_MCONTAINS: return strstr(target, leaf->ptnstr);
-		case C2_L_MSTART:
-			return strncmp(target, leaf->ptnstr, strlen(leaf->ptnstr)) == 0;
+		case C2_L_MSTART: return strncmp(target, leaf->ptnstr, leaf->ptnlen) == 0;
 		case C2_L_MWILDCARD: return !fnmatch(leaf->ptnstr, target, 0);
 		default: unreachable();
 		}
@@ -1687,6 +2131,9 @@ static bool c2_match_once_leaf_string(struct atom *atoms, const struct win *w,
 	const char *predef_target = NULL;
 	if (leaf->predef != C2_L_PUNDEFINED) {
 		if (leaf->predef == C2_L_PWINDOWTYPE) {
+			if (leaf->wintypes_resolved) {
+				return (w->window_types & leaf->wintypes) != 0;
+			}
 			for (unsigned i = 0; i < NUM_WINTYPES; i++) {
 				if (w->window_types & (1 << i) &&
 				    c2_string_op(leaf, WINTYPES[i].name)) {
@@ -1696,14 +2143,7 @@ static bool c2_match_once_leaf_string(struct atom *atoms, const struct win *w,
 			return false;
 		}
 
-		switch (leaf->predef) {
-		case C2_L_PNAME: predef_target = w->name; break;
-		case C2_L_PCLASSG: predef_target = w->class_general; break;
-		case C2_L_PCLASSI: predef_target = w->class_instance; break;
-		case C2_L_PROLE: predef_target = w->role; break;
-		case C2_L_PWINDOWTYPE:
-		default: unreachable();
-		}
+		predef_target = c2_predef_string(w, leaf->predef);
 		if (!predef_target) {
 			return false;
 		}
@@ -1717,7 +2157,6 @@ static bool c2_match_once_leaf_string(struct atom *atoms, const struct win *w,
 		return false;
 	}
 	auto values = &w->c2_state.values[leaf->target_id];
-	assert(!values->needs_update);
 	if (!values->valid) {
 		log_verbose("Property %s not found on window %#010x, client %#010x (%s)",
 		            leaf->tgt, win_id(w), win_client_id(w, false), w->name);
@@ -1887,18 +2326,165 @@ c2_condition *c2_new_true(struct list_node *list) {
 	return ret;
 }
 
+/// Match a window against a leaf, using and updating `results` if it's not NULL.
+static bool c2_match_leaf_cached(const struct c2_state *state, const struct win *w,
+                                 uint8_t *results, c2_condition_node_leaf *leaf) {
+	if (leaf == NULL) {
+		return false;
+	}
+	c2_condition_node_ptr node = {.type = C2_NODE_TYPE_LEAF, .l = leaf};
+	if (results == NULL || leaf->slot == 0) {
+		return c2_match_once_leaf(state, w, node);
+	}
+	if (results[leaf->slot] == C2_RESULT_UNKNOWN) {
+		results[leaf->slot] =
+		    c2_match_once_leaf(state, w, node) ? C2_RESULT_TRUE : C2_RESULT_FALSE;
+	}
+	return results[leaf->slot] == C2_RESULT_TRUE;
+}
+
+/// Run a compiled condition. Results of leaves are looked up in, and stored into,
+/// `results` if it's not NULL. So a leaf shared by many conditions is only evaluated
+/// once.
+static bool c2_program_run(const struct c2_state *state, const struct win *w,
+                           uint8_t *results, const struct c2_instruction *program) {
+	bool stack[C2_PROGRAM_MAX_STACK];
+	unsigned int sp = 0;
+	bool acc = false;
+	size_t len = dynarr_len(program);
+	for (size_t pc = 0; pc < len;) {
+		auto ins = &program[pc++];
+		switch (ins->op) {
+		case C2_OP_LEAF:
+			acc = c2_match_leaf_cached(state, w, results, ins->leaf) != ins->neg;
+			break;
+		case C2_OP_TRUE: acc = true; break;
+		case C2_OP_NOT: acc = !acc; break;
+		case C2_OP_JUMP_IF_TRUE:
+			if (acc) {
+				pc = ins->target;
+			}
+			break;
+		case C2_OP_JUMP_IF_FALSE:
+			if (!acc) {
+				pc = ins->target;
+			}
+			break;
+		case C2_OP_PUSH: stack[sp++] = acc; break;
+		case C2_OP_POP_XOR: acc = stack[--sp] != acc; break;
+		default: unreachable();
+		}
+	}
+	assert(sp == 0);
+	return acc;
+}
+
+/// Match a window against a condition, with its compiled program if there is one.
+static bool c2_match_condition(const struct c2_state *state, const struct win *w,
+                               uint8_t *results, const c2_condition *condition) {
+	if (condition->program == NULL) {
+		return c2_match_once(state, w, condition->root);
+	}
+	bool result = c2_program_run(state, w, results, condition->program);
+	log_debug("(%#010x): result = %d, pattern = %s", win_id(w), result,
+	          c2_condition_node_to_str2(condition->root));
+	return result;
+}
+
+#ifdef CONFIG_BENCHMARK
+unsigned int c2_state_slot_count(const struct c2_state *state) {
+	return state->slot_count;
+}
+
+bool c2_match_tree(const struct c2_state *state, const struct win *w,
+                   const c2_condition *condition) {
+	return c2_match_once(state, w, condition->root);
+}
+
+bool c2_match_program(const struct c2_state *state, const struct win *w,
+                      uint8_t *results, const c2_condition *condition) {
+	assert(condition->program != NULL);
+	return c2_program_run(state, w, results, condition->program);
+}
+#endif
+
+static void c2_invalidate_dependents(struct c2_window_state *window_state,
+                                     const unsigned int *dependents) {
+	if (window_state->results == NULL || dependents == NULL) {
+		return;
+	}
+	dynarr_foreach(dependents, id) {
+		window_state->results[*id] = C2_RESULT_UNKNOWN;
+	}
+}
+
+/// Compare the predefined targets used by conditions against the values seen last
+/// time, and invalidate cached results of conditions using the ones that changed.
+static void c2_window_state_check_predefs(const struct c2_state *state, struct win *w) {
+	auto values = w->c2_state.predefs;
+	if (values == NULL) {
+		return;
+	}
+	uint32_t used = state->used_predefs;
+	while (used) {
+		int predef = index_of_lowest_one(used);
+		uint32_t bit = 1U << predef;
+		used &= ~bit;
+
+		bool changed = !(values->known & bit);
+		if (c2_predef_is_string(predef)) {
+			const char *curr = c2_predef_string(w, predef);
+			char *prev = values->strings[predef];
+			if (!changed) {
+				changed = (curr == NULL) != (prev == NULL) ||
+				          (curr != NULL && strcmp(curr, prev) != 0);
+			}
+			if (changed) {
+				free(prev);
+				values->strings[predef] = curr ? strdup(curr) : NULL;
+			}
+		} else {
+			int64_t curr = c2_predef_number(w, predef);
+			changed = changed || values->numbers[predef] != curr;
+			values->numbers[predef] = curr;
+		}
+		if (changed) {
+			values->known |= bit;
+			c2_invalidate_dependents(&w->c2_state, state->predef_dependents[predef]);
+		}
+	}
+}
+
+/// Match a window against a condition, using the window's cached result if the
+/// things the condition depends on haven't changed since it was last evaluated.
+/// `c2_window_state_check_predefs` must be called before this.
+static bool c2_match_cached(const struct c2_state *state, struct win *w,
+                            const c2_condition *condition) {
+	auto results = w->c2_state.results;
+	if (condition->slot == 0 || results == NULL) {
+		return c2_match_condition(state, w, NULL, condition);
+	}
+	assert(condition->slot <= state->slot_count);
+	if (results[condition->slot] == C2_RESULT_UNKNOWN) {
+		results[condition->slot] = c2_match_condition(state, w, results, condition)
+		                               ? C2_RESULT_TRUE
+		                               : C2_RESULT_FALSE;
+	}
+	return results[condition->slot] == C2_RESULT_TRUE;
+}
+
 /**
  * Match a window against a condition linked list.
  *
- * @param cache a place to cache the last matched condition
  * @param pdata a place to return the data
  * @return true if matched, false otherwise.
  */
-bool c2_match(struct c2_state *state, const struct win *w,
-              const struct list_node *conditions, void **pdata) {
+bool c2_match(struct c2_state *state, struct win *w, const struct list_node *conditions,
+              void **pdata) {
+	c2_window_state_check_predefs(state, w);
 	// Then go through the whole linked list
 	list_foreach(c2_condition, i, conditions, siblings) {
-		if (c2_match_once(state, w, i->root)) {
+		if (c2_match_cached(state, w, i)) {
 			if (pdata) {
 				*pdata = i->data;
 			}
@@ -1910,12 +2496,13 @@ bool c2_match(struct c2_state *state, const struct win *w,
 }
 
 /// Match a window against the first condition in a condition linked list.
-bool c2_match_one(const struct c2_state *state, const struct win *w,
+bool c2_match_one(const struct c2_state *state, struct win *w,
                   const c2_condition *condition, void **pdata) {
 	if (!condition) {
 		return false;
 	}
-	if (c2_match_once(state, w, condition->root)) {
+	c2_window_state_check_predefs(state, w);
+	if (c2_match_cached(state, w, condition)) {
 		if (pdata) {
 			*pdata = condition->data;
 		}
@@ -1969,9 +2556,22 @@ void c2_state_free(struct c2_state *state) {
 	struct c2_tracked_property *property, *tmp;
 	HASH_ITER(hh, state->tracked_properties, property, tmp) {
 		HASH_DEL(state->tracked_properties, property);
+		if (property->dependents) {
+			dynarr_free_pod(property->dependents);
+		}
 		free(property);
 	}
-	free(state->cookies);
+	struct c2_interned_node *interned, *next_interned;
+	HASH_ITER(hh, state->interned_nodes, interned, next_interned) {
+		HASH_DEL(state->interned_nodes, interned);
+		free(interned->key);
+		free(interned);
+	}
+	for (size_t i = 0; i < ARR_SIZE(state->predef_dependents); i++) {
+		if (state->predef_dependents[i]) {
+			dynarr_free_pod(state->predef_dependents[i]);
+		}
+	}
 	free(state);
 }
 
@@ -1982,11 +2582,41 @@ void c2_window_state_init(const struct c2_state *state, struct c2_window_state *
 		window_state->values[i].needs_update = true;
 		window_state->values[i].valid = false;
 	}
+	// All results start as C2_RESULT_UNKNOWN. Index 0 is unused, see
+	// `struct c2_condition::slot`.
+	window_state->results = ccalloc(state->slot_count + 1, uint8_t);
+	window_state->predefs = ccalloc(1, struct c2_predef_values);
+	window_state->property_count = property_count;
+	window_state->slot_count = state->slot_count;
+}
+
+void c2_window_state_sync(const struct c2_state *state,
+                          struct c2_window_state *window_state) {
+	// Tracked properties and result slots are never removed, and their ids stay the
+	// same, so existing values and cached results are still valid.
+	unsigned int property_count = HASH_COUNT(state->tracked_properties);
+	if (property_count > window_state->property_count) {
+		window_state->values = crealloc(window_state->values, property_count);
+		for (auto i = window_state->property_count; i < property_count; i++) {
+			window_state->values[i] = (struct c2_property_value){
+			    .needs_update = true,
+			    .valid = false,
+			};
+		}
+		window_state->property_count = property_count;
+	}
+	if (state->slot_count > window_state->slot_count) {
+		window_state->results =
+		    crealloc(window_state->results, state->slot_count + 1);
+		memset(window_state->results + window_state->slot_count + 1, 0,
+		       state->slot_count - window_state->slot_count);
+		window_state->slot_count = state->slot_count;
+	}
 }
 
-void c2_window_state_destroy(const struct c2_state *state,
+void c2_window_state_destroy(const struct c2_state * /*state*/,
                              struct c2_window_state *window_state) {
-	size_t property_count = HASH_COUNT(state->tracked_properties);
+	size_t property_count = window_state->property_count;
 	for (size_t i = 0; i < property_count; i++) {
 		auto values = &window_state->values[i];
 		if (values->type == C2_PROPERTY_TYPE_STRING) {
@@ -1996,6 +2626,13 @@ void c2_window_state_destroy(const struct c2_state *state,
 		}
 	}
 	free(window_state->values);
+	free(window_state->results);
+	if (window_state->predefs) {
+		for (size_t i = 0; i < ARR_SIZE(window_state->predefs->strings); i++) {
+			free(window_state->predefs->strings[i]);
+		}
+		free(window_state->predefs);
+	}
 }
 
 void c2_window_state_mark_dirty(const struct c2_state *state,
@@ -2009,6 +2646,7 @@ void c2_window_state_mark_dirty(const struct c2_state *state,
 	HASH_FIND(hh, state->tracked_properties, &key, sizeof(key), p);
 	if (p) {
 		window_state->values[p->id].needs_update = true;
+		c2_invalidate_dependents(window_state, p->dependents);
 	}
 }
 
@@ -2021,7 +2659,6 @@ c2_window_state_update_one_from_reply(struct c2_state *state,
 	bool property_is_string = x_is_type_string(state->atoms, reply->type);
 	unsigned int external_capacity = 0;
 	char *external_storage = NULL;
-	value->needs_update = false;
 	value->valid = false;
 	if (reply->type == XCB_ATOM_NONE) {
 		// Property doesn't exist on this window
@@ -2127,40 +2764,9 @@ c2_window_state_update_one_from_reply(struct c2_state *state,
 	free(external_storage);
 }
 
-static void c2_window_state_update_from_replies(struct c2_state *state,
-                                                struct c2_window_state *window_state,
-                                                xcb_connection_t *c, xcb_window_t client_win,
-                                                xcb_window_t frame_win) {
-	HASH_ITER2(state->tracked_properties, p) {
-		if (!window_state->values[p->id].needs_update) {
-			continue;
-		}
-		xcb_window_t window = p->key.is_on_client ? client_win : frame_win;
-		xcb_get_property_reply_t *reply =
-		    xcb_get_property_reply(c, state->cookies[p->id], NULL);
-		if (!reply) {
-			log_warn("Failed to get property %d for window %#010x, some "
-			         "window rules might not work.",
-			         p->id, window);
-			window_state->values[p->id].valid = false;
-			window_state->values[p->id].needs_update = false;
-			continue;
-		}
-		c2_window_state_update_one_from_reply(state, &window_state->values[p->id],
-		                                      p->key.property, reply, c);
-		free(reply);
-	}
-}
-
 void c2_window_state_update(struct c2_state *state, struct c2_window_state *window_state,
-                            xcb_connection_t *c, xcb_window_t client_win,
-                            xcb_window_t frame_win) {
-	size_t property_count = HASH_COUNT(state->tracked_properties);
-	if (!state->cookies) {
-		state->cookies = ccalloc(property_count, xcb_get_property_cookie_t);
-	}
-	memset(state->cookies, 0, property_count * sizeof(xcb_get_property_cookie_t));
-
+                            xcb_window_t client_win, xcb_window_t frame_win,
+                            c2_fetch_property_fn fetch, void *data) {
 	log_verbose("Updating c2 window state for window %#010x (frame %#010x)",
 	            client_win, frame_win);
 
@@ -2170,13 +2776,37 @@ void c2_window_state_update(struct c2_state *state, struct c2_window_state *wind
 		}
 
 		xcb_window_t window = p->key.is_on_client ? client_win : frame_win;
-		// xcb_get_property long_length is in units of 4-byte,
-		// so use `ceil(length / 4)`. same below.
-		state->cookies[p->id] = xcb_get_property(
-		    c, 0, window, p->key.property, XCB_GET_PROPERTY_TYPE_ANY, 0, UINT32_MAX);
+		window_state->values[p->id].needs_update = false;
+		fetch(data, window, p->key.property, p->id);
 	}
+}
 
-	c2_window_state_update_from_replies(state, window_state, c, client_win, frame_win);
+void c2_window_state_update_from_reply(struct c2_state *state,
+                                       struct c2_window_state *window_state,
+                                       unsigned int id,
+                                       const xcb_get_property_reply_t *reply,
+                                       xcb_connection_t *c) {
+	struct c2_tracked_property *p = NULL;
+	HASH_ITER2(state->tracked_properties, i) {
+		if (i->id == id) {
+			p = i;
+			break;
+		}
+	}
+	assert(p != NULL);
+
+	if (!reply) {
+		log_warn("Failed to get property %s, some window rules might not work.",
+		         get_atom_name_cached(state->atoms, p->key.property));
+		window_state->values[id].valid = false;
+	} else {
+		c2_window_state_update_one_from_reply(state, &window_state->values[id],
+		                                      p->key.property,
+		                                      (xcb_get_property_reply_t *)reply, c);
+	}
+	// Results might have been cached with the old value while the request was in
+	// flight.
+	c2_invalidate_dependents(window_state, p->dependents);
 }
 
 bool c2_state_is_property_tracked(struct c2_state *state, xcb_atom_t property) {
@@ -6,6 +6,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <xcb/xproto.h>
 
 #include "utils/list.h"
@@ -18,6 +19,13 @@ struct c2_window_state {
 	/// An array of window properties. Exact how many
 	/// properties there are is stored inside `struct c2_state`.
 	struct c2_property_value *values;
+	/// Cached match results of conditions and their leaves, indexed by result slot.
+	/// How many slots there are is stored inside `struct c2_state`.
+	uint8_t *results;
+	/// Values of predefined targets when the conditions were last matched.
+	struct c2_predef_values *predefs;
+	/// Number of properties and result slots `values` and `results` have room for.
+	unsigned int property_count, slot_count;
 };
 struct atom;
 struct win;
@@ -47,17 +55,38 @@ void c2_state_free(struct c2_state *state);
 bool c2_state_is_property_tracked(struct c2_state *state, xcb_atom_t property);
 void c2_window_state_init(const struct c2_state *state, struct c2_window_state *window_state);
 void c2_window_state_destroy(const struct c2_state *state, struct c2_window_state *window_state);
+/// Make room in `window_state` for the properties and conditions added to `state` since
+/// it was initialized. Must be called for every window after more conditions are
+/// post-processed. Properties added are fetched by the next `c2_window_state_update`.
+void c2_window_state_sync(const struct c2_state *state, struct c2_window_state *window_state);
 void c2_window_state_mark_dirty(const struct c2_state *state,
                                 struct c2_window_state *window_state, xcb_atom_t property,
                                 bool is_on_client);
+/// Callback used by `c2_window_state_update` to fetch `property` of `window`. The reply
+/// should be passed to `c2_window_state_update_from_reply` along with `id`.
+typedef void (*c2_fetch_property_fn)(void *data, xcb_window_t window, xcb_atom_t property,
+                                     unsigned int id);
+/// Request new values of the tracked properties that changed, by calling `fetch` for
+/// each of them. Old values are kept for matching until the replies arrive.
 void c2_window_state_update(struct c2_state *state, struct c2_window_state *window_state,
-                            xcb_connection_t *c, xcb_window_t client_win,
-                            xcb_window_t frame_win);
+                            xcb_window_t client_win, xcb_window_t frame_win,
+                            c2_fetch_property_fn fetch, void *data);
+/// Update a tracked property with the reply to a request made by
+/// `c2_window_state_update`. `reply` is NULL if the request failed.
+void c2_window_state_update_from_reply(struct c2_state *state,
+                                       struct c2_window_state *window_state,
+                                       unsigned int id,
+                                       const xcb_get_property_reply_t *reply,
+                                       xcb_connection_t *c);
 
-bool c2_match(struct c2_state *state, const struct win *w,
-              const struct list_node *conditions, void **pdata);
-bool c2_match_one(const struct c2_state *state, const struct win *w,
-                  const c2_condition *condlst, void **pdata);
+/// Match a window against a list of conditions, returns true if any of them matched,
+/// and the data of the first one that did is returned in `pdata`. Results are cached
+/// in the window's c2 state, and only re-evaluated when the window properties or
+/// predefined targets a condition uses changed.
+bool c2_match(struct c2_state *state, struct win *w, const struct list_node *conditions,
+              void **pdata);
+bool c2_match_one(const struct c2_state *state, struct win *w, const c2_condition *condlst,
+                  void **pdata);
 
 bool c2_list_postprocess(struct c2_state *state, xcb_connection_t *c, struct list_node *list);
 /// Return user data stored in a condition.
@@ -73,6 +102,19 @@ c2_condition *c2_condition_list_entry(struct list_node *list);
 /// Create a new condition list with a single condition that is always true.
 c2_condition *c2_new_true(struct list_node *list);
 
+#ifdef CONFIG_BENCHMARK
+/// Number of result slots the compiled programs of `state` use, `c2_match_program`
+/// needs a zeroed buffer of this size plus one.
+unsigned int c2_state_slot_count(const struct c2_state *state);
+/// Match a window against a condition by walking its tree.
+bool c2_match_tree(const struct c2_state *state, const struct win *w,
+                   const c2_condition *condition);
+/// Match a window against a condition with its compiled program, reusing the results
+/// of shared subexpressions stored in `results`.
+bool c2_match_program(const struct c2_state *state, const struct win *w,
+                      uint8_t *results, const c2_condition *condition);
+#endif
+
 // NOLINTBEGIN(bugprone-macro-parentheses)
 #define c2_condition_list_foreach(list, i)                                               \
 	for (c2_condition *i =                                                           \
@@ -79,6 +79,9 @@ typedef struct session {
 	ev_timer unredir_timer;
 	/// Use an ev_timer callback for drawing
 	ev_timer draw_timer;
+	/// Timeout for finishing animations of windows that are fully covered, which
+	/// we don't render every frame.
+	ev_timer occluded_animation_timer;
 	/// Called every time we have timeouts or new data on socket,
 	/// so we can be sure if xcb read from X socket at anytime during event
 	/// handling, we will not left any event unhandled in the queue
@@ -87,6 +90,9 @@ typedef struct session {
 	ev_signal usr1_signal;
 	/// Signal handler for SIGINT
 	ev_signal int_signal;
+	/// Timer for reloading the configuration after the config file changed. Editors
+	/// can write a file in several steps, so the reload is delayed a little.
+	ev_timer config_reload_timer;
 
 	// === Backend related ===
 	/// backend data
@@ -142,6 +148,8 @@ typedef struct session {
 
 	/// Render statistics
 	struct render_statistics render_stats;
+	/// Time spent in each stage of the most recent frames, exposed over D-Bus.
+	struct frame_timing_ring frame_timings;
 
 	// === Operation related ===
 	/// Whether there is a pending quest to get the focused window
@@ -150,6 +158,11 @@ typedef struct session {
 	uint64_t root_flags;
 	/// Program options.
 	options_t o;
+	/// Command line arguments and the config file path picom was started with, so
+	/// the configuration can be parsed again when the config file changes.
+	int argc;
+	char **argv;
+	const char *config_file;
 	/// State object for c2.
 	struct c2_state *c2_state;
 	/// Whether we have hit unredirection timeout.
@@ -168,6 +181,9 @@ typedef struct session {
 	bool render_queued;
 	/// A X region used for various operations. Kept to avoid repeated allocation.
 	xcb_xfixes_region_t x_region;
+	/// Windows that received DamageNotify, whose damage hasn't been fetched yet. A
+	/// dynarr. See `ev_fetch_pending_damage`.
+	xcb_window_t *damage_pending_windows;
 	// TODO(yshui) move render related fields into separate struct
 	/// Render planner
 	struct layout_manager *layout_manager;
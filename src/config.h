@@ -271,6 +271,10 @@ typedef struct options {
 	bool dbus;
 	/// Path to log file.
 	char *logpath;
+	/// Whether to format and write logs on a background thread.
+	bool log_async;
+	/// Path to the trace file to record X events into. NULL for disabled.
+	char *record_events_path;
 	/// Number of cycles to paint in benchmark mode. 0 for disabled.
 	int benchmark;
 	/// Window to constantly repaint in benchmark mode. 0 for full-screen.
@@ -925,6 +925,8 @@ bool parse_config_libconfig(options_t *opt, const char *config_file) { /*NOLINT(
 		}
 		opt->logpath = strdup(sval);
 	}
+	// --log-async
+	lcfg_lookup_bool(&cfg, "log-async", &opt->log_async);
 	// --use-ewmh-active-win
 	lcfg_lookup_bool(&cfg, "use-ewmh-active-win", &opt->use_ewmh_active_win);
 	// --unredir-if-possible
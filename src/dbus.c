@@ -22,6 +22,7 @@
 #include "log.h"
 #include "picom.h"
 #include "utils/misc.h"
+#include "utils/statistics.h"
 #include "utils/str.h"
 #include "wm/defs.h"
 #include "wm/win.h"
@@ -672,6 +673,115 @@ static DBusHandlerResult cdbus_process_repaint(session_t *ps, DBusMessage *msg a
 	return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+/// Upper bounds of the histogram buckets used by `frame_timings`, in microseconds. There
+/// is an implicit last bucket for everything above the last bound.
+static const uint32_t cdbus_frame_timing_buckets[] = {
+    250, 500, 1000, 2000, 4000, 8000, 16000, 33000, 66000,
+};
+#define CDBUS_FRAME_TIMING_NBUCKETS ((int)ARR_SIZE(cdbus_frame_timing_buckets) + 1)
+
+static bool cdbus_append_uint32_array(DBusMessageIter *it, const uint32_t *arr, int n) {
+	DBusMessageIter subit;
+	if (!dbus_message_iter_open_container(it, DBUS_TYPE_ARRAY,
+	                                      DBUS_TYPE_UINT32_AS_STRING, &subit)) {
+		return false;
+	}
+	if (!dbus_message_iter_append_fixed_array(&subit, DBUS_TYPE_UINT32, &arr, n)) {
+		dbus_message_iter_abandon_container(it, &subit);
+		return false;
+	}
+	return dbus_message_iter_close_container(it, &subit);
+}
+
+/**
+ * Process a frame_timings D-Bus request.
+ *
+ * Replies with the names of the render stages, the histogram bucket bounds, a histogram
+ * for each of the stages, and the raw timings of the most recent frames, each as the
+ * frame number and the time spent in each stage. Times are in microseconds, a time of
+ * UINT32_MAX means it's unknown.
+ */
+static DBusHandlerResult
+cdbus_process_frame_timings(session_t *ps, DBusMessage *msg attr_unused,
+                            DBusMessage *reply, DBusError *e attr_unused) {
+	if (reply == NULL) {
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	struct frame_timing timings[FRAME_TIMING_RING_SIZE];
+	auto n = frame_timing_ring_snapshot(&ps->frame_timings, timings,
+	                                    FRAME_TIMING_RING_SIZE);
+	const int nbuckets = CDBUS_FRAME_TIMING_NBUCKETS;
+	uint32_t histograms[NUM_OF_FRAME_TIMING_STAGES][CDBUS_FRAME_TIMING_NBUCKETS] = {};
+	for (unsigned i = 0; i < n; i++) {
+		for (int j = 0; j < NUM_OF_FRAME_TIMING_STAGES; j++) {
+			auto us = timings[i].stage_us[j];
+			if (us == FRAME_TIMING_UNKNOWN) {
+				continue;
+			}
+			int bucket = 0;
+			while (bucket < nbuckets - 1 && us > cdbus_frame_timing_buckets[bucket]) {
+				bucket++;
+			}
+			histograms[j][bucket]++;
+		}
+	}
+
+	DBusMessageIter it, subit, structit;
+	dbus_message_iter_init_append(reply, &it);
+	if (!dbus_message_iter_open_container(&it, DBUS_TYPE_ARRAY,
+	                                      DBUS_TYPE_STRING_AS_STRING, &subit)) {
+		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+	}
+	for (int i = 0; i < NUM_OF_FRAME_TIMING_STAGES; i++) {
+		if (!dbus_message_iter_append_basic(&subit, DBUS_TYPE_STRING,
+		                                    &frame_timing_stage_names[i])) {
+			dbus_message_iter_abandon_container(&it, &subit);
+			return DBUS_HANDLER_RESULT_NEED_MEMORY;
+		}
+	}
+	if (!dbus_message_iter_close_container(&it, &subit)) {
+		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+	}
+
+	if (!cdbus_append_uint32_array(&it, cdbus_frame_timing_buckets, nbuckets - 1)) {
+		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+	}
+
+	if (!dbus_message_iter_open_container(&it, DBUS_TYPE_ARRAY, "au", &subit)) {
+		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+	}
+	for (int i = 0; i < NUM_OF_FRAME_TIMING_STAGES; i++) {
+		if (!cdbus_append_uint32_array(&subit, histograms[i], nbuckets)) {
+			dbus_message_iter_abandon_container(&it, &subit);
+			return DBUS_HANDLER_RESULT_NEED_MEMORY;
+		}
+	}
+	if (!dbus_message_iter_close_container(&it, &subit)) {
+		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+	}
+
+	if (!dbus_message_iter_open_container(&it, DBUS_TYPE_ARRAY, "(tau)", &subit)) {
+		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+	}
+	for (unsigned i = 0; i < n; i++) {
+		dbus_uint64_t frame = timings[i].frame;
+		if (!dbus_message_iter_open_container(&subit, DBUS_TYPE_STRUCT, NULL,
+		                                      &structit) ||
+		    !dbus_message_iter_append_basic(&structit, DBUS_TYPE_UINT64, &frame) ||
+		    !cdbus_append_uint32_array(&structit, timings[i].stage_us,
+		                               NUM_OF_FRAME_TIMING_STAGES) ||
+		    !dbus_message_iter_close_container(&subit, &structit)) {
+			dbus_message_iter_abandon_container(&it, &subit);
+			return DBUS_HANDLER_RESULT_NEED_MEMORY;
+		}
+	}
+	if (!dbus_message_iter_close_container(&it, &subit)) {
+		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+	}
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 static inline cdbus_enum_t tristate_to_switch(enum tristate val) {
 	switch (val) {
 	case TRI_FALSE: return OFF;
@@ -826,6 +936,7 @@ cdbus_process_win_set(session_t *ps, DBusMessage *msg, DBusMessage *reply, DBusE
 		return DBUS_HANDLER_RESULT_HANDLED;
 	}
 	if (changed) {
+		win_mark_layout_dirty(w);
 		queue_redraw(ps);
 	}
 
@@ -1089,6 +1200,12 @@ static DBusHandlerResult cdbus_process_introspect(DBusMessage *reply) {
 	    "    <method name='list_win'>\n"
 	    "      <arg name='wids' type='au' direction='out' />\n"
 	    "    </method>\n"
+	    "    <method name='frame_timings'>\n"
+	    "      <arg name='stages' type='as' direction='out' />\n"
+	    "      <arg name='buckets' type='au' direction='out' />\n"
+	    "      <arg name='histograms' type='aau' direction='out' />\n"
+	    "      <arg name='samples' type='a(tau)' direction='out' />\n"
+	    "    </method>\n"
 	    "  </interface>\n"
 	    "  <interface name='" PICOM_COMPOSITOR_INTERFACE "'>\n"
 	    "    <signal name='WinAdded'>\n"
@@ -1309,6 +1426,7 @@ static DBusHandlerResult cdbus_process(DBusConnection *conn, DBusMessage *msg, v
 		    {"reset", cdbus_process_reset},
 		    {"repaint", cdbus_process_repaint},
 		    {"list_win", cdbus_process_list_win},
+		    {"frame_timings", cdbus_process_frame_timings},
 		    {"win_get", cdbus_process_win_get},
 		    {"win_set", cdbus_process_win_set},
 		    {"find_win", cdbus_process_find_win},
@@ -21,6 +21,7 @@
 #include "log.h"
 #include "picom.h"
 #include "region.h"
+#include "utils/dynarr.h"
 #include "wm/defs.h"
 #include "wm/wm.h"
 #include "x.h"
@@ -622,56 +623,133 @@ static inline void ev_property_notify(session_t *ps, xcb_property_notify_event_t
 	}
 }
 
-static inline void repair_win(session_t *ps, struct win *w) {
-	// Only mapped window can receive damages
-	assert(w->state == WSTATE_MAPPED || win_check_flags_all(w, WIN_FLAGS_MAPPED));
+/// Add the damage region `parts`, in window-local coordinates of the window body, to
+/// the window's damage.
+static void win_add_damage(session_t *ps, struct win *w, region_t *parts) {
+	log_trace("Mark window %#010x (%s) as having received damage", win_id(w), w->name);
+
+	// Why care about damage when screen is unredirected?
+	// We will force full-screen repaint on redirection.
+	if (!ps->redirected) {
+		return;
+	}
+
+	pixman_region32_translate(parts, w->g.border_width, w->g.border_width);
+	pixman_region32_union(&w->damaged, &w->damaged, parts);
+}
+
+struct damage_fetch_request {
+	struct x_async_request_base base;
+	session_t *ps;
+	xcb_window_t wid;
+};
+
+static void handle_damage_fetch_reply(struct x_connection *c,
+                                      struct x_async_request_base *req_base,
+                                      const xcb_raw_generic_event_t *reply_or_error) {
+	auto req = (struct damage_fetch_request *)req_base;
+	auto ps = req->ps;
+	auto wid = req->wid;
+	free(req);
+
+	if (reply_or_error == NULL) {
+		// Shutting down
+		return;
+	}
+
+	if (reply_or_error->response_type == 0) {
+		log_debug("Failed to fetch damage of window %#010x: %s", wid,
+		          x_strerror(c, (xcb_generic_error_t *)reply_or_error));
+		return;
+	}
+
+	auto cursor = wm_find(ps->wm, wid);
+	auto w = cursor == NULL ? NULL : wm_ref_deref(cursor);
+	if (w == NULL || !w->ever_damaged) {
+		// The window is gone, or it has been unmapped and mapped again, in which
+		// case the whole window will be redrawn anyway.
+		return;
+	}
 
 	region_t parts;
-	pixman_region32_init(&parts);
+	if (!x_region_from_fetch_reply(
+	        (const xcb_xfixes_fetch_region_reply_t *)reply_or_error, &parts)) {
+		return;
+	}
+	win_add_damage(ps, w, &parts);
+	pixman_region32_fini(&parts);
+	queue_redraw(ps);
+}
 
-	// If this is the first time this window is damaged, we would redraw the
-	// whole window, so we don't need to fetch the damage region. But we still need
-	// to make sure the X server receives the DamageSubtract request, hence the
-	// `xcb_request_check` here.
-	// Otherwise, we fetch the damage regions. That means we will receive a reply
-	// from the X server, which implies it has received our DamageSubtract request.
-	if (!w->ever_damaged) {
-		auto e = xcb_request_check(
-		    ps->c.c,
-		    xcb_damage_subtract_checked(ps->c.c, w->damage, XCB_NONE, XCB_NONE));
-		if (e) {
-			if (ps->o.show_all_xerrors) {
-				x_print_error(&ps->c, e->sequence, e->major_code,
-				              e->minor_code, e->error_code);
-			}
-			free(e);
+bool ev_fetch_pending_damage(session_t *ps) {
+	if (dynarr_is_empty(ps->damage_pending_windows)) {
+		return false;
+	}
+
+	dynarr_foreach(ps->damage_pending_windows, wid) {
+		auto cursor = wm_find(ps->wm, *wid);
+		auto w = cursor == NULL ? NULL : wm_ref_deref(cursor);
+		if (w == NULL || !w->damage_pending) {
+			continue;
 		}
-		win_extents(w, &parts);
-		log_debug("Window %#010x (%s) has been damaged the first time", win_id(w),
-		          w->name);
-	} else {
+		w->damage_pending = false;
+
+		// X processes requests in order, so `x_region` can be reused for all
+		// windows: each fetch gets the region set by the subtract right before it.
 		auto cookie = xcb_damage_subtract(ps->c.c, w->damage, XCB_NONE, ps->x_region);
 		if (!ps->o.show_all_xerrors) {
 			x_set_error_action_ignore(&ps->c, cookie);
 		}
-		x_fetch_region(&ps->c, ps->x_region, &parts);
-		pixman_region32_translate(&parts, w->g.x + w->g.border_width,
-		                          w->g.y + w->g.border_width);
+		auto req = ccalloc(1, struct damage_fetch_request);
+		req->base.callback = handle_damage_fetch_reply;
+		req->base.sequence = xcb_xfixes_fetch_region(ps->c.c, ps->x_region).sequence;
+		req->ps = ps;
+		req->wid = *wid;
+		x_await_request(&ps->c, &req->base);
 	}
+	dynarr_clear_pod(ps->damage_pending_windows);
+	return true;
+}
 
-	log_trace("Mark window %#010x (%s) as having received damage", win_id(w), w->name);
-	w->ever_damaged = true;
+static inline void repair_win(session_t *ps, struct win *w) {
+	// Only mapped window can receive damages
+	assert(w->state == WSTATE_MAPPED || win_check_flags_all(w, WIN_FLAGS_MAPPED));
 	w->pixmap_damaged = true;
-
-	// Why care about damage when screen is unredirected?
-	// We will force full-screen repaint on redirection.
-	if (!ps->redirected) {
-		pixman_region32_fini(&parts);
+	if (w->win_image != NULL && ps->backend_data->ops.pixmap_damaged != NULL) {
+		ps->backend_data->ops.pixmap_damaged(ps->backend_data, w->win_image);
+	}
+
+	// Damage regions are not fetched here. With the default report level, X
+	// won't send another DamageNotify for this window until we subtract its
+	// damage, so all the damage it receives before we are done with the current
+	// batch of events is fetched with a single request by
+	// `ev_fetch_pending_damage`. The replies arrive asynchronously, rendering
+	// doesn't wait for them, same as it doesn't wait for DamageNotify.
+	if (w->ever_damaged) {
+		if (!w->damage_pending) {
+			w->damage_pending = true;
+			dynarr_push(ps->damage_pending_windows, win_id(w));
+		}
 		return;
 	}
 
-	pixman_region32_translate(&parts, -w->g.x, -w->g.y);
-	pixman_region32_union(&w->damaged, &w->damaged, &parts);
+	// If this is the first time this window is damaged, we would redraw the
+	// whole window, so we don't need to fetch the damage region. We just need to
+	// subtract it, so X will send us DamageNotify for further damages.
+	auto cookie = xcb_damage_subtract(ps->c.c, w->damage, XCB_NONE, XCB_NONE);
+	if (!ps->o.show_all_xerrors) {
+		x_set_error_action_ignore(&ps->c, cookie);
+	}
+	log_debug("Window %#010x (%s) has been damaged the first time", win_id(w), w->name);
+	win_mark_layout_dirty(w);
+	w->ever_damaged = true;
+
+	region_t parts;
+	pixman_region32_init(&parts);
+	win_extents(w, &parts);
+	pixman_region32_translate(&parts, -w->g.x - w->g.border_width,
+	                          -w->g.y - w->g.border_width);
+	win_add_damage(ps, w, &parts);
 	pixman_region32_fini(&parts);
 }
 
@@ -8,3 +8,7 @@
 
 void ev_handle(session_t *ps, xcb_generic_event_t *ev);
 void ev_update_focused(struct session *ps);
+/// Send one request to fetch the damage of each window that received DamageNotify
+/// since the last call. Damage is applied to the windows when the replies arrive.
+/// Returns true if any request is sent.
+bool ev_fetch_pending_damage(session_t *ps);
@@ -84,7 +84,7 @@ struct c2_match_state {
 };
 
 static bool c2_match_and_log(const struct list_node *list, const struct c2_state *state,
-                             const struct win *w, bool print_value) {
+                             struct win *w, bool print_value) {
 	void *rule_data = NULL;
 	c2_condition_list_foreach((struct list_node *)list, i) {
 		printf("    %s ... ", c2_condition_to_str(i));
@@ -100,7 +100,7 @@ static bool c2_match_and_log(const struct list_node *list, const struct c2_state
 }
 
 void inspect_dump_window(const struct c2_state *state, const struct options *opts,
-                         const struct win *w) {
+                         struct win *w) {
 	if (list_is_empty(&opts->rules)) {
 		printf("Checking " BOLD("transparent-clipping-exclude") ":\n");
 		c2_match_and_log(&opts->transparent_clipping_blacklist, state, w, false);
@@ -2,7 +2,12 @@
 // Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
 
 #include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,12 +27,54 @@
 
 thread_local struct log *tls_logger;
 
+/// Size of the ring buffer of a logger in async mode, in bytes.
+#define LOG_ASYNC_RING_SIZE (1024UL * 1024)
+/// In async mode, longer messages are truncated to this many bytes.
+#define LOG_ASYNC_MAX_MESSAGE 4096
+
 struct log_target;
 
+/// A message in the ring buffer of an async logger, followed by `len` bytes of
+/// message text.
+struct log_record {
+	/// Size of the record including the message and padding. Records are 8 bytes
+	/// aligned.
+	uint32_t size;
+	uint32_t len;
+	/// `LOG_LEVEL_INVALID` for padding at the end of the ring buffer.
+	int level;
+	const char *func;
+	struct timespec ts;
+};
+
+/// States of a logger in async mode.
+///
+/// The thread owning the logger is the only writer of the ring buffer, and the logging
+/// thread is the only reader, so neither of them takes a lock to access it. The log
+/// targets are only used by the logging thread, and `targets_mtx` is only taken when
+/// they are changed.
+struct log_async {
+	pthread_t thread;
+	char *buf;
+	/// Total number of bytes written to and read from the ring buffer.
+	atomic_size_t head, tail;
+	/// Number of messages dropped because the ring buffer was full.
+	atomic_uint_fast64_t dropped;
+	/// Whether the logging thread is waiting for `wakeup`.
+	atomic_bool waiting;
+	atomic_bool stop;
+	sem_t wakeup;
+	pthread_mutex_t targets_mtx;
+};
+
 struct log {
 	struct log_target *head;
 
 	int log_level;
+	/// Number of targets in `head` whose `log_ops::thread_bound` is set.
+	int thread_bound_targets;
+	/// Non-NULL if the logger is in async mode.
+	struct log_async *async;
 };
 
 struct log_target {
@@ -39,6 +86,10 @@ struct log_ops {
 	void (*write)(struct log_target *, const char *, size_t);
 	void (*writev)(struct log_target *, const struct iovec *, int vcnt);
 	void (*destroy)(struct log_target *);
+	/// Whether the target has to be written to on the thread the message is logged
+	/// on, e.g. because it uses that thread's GL context. In async mode, messages
+	/// are still written to such targets synchronously.
+	bool thread_bound;
 
 	/// Additional strings to print around the log_level string
 	const char *(*colorize_begin)(enum log_level);
@@ -106,32 +157,284 @@ struct log *log_new(void) {
 	auto ret = cmalloc(struct log);
 	ret->log_level = LOG_LEVEL_WARN;
 	ret->head = NULL;
+	ret->thread_bound_targets = 0;
+	ret->async = NULL;
 	return ret;
 }
 
 void log_add_target(struct log *l, struct log_target *tgt) {
 	assert(tgt->ops->writev);
+	if (l->async) {
+		pthread_mutex_lock(&l->async->targets_mtx);
+	}
 	tgt->next = l->head;
 	l->head = tgt;
+	if (tgt->ops->thread_bound) {
+		l->thread_bound_targets++;
+	}
+	if (l->async) {
+		pthread_mutex_unlock(&l->async->targets_mtx);
+	}
 }
 
 /// Remove a previously added log target for a log struct, and destroy it. If the log
 /// target was never added, nothing happens.
 void log_remove_target(struct log *l, struct log_target *tgt) {
+	if (l->async) {
+		pthread_mutex_lock(&l->async->targets_mtx);
+	}
 	struct log_target *now = l->head, **prev = &l->head;
 	while (now) {
 		if (now == tgt) {
 			*prev = now->next;
+			if (tgt->ops->thread_bound) {
+				l->thread_bound_targets--;
+			}
 			tgt->ops->destroy(tgt);
 			break;
 		}
 		prev = &now->next;
 		now = now->next;
 	}
+	if (l->async) {
+		pthread_mutex_unlock(&l->async->targets_mtx);
+	}
+}
+
+/// Which log targets `log_write` writes to.
+enum log_write_targets {
+	LOG_WRITE_ALL,
+	/// Only targets with `log_ops::thread_bound` set.
+	LOG_WRITE_THREAD_BOUND,
+	/// Only targets without `log_ops::thread_bound` set.
+	LOG_WRITE_UNBOUND,
+};
+
+/// Write a formatted message to the log targets of `l` selected by `targets`.
+static void log_write(struct log *l, enum log_write_targets targets, int level,
+                      const char *func, struct timespec ts, const char *msg, size_t len) {
+	struct tm now;
+	localtime_r(&ts.tv_sec, &now);
+	char time_buf[100];
+	size_t tlen = strftime(time_buf, sizeof time_buf, "%x %T", &now);
+	if (tlen == 0) {
+		return;
+	}
+	int ret = snprintf(time_buf + tlen, sizeof time_buf - tlen, ".%03ld",
+	                   ts.tv_nsec / 1000000);
+	if (ret < 0 || (size_t)ret >= sizeof time_buf - tlen) {
+		return;
+	}
+	tlen += (size_t)ret;
+
+	const char *log_level_str = log_level_to_string(level);
+	size_t llen = strlen(log_level_str);
+	size_t flen = strlen(func);
+
+	for (struct log_target *head = l->head; head; head = head->next) {
+		if ((targets == LOG_WRITE_THREAD_BOUND && !head->ops->thread_bound) ||
+		    (targets == LOG_WRITE_UNBOUND && head->ops->thread_bound)) {
+			continue;
+		}
+		const char *p = "", *s = "";
+		size_t plen = 0, slen = 0;
+
+		if (head->ops->colorize_begin) {
+			// construct target specific prefix
+			p = head->ops->colorize_begin(level);
+			plen = strlen(p);
+			if (head->ops->colorize_end) {
+				s = head->ops->colorize_end(level);
+				slen = strlen(s);
+			}
+		}
+		head->ops->writev(
+		    head,
+		    (struct iovec[]){{.iov_base = "[ ", .iov_len = 2},
+		                     {.iov_base = time_buf, .iov_len = tlen},
+		                     {.iov_base = " ", .iov_len = 1},
+		                     {.iov_base = (void *)func, .iov_len = flen},
+		                     {.iov_base = " ", .iov_len = 1},
+		                     {.iov_base = (void *)p, .iov_len = plen},
+		                     {.iov_base = (void *)log_level_str, .iov_len = llen},
+		                     {.iov_base = (void *)s, .iov_len = slen},
+		                     {.iov_base = " ] ", .iov_len = 3},
+		                     {.iov_base = (void *)msg, .iov_len = len},
+		                     {.iov_base = "\n", .iov_len = 1}},
+		    11);
+	}
+}
+
+/// Write out every message in the ring buffer. Called on the logging thread.
+static void log_async_drain(struct log *l) {
+	auto a = l->async;
+	pthread_mutex_lock(&a->targets_mtx);
+	size_t head = atomic_load_explicit(&a->head, memory_order_acquire);
+	size_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+	while (tail != head) {
+		size_t offset = tail % LOG_ASYNC_RING_SIZE;
+		if (LOG_ASYNC_RING_SIZE - offset < sizeof(struct log_record)) {
+			// No room for a record before the end, the writer wrapped around.
+			tail += LOG_ASYNC_RING_SIZE - offset;
+			continue;
+		}
+		auto record = (struct log_record *)(a->buf + offset);
+		if (record->level != LOG_LEVEL_INVALID) {
+			log_write(l, LOG_WRITE_UNBOUND, record->level, record->func,
+			          record->ts, (const char *)(record + 1), record->len);
+		}
+		tail += record->size;
+		// Free up the space as soon as possible.
+		atomic_store_explicit(&a->tail, tail, memory_order_release);
+	}
+	atomic_store_explicit(&a->tail, tail, memory_order_release);
+
+	uint64_t dropped = atomic_exchange(&a->dropped, 0);
+	if (dropped > 0) {
+		char msg[100];
+		int len = snprintf(msg, sizeof msg,
+		                   "%" PRIu64 " log messages were dropped because the "
+		                   "log buffer was full",
+		                   dropped);
+		struct timespec ts;
+		timespec_get(&ts, TIME_UTC);
+		log_write(l, LOG_WRITE_UNBOUND, LOG_LEVEL_WARN, __func__, ts, msg,
+		          min2((size_t)len, sizeof msg - 1));
+	}
+	pthread_mutex_unlock(&a->targets_mtx);
+}
+
+static void *log_async_thread(void *data) {
+	struct log *l = data;
+	auto a = l->async;
+	while (true) {
+		bool stop = atomic_load(&a->stop);
+		log_async_drain(l);
+		if (stop) {
+			break;
+		}
+
+		atomic_store(&a->waiting, true);
+		// Check again after announcing we are waiting, a message might have been
+		// written in between, and its writer didn't know it needed to wake us up.
+		if (atomic_load(&a->head) != atomic_load(&a->tail) ||
+		    atomic_load(&a->stop)) {
+			atomic_store(&a->waiting, false);
+			continue;
+		}
+		sem_wait(&a->wakeup);
+	}
+	return NULL;
+}
+
+/// Wait until the logging thread has written out everything in the ring buffer.
+static void log_async_flush(struct log *l) {
+	auto a = l->async;
+	size_t head = atomic_load(&a->head);
+	while (atomic_load_explicit(&a->tail, memory_order_acquire) < head) {
+		if (atomic_exchange(&a->waiting, false)) {
+			sem_post(&a->wakeup);
+		}
+		nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+	}
+}
+
+/// Copy a message into the ring buffer. The message is dropped if there isn't enough
+/// room.
+static void log_async_push(struct log *l, int level, const char *func,
+                           const char *fmt, va_list args) {
+	auto a = l->async;
+	char msg[LOG_ASYNC_MAX_MESSAGE];
+	int ret = vsnprintf(msg, sizeof msg, fmt, args);
+	if (ret < 0) {
+		return;
+	}
+	auto len = min2((size_t)ret, sizeof msg - 1);
+
+	size_t size = (sizeof(struct log_record) + len + 7UL) & ~7UL;
+	size_t head = atomic_load_explicit(&a->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+	size_t offset = head % LOG_ASYNC_RING_SIZE;
+	size_t skip = 0;
+	if (LOG_ASYNC_RING_SIZE - offset < size) {
+		// Records are never split, wrap around instead.
+		skip = LOG_ASYNC_RING_SIZE - offset;
+	}
+	if (head + skip + size - tail > LOG_ASYNC_RING_SIZE) {
+		atomic_fetch_add_explicit(&a->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	if (skip >= sizeof(struct log_record)) {
+		*(struct log_record *)(a->buf + offset) = (struct log_record){
+		    .size = (uint32_t)skip,
+		    .level = LOG_LEVEL_INVALID,
+		};
+	}
+
+	auto record = (struct log_record *)(a->buf + (head + skip) % LOG_ASYNC_RING_SIZE);
+	*record = (struct log_record){
+	    .size = (uint32_t)size,
+	    .len = (uint32_t)len,
+	    .level = level,
+	    .func = func,
+	};
+	timespec_get(&record->ts, TIME_UTC);
+	memcpy(record + 1, msg, len);
+
+	atomic_store(&a->head, head + skip + size);
+	if (atomic_exchange(&a->waiting, false)) {
+		sem_post(&a->wakeup);
+	}
+}
+
+bool log_enable_async(struct log *l) {
+	if (l->async) {
+		return true;
+	}
+	auto a = ccalloc(1, struct log_async);
+	a->buf = malloc(LOG_ASYNC_RING_SIZE);
+	allocchk(a->buf);
+	atomic_init(&a->head, 0);
+	atomic_init(&a->tail, 0);
+	atomic_init(&a->dropped, 0);
+	atomic_init(&a->waiting, false);
+	atomic_init(&a->stop, false);
+	sem_init(&a->wakeup, 0, 0);
+	pthread_mutex_init(&a->targets_mtx, NULL);
+	l->async = a;
+
+	// Signals should be handled by the main thread.
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int ret = pthread_create(&a->thread, NULL, log_async_thread, l);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (ret != 0) {
+		l->async = NULL;
+		pthread_mutex_destroy(&a->targets_mtx);
+		sem_destroy(&a->wakeup);
+		free(a->buf);
+		free(a);
+		return false;
+	}
+	return true;
 }
 
 /// Destroy a log struct and every log target added to it
 void log_destroy(struct log *l) {
+	if (l->async) {
+		// The logging thread writes out all the remaining messages before
+		// stopping.
+		atomic_store(&l->async->stop, true);
+		sem_post(&l->async->wakeup);
+		pthread_join(l->async->thread, NULL);
+		pthread_mutex_destroy(&l->async->targets_mtx);
+		sem_destroy(&l->async->wakeup);
+		free(l->async->buf);
+		free(l->async);
+		l->async = NULL;
+	}
+
 	// free all tgt
 	struct log_target *head = l->head;
 	while (head) {
@@ -158,9 +461,28 @@ attr_printf(4, 5) void log_printf(struct log *l, int level, const char *func,
 		return;
 	}
 
-	char *buf = NULL;
 	va_list args;
+	enum log_write_targets targets = LOG_WRITE_ALL;
+	if (l->async) {
+		if (level == LOG_LEVEL_FATAL) {
+			// picom is probably about to exit, make sure this message is
+			// written out, and that nothing is dropped in front of it.
+			log_async_flush(l);
+		}
+		va_start(args, fmt);
+		log_async_push(l, level, func, fmt, args);
+		va_end(args);
+		if (level == LOG_LEVEL_FATAL) {
+			log_async_flush(l);
+		}
+		if (l->thread_bound_targets == 0) {
+			return;
+		}
+		// Thread bound targets can't be written to by the logging thread.
+		targets = LOG_WRITE_THREAD_BOUND;
+	}
 
+	char *buf = NULL;
 	va_start(args, fmt);
 	int blen = vasprintf(&buf, fmt, args);
 	va_end(args);
@@ -172,54 +494,7 @@ attr_printf(4, 5) void log_printf(struct log *l, int level, const char *func,
 
 	struct timespec ts;
 	timespec_get(&ts, TIME_UTC);
-	struct tm now;
-	localtime_r(&ts.tv_sec, &now);
-	char time_buf[100];
-	strftime(time_buf, sizeof time_buf, "%x %T", &now);
-
-	char *time = NULL;
-	int tlen = asprintf(&time, "%s.%03ld", time_buf, ts.tv_nsec / 1000000);
-	if (tlen < 0 || !time) {
-		free(buf);
-		free(time);
-		return;
-	}
-
-	const char *log_level_str = log_level_to_string(level);
-	size_t llen = strlen(log_level_str);
-	size_t flen = strlen(func);
-
-	struct log_target *head = l->head;
-	while (head) {
-		const char *p = "", *s = "";
-		size_t plen = 0, slen = 0;
-
-		if (head->ops->colorize_begin) {
-			// construct target specific prefix
-			p = head->ops->colorize_begin(level);
-			plen = strlen(p);
-			if (head->ops->colorize_end) {
-				s = head->ops->colorize_end(level);
-				slen = strlen(s);
-			}
-		}
-		head->ops->writev(
-		    head,
-		    (struct iovec[]){{.iov_base = "[ ", .iov_len = 2},
-		                     {.iov_base = time, .iov_len = (size_t)tlen},
-		                     {.iov_base = " ", .iov_len = 1},
-		                     {.iov_base = (void *)func, .iov_len = flen},
-		                     {.iov_base = " ", .iov_len = 1},
-		                     {.iov_base = (void *)p, .iov_len = plen},
-		                     {.iov_base = (void *)log_level_str, .iov_len = llen},
-		                     {.iov_base = (void *)s, .iov_len = slen},
-		                     {.iov_base = " ] ", .iov_len = 3},
-		                     {.iov_base = buf, .iov_len = (size_t)blen},
-		                     {.iov_base = "\n", .iov_len = 1}},
-		    11);
-		head = head->next;
-	}
-	free(time);
+	log_write(l, targets, level, func, ts, buf, (size_t)blen);
 	free(buf);
 }
 
@@ -353,6 +628,9 @@ static const struct log_ops gl_string_marker_logger_ops = {
     .write = gl_string_marker_logger_write,
     .writev = log_default_writev,
     .destroy = logger_trivial_destroy,
+    // glStringMarkerGREMEDY needs the GL context current on the logging thread, and
+    // the marker has to be at the right place in the GL command stream.
+    .thread_bound = true,
 };
 
 /// Create an opengl logger that can be used for logging into opengl debugging tools,
@@ -373,4 +651,85 @@ struct log_target *gl_string_marker_logger_new(void) {
 }
 #endif
 
+/// A log target that collects everything written to it, for testing.
+struct test_logger {
+	struct log_target tgt;
+	char buf[4096];
+	size_t len;
+	/// The thread messages are expected to be written on, for thread bound targets.
+	pthread_t thread;
+	bool wrong_thread;
+};
+
+static void
+test_logger_writev(struct log_target *tgt, const struct iovec *vec, int vcnt) {
+	auto t = (struct test_logger *)tgt;
+	if (tgt->ops->thread_bound && !pthread_equal(pthread_self(), t->thread)) {
+		t->wrong_thread = true;
+	}
+	for (int i = 0; i < vcnt; i++) {
+		auto len = min2(vec[i].iov_len, sizeof(t->buf) - t->len - 1);
+		memcpy(t->buf + t->len, vec[i].iov_base, len);
+		t->len += len;
+	}
+	t->buf[t->len] = '\0';
+}
+
+static void test_logger_destroy(struct log_target *tgt attr_unused) {
+}
+
+static const struct log_ops test_logger_ops = {
+    .writev = test_logger_writev,
+    .destroy = test_logger_destroy,
+};
+
+static const struct log_ops test_thread_bound_logger_ops = {
+    .writev = test_logger_writev,
+    .destroy = test_logger_destroy,
+    .thread_bound = true,
+};
+
+TEST_CASE(log_async) {
+	static struct test_logger t = {.tgt.ops = &test_logger_ops};
+	auto l = log_new();
+	log_add_target(l, &t.tgt);
+	TEST_TRUE(log_enable_async(l));
+	for (int i = 0; i < 3; i++) {
+		log_printf(l, LOG_LEVEL_WARN, "test", "message %d", i);
+	}
+	log_printf(l, LOG_LEVEL_DEBUG, "test", "filtered");
+	// Destroying the logger writes out everything still in the ring buffer.
+	log_destroy(l);
+
+	auto first = strstr(t.buf, "message 0");
+	TEST_NOTEQUAL(first, NULL);
+	auto second = strstr(first, "message 1");
+	TEST_NOTEQUAL(second, NULL);
+	TEST_NOTEQUAL(strstr(second, "message 2"), NULL);
+	TEST_EQUAL(strstr(t.buf, "filtered"), NULL);
+}
+
+TEST_CASE(log_async_thread_bound) {
+	static struct test_logger t = {.tgt.ops = &test_logger_ops};
+	static struct test_logger bound = {.tgt.ops = &test_thread_bound_logger_ops};
+	bound.thread = pthread_self();
+	auto l = log_new();
+	log_add_target(l, &t.tgt);
+	log_add_target(l, &bound.tgt);
+	TEST_TRUE(log_enable_async(l));
+	log_printf(l, LOG_LEVEL_WARN, "test", "message");
+	// Thread bound targets are written to before log_printf returns, on the
+	// calling thread.
+	TEST_NOTEQUAL(strstr(bound.buf, "message"), NULL);
+	log_destroy(l);
+
+	TEST_TRUE(!bound.wrong_thread);
+	TEST_NOTEQUAL(strstr(t.buf, "message"), NULL);
+	// Messages are written to each target once.
+	auto first = strstr(bound.buf, "message");
+	TEST_EQUAL(strstr(first + 1, "message"), NULL);
+	first = strstr(t.buf, "message");
+	TEST_EQUAL(strstr(first + 1, "message"), NULL);
+}
+
 // vim: set noet sw=8 ts=8:
@@ -4,6 +4,7 @@
 #pragma once
 #include <assert.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "compiler.h"
@@ -66,6 +67,11 @@ attr_pure int string_to_log_level(const char *);
 /// Remove a previously added log target for a log struct, and destroy it. If the log
 /// target was never added, nothing happens.
 void log_remove_target(struct log *l, struct log_target *tgt);
+/// Switch a log struct to async mode. Logging a message then only formats it into a
+/// ring buffer, and a background thread adds the timestamps and writes the messages to
+/// the log targets. Messages are dropped if the ring buffer is full. Returns false if
+/// the background thread can't be started.
+attr_nonnull_all bool log_enable_async(struct log *l);
 
 extern thread_local struct log *tls_logger;
 
@@ -88,6 +94,11 @@ static inline attr_nonnull_all void log_remove_target_tls(struct log_target *tgt
 	log_remove_target(tls_logger, tgt);
 }
 
+static inline bool log_enable_async_tls(void) {
+	assert(tls_logger);
+	return log_enable_async(tls_logger);
+}
+
 static inline attr_pure enum log_level log_get_level_tls(void) {
 	assert(tls_logger);
 	return log_get_level(tls_logger);
@@ -454,6 +454,8 @@ static const struct picom_option picom_options[] = {
                                                                              "other issues. Disable this if you see the compositor being killed."},
     [805] = {"monitor"                  , ENABLE(inspect_monitor)          , "For picom-inspect, run in a loop and dump information every time something "
                                                                              "changed about a window.", "picom-inspect"},
+    [807] = {"log-async"                , ENABLE(log_async)                , "Format and write logs on a background thread. Reduces the cost of verbose "
+                                                                             "logging, but messages are dropped if they are logged too quickly."},
 
     // Flags that takes an argument
     ['r'] = {"shadow-radius"               , INTEGER(shadow_radius, 0, INT_MAX)             , "The blur radius for shadows. (default 12)"},
@@ -473,6 +475,8 @@ static const struct picom_option picom_options[] = {
     [302] = {"resize-damage"               , WARN_DEPRECATED(INTEGER(resize_damage, INT_MIN, INT_MAX))},       // only used by legacy backends
     [309] = {"unredir-if-possible-delay"   , INTEGER(unredir_if_possible_delay, 0, INT_MAX) , "Delay before unredirecting the window, in milliseconds. Defaults to 0."},
     [310] = {"write-pid-path"              , NAMED_STRING(write_pid_path, "PATH")           , "Write process ID to a file."},
+    [806] = {"record-events"               , NAMED_STRING(record_events_path, "PATH")       , "Record all received X events and replies into a binary trace file, for "
+                                                                                              "offline profiling."},
     [322] = {"log-file"                    , STRING(logpath)                                , "Path to the log file."},
     [326] = {"max-brightness"              , FLOAT(max_brightness, 0, 1)                    , "Dims windows which average brightness is above this threshold. Requires "
                                                                                               "--no-use-damage. (default: 1.0, meaning no dimming)"},
@@ -942,6 +946,32 @@ void options_postprocess_c2_lists(struct c2_state *state, struct x_connection *c
 	}
 }
 
+void options_move(struct options *dst, struct options *src) {
+	*dst = *src;
+	struct list_node *lists[][2] = {
+	    {&dst->included_config_files, &src->included_config_files},
+	    {&dst->unredir_if_possible_blacklist, &src->unredir_if_possible_blacklist},
+	    {&dst->paint_blacklist, &src->paint_blacklist},
+	    {&dst->shadow_blacklist, &src->shadow_blacklist},
+	    {&dst->shadow_clip_list, &src->shadow_clip_list},
+	    {&dst->fade_blacklist, &src->fade_blacklist},
+	    {&dst->blur_background_blacklist, &src->blur_background_blacklist},
+	    {&dst->invert_color_list, &src->invert_color_list},
+	    {&dst->window_shader_fg_rules, &src->window_shader_fg_rules},
+	    {&dst->opacity_rules, &src->opacity_rules},
+	    {&dst->rounded_corners_blacklist, &src->rounded_corners_blacklist},
+	    {&dst->corner_radius_rules, &src->corner_radius_rules},
+	    {&dst->focus_blacklist, &src->focus_blacklist},
+	    {&dst->transparent_clipping_blacklist, &src->transparent_clipping_blacklist},
+	    {&dst->rules, &src->rules},
+	};
+	for (size_t i = 0; i < ARR_SIZE(lists); i++) {
+		// The nodes of the lists still point to the heads in `src`.
+		list_init_head(lists[i][0]);
+		list_splice(lists[i][1], lists[i][0]);
+	}
+}
+
 static void free_window_maybe_options(void *data) {
 	auto wopts = (struct window_maybe_options *)data;
 	free((void *)wopts->shader);
@@ -968,6 +998,7 @@ void options_destroy(struct options *options) {
 	free(options->config_file_path);
 	free(options->write_pid_path);
 	free(options->logpath);
+	free(options->record_events_path);
 
 	for (int i = 0; i < options->blur_kernel_count; ++i) {
 		free(options->blur_kerns[i]);
@@ -34,5 +34,9 @@ bool must_use get_cfg(options_t *opt, int argc, char *const *argv);
 void options_postprocess_c2_lists(struct c2_state *state, struct x_connection *c,
                                   struct options *option);
 void options_destroy(struct options *options);
+/// Move the options in `src` to `dst`, which must not hold any options. Options can't
+/// be copied by assignment, because the nodes of the lists in them point to the list
+/// heads. `src` must not be destroyed afterwards.
+void options_move(struct options *dst, struct options *src);
 
 // vim: set noet sw=8 ts=8:
@@ -53,11 +53,14 @@
 #include "log.h"
 #include "options.h"
 #include "picom.h"
+#include "recorder.h"
 #include "region.h"
 #include "renderer/command_builder.h"
 #include "renderer/layout.h"
 #include "renderer/renderer.h"
+#include "utils/dynarr.h"
 #include "utils/file_watch.h"
+#include "utils/kernel.h"
 #include "utils/list.h"
 #include "utils/misc.h"
 #include "utils/process.h"
@@ -77,6 +80,9 @@
 		(session_t *)((char *)__mptr - offsetof(session_t, member));             \
 	})
 
+/// How long to wait after the config file changed before reloading it, in seconds.
+#define CONFIG_RELOAD_DELAY 0.2
+
 static bool must_use redirect_start(session_t *ps);
 
 static void unredirect(session_t *ps);
@@ -142,9 +148,10 @@ enum vblank_callback_action check_render_finish(struct vblank_event *e attr_unus
 	}
 
 	// The frame has been finished and presented, record its render time.
+	int render_time_us =
+	    (int)(render_time.tv_sec * 1000000L + render_time.tv_nsec / 1000L);
+	frame_timing_ring_set_gpu_time(&ps->frame_timings, (uint32_t)render_time_us);
 	if (global_debug_options.smart_frame_pacing) {
-		int render_time_us =
-		    (int)(render_time.tv_sec * 1000000L + render_time.tv_nsec / 1000L);
 		render_statistics_add_render_time_sample(
 		    &ps->render_stats, render_time_us + (int)ps->last_schedule_delay);
 		log_verbose("Last render call took: %d (gpu) + %d (cpu) us, "
@@ -522,6 +529,39 @@ static bool initialize_blur(session_t *ps) {
 	return ps->backend_blur_context != NULL;
 }
 
+/// Create backend shaders for the loaded shader sources that don't have one yet.
+static void create_backend_shaders(session_t *ps) {
+	if (!ps->backend_data->ops.create_shader) {
+		if (ps->shaders) {
+			log_warn("Shaders are not supported by selected backend %s, "
+			         "they will be ignored",
+			         backend_name(ps->o.backend));
+		}
+		return;
+	}
+	HASH_ITER2(ps->shaders, shader) {
+		if (shader->backend_shader != NULL) {
+			continue;
+		}
+		shader->backend_shader =
+		    ps->backend_data->ops.create_shader(ps->backend_data, shader->source);
+		if (shader->backend_shader == NULL) {
+			log_warn("Failed to create shader for shader file %s, this shader "
+			         "will not be used",
+			         shader->key);
+		} else {
+			shader->attributes = 0;
+			if (ps->backend_data->ops.get_shader_attributes) {
+				shader->attributes =
+				    ps->backend_data->ops.get_shader_attributes(
+				        ps->backend_data, shader->backend_shader);
+			}
+			log_debug("Shader %s has attributes %" PRIu64, shader->key,
+			          shader->attributes);
+		}
+	}
+}
+
 /// Init the backend and bind all the window pixmap to backend images
 static bool initialize_backend(session_t *ps) {
 	assert(!ps->backend_data);
@@ -539,32 +579,7 @@ static bool initialize_backend(session_t *ps) {
 		goto err;
 	}
 
-	// Create shaders
-	if (!ps->backend_data->ops.create_shader && ps->shaders) {
-		log_warn("Shaders are not supported by selected backend %s, "
-		         "they will be ignored",
-		         backend_name(ps->o.backend));
-	} else {
-		HASH_ITER2(ps->shaders, shader) {
-			assert(shader->backend_shader == NULL);
-			shader->backend_shader = ps->backend_data->ops.create_shader(
-			    ps->backend_data, shader->source);
-			if (shader->backend_shader == NULL) {
-				log_warn("Failed to create shader for shader "
-				         "file %s, this shader will not be used",
-				         shader->key);
-			} else {
-				shader->attributes = 0;
-				if (ps->backend_data->ops.get_shader_attributes) {
-					shader->attributes =
-					    ps->backend_data->ops.get_shader_attributes(
-					        ps->backend_data, shader->backend_shader);
-				}
-				log_debug("Shader %s has attributes %" PRIu64,
-				          shader->key, shader->attributes);
-			}
-		}
-	}
+	create_backend_shaders(ps);
 
 	wm_stack_foreach(ps->wm, cursor) {
 		auto w = wm_ref_deref(cursor);
@@ -658,31 +673,95 @@ void configure_root(session_t *ps) {
 	force_repaint(ps);
 }
 
-/**
- * Go through the window stack and calculate some parameters for rendering.
- *
- * @return whether the operation succeeded
- */
-static bool paint_preprocess(session_t *ps, bool *animation, struct win **out_bottom) {
+/// Whether window `w` is opaque everywhere inside its bounding shape, without its
+/// rounded corners, and is drawn exactly there. So it hides everything below it.
+static bool win_is_occluder(const session_t *ps, const struct win *w,
+                            const struct window_options *opts, double opacity) {
+	return w->state == WSTATE_MAPPED && w->running_animation_instance == NULL &&
+	       w->win_image != NULL && w->mode == WMODE_SOLID && opacity == 1 &&
+	       !ps->o.force_win_blend && opts->shader == NULL;
+}
+
+/// Whether everything drawn for window `w`, i.e. its body, its shadow and its blurred
+/// background, is inside `covered`. Animations are taken into account.
+static bool win_is_occluded(struct win *w, const struct window_options *opts,
+                            region_t *covered) {
+	if (!pixman_region32_not_empty(covered)) {
+		return false;
+	}
+	if (opts->clip_shadow_above) {
+		// This window clips the shadows of windows above it, even where itself is
+		// covered.
+		return false;
+	}
+
+	vec2 scale = {
+	    .x = win_animatable_get(w, WIN_SCRIPT_SCALE_X),
+	    .y = win_animatable_get(w, WIN_SCRIPT_SCALE_Y),
+	};
+	auto origin =
+	    vec2_as((vec2){.x = w->g.x + win_animatable_get(w, WIN_SCRIPT_OFFSET_X),
+	                   .y = w->g.y + win_animatable_get(w, WIN_SCRIPT_OFFSET_Y)});
+	auto size = ivec2_scale_ceil((ivec2){w->widthb, w->heightb}, scale);
+	rect_t body = {
+	    .x1 = origin.x,
+	    .y1 = origin.y,
+	    .x2 = origin.x + size.width,
+	    .y2 = origin.y + size.height,
+	};
+	if (pixman_region32_contains_rectangle(covered, &body) != PIXMAN_REGION_IN) {
+		return false;
+	}
+	if (!opts->shadow) {
+		return true;
+	}
+
+	scale = (vec2){
+	    .x = win_animatable_get(w, WIN_SCRIPT_SHADOW_SCALE_X),
+	    .y = win_animatable_get(w, WIN_SCRIPT_SHADOW_SCALE_Y),
+	};
+	origin = vec2_as(
+	    (vec2){.x = w->g.x + w->shadow_dx + win_animatable_get(w, WIN_SCRIPT_SHADOW_OFFSET_X),
+	           .y = w->g.y + w->shadow_dy + win_animatable_get(w, WIN_SCRIPT_SHADOW_OFFSET_Y)});
+	size = ivec2_scale_ceil((ivec2){w->shadow_width, w->shadow_height}, scale);
+	rect_t shadow = {
+	    .x1 = origin.x,
+	    .y1 = origin.y,
+	    .x2 = origin.x + size.width,
+	    .y2 = origin.y + size.height,
+	};
+	return pixman_region32_contains_rectangle(covered, &shadow) == PIXMAN_REGION_IN;
+}
+
+/// Go through the window stack and calculate some parameters for rendering: decide
+/// which windows to paint, and whether to (un)redirect the screen.
+///
+/// @param[out] animation set if animations are running for windows that are visible,
+///                       or that might be moved into view by their animations, so the
+///                       screen needs to be rendered again.
+/// @param[out] occluded_animation_left
+///                       if windows that are fully covered have animations running, how
+///                       many seconds until the first of them finishes. INFINITY
+///                       otherwise.
+/// @return whether the operation succeeded
+static bool paint_preprocess(session_t *ps, bool *animation,
+                             double *occluded_animation_left, struct win **out_bottom) {
 	// XXX need better, more general name for `fade_running`. It really
 	// means if fade is still ongoing after the current frame is rendered
 	struct win *bottom = NULL;
 	*animation = false;
+	*occluded_animation_left = INFINITY;
 	*out_bottom = NULL;
 
 	// First, let's process fading, and animated shaders
-	// TODO(yshui) check if a window is fully obscured, and if we don't need to
-	//             process fading or animation for it.
 	wm_stack_foreach_safe(ps->wm, cursor, tmp) {
 		auto w = wm_ref_deref(cursor);
 		if (w == NULL) {
 			continue;
 		}
 
-		if (w->running_animation_instance != NULL) {
-			*animation = true;
-		}
-
+		auto old_frame_opacity = w->frame_opacity;
+		auto old_mode = w->mode;
 		if (win_has_frame(w)) {
 			w->frame_opacity = ps->o.frame_opacity;
 		} else {
@@ -691,6 +770,9 @@ static bool paint_preprocess(session_t *ps, bool *animation, struct win **out_bo
 
 		// Update window mode
 		w->mode = win_calc_mode(w);
+		if (w->frame_opacity != old_frame_opacity || w->mode != old_mode) {
+			win_mark_layout_dirty(w);
+		}
 	}
 
 	// Opacity will not change, from this point onwards.
@@ -698,6 +780,10 @@ static bool paint_preprocess(session_t *ps, bool *animation, struct win **out_bo
 	bool unredir_possible = false;
 	// Track whether it's the highest window to paint
 	bool is_highest = true;
+	// Region of the screen covered by opaque windows above the current window. Windows
+	// entirely inside of it are not visible, so we don't need to render them.
+	region_t covered;
+	pixman_region32_init(&covered);
 	wm_stack_foreach_safe(ps->wm, cursor, next_cursor) {
 		__label__ skip_window;
 		auto w = wm_ref_deref(cursor);
@@ -737,6 +823,9 @@ static bool paint_preprocess(session_t *ps, bool *animation, struct win **out_bo
 		} else if (!w->ever_damaged) {
 			log_trace("|- has not received any damages");
 			to_paint = false;
+		} else if (w->awaiting_properties) {
+			log_trace("|- is waiting for its properties");
+			to_paint = false;
 		} else if (unlikely(w->g.x + w->g.width < 1 || w->g.y + w->g.height < 1 ||
 		                    w->g.x >= ps->root_width || w->g.y >= ps->root_height)) {
 			log_trace("|- is positioned outside of the screen");
@@ -759,12 +848,37 @@ static bool paint_preprocess(session_t *ps, bool *animation, struct win **out_bo
 		// log_trace("%s %d %d %d", w->name, to_paint, w->opacity,
 		// w->paint_excluded);
 
+		bool occluded = to_paint && win_is_occluded(w, &window_options, &covered);
+		if (occluded != w->occluded) {
+			w->occluded = occluded;
+			win_mark_layout_dirty(w);
+		}
+		if (w->running_animation_instance != NULL) {
+			// A covered window can be brought into view by its own animation,
+			// so its animation has to be rendered to recheck occlusion.
+			if (!occluded || win_animation_can_move(w)) {
+				*animation = true;
+			} else {
+				auto left = win_animation_time_left(w);
+				*occluded_animation_left =
+				    min2(*occluded_animation_left, left);
+			}
+		}
+
 		// to_paint will never change after this point
 		if (!to_paint) {
 			log_trace("|- will not be painted");
 			goto skip_window;
 		}
 
+		if (occluded) {
+			log_trace("|- is fully covered by windows above");
+		} else if (win_is_occluder(ps, w, &window_options, window_opacity)) {
+			auto shape = win_get_bounding_shape_global_without_corners_by_val(w);
+			pixman_region32_union(&covered, &covered, &shape);
+			pixman_region32_fini(&shape);
+		}
+
 		log_trace("|- will be painted");
 		log_verbose("Window %#010x (%s) will be painted", win_id(w), w->name);
 
@@ -812,6 +926,7 @@ static bool paint_preprocess(session_t *ps, bool *animation, struct win **out_bo
 			w->to_paint = to_paint;
 		}
 	}
+	pixman_region32_fini(&covered);
 
 	// If possible, unredirect all windows and stop painting
 	if (ps->o.redirected_force != UNSET) {
@@ -887,10 +1002,11 @@ void root_damaged(session_t *ps) {
 			    r->depth == ps->c.screen_info->root_depth
 			        ? ps->c.screen_info->root_visual
 			        : x_get_visual_for_depth(ps->c.screen_info, r->depth);
+			ivec2 size = {.width = r->width, .height = r->height};
 			free(r);
 
 			ps->root_image = ps->backend_data->ops.bind_pixmap(
-			    ps->backend_data, pixmap, x_get_visual_info(&ps->c, visual));
+			    ps->backend_data, pixmap, size, x_get_visual_info(&ps->c, visual));
 			ps->root_image_generation += 1;
 			if (!ps->root_image) {
 			err:
@@ -1311,6 +1427,12 @@ static void handle_x_events(struct session *ps) {
 			free(ev);
 		};
 
+		// All DamageNotify received in this batch of events are coalesced into one
+		// fetch per window.
+		if (ev_fetch_pending_damage(ps)) {
+			needs_flush = true;
+		}
+
 		if (ps->c.latest_completed_request != latest_completed) {
 			needs_flush = true;
 			latest_completed = ps->c.latest_completed_request;
@@ -1504,6 +1626,30 @@ static void tmout_unredir_callback(EV_P attr_unused, ev_timer *w, int revents at
 	queue_redraw(ps);
 }
 
+static void
+occluded_animation_callback(EV_P attr_unused, ev_timer *w, int revents attr_unused) {
+	session_t *ps = session_ptr(w, occluded_animation_timer);
+	queue_redraw(ps);
+}
+
+/// Wrap up the animation of `w`, and finish its unmapping or destruction if that's what
+/// the animation was for. `w` is freed if it was destroyed.
+static void finish_win_animation(session_t *ps, struct win *w) {
+	win_mark_layout_dirty(w);
+	free(w->running_animation_instance);
+	w->running_animation_instance = NULL;
+	w->in_openclose = false;
+	w->save_win_image_on_rebind = false;
+	if (w->saved_win_image != NULL) {
+		win_release_saved_win_image(ps->backend_data, w);
+	}
+	if (w->state == WSTATE_UNMAPPED) {
+		unmap_win_finish(ps, w);
+	} else if (w->state == WSTATE_DESTROYED) {
+		win_destroy_finish(ps, w);
+	}
+}
+
 static void handle_pending_updates(struct session *ps, double delta_t) {
 	// Process new windows, and maybe allocate struct managed_win for them
 	handle_new_windows(ps);
@@ -1523,17 +1669,7 @@ static void handle_pending_updates(struct session *ps, double delta_t) {
 		// Window might be freed by this function, if it's destroyed and its
 		// animation finished
 		if (w != NULL && win_process_animation_and_state_change(ps, w, delta_t)) {
-			free(w->running_animation_instance);
-			w->running_animation_instance = NULL;
-			w->in_openclose = false;
-			if (w->saved_win_image != NULL) {
-				win_release_saved_win_image(ps->backend_data, w);
-			}
-			if (w->state == WSTATE_UNMAPPED) {
-				unmap_win_finish(ps, w);
-			} else if (w->state == WSTATE_DESTROYED) {
-				win_destroy_finish(ps, w);
-			}
+			finish_win_animation(ps, w);
 		}
 	}
 
@@ -1643,9 +1779,10 @@ static void draw_callback_impl(EV_P_ session_t *ps, int revents attr_unused) {
 	 * screen is not redirected. its sole purpose should be to decide whether the
 	 * screen should be redirected. */
 	bool animation = false;
+	double occluded_animation_left = INFINITY;
 	bool was_redirected = ps->redirected;
 	struct win *bottom = NULL;
-	if (!paint_preprocess(ps, &animation, &bottom)) {
+	if (!paint_preprocess(ps, &animation, &occluded_animation_left, &bottom)) {
 		log_fatal("Pre-render preparation has failed, exiting...");
 		exit(1);
 	}
@@ -1724,6 +1861,20 @@ static void draw_callback_impl(EV_P_ session_t *ps, int revents attr_unused) {
 			log_fatal("Render failure");
 			abort();
 		}
+		now = get_time_timespec();
+		auto render_end_us =
+		    (uint64_t)now.tv_sec * 1000000UL + (uint64_t)now.tv_nsec / 1000;
+		frame_timing_ring_push(
+		    &ps->frame_timings,
+		    (uint32_t[NUM_OF_FRAME_TIMING_STAGES]){
+		        [FRAME_TIMING_STAGE_UPDATES] = (uint32_t)(after_handle_pending_updates_us -
+		                                                  draw_callback_enter_us),
+		        [FRAME_TIMING_STAGE_PREPROCESS] =
+		            (uint32_t)(after_preprocess_us - after_handle_pending_updates_us),
+		        [FRAME_TIMING_STAGE_DAMAGE] = (uint32_t)(after_damage_us - render_start_us),
+		        [FRAME_TIMING_STAGE_RENDER] = (uint32_t)(render_end_us - after_damage_us),
+		        [FRAME_TIMING_STAGE_GPU] = FRAME_TIMING_UNKNOWN,
+		    });
 		did_render = true;
 		if (ps->next_render > 0) {
 			log_verbose("Render schedule deviation: %ld us (%s) %" PRIu64
@@ -1761,8 +1912,15 @@ static void draw_callback_impl(EV_P_ session_t *ps, int revents attr_unused) {
 
 	// Queue redraw if animation is running. This should be picked up by next present
 	// event.
+	ev_timer_stop(ps->loop, &ps->occluded_animation_timer);
 	if (animation) {
 		queue_redraw(ps);
+	} else if (isfinite(occluded_animation_left)) {
+		// The only animations running are for windows that are fully covered,
+		// there is nothing to render until they finish. Keep `fade_time`, so the
+		// time that passes is accounted for in the next frame.
+		ev_timer_set(&ps->occluded_animation_timer, occluded_animation_left, 0);
+		ev_timer_start(ps->loop, &ps->occluded_animation_timer);
 	} else {
 		ps->fade_time = 0L;
 	}
@@ -1807,7 +1965,9 @@ static void x_event_callback(EV_P attr_unused, ev_io *w, int revents attr_unused
 
 static void config_file_change_cb(void *_ps) {
 	auto ps = (struct session *)_ps;
-	reset_enable(ps->loop, NULL, 0);
+	// The watches can't be recreated from inside their callback, and the file might
+	// be written in several steps, so reload a bit later.
+	ev_timer_again(ps->loop, &ps->config_reload_timer);
 }
 
 static bool load_shader_source(session_t *ps, const char *path) {
@@ -1862,6 +2022,52 @@ err:
 	return true;
 }
 
+/// Load the source of the shaders used by options `o`, the ones already loaded are
+/// reused.
+static void load_shaders(session_t *ps, const struct options *o) {
+	// Load shader source file specified in the shader rules
+	c2_condition_list_foreach(&o->window_shader_fg_rules, i) {
+		if (!load_shader_source(ps, c2_condition_get_data(i))) {
+			log_error("Failed to load shader source file for some of the "
+			          "window shader rules");
+		}
+	}
+	if (load_shader_source(ps, o->window_shader_fg)) {
+		log_error("Failed to load window shader source file");
+	}
+
+	c2_condition_list_foreach(&o->rules, i) {
+		auto data = (struct window_maybe_options *)c2_condition_get_data(i);
+		if (data->shader == NULL) {
+			continue;
+		}
+		if (load_shader_source(ps, data->shader)) {
+			log_error("Failed to load shader source file for window rules");
+		}
+	}
+
+	if (log_get_level_tls() <= LOG_LEVEL_DEBUG) {
+		HASH_ITER2(ps->shaders, shader) {
+			log_debug("Shader %s:", shader->key);
+			log_debug("%s", shader->source);
+		}
+	}
+}
+
+/// Free all the loaded shaders, and their backend shaders if there are any.
+static void free_shaders(session_t *ps) {
+	HASH_ITER2(ps->shaders, shader) {
+		HASH_DEL(ps->shaders, shader);
+		if (shader->backend_shader != NULL) {
+			ps->backend_data->ops.destroy_shader(ps->backend_data,
+			                                     shader->backend_shader);
+		}
+		free(shader->source);
+		free(shader->key);
+		free(shader);
+	}
+}
+
 static struct window_options win_options_from_config(const struct options *opts) {
 	struct window_options ret = {
 	    .blur_background = opts->blur_method != BLUR_METHOD_NONE,
@@ -1882,6 +2088,223 @@ static struct window_options win_options_from_config(const struct options *opts)
 	return ret;
 }
 
+static bool path_changed(const char *a, const char *b) {
+	if (a == NULL || b == NULL) {
+		return a != b;
+	}
+	return strcmp(a, b) != 0;
+}
+
+/// Whether switching from options `old` to `new` needs a full reset of the session,
+/// because the options that differ are only used when the session is set up.
+static bool options_need_reset(const struct options *old, const struct options *new) {
+	return old->backend != new->backend ||
+	       old->use_legacy_backends != new->use_legacy_backends ||
+	       old->vsync != new->vsync ||
+	       old->vsync_use_glfinish != new->vsync_use_glfinish ||
+	       old->dithered_present != new->dithered_present ||
+	       old->frame_pacing != new->frame_pacing || old->dbus != new->dbus ||
+	       old->debug_mode != new->debug_mode ||
+	       old->monitor_repaint != new->monitor_repaint ||
+	       old->benchmark != new->benchmark ||
+	       old->benchmark_wid != new->benchmark_wid ||
+	       path_changed(old->logpath, new->logpath) ||
+	       old->log_async != new->log_async ||
+	       path_changed(old->record_events_path, new->record_events_path) ||
+	       path_changed(old->write_pid_path, new->write_pid_path) ||
+	       old->use_realtime_scheduling != new->use_realtime_scheduling ||
+	       old->no_x_selection != new->no_x_selection ||
+	       old->xrender_sync_fence != new->xrender_sync_fence ||
+	       old->crop_shadow_to_monitor != new->crop_shadow_to_monitor ||
+	       old->detect_transient != new->detect_transient ||
+	       old->detect_client_leader != new->detect_client_leader ||
+	       old->track_leader != new->track_leader ||
+	       old->use_ewmh_active_win != new->use_ewmh_active_win;
+}
+
+static bool blur_options_changed(const struct options *old, const struct options *new) {
+	if (old->blur_method != new->blur_method || old->blur_radius != new->blur_radius ||
+	    old->blur_deviation != new->blur_deviation ||
+	    old->blur_strength != new->blur_strength ||
+	    old->blur_kernel_count != new->blur_kernel_count) {
+		return true;
+	}
+	for (int i = 0; i < old->blur_kernel_count; i++) {
+		auto a = old->blur_kerns[i];
+		auto b = new->blur_kerns[i];
+		if (a->w != b->w || a->h != b->h ||
+		    memcmp(a->data, b->data, sizeof(double) * (size_t)(a->w * a->h))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool shadow_options_changed(const struct options *old, const struct options *new) {
+	return old->shadow_radius != new->shadow_radius ||
+	       old->shadow_offset_x != new->shadow_offset_x ||
+	       old->shadow_offset_y != new->shadow_offset_y ||
+	       old->shadow_opacity != new->shadow_opacity ||
+	       old->shadow_red != new->shadow_red ||
+	       old->shadow_green != new->shadow_green ||
+	       old->shadow_blue != new->shadow_blue;
+}
+
+/// Watch the config file and the files it includes for changes.
+static void watch_config_files(session_t *ps) {
+	if (!ps->o.config_file_path) {
+		return;
+	}
+	ps->file_watch_handle = file_watch_init(ps->loop);
+	if (!ps->file_watch_handle) {
+		return;
+	}
+	file_watch_add(ps->file_watch_handle, ps->o.config_file_path,
+	               config_file_change_cb, ps);
+	list_foreach(struct included_config_file, i, &ps->o.included_config_files,
+	             siblings) {
+		file_watch_add(ps->file_watch_handle, i->path, config_file_change_cb, ps);
+	}
+}
+
+/// Parse the configuration again, and apply it without tearing down the session. If
+/// options that are only used when the session is set up changed, the session is
+/// reset instead.
+static void reload_config(session_t *ps) {
+	log_info("Config file changed, reloading...");
+
+	struct options new_opt;
+	bool parsed = parse_config(&new_opt, ps->config_file);
+	if (parsed && !get_cfg(&new_opt, ps->argc, ps->argv)) {
+		parsed = false;
+	}
+	if (!parsed) {
+		log_error("Failed to parse the new configuration, keeping the current "
+		          "one.");
+		options_destroy(&new_opt);
+		free(new_opt.window_shader_fg);
+		return;
+	}
+
+	// Apply the adjustments `session_init` made, and keep the states changed through
+	// D-Bus.
+	new_opt.show_all_xerrors = ps->o.show_all_xerrors;
+	new_opt.redirected_force = ps->o.redirected_force;
+	new_opt.stoppaint_force = ps->o.stoppaint_force;
+	if (ps->drivers & DRIVER_NVIDIA) {
+		new_opt.xrender_sync_fence = true;
+	}
+	if (ps->sync_fence == XCB_NONE) {
+		new_opt.xrender_sync_fence = false;
+	}
+#ifdef CONFIG_DBUS
+	if (new_opt.dbus && ps->dbus_data == NULL) {
+		new_opt.dbus = false;
+	}
+#endif
+
+	if (options_need_reset(&ps->o, &new_opt) || ps->o.inspect_win != XCB_NONE ||
+	    ps->o.inspect_monitor) {
+		options_destroy(&new_opt);
+		free(new_opt.window_shader_fg);
+		reset_enable(ps->loop, NULL, 0);
+		return;
+	}
+
+	// Conditions identical to the old ones keep their result slots, so cached match
+	// results stay valid.
+	options_postprocess_c2_lists(ps->c2_state, &ps->c, &new_opt);
+	wm_stack_foreach(ps->wm, cursor) {
+		auto w = wm_ref_deref(cursor);
+		if (w != NULL) {
+			c2_window_state_sync(ps->c2_state, &w->c2_state);
+		}
+	}
+
+	// Running animations use the scripts of the old options, just finish them.
+	wm_stack_foreach_safe(ps->wm, cursor, tmp) {
+		auto w = wm_ref_deref(cursor);
+		if (w != NULL && w->running_animation_instance != NULL) {
+			finish_win_animation(ps, w);
+		}
+	}
+
+	// Shader files might have changed too, so they are all loaded again.
+	free_shaders(ps);
+	load_shaders(ps, &new_opt);
+	if (ps->backend_data) {
+		create_backend_shaders(ps);
+	}
+
+	bool blur_changed = blur_options_changed(&ps->o, &new_opt);
+	bool shadow_changed = shadow_options_changed(&ps->o, &new_opt);
+	struct options old_opt;
+	options_move(&old_opt, &ps->o);
+	options_move(&ps->o, &new_opt);
+	ps->window_options_default = win_options_from_config(&ps->o);
+
+	if (ps->backend_data && blur_changed) {
+		if (ps->backend_blur_context) {
+			ps->backend_data->ops.destroy_blur_context(
+			    ps->backend_data, ps->backend_blur_context);
+			ps->backend_blur_context = NULL;
+		}
+		if (!initialize_blur(ps)) {
+			log_error("Failed to prepare for background blur, background blur "
+			          "will be disabled.");
+		}
+	}
+	if (ps->backend_data && (blur_changed || shadow_changed)) {
+		// The renderer caches the shadow kernel and blur results.
+		renderer_free(ps->backend_data, ps->renderer);
+		ps->renderer = renderer_new(ps->backend_data, ps->o.shadow_radius,
+		                            (struct color){.alpha = ps->o.shadow_opacity,
+		                                           .red = ps->o.shadow_red,
+		                                           .green = ps->o.shadow_green,
+		                                           .blue = ps->o.shadow_blue},
+		                            ps->o.dithered_present);
+		if (!ps->renderer) {
+			log_fatal("Failed to create renderer, aborting...");
+			quit(ps);
+		}
+	}
+
+	wm_stack_foreach(ps->wm, cursor) {
+		auto w = wm_ref_deref(cursor);
+		if (w == NULL) {
+			continue;
+		}
+		// Options from rules point into the old options.
+		w->options = WIN_MAYBE_OPTIONS_DEFAULT;
+		w->shadow_opacity = ps->o.shadow_opacity;
+		win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
+		if (shadow_changed) {
+			// Recalculate the shadow geometry and rebuild the shadow image.
+			win_set_flags(w, WIN_FLAGS_SIZE_STALE);
+		}
+	}
+
+	options_destroy(&old_opt);
+	free(old_opt.window_shader_fg);
+
+	ps->pending_updates = true;
+	force_repaint(ps);
+	log_info("Config reloaded.");
+}
+
+static void
+config_reload_callback(EV_P attr_unused, ev_timer *w, int revents attr_unused) {
+	session_t *ps = session_ptr(w, config_reload_timer);
+	ev_timer_stop(ps->loop, w);
+
+	// Editors often replace the file when saving it, which removes the watches, so
+	// they are recreated for the files used by whichever configuration is in effect.
+	file_watch_destroy(ps->loop, ps->file_watch_handle);
+	ps->file_watch_handle = NULL;
+	reload_config(ps);
+	watch_config_files(ps);
+}
+
 static void show_config_warning_message_box(struct options *opt) {
 	if (opt->problematic_options == NULL) {
 		return;
@@ -2003,6 +2426,9 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	render_statistics_init(&ps->render_stats, 128);
 
 	ps->o.show_all_xerrors = all_xerrors;
+	ps->argc = argc;
+	ps->argv = argv;
+	ps->config_file = config_file;
 
 	// Use the same Display across reset, primarily for resource leak checking
 	x_connection_init(&ps->c, dpy);
@@ -2015,6 +2441,7 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 		log_fatal("Failed to create a XFixes region");
 		goto err;
 	}
+	ps->damage_pending_windows = dynarr_new(xcb_window_t, 16);
 
 	// Parse configuration file
 	if (!parse_config(&ps->o, config_file)) {
@@ -2063,6 +2490,15 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 		}
 	}
 
+	if (ps->o.log_async && !log_enable_async_tls()) {
+		log_error("Failed to start the logging thread, logs will be written "
+		          "synchronously.");
+	}
+
+	if (ps->o.record_events_path) {
+		ps->c.recorder = event_recorder_new(ps->loop, ps->o.record_events_path);
+	}
+
 	if (strstr(argv[0], "compton")) {
 		log_warn("This compositor has been renamed to \"picom\", the \"compton\" "
 		         "binary will not be installed in the future.");
@@ -2074,33 +2510,7 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	// Get needed atoms for c2 condition lists
 	options_postprocess_c2_lists(ps->c2_state, &ps->c, &ps->o);
 
-	// Load shader source file specified in the shader rules
-	c2_condition_list_foreach(&ps->o.window_shader_fg_rules, i) {
-		if (!load_shader_source(ps, c2_condition_get_data(i))) {
-			log_error("Failed to load shader source file for some of the "
-			          "window shader rules");
-		}
-	}
-	if (load_shader_source(ps, ps->o.window_shader_fg)) {
-		log_error("Failed to load window shader source file");
-	}
-
-	c2_condition_list_foreach(&ps->o.rules, i) {
-		auto data = (struct window_maybe_options *)c2_condition_get_data(i);
-		if (data->shader == NULL) {
-			continue;
-		}
-		if (load_shader_source(ps, data->shader)) {
-			log_error("Failed to load shader source file for window rules");
-		}
-	}
-
-	if (log_get_level_tls() <= LOG_LEVEL_DEBUG) {
-		HASH_ITER2(ps->shaders, shader) {
-			log_debug("Shader %s:", shader->key);
-			log_debug("%s", shader->source);
-		}
-	}
+	load_shaders(ps, &ps->o);
 
 	ps->sync_fence = XCB_NONE;
 	if (ps->c.e.has_sync) {
@@ -2158,18 +2568,7 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 		exit(0);
 	}
 
-	if (ps->o.config_file_path) {
-		ps->file_watch_handle = file_watch_init(ps->loop);
-		if (ps->file_watch_handle) {
-			file_watch_add(ps->file_watch_handle, ps->o.config_file_path,
-			               config_file_change_cb, ps);
-			list_foreach(struct included_config_file, i,
-			             &ps->o.included_config_files, siblings) {
-				file_watch_add(ps->file_watch_handle, i->path,
-				               config_file_change_cb, ps);
-			}
-		}
-	}
+	watch_config_files(ps);
 
 	// Monitor screen changes if vsync_sw is enabled and we are using
 	// an auto-detected refresh rate, or when X RandR features are enabled
@@ -2183,6 +2582,9 @@ static session_t *session_init(int argc, char **argv, Display *dpy,
 	ev_io_start(ps->loop, &ps->xiow);
 	ev_init(&ps->unredir_timer, tmout_unredir_callback);
 	ev_init(&ps->draw_timer, draw_callback);
+	ev_init(&ps->occluded_animation_timer, occluded_animation_callback);
+	ev_init(&ps->config_reload_timer, config_reload_callback);
+	ps->config_reload_timer.repeat = CONFIG_RELOAD_DELAY;
 
 	// Set up SIGUSR1 signal handler to reset program
 	ev_signal_init(&ps->usr1_signal, reset_enable, SIGUSR1);
@@ -2372,14 +2774,7 @@ static void session_destroy(session_t *ps) {
 
 	// Release custom window shaders
 	free(ps->o.window_shader_fg);
-	struct shader_info *shader, *tmp;
-	HASH_ITER(hh, ps->shaders, shader, tmp) {
-		HASH_DEL(ps->shaders, shader);
-		assert(shader->backend_shader == NULL);
-		free(shader->source);
-		free(shader->key);
-		free(shader);
-	}
+	free_shaders(ps);
 
 	// Release overlay window
 	if (ps->overlay && session_redirection_mode(ps) == XCB_COMPOSITE_REDIRECT_MANUAL) {
@@ -2407,6 +2802,9 @@ static void session_destroy(session_t *ps) {
 		xcb_xfixes_destroy_region(ps->c.c, ps->x_region);
 		ps->x_region = XCB_NONE;
 	}
+	if (ps->damage_pending_windows) {
+		dynarr_free_pod(ps->damage_pending_windows);
+	}
 
 	// backend is deinitialized in unredirect()
 	assert(ps->backend_data == NULL);
@@ -2424,10 +2822,15 @@ static void session_destroy(session_t *ps) {
 	// Stop libev event handlers
 	ev_timer_stop(ps->loop, &ps->unredir_timer);
 	ev_timer_stop(ps->loop, &ps->draw_timer);
+	ev_timer_stop(ps->loop, &ps->occluded_animation_timer);
+	ev_timer_stop(ps->loop, &ps->config_reload_timer);
 	ev_prepare_stop(ps->loop, &ps->event_check);
 	ev_signal_stop(ps->loop, &ps->usr1_signal);
 	ev_signal_stop(ps->loop, &ps->int_signal);
 
+	event_recorder_free(ps->c.recorder);
+	ps->c.recorder = NULL;
+
 	// The X connection could hold references to wm if there are pending async
 	// requests. Therefore the wm must be freed after the X connection.
 	free_x_connection(&ps->c);
@@ -2456,7 +2859,7 @@ static void session_run(session_t *ps) {
 	ev_run(ps->loop, 0);
 }
 
-#ifdef CONFIG_FUZZER
+#if defined(CONFIG_FUZZER) || defined(CONFIG_BENCHMARK)
 #define PICOM_MAIN(...) no_main(__VA_ARGS__)
 #else
 #define PICOM_MAIN(...) main(__VA_ARGS__)
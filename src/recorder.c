@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ev.h>
+
+#include "compiler.h"
+#include "log.h"
+#include "utils/misc.h"
+
+#include "recorder.h"
+
+/// How often buffered records are written out, in seconds.
+#define EVENT_RECORDER_FLUSH_INTERVAL 1.0
+/// If this many bytes are buffered, write them out without waiting for the timer, so
+/// memory usage stays bounded even under an event storm.
+#define EVENT_RECORDER_HIGH_WATERMARK (64UL * 1024 * 1024)
+
+struct event_recorder {
+	int fd;
+	struct ev_loop *loop;
+	ev_timer flush_timer;
+	char *buf;
+	size_t len, cap;
+	/// Set if we failed to write to the trace file, after which nothing is recorded.
+	bool failed;
+};
+
+static inline uint64_t event_recorder_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000UL + (uint64_t)now.tv_nsec;
+}
+
+static void event_recorder_flush(struct event_recorder *r) {
+	size_t written = 0;
+	while (written < r->len && !r->failed) {
+		auto ret = write(r->fd, r->buf + written, r->len - written);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_error("Failed to write event trace: %s. Recording stopped.",
+			          strerror(errno));
+			r->failed = true;
+			break;
+		}
+		written += (size_t)ret;
+	}
+	r->len = 0;
+}
+
+static void event_recorder_flush_callback(EV_P attr_unused, ev_timer *w, int revents attr_unused) {
+	auto r = container_of(w, struct event_recorder, flush_timer);
+	event_recorder_flush(r);
+}
+
+struct event_recorder *event_recorder_new(struct ev_loop *loop, const char *path) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_error("Failed to open event trace file %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	auto r = ccalloc(1, struct event_recorder);
+	r->fd = fd;
+	r->loop = loop;
+	r->cap = 64 * 1024;
+	r->buf = malloc(r->cap);
+	allocchk(r->buf);
+
+	struct event_trace_header header = {
+	    .version = EVENT_TRACE_VERSION,
+	    .header_size = sizeof(struct event_trace_header),
+	    .start_time_ns = event_recorder_now(),
+	};
+	memcpy(header.magic, EVENT_TRACE_MAGIC, sizeof(header.magic));
+	memcpy(r->buf, &header, sizeof(header));
+	r->len = sizeof(header);
+
+	ev_timer_init(&r->flush_timer, event_recorder_flush_callback,
+	              EVENT_RECORDER_FLUSH_INTERVAL, EVENT_RECORDER_FLUSH_INTERVAL);
+	ev_timer_start(loop, &r->flush_timer);
+	log_info("Recording X events to %s", path);
+	return r;
+}
+
+void event_recorder_free(struct event_recorder *r) {
+	if (r == NULL) {
+		return;
+	}
+	ev_timer_stop(r->loop, &r->flush_timer);
+	event_recorder_flush(r);
+	close(r->fd);
+	free(r->buf);
+	free(r);
+}
+
+void *event_recorder_reserve(struct event_recorder *r, enum event_trace_record_type type,
+                             uint32_t sequence, uint32_t length) {
+	if (r->failed) {
+		return NULL;
+	}
+	size_t size = sizeof(struct event_trace_record) + ((length + 7UL) & ~7UL);
+	if (r->len + size > r->cap) {
+		if (r->len >= EVENT_RECORDER_HIGH_WATERMARK) {
+			event_recorder_flush(r);
+		}
+		while (r->len + size > r->cap) {
+			r->cap *= 2;
+		}
+		r->buf = realloc(r->buf, r->cap);
+		allocchk(r->buf);
+	}
+
+	auto record = (struct event_trace_record *)(r->buf + r->len);
+	*record = (struct event_trace_record){
+	    .timestamp_ns = event_recorder_now(),
+	    .sequence = sequence,
+	    .type = (uint16_t)type,
+	    .length = length,
+	};
+	// Zero the padding, so the trace doesn't contain garbage.
+	memset((char *)(record + 1) + length, 0,
+	       size - sizeof(struct event_trace_record) - length);
+	r->len += size;
+	return record + 1;
+}
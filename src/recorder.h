@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+/// Recorder of the X events and replies we receive, for offline replay and profiling.
+///
+/// # Trace file format
+///
+/// A trace file starts with a `struct event_trace_header`, followed by a sequence of
+/// records. Each record is a `struct event_trace_record` followed by `length` bytes of
+/// payload, padded to a multiple of 8 bytes. So the file can be memory mapped and
+/// walked in place. The file is append only, a trace cut short (e.g. picom crashed)
+/// is still valid up to its last complete record. Everything is in host byte order.
+///
+/// The payload is the raw X protocol message. For generic events, the `full_sequence`
+/// field xcb inserts after the first 32 bytes is not included.
+
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ev.h>
+
+#define EVENT_TRACE_MAGIC "PICOMEVT"
+#define EVENT_TRACE_VERSION 1
+
+struct event_trace_header {
+	char magic[8];
+	uint32_t version;
+	/// Size of this header, records start at this offset.
+	uint32_t header_size;
+	/// CLOCK_MONOTONIC time when the recording started, in nanoseconds.
+	uint64_t start_time_ns;
+};
+
+enum event_trace_record_type {
+	/// An event or an error.
+	EVENT_TRACE_RECORD_EVENT = 1,
+	/// A reply to an async request.
+	EVENT_TRACE_RECORD_REPLY = 2,
+};
+
+struct event_trace_record {
+	/// CLOCK_MONOTONIC time when the message was received, in nanoseconds.
+	uint64_t timestamp_ns;
+	/// The full sequence number of the message.
+	uint32_t sequence;
+	/// A `enum event_trace_record_type`.
+	uint16_t type;
+	uint16_t padding;
+	/// Length of the payload, not including padding.
+	uint32_t length;
+	uint32_t padding2;
+};
+
+static_assert(sizeof(struct event_trace_header) % 8 == 0, "Trace header is not padded");
+static_assert(sizeof(struct event_trace_record) % 8 == 0, "Trace record is not padded");
+
+struct event_recorder;
+
+/// Create a new recorder writing into the file at `path`. Recorded messages are
+/// buffered in memory, and written out periodically by a timer on `loop`.
+struct event_recorder *event_recorder_new(struct ev_loop *loop, const char *path);
+/// Write out everything buffered and close the trace file.
+void event_recorder_free(struct event_recorder *r);
+/// Reserve space for a record with a payload of `length` bytes. Returns a pointer the
+/// payload should be written to, or NULL if the recorder has stopped because of an
+/// earlier error.
+void *event_recorder_reserve(struct event_recorder *r, enum event_trace_record_type type,
+                             uint32_t sequence, uint32_t length);
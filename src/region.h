@@ -140,6 +140,17 @@ static inline rect_t region_translate_rect(rect_t rect, ivec2 origin) {
 	};
 }
 
+/// Whether the rectangles `a` and `b` overlap. Empty rectangles don't overlap anything.
+static inline bool rect_overlap(const rect_t *a, const rect_t *b) {
+	return a->x1 < b->x2 && b->x1 < a->x2 && a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+/// Whether the extents of `a` and `b` overlap. If not, the two regions are definitely
+/// disjoint, and this is much cheaper to check than computing their intersection.
+static inline bool region_extents_overlap(const region_t *a, const region_t *b) {
+	return rect_overlap(&a->extents, &b->extents);
+}
+
 /// Subtract `other`, placed at `origin`, from `region`.
 static inline void region_subtract(region_t *region, ivec2 origin, const region_t *other) {
 	pixman_region32_translate(region, -origin.x, -origin.y);
@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: MPL-2.0
 // Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
 
+#include <string.h>
+
 #include "backend/backend.h"
 #include "common.h"
 #include "layout.h"
@@ -77,6 +79,19 @@ commands_for_window_body(struct layer *layer, struct backend_command *cmd_base,
 	    .source_mask = NULL,
 	    .max_brightness = max_brightness,
 	};
+	struct backend_blit_args window_args = args_base;
+	if (w->win_image_size.width > 0 && w->win_image_size.height > 0 &&
+	    !ivec2_eq(w->win_image_size, layer->window.size)) {
+		// The window has been resized, but its new pixmap hasn't arrived yet.
+		// Stretch the old image over the window until then.
+		window_args.effective_size = w->win_image_size;
+		window_args.scale = vec2_scale(
+		    window_args.scale,
+		    (vec2){
+		        .x = (double)layer->window.size.width / w->win_image_size.width,
+		        .y = (double)layer->window.size.height / w->win_image_size.height,
+		    });
+	}
 	region_scale(&cmd->target_mask, layer->window.origin, layer->scale);
 	region_scale(&cmd->opaque_region, layer->window.origin, layer->scale);
 	pixman_region32_intersect(&cmd->target_mask, &cmd->target_mask, &crop);
@@ -84,7 +99,7 @@ commands_for_window_body(struct layer *layer, struct backend_command *cmd_base,
 	cmd->op = BACKEND_COMMAND_BLIT;
 	cmd->source = BACKEND_COMMAND_SOURCE_WINDOW;
 	cmd->origin = layer->window.origin;
-	cmd->blit = args_base;
+	cmd->blit = window_args;
 	cmd->blit.target_mask = &cmd->target_mask;
 	cmd -= 1;
 	if (layer->saved_image_blend > 0) {
@@ -116,7 +131,7 @@ commands_for_window_body(struct layer *layer, struct backend_command *cmd_base,
 	cmd->op = BACKEND_COMMAND_BLIT;
 	cmd->origin = layer->window.origin;
 	cmd->source = BACKEND_COMMAND_SOURCE_WINDOW;
-	cmd->blit = args_base;
+	cmd->blit = window_args;
 	cmd->blit.target_mask = &cmd->target_mask;
 	cmd->blit.opacity = w->frame_opacity * opacity;
 	cmd -= 1;
@@ -139,7 +154,153 @@ commands_for_window_body(struct layer *layer, struct backend_command *cmd_base,
 	return (unsigned)(cmd_base - cmd);
 }
 
-/// Generate render command for the shadow in `layer`
+/// Whether the shadow of `layer` can be drawn in nine slices, see `shadow_tile_size`.
+static inline bool
+layer_has_nine_slice_shadow(const struct layer *layer, int *tile_size) {
+	if (layer->win->bounding_shaped || !vec2_eq(layer->shadow_scale, SCALE_IDENTITY)) {
+		return false;
+	}
+	auto shadow = layer->shadow;
+	int shadow_radius = (shadow.size.width - layer->window.size.width) / 2;
+	int t = *tile_size = shadow_tile_size(shadow_radius, layer->options.corner_radius);
+	if (shadow.size.width <= 2 * t || shadow.size.height <= 2 * t) {
+		return false;
+	}
+	// The window has to cover the center, and its corners have to be inside the
+	// corner slices. This is the case unless the shadow offset is large.
+	int max_margin = t - (int)layer->options.corner_radius;
+	int margins[] = {
+	    layer->window.origin.x - shadow.origin.x,
+	    layer->window.origin.y - shadow.origin.y,
+	    shadow.origin.x + shadow.size.width - layer->window.origin.x -
+	        layer->window.size.width,
+	    shadow.origin.y + shadow.size.height - layer->window.origin.y -
+	        layer->window.size.height,
+	};
+	for (size_t i = 0; i < ARR_SIZE(margins); i++) {
+		if (margins[i] < 0 || margins[i] > max_margin) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Number of commands `command_for_shadow` generates for `layer`.
+static inline unsigned commands_for_shadow_count(const struct layer *layer) {
+	int tile_size;
+	if (!layer->options.shadow) {
+		return 0;
+	}
+	if (!layer_has_nine_slice_shadow(layer, &tile_size)) {
+		return 1;
+	}
+	// The center is always covered by the window, unless we draw the full shadow.
+	return layer->options.full_shadow ? 9 : 8;
+}
+
+/// Generate commands for drawing the shadow of `layer` in nine slices, with `mask` being
+/// the region the whole shadow covers. Commands are stored going backwards, like
+/// `commands_for_window_body`.
+static inline unsigned
+commands_for_nine_slice_shadow(struct layer *layer, struct backend_command *cmd_base,
+                               const region_t *mask, int tile_size) {
+	auto cmd = cmd_base;
+	auto s = layer->shadow;
+	int t = tile_size, corner = 2 * tile_size + 1;
+	int shadow_radius = (s.size.width - layer->window.size.width) / 2;
+	// Size of the small window the corners are cut from
+	int corner_window = corner - 2 * shadow_radius;
+	const struct {
+		enum backend_command_source source;
+		/// Where the source image is placed.
+		ivec2 origin;
+		/// The part of the shadow this slice covers.
+		struct ibox box;
+	} slices[] = {
+	    {BACKEND_COMMAND_SOURCE_SHADOW_CORNER, {0, 0}, {{0, 0}, {t, t}}},
+	    {BACKEND_COMMAND_SOURCE_SHADOW_CORNER,
+	     {s.size.width - corner, 0},
+	     {{s.size.width - t, 0}, {t, t}}},
+	    {BACKEND_COMMAND_SOURCE_SHADOW_CORNER,
+	     {0, s.size.height - corner},
+	     {{0, s.size.height - t}, {t, t}}},
+	    {BACKEND_COMMAND_SOURCE_SHADOW_CORNER,
+	     {s.size.width - corner, s.size.height - corner},
+	     {{s.size.width - t, s.size.height - t}, {t, t}}},
+	    {BACKEND_COMMAND_SOURCE_SHADOW_TOP,
+	     {t, 0},
+	     {{t, 0}, {s.size.width - 2 * t, t}}},
+	    {BACKEND_COMMAND_SOURCE_SHADOW_BOTTOM,
+	     {t, s.size.height - t},
+	     {{t, s.size.height - t}, {s.size.width - 2 * t, t}}},
+	    {BACKEND_COMMAND_SOURCE_SHADOW_LEFT,
+	     {0, t},
+	     {{0, t}, {t, s.size.height - 2 * t}}},
+	    {BACKEND_COMMAND_SOURCE_SHADOW_RIGHT,
+	     {s.size.width - t, t},
+	     {{s.size.width - t, t}, {t, s.size.height - 2 * t}}},
+	    {BACKEND_COMMAND_SOURCE_SHADOW_CENTER,
+	     {t, t},
+	     {{t, t}, {s.size.width - 2 * t, s.size.height - 2 * t}}},
+	};
+	unsigned count = commands_for_shadow_count(layer);
+	scoped_region_t window = region_from_box(layer->window);
+	for (unsigned i = 0; i < count; i++) {
+		auto slice = &slices[i];
+		bool is_corner = slice->source == BACKEND_COMMAND_SOURCE_SHADOW_CORNER;
+		struct ibox box = {
+		    .origin = ivec2_add(s.origin, slice->box.origin),
+		    .size = slice->box.size,
+		};
+		cmd->op = BACKEND_COMMAND_BLIT;
+		cmd->source = slice->source;
+		cmd->origin = ivec2_add(s.origin, slice->origin);
+		pixman_region32_intersect_rect(&cmd->target_mask, mask, box.origin.x,
+		                               box.origin.y, (unsigned)box.size.width,
+		                               (unsigned)box.size.height);
+		if (layer->options.corner_radius > 0) {
+			if (is_corner) {
+				// Cut the window out of the corners with the mask of the
+				// small window the corners are cut from, placed so its
+				// corner lines up with the window's.
+				auto wbox = layer->window;
+				ivec2 mask_origin = wbox.origin;
+				if (slice->box.origin.x > 0) {
+					mask_origin.x += wbox.size.width - corner_window;
+				}
+				if (slice->box.origin.y > 0) {
+					mask_origin.y += wbox.size.height - corner_window;
+				}
+				cmd->source_mask.corner_radius =
+				    layer->options.corner_radius;
+				cmd->source_mask.inverted = true;
+				cmd->source_mask.origin =
+				    ivec2_sub(mask_origin, cmd->origin);
+			} else {
+				// Away from the corners, the window is a plain rectangle.
+				pixman_region32_subtract(&cmd->target_mask,
+				                         &cmd->target_mask, &window);
+			}
+		}
+		cmd->blit = (struct backend_blit_args){
+		    .opacity = layer->shadow_opacity,
+		    .max_brightness = 1,
+		    .source_mask = is_corner && layer->options.corner_radius > 0
+		                       ? &cmd->source_mask
+		                       : NULL,
+		    .scale = SCALE_IDENTITY,
+		    .effective_size =
+		        is_corner ? (ivec2){corner, corner} : slice->box.size,
+		    .target_mask = &cmd->target_mask,
+		};
+		pixman_region32_init(&cmd->opaque_region);
+		cmd -= 1;
+	}
+	return count;
+}
+
+/// Generate render command for the shadow in `layer`. When the shadow is drawn in nine
+/// slices, multiple commands are stored going backwards from `cmd`.
 ///
 /// @param[in] end the end of the commands generated for this `layer`.
 static inline unsigned
@@ -151,16 +312,12 @@ command_for_shadow(struct layer *layer, struct backend_command *cmd,
 	}
 
 	auto shadow_size_scaled = ivec2_scale_floor(layer->shadow.size, layer->shadow_scale);
-	cmd->op = BACKEND_COMMAND_BLIT;
-	cmd->origin = layer->shadow.origin;
-	cmd->source = BACKEND_COMMAND_SOURCE_SHADOW;
-	pixman_region32_clear(&cmd->target_mask);
-	pixman_region32_union_rect(&cmd->target_mask, &cmd->target_mask,
-	                           layer->shadow.origin.x, layer->shadow.origin.y,
-	                           (unsigned)shadow_size_scaled.width,
-	                           (unsigned)shadow_size_scaled.height);
+	scoped_region_t mask = region_from_box((struct ibox){
+	    .origin = layer->shadow.origin,
+	    .size = shadow_size_scaled,
+	});
 	log_trace("Calculate shadow for %#010x (%s)", win_id(w), w->name);
-	log_region(TRACE, &cmd->target_mask);
+	log_region(TRACE, &mask);
 	if (!layer->options.full_shadow) {
 		// We need to not draw under the window
 		// From this command up, until the next WINDOW_START
@@ -170,29 +327,41 @@ command_for_shadow(struct layer *layer, struct backend_command *cmd,
 			assert(j->source == BACKEND_COMMAND_SOURCE_WINDOW ||
 			       j->source == BACKEND_COMMAND_SOURCE_WINDOW_SAVED);
 			if (j->blit.corner_radius == 0) {
-				pixman_region32_subtract(
-				    &cmd->target_mask, &cmd->target_mask, &j->target_mask);
+				pixman_region32_subtract(&mask, &mask, &j->target_mask);
 			} else {
 				region_t mask_without_corners;
 				pixman_region32_init(&mask_without_corners);
 				pixman_region32_copy(&mask_without_corners, &j->target_mask);
 				win_region_remove_corners(layer->win, j->origin,
 				                          &mask_without_corners);
-				pixman_region32_subtract(&cmd->target_mask, &cmd->target_mask,
+				pixman_region32_subtract(&mask, &mask,
 				                         &mask_without_corners);
 				pixman_region32_fini(&mask_without_corners);
 			}
 		}
 	}
-	log_region(TRACE, &cmd->target_mask);
+	log_region(TRACE, &mask);
 	if (monitors) {
 		auto monitor_index = win_find_monitor(monitors, w);
 		if (monitor_index >= 0) {
-			pixman_region32_intersect(&cmd->target_mask, &cmd->target_mask,
+			pixman_region32_intersect(&mask, &mask,
 			                          &monitors->regions[monitor_index]);
 		}
 	}
-	log_region(TRACE, &cmd->target_mask);
+	log_region(TRACE, &mask);
+
+	scoped_region_t crop = region_from_box(layer->crop);
+	pixman_region32_intersect(&mask, &mask, &crop);
+
+	int tile_size;
+	if (layer_has_nine_slice_shadow(layer, &tile_size)) {
+		return commands_for_nine_slice_shadow(layer, cmd, &mask, tile_size);
+	}
+
+	cmd->op = BACKEND_COMMAND_BLIT;
+	cmd->origin = layer->shadow.origin;
+	cmd->source = BACKEND_COMMAND_SOURCE_SHADOW;
+	pixman_region32_copy(&cmd->target_mask, &mask);
 	if (layer->options.corner_radius > 0) {
 		cmd->source_mask.corner_radius = layer->options.corner_radius;
 		cmd->source_mask.inverted = true;
@@ -200,9 +369,6 @@ command_for_shadow(struct layer *layer, struct backend_command *cmd,
 		    ivec2_sub(layer->window.origin, layer->shadow.origin);
 	}
 
-	scoped_region_t crop = region_from_box(layer->crop);
-	pixman_region32_intersect(&cmd->target_mask, &cmd->target_mask, &crop);
-
 	cmd->blit = (struct backend_blit_args){
 	    .opacity = layer->shadow_opacity,
 	    .max_brightness = 1,
@@ -252,8 +418,11 @@ command_for_blur(struct layer *layer, struct backend_command *cmd,
 	return 1;
 }
 
+/// Apply transparent-clipping to the commands in `layout`. Commands of layers marked in
+/// `reused` are already clipped, and are left alone.
 static inline void
-command_builder_apply_transparent_clipping(struct layout *layout, region_t *scratch_region) {
+command_builder_apply_transparent_clipping(struct layout *layout, const bool *reused,
+                                           region_t *scratch_region) {
 	// Going from top down, apply transparent-clipping
 	if (dynarr_is_empty(layout->layers)) {
 		return;
@@ -286,6 +455,12 @@ command_builder_apply_transparent_clipping(struct layout *layout, region_t *scra
 			layer_start -= layer->number_of_commands;
 		}
 
+		if (reused[layer - layout->layers] ||
+		    !region_extents_overlap(&i->target_mask, scratch_region)) {
+			// The opaque region is always within the target mask, so it
+			// doesn't overlap `scratch_region` either.
+			continue;
+		}
 		if (i->op == BACKEND_COMMAND_BLUR ||
 		    (i->op == BACKEND_COMMAND_BLIT &&
 		     i->source != BACKEND_COMMAND_SOURCE_BACKGROUND)) {
@@ -299,8 +474,11 @@ command_builder_apply_transparent_clipping(struct layout *layout, region_t *scra
 		}
 	}
 }
+/// Apply clip-shadow-above to the commands in `layout`. Commands of layers marked in
+/// `reused` are already clipped, and are left alone.
 static inline void
-command_builder_apply_shadow_clipping(struct layout *layout, region_t *scratch_region) {
+command_builder_apply_shadow_clipping(struct layout *layout, const bool *reused,
+                                      region_t *scratch_region) {
 	// Going from bottom up, apply clipping-shadow-above
 	pixman_region32_clear(scratch_region);
 	auto begin = &layout->commands[layout->first_layer_start];
@@ -320,7 +498,10 @@ command_builder_apply_shadow_clipping(struct layout *layout, region_t *scratch_r
 			pixman_region32_subtract(scratch_region, scratch_region,
 			                         &i->target_mask);
 		} else if (i->op == BACKEND_COMMAND_BLIT) {
-			if (i->source == BACKEND_COMMAND_SOURCE_SHADOW) {
+			if (backend_command_source_is_shadow(i->source)) {
+				if (reused[layer - layout->layers]) {
+					continue;
+				}
 				pixman_region32_subtract(&i->target_mask, &i->target_mask,
 				                         scratch_region);
 			} else if (i->source == BACKEND_COMMAND_SOURCE_WINDOW &&
@@ -332,9 +513,25 @@ command_builder_apply_shadow_clipping(struct layout *layout, region_t *scratch_r
 	}
 }
 
+/// Parameters that affect the generated commands, besides the layers themselves.
+struct command_builder_params {
+	bool force_blend;
+	bool blur_frame;
+	bool inactive_dim_fixed;
+	double max_brightness;
+	const struct x_monitors *monitors;
+	uint64_t monitors_generation;
+	const struct shader_info *shaders;
+};
+
 struct command_builder {
 	region_t scratch_region;
 	struct list_node free_command_lists;
+	/// Parameters the commands of the previous layout were built with.
+	struct command_builder_params last_params;
+	/// Whether the commands for each layer of the layout being built are copied
+	/// from the previous layout. This is a dynarr.
+	bool *reused;
 };
 
 struct command_list {
@@ -394,6 +591,7 @@ struct command_builder *command_builder_new(void) {
 	auto cb = ccalloc(1, struct command_builder);
 	pixman_region32_init(&cb->scratch_region);
 	list_init_head(&cb->free_command_lists);
+	cb->reused = dynarr_new(bool, 0);
 	return cb;
 }
 
@@ -407,15 +605,149 @@ void command_builder_free(struct command_builder *cb) {
 	}
 
 	pixman_region32_fini(&cb->scratch_region);
+	dynarr_free_pod(cb->reused);
 	free(cb);
 }
 
+static bool command_builder_params_eq(const struct command_builder_params *a,
+                                      const struct command_builder_params *b) {
+	return a->force_blend == b->force_blend && a->blur_frame == b->blur_frame &&
+	       a->inactive_dim_fixed == b->inactive_dim_fixed &&
+	       a->max_brightness == b->max_brightness && a->monitors == b->monitors &&
+	       a->monitors_generation == b->monitors_generation && a->shaders == b->shaders;
+}
+
+/// Whether the commands generated for `layer` would be the same as the ones generated
+/// for `prev_layer` in the previous frame, before any clipping is applied. Damage
+/// doesn't affect the commands, so it's not considered.
+static bool layer_commands_unchanged(const struct layer *prev_layer, const struct layer *layer) {
+	return prev_layer->generation == layer->generation &&
+	       ibox_eq(prev_layer->window, layer->window) &&
+	       ibox_eq(prev_layer->shadow, layer->shadow) &&
+	       ibox_eq(prev_layer->crop, layer->crop) && vec2_eq(prev_layer->scale, layer->scale) &&
+	       vec2_eq(prev_layer->shadow_scale, layer->shadow_scale) &&
+	       prev_layer->opacity == layer->opacity &&
+	       prev_layer->blur_opacity == layer->blur_opacity &&
+	       prev_layer->shadow_opacity == layer->shadow_opacity &&
+	       prev_layer->saved_image_blend == layer->saved_image_blend;
+}
+
+static bool layout_has_clipping(const struct layout *layout) {
+	for (unsigned i = 0; i < dynarr_len(layout->layers); i++) {
+		auto options = &layout->layers[i].options;
+		if (options->transparent_clipping || options->clip_shadow_above) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Decide which layers of `layout` can have their commands copied from `prev_layout`.
+///
+/// Without transparent-clipping and clip-shadow-above, the commands of a layer only
+/// depend on the layer itself. Otherwise, they also depend on the layers above (for
+/// transparent-clipping) and the layers below (for clip-shadow-above), so we only reuse
+/// commands if the window stack didn't change, and no layer that could clip this layer
+/// has changed.
+static void command_builder_find_reusable_layers(struct command_builder *cb,
+                                                 struct layout *layout,
+                                                 const struct layout *prev_layout,
+                                                 bool params_changed) {
+	auto nlayers = dynarr_len(layout->layers);
+	dynarr_resize_pod(cb->reused, nlayers);
+	if (params_changed || prev_layout == NULL || prev_layout->commands == NULL ||
+	    !ivec2_eq(prev_layout->size, layout->size)) {
+		memset(cb->reused, 0, nlayers * sizeof(bool));
+		return;
+	}
+
+	bool clipping = layout_has_clipping(layout) || layout_has_clipping(prev_layout);
+	bool stack_unchanged = nlayers == dynarr_len(prev_layout->layers);
+	for (unsigned i = 0; i < nlayers; i++) {
+		auto layer = &layout->layers[i];
+		cb->reused[i] =
+		    layer->prev_rank >= 0 &&
+		    layer_commands_unchanged(&prev_layout->layers[layer->prev_rank], layer);
+		stack_unchanged = stack_unchanged && layer->prev_rank == (int)i;
+	}
+	if (!clipping) {
+		return;
+	}
+	if (!stack_unchanged) {
+		memset(cb->reused, 0, nlayers * sizeof(bool));
+		return;
+	}
+
+	// Because the stack didn't change, `prev_layout->layers[i]` is the previous
+	// state of `layout->layers[i]`.
+	bool above_changed = false;
+	for (unsigned i = nlayers; i-- > 0;) {
+		bool changed = !cb->reused[i];
+		cb->reused[i] = !changed && !above_changed;
+		if (changed && (layout->layers[i].options.transparent_clipping ||
+		                prev_layout->layers[i].options.transparent_clipping)) {
+			above_changed = true;
+		}
+	}
+	bool below_changed = false, below_clips_shadow = false;
+	for (unsigned i = 0; i < nlayers; i++) {
+		auto layer = &layout->layers[i];
+		bool changed = !cb->reused[i];
+		if (layer->options.shadow && below_changed) {
+			cb->reused[i] = false;
+		}
+		below_clips_shadow = below_clips_shadow || layer->options.clip_shadow_above ||
+		                     prev_layout->layers[i].options.clip_shadow_above;
+		below_changed = below_changed || (changed && below_clips_shadow);
+	}
+}
+
+/// Copy `src` into `dst`, which must be an unused command in a command list.
+static void command_copy(struct backend_command *dst, const struct backend_command *src) {
+	region_t target_mask = dst->target_mask;
+	*dst = *src;
+	dst->target_mask = target_mask;
+	pixman_region32_copy(&dst->target_mask, &src->target_mask);
+	switch (src->op) {
+	case BACKEND_COMMAND_BLIT:
+		pixman_region32_init(&dst->opaque_region);
+		pixman_region32_copy(&dst->opaque_region, &src->opaque_region);
+		dst->blit.target_mask = &dst->target_mask;
+		if (src->blit.source_mask != NULL) {
+			dst->blit.source_mask = &dst->source_mask;
+		}
+		break;
+	case BACKEND_COMMAND_BLUR:
+		dst->blur.target_mask = &dst->target_mask;
+		if (src->blur.source_mask != NULL) {
+			dst->blur.source_mask = &dst->source_mask;
+		}
+		break;
+	case BACKEND_COMMAND_COPY_AREA:
+	case BACKEND_COMMAND_INVALID:
+	default: assert(false);
+	}
+}
+
 // TODO(yshui) reduce the number of parameters by storing the final effective parameter
 // value in `struct managed_win`.
 void command_builder_build(struct command_builder *cb, struct layout *layout,
-                           bool force_blend, bool blur_frame, bool inactive_dim_fixed,
-                           double max_brightness, const struct x_monitors *monitors,
+                           const struct layout *prev_layout, bool force_blend,
+                           bool blur_frame, bool inactive_dim_fixed, double max_brightness,
+                           const struct x_monitors *monitors,
                            const struct shader_info *shaders) {
+	struct command_builder_params params = {
+	    .force_blend = force_blend,
+	    .blur_frame = blur_frame,
+	    .inactive_dim_fixed = inactive_dim_fixed,
+	    .max_brightness = max_brightness,
+	    .monitors = monitors,
+	    .monitors_generation = monitors ? monitors->generation : 0,
+	    .shaders = shaders,
+	};
+	command_builder_find_reusable_layers(
+	    cb, layout, prev_layout, !command_builder_params_eq(&params, &cb->last_params));
+	cb->last_params = params;
 
 	unsigned ncmds = 1;
 	dynarr_foreach(layout->layers, layer) {
@@ -426,9 +758,7 @@ void command_builder_build(struct command_builder *cb, struct layout *layout,
 			// Needs blur
 			ncmds += 1;
 		}
-		if (layer->options.shadow) {
-			ncmds += 1;
-		}
+		ncmds += commands_for_shadow_count(layer);
 
 		unsigned n_cmds_for_window_body = 1;
 		if (layer->win->frame_opacity < 1 && layer->win->frame_opacity > 0) {
@@ -447,6 +777,18 @@ void command_builder_build(struct command_builder *cb, struct layout *layout,
 	auto cmd = &layout->commands[ncmds - 1];
 	dynarr_foreach_rev(layout->layers, layer) {
 		auto last = cmd;
+		if (cb->reused[layer - layout->layers]) {
+			auto prev_layer = &prev_layout->layers[layer->prev_rank];
+			auto prev_cmds = &prev_layout->commands[prev_layer->first_command];
+			for (unsigned i = prev_layer->number_of_commands; i-- > 0;) {
+				command_copy(cmd, &prev_cmds[i]);
+				cmd -= 1;
+			}
+			layer->number_of_commands = prev_layer->number_of_commands;
+			layer->first_command = (unsigned)(cmd + 1 - layout->commands);
+			continue;
+		}
+
 		auto frame_region = win_get_region_frame_local_by_val(layer->win);
 		pixman_region32_translate(&frame_region, layer->window.origin.x,
 		                          layer->window.origin.y);
@@ -462,6 +804,7 @@ void command_builder_build(struct command_builder *cb, struct layout *layout,
 		cmd -= command_for_blur(layer, cmd, &frame_region, force_blend, blur_frame);
 
 		layer->number_of_commands = (unsigned)(last - cmd);
+		layer->first_command = (unsigned)(cmd + 1 - layout->commands);
 		pixman_region32_fini(&frame_region);
 	}
 
@@ -478,6 +821,129 @@ void command_builder_build(struct command_builder *cb, struct layout *layout,
 	layout->first_layer_start = 1;
 	layout->number_of_commands = ncmds;
 
-	command_builder_apply_transparent_clipping(layout, &cb->scratch_region);
-	command_builder_apply_shadow_clipping(layout, &cb->scratch_region);
+	bool transparent_clipping = false, clip_shadow_above = false;
+	dynarr_foreach(layout->layers, layer) {
+		transparent_clipping = transparent_clipping || layer->options.transparent_clipping;
+		clip_shadow_above = clip_shadow_above || layer->options.clip_shadow_above;
+	}
+	// Both passes are no-ops if no window has the corresponding option set.
+	if (transparent_clipping) {
+		command_builder_apply_transparent_clipping(layout, cb->reused,
+		                                           &cb->scratch_region);
+	}
+	if (clip_shadow_above) {
+		command_builder_apply_shadow_clipping(layout, cb->reused, &cb->scratch_region);
+	}
+	layout_index_commands(layout);
+}
+
+/// Generate the nine-slice commands for the shadow of `layer`, with `mask` as the
+/// region the shadow covers. Returns whether the slices don't overlap, and together
+/// cover exactly `mask`.
+static bool
+nine_slice_shadow_covers_mask(struct layer *layer, const region_t *mask, int tile_size) {
+	struct backend_command cmds[9];
+	auto count = commands_for_shadow_count(layer);
+	for (unsigned i = 0; i < count; i++) {
+		pixman_region32_init(&cmds[i].target_mask);
+	}
+	commands_for_nine_slice_shadow(layer, &cmds[count - 1], mask, tile_size);
+
+	bool ret = true;
+	region_t covered, overlap;
+	pixman_region32_init(&covered);
+	pixman_region32_init(&overlap);
+	for (unsigned i = 0; i < count; i++) {
+		pixman_region32_intersect(&overlap, &covered, &cmds[i].target_mask);
+		ret = ret && !pixman_region32_not_empty(&overlap);
+		pixman_region32_union(&covered, &covered, &cmds[i].target_mask);
+		pixman_region32_fini(&cmds[i].target_mask);
+		pixman_region32_fini(&cmds[i].opaque_region);
+	}
+	ret = ret && pixman_region32_equal(&covered, mask);
+	pixman_region32_fini(&covered);
+	pixman_region32_fini(&overlap);
+	return ret;
+}
+
+/// Give `layer` a shadow of `radius`, offset by `offset` in both directions.
+static void layer_set_test_shadow(struct layer *layer, int radius, int offset) {
+	layer->shadow = (struct ibox){
+	    .origin = {layer->window.origin.x + offset, layer->window.origin.y + offset},
+	    .size = {layer->window.size.width + 2 * radius,
+	             layer->window.size.height + 2 * radius},
+	};
+}
+
+TEST_CASE(nine_slice_shadow) {
+	const int radius = 12;
+	struct win w = {};
+	struct layer layer = {
+	    .win = &w,
+	    .window = {.origin = {100, 100}, .size = {400, 300}},
+	    .shadow_scale = SCALE_IDENTITY,
+	    .shadow_opacity = 1,
+	    .options = {.shadow = true},
+	};
+	int t;
+
+	// Default shadow offset, the corners of the window are inside the corner slices.
+	layer_set_test_shadow(&layer, radius, -15);
+	TEST_TRUE(layer_has_nine_slice_shadow(&layer, &t));
+	TEST_EQUAL(t, shadow_tile_size(radius, 0));
+	TEST_EQUAL(commands_for_shadow_count(&layer), 8);
+
+	// The shadow has to reach past the window on every side. The margins on the left
+	// and top are `-offset`, the ones on the right and bottom `2 * radius + offset`.
+	layer_set_test_shadow(&layer, radius, 0);
+	TEST_TRUE(layer_has_nine_slice_shadow(&layer, &t));
+	layer_set_test_shadow(&layer, radius, -2 * radius);
+	TEST_TRUE(layer_has_nine_slice_shadow(&layer, &t));
+	layer_set_test_shadow(&layer, radius, -2 * radius - 1);
+	TEST_TRUE(!layer_has_nine_slice_shadow(&layer, &t));
+	layer_set_test_shadow(&layer, radius, 1);
+	TEST_TRUE(!layer_has_nine_slice_shadow(&layer, &t));
+
+	// Rounded corners make the tiles larger.
+	layer.options.corner_radius = 10;
+	layer_set_test_shadow(&layer, radius, -15);
+	TEST_TRUE(layer_has_nine_slice_shadow(&layer, &t));
+	TEST_EQUAL(t, shadow_tile_size(radius, 10));
+	layer.options.corner_radius = 0;
+
+	// Windows too small for the tiles.
+	layer.window.size = (ivec2){10, 300};
+	layer_set_test_shadow(&layer, radius, -15);
+	TEST_TRUE(!layer_has_nine_slice_shadow(&layer, &t));
+	layer.window.size = (ivec2){400, 300};
+
+	// Shaped and scaled windows.
+	layer_set_test_shadow(&layer, radius, -15);
+	w.bounding_shaped = true;
+	TEST_TRUE(!layer_has_nine_slice_shadow(&layer, &t));
+	w.bounding_shaped = false;
+	layer.shadow_scale = (vec2){2, 2};
+	TEST_TRUE(!layer_has_nine_slice_shadow(&layer, &t));
+	layer.shadow_scale = SCALE_IDENTITY;
+
+	// The slices cover the whole shadow except under the window, without overlapping.
+	TEST_TRUE(layer_has_nine_slice_shadow(&layer, &t));
+	region_t mask;
+	pixman_region32_init(&mask);
+	pixman_region32_union_rect(&mask, &mask, layer.shadow.origin.x,
+	                           layer.shadow.origin.y,
+	                           (unsigned)layer.shadow.size.width,
+	                           (unsigned)layer.shadow.size.height);
+	scoped_region_t window = region_from_box(layer.window);
+	pixman_region32_subtract(&mask, &mask, &window);
+	bool covers = nine_slice_shadow_covers_mask(&layer, &mask, t);
+
+	// With full shadow, the center slice is drawn as well.
+	layer.options.full_shadow = true;
+	TEST_EQUAL(commands_for_shadow_count(&layer), 9);
+	pixman_region32_union(&mask, &mask, &window);
+	bool covers_full = nine_slice_shadow_covers_mask(&layer, &mask, t);
+	pixman_region32_fini(&mask);
+	TEST_TRUE(covers);
+	TEST_TRUE(covers_full);
 }
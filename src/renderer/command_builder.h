@@ -12,6 +12,15 @@ struct x_monitors;
 struct win_option;
 struct shader_info;
 
+/// Shadows of rectangular windows are drawn in nine slices. The four corners are cut
+/// from the shadow of a small window, which is shared by all windows with the same
+/// corner radius. The edges and the center repeat a single row or column of it. This is
+/// the size of the corners, beyond which the shadow doesn't change along the edges.
+/// One extra pixel is added in case the blur reaches a bit further than its radius.
+static inline int shadow_tile_size(int shadow_radius, unsigned int corner_radius) {
+	return 2 * shadow_radius + (int)corner_radius + 1;
+}
+
 struct command_builder *command_builder_new(void);
 void command_builder_free(struct command_builder *);
 
@@ -24,7 +33,12 @@ void command_builder_command_list_free(struct backend_command *cmds);
 /// It is guaranteed that each of the command's region of operation (e.g. the mask.region
 /// argument of blit), will be store in `struct backend_command::mask`. This might not
 /// stay true after further passes.
+///
+/// `prev_layout` is the layout rendered in the previous frame, or NULL. Commands of
+/// layers that haven't changed since then are copied from it instead of being
+/// generated again.
 void command_builder_build(struct command_builder *cb, struct layout *layout,
-                           bool force_blend, bool blur_frame, bool inactive_dim_fixed,
-                           double max_brightness, const struct x_monitors *monitors,
+                           const struct layout *prev_layout, bool force_blend,
+                           bool blur_frame, bool inactive_dim_fixed, double max_brightness,
+                           const struct x_monitors *monitors,
                            const struct shader_info *shaders);
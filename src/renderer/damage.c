@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: MPL-2.0
 // Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
 
+#include <string.h>
+
 #include "backend/backend.h"
 #include "layout.h"
 #include "region.h"
@@ -10,50 +12,93 @@
 #include "damage.h"
 
 /// Compare two layers that contain the same window, return if they are the "same". Same
-/// means these two layers are render in the same way at the same position, with the only
-/// possible differences being the contents inside the window.
-static bool
-layer_compare(const struct layer *past_layer, const struct backend_command *past_layer_cmd,
-              const struct layer *curr_layer, const struct backend_command *curr_layer_cmd) {
+/// means these two layers are render at the same position, with the only possible
+/// differences being the contents inside the window, and the render commands used.
+/// Render commands are compared separately, see `layer_match_commands`.
+static bool layer_compare(const struct layer *past_layer, const struct layer *curr_layer) {
 	if (!ibox_eq(past_layer->window, curr_layer->window)) {
 		// Window moved or size changed
 		return false;
 	}
 
 	// TODO(yshui) consider window body and shadow separately.
-	if (!vec2_eq(past_layer->scale, curr_layer->scale) ||
-	    !vec2_eq(past_layer->shadow_scale, curr_layer->shadow_scale)) {
-		// Window or shadow scale changed
+	if (!vec2_eq(past_layer->scale, curr_layer->scale)) {
+		// Window scale changed
 		return false;
 	}
 
-	if (!ibox_eq(past_layer->shadow, curr_layer->shadow)) {
-		// Shadow moved or size changed
+	// If the shadow is only enabled in one of the layers, the shadow command won't
+	// have a match, and will be damaged by itself.
+	if (past_layer->options.shadow && curr_layer->options.shadow &&
+	    (!vec2_eq(past_layer->shadow_scale, curr_layer->shadow_scale) ||
+	     !ibox_eq(past_layer->shadow, curr_layer->shadow))) {
+		// Shadow moved, or its size or scale changed
 		return false;
 	}
 	if (past_layer->saved_image_blend != curr_layer->saved_image_blend) {
 		// The amount of blending with the saved image changed
 		return false;
 	}
-	if (past_layer->number_of_commands != curr_layer->number_of_commands) {
-		// Number of render commands changed. We are being conservative
-		// here, because even though the number of commands changed, we can still
-		// try to match them up. For example, maybe this window just has shadow
-		// disabled, but other commands are still the same. We are not do that
-		// here, this could be a TODO
-		// TODO(yshui) match render commands here
-		return false;
+	return true;
+}
+
+/// Maximum number of commands a single layer can have: a blur, a shadow in up to nine
+/// slices, and the window body and frame, each possibly blended with the saved window
+/// image.
+#define LAYER_MAX_COMMANDS 14
+
+/// A pair of matching commands from two layers of the same window. Either side can be
+/// NULL, if the command has no match in the other layer.
+struct command_match {
+	struct backend_command *past, *curr;
+};
+
+/// Order of the commands within a layer, see `command_builder_build`.
+static inline int command_kind(const struct backend_command *cmd) {
+	if (cmd->op == BACKEND_COMMAND_BLUR) {
+		return 0;
 	}
+	assert(cmd->op == BACKEND_COMMAND_BLIT);
+	return backend_command_source_is_shadow(cmd->source) ? 1 : 2;
+}
 
-	for (unsigned i = 0; i < past_layer->number_of_commands; i++) {
-		auto cmd1 = &past_layer_cmd[i];
-		auto cmd2 = &curr_layer_cmd[i];
-		if (cmd1->op != cmd2->op || !ivec2_eq(cmd1->origin, cmd2->origin) ||
-		    cmd1->source != cmd2->source) {
-			return false;
+/// Match up the render commands of two layers of the same window, by their operation
+/// and source. Commands in a layer are always ordered the same way, so this is a merge
+/// of two sorted sequences. The window body is the last command, so we go backwards,
+/// so it's always matched even if e.g. a separate frame command appeared.
+///
+/// Matches are stored into `out` from bottom to top, returns the number of matches.
+static unsigned
+layer_match_commands(const struct layer *past_layer, struct backend_command *past_layer_cmd,
+                     const struct layer *curr_layer, struct backend_command *curr_layer_cmd,
+                     struct command_match out[static 2 * LAYER_MAX_COMMANDS]) {
+	assert(past_layer->number_of_commands <= LAYER_MAX_COMMANDS);
+	assert(curr_layer->number_of_commands <= LAYER_MAX_COMMANDS);
+	unsigned n = 0;
+	auto cmd1 = past_layer_cmd + past_layer->number_of_commands;
+	auto cmd2 = curr_layer_cmd + curr_layer->number_of_commands;
+	while (cmd1 != past_layer_cmd || cmd2 != curr_layer_cmd) {
+		int kind1 = cmd1 != past_layer_cmd ? command_kind(cmd1 - 1) : -1;
+		int kind2 = cmd2 != curr_layer_cmd ? command_kind(cmd2 - 1) : -1;
+		if (kind1 > kind2) {
+			out[n++] = (struct command_match){.past = --cmd1};
+		} else if (kind2 > kind1) {
+			out[n++] = (struct command_match){.curr = --cmd2};
+		} else if (cmd1[-1].op == cmd2[-1].op && cmd1[-1].source == cmd2[-1].source &&
+		           ivec2_eq(cmd1[-1].origin, cmd2[-1].origin)) {
+			out[n++] = (struct command_match){.past = --cmd1, .curr = --cmd2};
+		} else {
+			out[n++] = (struct command_match){.past = --cmd1};
+			out[n++] = (struct command_match){.curr = --cmd2};
 		}
 	}
-	return true;
+	// Reverse the matches, so they are from bottom to top.
+	for (unsigned i = 0; i < n / 2; i++) {
+		auto tmp = out[i];
+		out[i] = out[n - 1 - i];
+		out[n - 1 - i] = tmp;
+	}
+	return n;
 }
 
 /// Add all regions of `layer`'s commands to `region`
@@ -134,7 +179,7 @@ static inline void command_blur_damage(region_t *damage, region_t *scratch_regio
 /// Do the first step of render planning, collecting damages and calculating which
 /// parts of the final screen will be affected by the damages.
 void layout_manager_damage(struct layout_manager *lm, unsigned buffer_age,
-                           ivec2 blur_size, region_t *damage) {
+                           ivec2 blur_size, region_t *damage, region_t *layer_damage) {
 	log_trace("Damage for buffer age %d", buffer_age);
 	unsigned past_layer_rank = 0, curr_layer_rank = 0;
 	auto past_layout = layout_manager_layout(lm, buffer_age);
@@ -152,6 +197,12 @@ void layout_manager_damage(struct layout_manager *lm, unsigned buffer_age,
 		pixman_region32_union_rect(damage, damage, 0, 0,
 		                           (unsigned)curr_layout->size.width,
 		                           (unsigned)curr_layout->size.height);
+		if (layer_damage != NULL) {
+			for (unsigned i = 0; i < dynarr_len(curr_layout->layers); i++) {
+				pixman_region32_copy(&layer_damage[i], damage);
+			}
+		}
+		pixman_region32_fini(&scratch_region);
 		return;
 	}
 	if (log_get_level_tls() <= LOG_LEVEL_TRACE) {
@@ -249,6 +300,13 @@ void layout_manager_damage(struct layout_manager *lm, unsigned buffer_age,
 			past_layer += 1;
 		}
 		for (; curr_layer_rank < curr_layer_rank_target; curr_layer_rank++) {
+			if (layer_damage != NULL) {
+				auto ld = &layer_damage[curr_layer_rank];
+				pixman_region32_clear(ld);
+				pixman_region32_union_rect(
+				    ld, ld, 0, 0, (unsigned)curr_layout->size.width,
+				    (unsigned)curr_layout->size.height);
+			}
 			region_union_render_layer(damage, curr_layer, curr_layer_cmd);
 			curr_layer_cmd += curr_layer->number_of_commands;
 			curr_layer += 1;
@@ -265,18 +323,32 @@ void layout_manager_damage(struct layout_manager *lm, unsigned buffer_age,
 		assert(wm_treeid_eq(past_layer->key, curr_layer->key));
 		log_trace("%#010x == %#010x %s", past_layer->key.x, curr_layer->key.x,
 		          curr_layer->win->name);
+		if (layer_damage != NULL) {
+			pixman_region32_copy(&layer_damage[curr_layer_rank], damage);
+		}
 
-		if (!layer_compare(past_layer, past_layer_cmd, curr_layer, curr_layer_cmd)) {
+		if (!layer_compare(past_layer, curr_layer)) {
 			region_union_render_layer(damage, curr_layer, curr_layer_cmd);
 			region_union_render_layer(damage, past_layer, past_layer_cmd);
 			continue;
 		}
 
-		// Layers are otherwise identical besides the window content. We will
-		// process their render command and add appropriate damage.
+		// Layers are otherwise identical besides the window content and maybe
+		// the render commands. We will process their render command and add
+		// appropriate damage. Commands that appeared or disappeared damage the
+		// area they cover.
 		log_trace("Adding window damage");
-		for (struct backend_command *cmd1 = past_layer_cmd, *cmd2 = curr_layer_cmd;
-		     cmd1 < past_layer_cmd + past_layer->number_of_commands; cmd1++, cmd2++) {
+		struct command_match matches[2 * LAYER_MAX_COMMANDS];
+		auto nmatches = layer_match_commands(past_layer, past_layer_cmd, curr_layer,
+		                                     curr_layer_cmd, matches);
+		for (unsigned i = 0; i < nmatches; i++) {
+			auto cmd1 = matches[i].past;
+			auto cmd2 = matches[i].curr;
+			if (cmd1 == NULL || cmd2 == NULL) {
+				auto cmd = cmd1 ?: cmd2;
+				pixman_region32_union(damage, damage, &cmd->target_mask);
+				continue;
+			}
 			switch (cmd1->op) {
 			case BACKEND_COMMAND_BLIT:
 				command_blit_damage(damage, &scratch_region, cmd1, cmd2,
@@ -294,7 +366,8 @@ void layout_manager_damage(struct layout_manager *lm, unsigned buffer_age,
 }
 
 void commands_cull_with_damage(struct layout *layout, const region_t *damage,
-                               ivec2 blur_size, region_t *culled_mask) {
+                               ivec2 blur_size, const region_t *const *blur_cached,
+                               region_t *culled_mask) {
 	// This may sound silly, and probably actually is. Why do GPU's job on the CPU?
 	// Isn't the GPU supposed to be the one that does culling, depth testing etc.?
 	//
@@ -315,28 +388,60 @@ void commands_cull_with_damage(struct layout *layout, const region_t *damage,
 	// scratch_region stores the visible damage region of the screen at the current
 	// layer. at the top most layer, all of damage is visible
 	pixman_region32_copy(&scratch_region, damage);
+
+	// Only commands that could overlap the damage need to be looked at. Commands
+	// that are not marked don't overlap `scratch_region`, so culling them leaves
+	// nothing, and they don't change `scratch_region` either. `scratch_region`
+	// only grows when we go past a blur, then we mark the commands overlapping
+	// the added area.
+	auto marked = layout->grid.marked;
+	memset(marked, 0, layout->number_of_commands * sizeof(bool));
+	layout_mark_commands(layout, damage, layout->number_of_commands);
 	for (int i = to_int_checked(layout->number_of_commands - 1); i >= 0; i--) {
 		auto cmd = &layout->commands[i];
-		pixman_region32_copy(&culled_mask[i], &cmd->target_mask);
-		pixman_region32_intersect(&culled_mask[i], &culled_mask[i], &scratch_region);
+		if (marked[i]) {
+			pixman_region32_copy(&culled_mask[i], &cmd->target_mask);
+			pixman_region32_intersect(&culled_mask[i], &culled_mask[i],
+			                          &scratch_region);
+		} else {
+			pixman_region32_clear(&culled_mask[i]);
+		}
 		switch (cmd->op) {
 		case BACKEND_COMMAND_BLIT:
-			pixman_region32_subtract(&scratch_region, &scratch_region,
-			                         &cmd->opaque_region);
+			if (marked[i]) {
+				pixman_region32_subtract(&scratch_region, &scratch_region,
+				                         &cmd->opaque_region);
+			}
 			cmd->blit.target_mask = &culled_mask[i];
 			break;
 		case BACKEND_COMMAND_COPY_AREA:
-			pixman_region32_subtract(&scratch_region, &scratch_region,
-			                         &cmd->target_mask);
+			if (marked[i]) {
+				pixman_region32_subtract(&scratch_region, &scratch_region,
+				                         &cmd->target_mask);
+			}
 			cmd->copy_area.region = &culled_mask[i];
 			break;
 		case BACKEND_COMMAND_BLUR:
 			// To render blur, the layers below must render pixels surrounding
 			// the blurred area in this layer.
-			pixman_region32_copy(&tmp, &scratch_region);
-			pixman_region32_intersect(&tmp, &tmp, &cmd->target_mask);
-			resize_region_in_place(&tmp, blur_size.width, blur_size.height);
-			pixman_region32_union(&scratch_region, &scratch_region, &tmp);
+			if (marked[i]) {
+				if (blur_cached != NULL && blur_cached[i] != NULL) {
+					// Cached parts of the blur are copied over
+					// whatever is below, so they act like an opaque
+					// region. Only the rest needs pixels from below.
+					pixman_region32_intersect(&tmp, &culled_mask[i],
+					                          blur_cached[i]);
+					pixman_region32_subtract(&scratch_region,
+					                         &scratch_region, &tmp);
+					pixman_region32_subtract(&tmp, &culled_mask[i],
+					                         blur_cached[i]);
+				} else {
+					pixman_region32_copy(&tmp, &culled_mask[i]);
+				}
+				resize_region_in_place(&tmp, blur_size.width, blur_size.height);
+				pixman_region32_union(&scratch_region, &scratch_region, &tmp);
+				layout_mark_commands(layout, &tmp, (unsigned)i);
+			}
 			cmd->blur.target_mask = &culled_mask[i];
 			break;
 		case BACKEND_COMMAND_INVALID: assert(false);
@@ -13,14 +13,20 @@ struct backend_mask;
 ///
 /// After this call, the commands' regions of operations no longer point to their `mask`
 /// fields. they point to `culled_mask` instead. The values of their `mask` fields are
-/// retained, so later the commands can be "un-culled".
+/// retained, so later the commands can be "un-culled". `layout`'s commands must have
+/// been indexed with `layout_index_commands`.
 ///
+/// @param blur_cached optional, for each command, NULL or the region of the screen where
+///                    the result of that blur command is already available, and will be
+///                    copied into place instead of being blurred again. Layers below
+///                    don't need to be rendered there for the blur.
 /// @param culled_mask use to stored the culled masks, must be have space to store at
 ///                    least `layout->number_of_commands` elements. They MUST be
 ///                    initialized before calling this function. These masks MUST NOT be
 ///                    freed until you call `commands_uncull`.
 void commands_cull_with_damage(struct layout *layout, const region_t *damage,
-                               ivec2 blur_size, region_t *culled_mask);
+                               ivec2 blur_size, const region_t *const *blur_cached,
+                               region_t *culled_mask);
 
 /// Un-do the effect of `commands_cull_with_damage`
 void commands_uncull(struct layout *layout);
@@ -36,7 +42,13 @@ void commands_uncull(struct layout *layout);
 /// them. `blur_size` is the size of the background blur, and is assumed to not change
 /// over time.
 ///
+/// If `layer_damage` is not NULL, it must have space for one initialized region per
+/// layer in the current layout. For each layer, the damage caused by the layers below
+/// it is stored there, i.e. what `damage` would be if that layer and everything above
+/// were not rendered. Layers that have no match in the past layout get the whole
+/// screen.
+///
 /// Note `layout_manager_damage` cannot take desktop background change into
 /// account.
 void layout_manager_damage(struct layout_manager *lm, unsigned buffer_age,
-                           ivec2 blur_size, region_t *damage);
+                           ivec2 blur_size, region_t *damage, region_t *layer_damage);
@@ -2,10 +2,12 @@
 // Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
 
 #include <stddef.h>
+#include <string.h>
 #include <uthash.h>
 
 #include <picom/types.h>
 
+#include "backend/backend.h"
 #include "command_builder.h"
 #include "common.h"
 #include "region.h"
@@ -42,7 +44,7 @@ struct layout_manager {
 static bool layer_from_window(struct layer *out_layer, struct win *w, ivec2 size) {
 	bool to_paint = false;
 	auto w_opts = win_options(w);
-	if (!w->ever_damaged || !w_opts.paint) {
+	if (!w->ever_damaged || w->awaiting_properties || !w_opts.paint || w->occluded) {
 		goto out;
 	}
 	if (w->win_image == NULL) {
@@ -114,6 +116,7 @@ static bool layer_from_window(struct layer *out_layer, struct win *w, ivec2 size
 	out_layer->prev_rank = -1;
 	out_layer->key = wm_ref_treeid(w->tree_ref);
 	out_layer->win = w;
+	out_layer->generation = w->layout_generation;
 	to_paint = true;
 
 out:
@@ -121,6 +124,27 @@ out:
 	return to_paint;
 }
 
+/// Whether the layer `prev_layer` computed for `w` in the previous frame is still up to
+/// date. Layers of windows that are animating, or that have new damage, are always
+/// recomputed.
+static bool layer_is_reusable(const struct layer *prev_layer, const struct win *w) {
+	return prev_layer->generation == w->layout_generation &&
+	       w->running_animation_instance == NULL && !pixman_region32_not_empty(&w->damaged);
+}
+
+/// Reuse `prev_layer` for the current frame. `out_layer` gets a copy of it, with its
+/// damage cleared.
+static void layer_reuse(struct layer *out_layer, const struct layer *prev_layer,
+                        struct win *w) {
+	region_t damaged = out_layer->damaged;
+	*out_layer = *prev_layer;
+	out_layer->damaged = damaged;
+	pixman_region32_clear(&out_layer->damaged);
+	out_layer->next_rank = -1;
+	out_layer->prev_rank = -1;
+	out_layer->win = w;
+}
+
 static void layer_deinit(struct layer *layer) {
 	pixman_region32_fini(&layer->damaged);
 }
@@ -166,10 +190,22 @@ void layout_manager_clear(struct layout_manager *lm) {
 	lm->current = 0;
 }
 
+static void command_grid_free(struct command_grid *grid) {
+	for (int i = 0; i < grid->size.width * grid->size.height; i++) {
+		dynarr_free_pod(grid->cells[i]);
+	}
+	free(grid->cells);
+	if (grid->marked) {
+		dynarr_free_pod(grid->marked);
+	}
+	*grid = (struct command_grid){};
+}
+
 void layout_manager_free(struct layout_manager *lm) {
 	for (unsigned i = 0; i < lm->max_buffer_age; i++) {
 		layout_deinit(&lm->layouts[i]);
 		dynarr_free(lm->layouts[i].layers, layer_deinit);
+		command_grid_free(&lm->layouts[i].grid);
 	}
 	struct layer_index *index, *tmp;
 	HASH_ITER(hh, lm->layer_indices, index, tmp) {
@@ -200,6 +236,8 @@ void layout_manager_append_layout(struct layout_manager *lm, struct wm *wm,
 	lm->current = (lm->current + 1) % lm->max_buffer_age;
 	auto layout = &lm->layouts[lm->current];
 	command_builder_command_list_free(layout->commands);
+	layout->commands = NULL;
+	layout->number_of_commands = 0;
 	layout->root_image_generation = root_pixmap_generation;
 	layout->size = size;
 
@@ -211,12 +249,21 @@ void layout_manager_append_layout(struct layout_manager *lm, struct wm *wm,
 			continue;
 		}
 		dynarr_resize(layout->layers, rank + 1, layer_init, layer_deinit);
-		if (!layer_from_window(&layout->layers[rank], (struct win *)w, size)) {
+
+		// If this window hasn't changed since the previous frame, its layer can be
+		// copied from the previous layout instead of computed from scratch. Every
+		// window is still visited, looked up and copied, since each layout keeps
+		// all of its layers for damage calculation; this only saves folding the
+		// window options and looking up the animatables.
+		auto key = wm_ref_treeid(cursor);
+		HASH_FIND(hh, lm->layer_indices, &key, sizeof(key), index);
+		if (index && ivec2_eq(prev_layout->size, size) &&
+		    layer_is_reusable(&prev_layout->layers[index->index], w)) {
+			layer_reuse(&layout->layers[rank], &prev_layout->layers[index->index], w);
+		} else if (!layer_from_window(&layout->layers[rank], w, size)) {
 			continue;
 		}
 
-		HASH_FIND(hh, lm->layer_indices, &layout->layers[rank].key,
-		          sizeof(layout->layers[rank].key), index);
 		if (index) {
 			prev_layout->layers[index->index].next_rank = (int)rank;
 			layout->layers[rank].prev_rank = (int)index->index;
@@ -304,3 +351,83 @@ int layer_next_rank(struct layout_manager *lm, unsigned buffer_age, unsigned ind
 	}
 	return index;
 }
+
+/// Find the range of cells `rect` covers, clamped to the grid. `end` is exclusive.
+static inline void
+command_grid_cell_range(const struct command_grid *grid, const rect_t *rect,
+                        ivec2 *start, ivec2 *end) {
+	start->x = clamp(rect->x1 / COMMAND_GRID_CELL_SIZE, 0, grid->size.width - 1);
+	start->y = clamp(rect->y1 / COMMAND_GRID_CELL_SIZE, 0, grid->size.height - 1);
+	end->x = clamp((rect->x2 - 1) / COMMAND_GRID_CELL_SIZE, 0, grid->size.width - 1) + 1;
+	end->y = clamp((rect->y2 - 1) / COMMAND_GRID_CELL_SIZE, 0, grid->size.height - 1) + 1;
+}
+
+void layout_index_commands(struct layout *layout) {
+	auto grid = &layout->grid;
+	ivec2 size = {
+	    .width = max2(1, (layout->size.width + COMMAND_GRID_CELL_SIZE - 1) /
+	                         COMMAND_GRID_CELL_SIZE),
+	    .height = max2(1, (layout->size.height + COMMAND_GRID_CELL_SIZE - 1) /
+	                          COMMAND_GRID_CELL_SIZE),
+	};
+	if (!ivec2_eq(size, grid->size)) {
+		command_grid_free(grid);
+		grid->size = size;
+		grid->cells = ccalloc(size.width * size.height, unsigned *);
+		for (int i = 0; i < size.width * size.height; i++) {
+			grid->cells[i] = dynarr_new(unsigned, 0);
+		}
+	}
+	if (grid->marked == NULL) {
+		grid->marked = dynarr_new(bool, layout->number_of_commands);
+	}
+	dynarr_resize_pod(grid->marked, layout->number_of_commands);
+	for (int i = 0; i < size.width * size.height; i++) {
+		dynarr_clear_pod(grid->cells[i]);
+	}
+
+	for (unsigned i = 0; i < layout->number_of_commands; i++) {
+		auto extents = &layout->commands[i].target_mask.extents;
+		if (extents->x1 >= extents->x2 || extents->y1 >= extents->y2) {
+			continue;
+		}
+		ivec2 start, end;
+		command_grid_cell_range(grid, extents, &start, &end);
+		for (int y = start.y; y < end.y; y++) {
+			for (int x = start.x; x < end.x; x++) {
+				dynarr_push(grid->cells[y * size.width + x], i);
+			}
+		}
+	}
+}
+
+void layout_mark_commands(struct layout *layout, const region_t *region, unsigned end) {
+	auto grid = &layout->grid;
+	int nrects;
+	auto rects = pixman_region32_rectangles(region, &nrects);
+	for (int i = 0; i < nrects; i++) {
+		ivec2 cell_start, cell_end;
+		command_grid_cell_range(grid, &rects[i], &cell_start, &cell_end);
+		if ((cell_end.x - cell_start.x) * (cell_end.y - cell_start.y) * 2 >
+		    grid->size.width * grid->size.height) {
+			// Most of the screen is covered, going through the cells is
+			// going to be slower than just marking everything.
+			memset(grid->marked, true, end * sizeof(bool));
+			return;
+		}
+		for (int y = cell_start.y; y < cell_end.y; y++) {
+			for (int x = cell_start.x; x < cell_end.x; x++) {
+				dynarr_foreach(grid->cells[y * grid->size.width + x], index) {
+					if (*index >= end) {
+						break;
+					}
+					if (!grid->marked[*index] &&
+					    rect_overlap(&layout->commands[*index].target_mask.extents,
+					                 &rects[i])) {
+						grid->marked[*index] = true;
+					}
+				}
+			}
+		}
+	}
+}
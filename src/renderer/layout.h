@@ -45,6 +45,10 @@ struct layer {
 
 	/// How many commands are needed to render this layer
 	unsigned number_of_commands;
+	/// Index of the first command of this layer in `struct layout::commands`
+	unsigned first_command;
+	/// `layout_generation` of the window when this layer was computed.
+	uint64_t generation;
 
 	/// Rank of this layer in the previous frame, -1 if this window
 	/// appears in this frame for the first time
@@ -59,6 +63,24 @@ struct layer {
 	// region_t blur_region;
 };
 
+/// Size of the cells of `struct command_grid`, in pixels.
+#define COMMAND_GRID_CELL_SIZE 256
+
+/// A uniform grid over the screen, indexing the commands of a layout by the extents of
+/// their target masks. Used to quickly find the commands that could overlap a small
+/// region, without looking at every command.
+struct command_grid {
+	/// Number of cells in each direction.
+	ivec2 size;
+	/// `size.width * size.height` dynarrs, in row major order. Each has the indices of
+	/// the commands whose extents overlap that cell, in ascending order. Parts of
+	/// commands outside of the screen are counted towards the cells on the edges.
+	unsigned **cells;
+	/// Whether each command has been marked by `layout_mark_commands`. This is a
+	/// dynarr.
+	bool *marked;
+};
+
 /// Layout of windows at a specific frame
 struct layout {
 	ivec2 size;
@@ -75,6 +97,8 @@ struct layout {
 	/// are recorded in the same order as the layers they correspond to. Each layer
 	/// can have 0 or more commands associated with it.
 	struct backend_command *commands;
+	/// Spatial index of `commands`.
+	struct command_grid grid;
 };
 
 struct wm;
@@ -103,3 +127,11 @@ int layer_prev_rank(struct layout_manager *lm, unsigned buffer_age, unsigned ind
 /// Find layer that was at `index` `buffer_age` aga in the current layout.
 int layer_next_rank(struct layout_manager *lm, unsigned buffer_age, unsigned index_);
 unsigned layout_manager_max_buffer_age(const struct layout_manager *lm);
+/// Rebuild the spatial index of `layout`'s commands. Has to be called every time the
+/// commands are changed.
+void layout_index_commands(struct layout *layout);
+/// Set `layout->grid.marked` for the commands whose index is less than `end`, and whose
+/// target masks could overlap `region`. A command might be marked even if it doesn't
+/// overlap `region`, but all commands that do overlap are marked. Existing marks are not
+/// cleared.
+void layout_mark_commands(struct layout *layout, const region_t *region, unsigned end);
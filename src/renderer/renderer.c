@@ -4,6 +4,8 @@
 #include "renderer.h"
 
 #include <inttypes.h>
+#include <string.h>
+#include <uthash.h>
 #include <xcb/xcb_aux.h>
 
 #include "backend/backend.h"
@@ -13,6 +15,42 @@
 #include "layout.h"
 #include "picom.h"
 #include "utils/dynarr.h"
+#include "utils/uthash_extra.h"
+
+/// Pieces nine-slice shadows are drawn with, see `shadow_tile_size`. Shadow radius and
+/// color are the same for all windows, and opacity is applied when blitting, so the
+/// tiles only depend on the corner radius.
+struct shadow_tiles {
+	unsigned int corner_radius;
+	/// Shadow of a small window, the corners are cut from this.
+	image_handle corners;
+	/// Mask of the small window, used to cut the window out of the corners.
+	image_handle mask;
+	/// One pixel wide strips through the middle of `corners`.
+	image_handle top, bottom, left, right;
+	/// The center pixel of `corners`.
+	image_handle center;
+	UT_hash_handle hh;
+};
+
+/// Background blur of a window, kept so it doesn't have to be redone while nothing below
+/// the window changes. What is kept is the back image right after the blur command, i.e.
+/// already blended with the blur opacity and mask, so it can be copied back as is.
+struct blur_cache {
+	wm_treeid key;
+	image_handle image;
+	/// Part of the screen `image` covers.
+	struct ibox box;
+	/// Part of the screen where `image` holds an up-to-date blur result.
+	region_t valid;
+	/// Arguments of the blur command the result was rendered with.
+	double opacity;
+	bool has_mask;
+	struct backend_mask_image mask;
+	/// Whether the window still has a blur command in the current frame.
+	bool used;
+	UT_hash_handle hh;
+};
 
 struct renderer {
 	/// Intermediate image to hold what will be presented to the back buffer.
@@ -41,12 +79,55 @@ struct renderer {
 	int shadow_radius;
 	void *shadow_blur_context;
 	struct conv *shadow_kernel;
+	/// Cached nine-slice shadow tiles, keyed by corner radius.
+	struct shadow_tiles *shadow_tiles;
+	/// Cached background blurs, keyed by window.
+	struct blur_cache *blur_caches;
+	/// Blur context and blur size `blur_caches` were rendered with.
+	void *blur_cache_context;
+	ivec2 blur_cache_size;
+	/// Whether the last frame was completely rendered. If not, `blur_caches` might
+	/// have missed some damage.
+	bool last_frame_rendered;
 
 	/// A dynarr of region_t for storing culled masks
 	region_t *culled_masks;
+	/// A dynarr of region_t, damage since the last frame caused by the layers below
+	/// each layer, see `layout_manager_damage`.
+	region_t *layer_damage;
+	/// A dynarr with one element per render command, the `valid` region of the
+	/// `blur_cache` used by that command, or NULL.
+	const region_t **blur_cached;
 };
 
+static void shadow_tiles_free(struct backend_base *backend, struct shadow_tiles *tiles) {
+	image_handle images[] = {tiles->corners, tiles->mask,  tiles->top,   tiles->bottom,
+	                         tiles->left,    tiles->right, tiles->center};
+	for (size_t i = 0; i < ARR_SIZE(images); i++) {
+		if (images[i]) {
+			backend->ops.release_image(backend, images[i]);
+		}
+	}
+	free(tiles);
+}
+
+static void blur_cache_free(struct backend_base *backend, struct blur_cache *cache) {
+	if (cache->image) {
+		backend->ops.release_image(backend, cache->image);
+	}
+	pixman_region32_fini(&cache->valid);
+	free(cache);
+}
+
 void renderer_free(struct backend_base *backend, struct renderer *r) {
+	HASH_ITER2(r->shadow_tiles, tiles) {
+		HASH_DEL(r->shadow_tiles, tiles);
+		shadow_tiles_free(backend, tiles);
+	}
+	HASH_ITER2(r->blur_caches, cache) {
+		HASH_DEL(r->blur_caches, cache);
+		blur_cache_free(backend, cache);
+	}
 	if (r->white_image) {
 		backend->ops.release_image(backend, r->white_image);
 	}
@@ -81,6 +162,8 @@ void renderer_free(struct backend_base *backend, struct renderer *r) {
 		free(r->monitor_repaint_copy);
 	}
 	dynarr_free(r->culled_masks, pixman_region32_fini);
+	dynarr_free(r->layer_damage, pixman_region32_fini);
+	dynarr_free_pod(r->blur_cached);
 	free(r);
 }
 
@@ -119,6 +202,11 @@ renderer_init(struct renderer *renderer, struct backend_base *backend,
 		}
 		renderer->shadow_radius = (int)shadow_radius;
 		renderer->shadow_color = shadow_color;
+	}
+	bool cpu_shadow = backend->ops.quirks(backend) & BACKEND_QUIRK_SLOW_BLUR;
+	if (shadow_radius > 0 && cpu_shadow) {
+		// Only needed for generating shadows on the CPU, see
+		// `renderer_bind_shadow`.
 		renderer->shadow_pixel =
 		    solid_picture(backend->c, true, shadow_color.alpha, shadow_color.red,
 		                  shadow_color.green, shadow_color.blue);
@@ -135,6 +223,8 @@ renderer_init(struct renderer *renderer, struct backend_base *backend,
 	}
 	renderer->max_buffer_age = backend->ops.max_buffer_age(backend) + 1;
 	renderer->culled_masks = dynarr_new(region_t, 0);
+	renderer->layer_damage = dynarr_new(region_t, 0);
+	renderer->blur_cached = dynarr_new(const region_t *, 0);
 	return true;
 }
 
@@ -351,15 +441,17 @@ static bool
 renderer_bind_shadow(struct renderer *r, struct backend_base *backend, struct win *w) {
 	if (backend->ops.quirks(backend) & BACKEND_QUIRK_SLOW_BLUR) {
 		xcb_pixmap_t shadow = XCB_NONE;
+		ivec2 shadow_size;
 		if (!build_shadow(backend->c, r->shadow_color.alpha, w->widthb, w->heightb,
-		                  (void *)r->shadow_kernel, r->shadow_pixel, &shadow)) {
+		                  (void *)r->shadow_kernel, r->shadow_pixel, &shadow,
+		                  &shadow_size)) {
 			return false;
 		}
 
 		auto visual =
 		    x_get_visual_for_standard(backend->c, XCB_PICT_STANDARD_ARGB_32);
 		w->shadow_image = backend->ops.bind_pixmap(
-		    backend, shadow, x_get_visual_info(backend->c, visual));
+		    backend, shadow, shadow_size, x_get_visual_info(backend->c, visual));
 	} else {
 		if (!w->mask_image && !renderer_bind_mask(r, backend, w)) {
 			return false;
@@ -375,6 +467,130 @@ renderer_bind_shadow(struct renderer *r, struct backend_base *backend, struct wi
 	return true;
 }
 
+/// Cut the part of `source` covered by `box` out into a new image.
+static image_handle renderer_cut_shadow_strip(struct backend_base *backend,
+                                              image_handle source, ivec2 source_size,
+                                              struct ibox box) {
+	auto image =
+	    backend->ops.new_image(backend, BACKEND_IMAGE_FORMAT_PIXMAP, box.size);
+	if (!image || !backend->ops.clear(backend, image, (struct color){0, 0, 0, 0})) {
+		goto err;
+	}
+
+	{
+		scoped_region_t target_mask =
+		    region_from_box((struct ibox){.size = box.size});
+		struct backend_blit_args args = {
+		    .source_image = source,
+		    .target_mask = &target_mask,
+		    .opacity = 1,
+		    .max_brightness = 1,
+		    .scale = SCALE_IDENTITY,
+		    .effective_size = source_size,
+		};
+		if (backend->ops.blit(backend, ivec2_neg(box.origin), image, &args)) {
+			return image;
+		}
+	}
+err:
+	if (image) {
+		backend->ops.release_image(backend, image);
+	}
+	return NULL;
+}
+
+/// Get the nine-slice shadow tiles for windows with `corner_radius`, generating them
+/// if they are not cached yet.
+static struct shadow_tiles *renderer_get_shadow_tiles(struct renderer *r,
+                                                      struct backend_base *backend,
+                                                      unsigned int corner_radius) {
+	struct shadow_tiles *tiles = NULL;
+	HASH_FIND(hh, r->shadow_tiles, &corner_radius, sizeof(corner_radius), tiles);
+	if (tiles) {
+		return tiles;
+	}
+
+	int t = shadow_tile_size(r->shadow_radius, corner_radius);
+	int size = 2 * t + 1;
+	ivec2 window_size = {size - 2 * r->shadow_radius, size - 2 * r->shadow_radius};
+	log_debug("Generating shadow tiles for corner radius %u, tile size %d",
+	          corner_radius, t);
+	tiles = ccalloc(1, struct shadow_tiles);
+	tiles->corner_radius = corner_radius;
+	tiles->mask =
+	    backend->ops.new_image(backend, BACKEND_IMAGE_FORMAT_MASK, window_size);
+	if (!tiles->mask ||
+	    !backend->ops.clear(backend, tiles->mask, (struct color){1, 1, 1, 1})) {
+		goto err;
+	}
+
+	if (backend->ops.quirks(backend) & BACKEND_QUIRK_SLOW_BLUR) {
+		xcb_pixmap_t shadow = XCB_NONE;
+		ivec2 shadow_size;
+		if (!build_shadow(backend->c, r->shadow_color.alpha, window_size.width,
+		                  window_size.height, (void *)r->shadow_kernel,
+		                  r->shadow_pixel, &shadow, &shadow_size)) {
+			goto err;
+		}
+
+		auto visual =
+		    x_get_visual_for_standard(backend->c, XCB_PICT_STANDARD_ARGB_32);
+		tiles->corners = backend->ops.bind_pixmap(
+		    backend, shadow, shadow_size, x_get_visual_info(backend->c, visual));
+	} else {
+		tiles->corners = renderer_shadow_from_mask(r, backend, tiles->mask,
+		                                           corner_radius, window_size);
+	}
+	if (!tiles->corners) {
+		goto err;
+	}
+
+	ivec2 corners_size = {size, size};
+	tiles->top = renderer_cut_shadow_strip(backend, tiles->corners, corners_size,
+	                                       (struct ibox){{t, 0}, {1, t}});
+	tiles->bottom = renderer_cut_shadow_strip(backend, tiles->corners, corners_size,
+	                                          (struct ibox){{t, size - t}, {1, t}});
+	tiles->left = renderer_cut_shadow_strip(backend, tiles->corners, corners_size,
+	                                        (struct ibox){{0, t}, {t, 1}});
+	tiles->right = renderer_cut_shadow_strip(backend, tiles->corners, corners_size,
+	                                         (struct ibox){{size - t, t}, {t, 1}});
+	tiles->center = renderer_cut_shadow_strip(backend, tiles->corners, corners_size,
+	                                          (struct ibox){{t, t}, {1, 1}});
+	if (!tiles->top || !tiles->bottom || !tiles->left || !tiles->right ||
+	    !tiles->center) {
+		goto err;
+	}
+	HASH_ADD(hh, r->shadow_tiles, corner_radius, sizeof(tiles->corner_radius), tiles);
+	return tiles;
+err:
+	log_error("Failed to generate shadow tiles");
+	shadow_tiles_free(backend, tiles);
+	return NULL;
+}
+
+bool renderer_prepare_shadow_slice(struct renderer *r, struct backend_base *backend,
+                                   unsigned int corner_radius,
+                                   struct backend_command *cmd) {
+	auto tiles = renderer_get_shadow_tiles(r, backend, corner_radius);
+	if (tiles == NULL) {
+		return false;
+	}
+	const image_handle images[] = {
+	    [BACKEND_COMMAND_SOURCE_SHADOW_CORNER] = tiles->corners,
+	    [BACKEND_COMMAND_SOURCE_SHADOW_TOP] = tiles->top,
+	    [BACKEND_COMMAND_SOURCE_SHADOW_BOTTOM] = tiles->bottom,
+	    [BACKEND_COMMAND_SOURCE_SHADOW_LEFT] = tiles->left,
+	    [BACKEND_COMMAND_SOURCE_SHADOW_RIGHT] = tiles->right,
+	    [BACKEND_COMMAND_SOURCE_SHADOW_CENTER] = tiles->center,
+	};
+	assert(cmd->source < ARR_SIZE(images) && images[cmd->source] != NULL);
+	cmd->blit.source_image = images[cmd->source];
+	if (cmd->blit.source_mask != NULL) {
+		cmd->source_mask.image = tiles->mask;
+	}
+	return true;
+}
+
 /// Go through the list of commands and replace symbolic image references with real
 /// images. Allocate images for windows when necessary.
 static bool renderer_prepare_commands(struct renderer *r, struct backend_base *backend,
@@ -411,6 +627,12 @@ static bool renderer_prepare_commands(struct renderer *r, struct backend_base *b
 					return false;
 				}
 				cmd->blit.source_image = w->shadow_image;
+			} else if (backend_command_source_is_shadow(cmd->source)) {
+				if (!renderer_prepare_shadow_slice(
+				        r, backend, win_options(w).corner_radius, cmd)) {
+					return false;
+				}
+				break;
 			} else if (cmd->source == BACKEND_COMMAND_SOURCE_WINDOW) {
 				assert(w->win_image);
 				cmd->blit.source_image = w->win_image;
@@ -484,6 +706,210 @@ void renderer_ensure_images_ready(struct renderer *r, struct backend_base *backe
 	}
 }
 
+static bool renderer_layout_has_blur(const struct layout *layout) {
+	for (unsigned i = layout->first_layer_start; i < layout->number_of_commands; i++) {
+		if (layout->commands[i].op == BACKEND_COMMAND_BLUR) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Whether the result in `cache` was rendered with the same arguments as blur command
+/// `cmd`. `mask_image` is the mask image `cmd` will use.
+static bool
+blur_cache_matches(const struct blur_cache *cache, const struct backend_command *cmd,
+                   image_handle mask_image) {
+	if (cache->opacity != cmd->blur.opacity ||
+	    cache->has_mask != (cmd->blur.source_mask != NULL)) {
+		return false;
+	}
+	return !cache->has_mask ||
+	       (cache->mask.image == mask_image &&
+	        cache->mask.corner_radius == cmd->source_mask.corner_radius &&
+	        cache->mask.inverted == cmd->source_mask.inverted &&
+	        ivec2_eq(cache->mask.origin, cmd->source_mask.origin));
+}
+
+/// Find the blur caches for the blur commands in `layout`, and remove the parts of them
+/// that are invalidated by damage below their windows. Caches of windows that are no
+/// longer blurred are freed. Must be called before the commands are culled.
+///
+/// @param blur_context the blur context of the blur commands, or NULL if blur results
+///                     shouldn't be cached.
+static void
+renderer_update_blur_caches(struct renderer *r, struct backend_base *backend,
+                            const struct layout *layout, void *blur_context,
+                            ivec2 blur_size, bool has_layer_damage) {
+	bool reusable = has_layer_damage && blur_context == r->blur_cache_context &&
+	                ivec2_eq(blur_size, r->blur_cache_size);
+	r->blur_cache_context = blur_context;
+	r->blur_cache_size = blur_size;
+	HASH_ITER2(r->blur_caches, cache) {
+		cache->used = false;
+	}
+	dynarr_resize_pod(r->blur_cached, layout->number_of_commands);
+	memset(r->blur_cached, 0, layout->number_of_commands * sizeof(*r->blur_cached));
+
+	region_t scratch;
+	pixman_region32_init(&scratch);
+	auto cmd = &layout->commands[layout->first_layer_start];
+	for (unsigned i = 0; blur_context != NULL && i < dynarr_len(layout->layers);
+	     cmd += layout->layers[i].number_of_commands, i++) {
+		auto layer = &layout->layers[i];
+		if (layer->number_of_commands == 0 || cmd->op != BACKEND_COMMAND_BLUR ||
+		    !pixman_region32_not_empty(&cmd->target_mask)) {
+			continue;
+		}
+
+		struct blur_cache *cache = NULL;
+		HASH_FIND(hh, r->blur_caches, &layer->key, sizeof(layer->key), cache);
+		if (cache == NULL) {
+			cache = ccalloc(1, struct blur_cache);
+			cache->key = layer->key;
+			pixman_region32_init(&cache->valid);
+			HASH_ADD(hh, r->blur_caches, key, sizeof(cache->key), cache);
+		}
+
+		auto extent = pixman_region32_extents(&cmd->target_mask);
+		if (cache->image == NULL || extent->x1 < cache->box.origin.x ||
+		    extent->y1 < cache->box.origin.y ||
+		    extent->x2 > cache->box.origin.x + cache->box.size.width ||
+		    extent->y2 > cache->box.origin.y + cache->box.size.height) {
+			if (cache->image) {
+				backend->ops.release_image(backend, cache->image);
+			}
+			pixman_region32_clear(&cache->valid);
+			cache->box = (struct ibox){
+			    .origin = {extent->x1, extent->y1},
+			    .size = {extent->x2 - extent->x1, extent->y2 - extent->y1},
+			};
+			cache->image = backend->ops.new_image(backend, r->format,
+			                                      cache->box.size);
+			if (cache->image == NULL) {
+				log_error("Failed to allocate image for blur cache");
+				continue;
+			}
+		}
+
+		auto mask_image = cmd->blur.source_mask ? layer->win->mask_image : NULL;
+		if (!reusable || !blur_cache_matches(cache, cmd, mask_image)) {
+			pixman_region32_clear(&cache->valid);
+		} else {
+			// Blur reads pixels up to `blur_size` away from what it renders.
+			pixman_region32_copy(&scratch, &r->layer_damage[i]);
+			resize_region_in_place(&scratch, blur_size.width,
+			                       blur_size.height);
+			pixman_region32_subtract(&cache->valid, &cache->valid, &scratch);
+		}
+		pixman_region32_intersect(&cache->valid, &cache->valid, &cmd->target_mask);
+		cache->used = true;
+		r->blur_cached[cmd - layout->commands] = &cache->valid;
+	}
+	pixman_region32_fini(&scratch);
+
+	HASH_ITER2(r->blur_caches, cache) {
+		if (!cache->used) {
+			HASH_DEL(r->blur_caches, cache);
+			blur_cache_free(backend, cache);
+		}
+	}
+}
+
+/// Execute blur command `cmd` with the help of `cache`. Cached parts of the blur are
+/// copied into `target`, the rest is blurred, and then saved into the cache. Blurring
+/// reads from the back image, so `target` can only be something else if everything
+/// is cached.
+static bool renderer_blur_with_cache(struct renderer *r, struct backend_base *backend,
+                                     image_handle target,
+                                     const struct backend_command *cmd,
+                                     struct blur_cache *cache) {
+	cache->opacity = cmd->blur.opacity;
+	cache->has_mask = cmd->blur.source_mask != NULL;
+	if (cache->has_mask) {
+		cache->mask = *cmd->blur.source_mask;
+	}
+	if (!pixman_region32_not_empty(cmd->blur.target_mask)) {
+		return true;
+	}
+
+	scoped_region_t cached, missing;
+	pixman_region32_init(&cached);
+	pixman_region32_init(&missing);
+	pixman_region32_intersect(&cached, cmd->blur.target_mask, &cache->valid);
+	pixman_region32_subtract(&missing, cmd->blur.target_mask, &cache->valid);
+	if (pixman_region32_not_empty(&missing)) {
+		assert(target == r->back_image);
+		auto args = cmd->blur;
+		args.target_mask = &missing;
+		if (!backend->ops.blur(backend, cmd->origin, r->back_image, &args)) {
+			return false;
+		}
+		pixman_region32_union(&cache->valid, &cache->valid, &missing);
+		pixman_region32_translate(&missing, -cache->box.origin.x,
+		                          -cache->box.origin.y);
+		if (!backend->ops.copy_area(backend, ivec2_neg(cache->box.origin),
+		                            cache->image, r->back_image, &missing)) {
+			return false;
+		}
+	}
+	if (pixman_region32_not_empty(&cached)) {
+		return backend->ops.copy_area(backend, cache->box.origin, target,
+		                              cache->image, &cached);
+	}
+	return true;
+}
+
+/// Whether anything in `layout` needs to read back what was rendered, after the commands
+/// are culled. That is the case if any blur command has parts that are not cached.
+static bool
+renderer_needs_read_back(const struct renderer *r, const struct layout *layout) {
+	region_t scratch;
+	pixman_region32_init(&scratch);
+	bool ret = false;
+	for (unsigned i = layout->first_layer_start; i < layout->number_of_commands; i++) {
+		auto cmd = &layout->commands[i];
+		if (cmd->op != BACKEND_COMMAND_BLUR ||
+		    !pixman_region32_not_empty(cmd->blur.target_mask)) {
+			continue;
+		}
+		if (r->blur_cached[i] == NULL) {
+			ret = true;
+			break;
+		}
+		pixman_region32_subtract(&scratch, cmd->blur.target_mask,
+		                         r->blur_cached[i]);
+		if (pixman_region32_not_empty(&scratch)) {
+			ret = true;
+			break;
+		}
+	}
+	pixman_region32_fini(&scratch);
+	return ret;
+}
+
+/// Execute the render commands in `layout` into `target`, blur commands that have a
+/// cache go through `renderer_blur_with_cache`.
+static bool renderer_execute(struct renderer *r, struct backend_base *backend,
+                             image_handle target, struct layout *layout) {
+	unsigned start = 0;
+	for (unsigned i = 0; i < layout->number_of_commands; i++) {
+		if (r->blur_cached[i] == NULL) {
+			continue;
+		}
+		auto cache = container_of(r->blur_cached[i], struct blur_cache, valid);
+		if (!backend_execute(backend, target, i - start,
+		                     &layout->commands[start]) ||
+		    !renderer_blur_with_cache(r, backend, target, &layout->commands[i],
+		                              cache)) {
+			return false;
+		}
+		start = i + 1;
+	}
+	return backend_execute(backend, target, layout->number_of_commands - start,
+	                       &layout->commands[start]);
+}
+
 /// @return true if a frame is rendered, false if this frame is skipped.
 bool renderer_render(struct renderer *r, struct backend_base *backend,
                      image_handle root_image, struct layout_manager *lm,
@@ -492,16 +918,14 @@ bool renderer_render(struct renderer *r, struct backend_base *backend,
                      bool force_blend, bool blur_frame, bool inactive_dim_fixed,
                      double max_brightness, const struct x_monitors *monitors,
                      const struct shader_info *shaders, uint64_t *after_damage_us) {
+	bool last_frame_rendered = r->last_frame_rendered;
+	r->last_frame_rendered = false;
 	if (xsync_fence != XCB_NONE) {
 		// Trigger the fence but don't immediately wait on it. Let it run
 		// concurrent with our CPU tasks to save time.
 		x_set_error_action_abort(
 		    backend->c, xcb_sync_trigger_fence(backend->c->c, xsync_fence));
 	}
-	// TODO(yshui) In some cases we can render directly into the back buffer, and
-	// don't need the intermediate back_image. Several conditions need to be met: no
-	// dithered present; no blur, with blur we will render areas that's just for blur
-	// and can't be presented;
 	auto layout = layout_manager_layout(lm, 0);
 	if (!renderer_set_root_size(r, backend,
 	                            (ivec2){layout->size.width, layout->size.height})) {
@@ -511,8 +935,10 @@ bool renderer_render(struct renderer *r, struct backend_base *backend,
 
 	renderer_ensure_images_ready(r, backend, monitor_repaint);
 
-	command_builder_build(cb, layout, force_blend, blur_frame, inactive_dim_fixed,
-	                      max_brightness, monitors, shaders);
+	auto prev_layout =
+	    layout_manager_max_buffer_age(lm) > 0 ? layout_manager_layout(lm, 1) : NULL;
+	command_builder_build(cb, layout, prev_layout, force_blend, blur_frame,
+	                      inactive_dim_fixed, max_brightness, monitors, shaders);
 	if (log_get_level_tls() <= LOG_LEVEL_TRACE) {
 		auto layer = layout->layers - 1;
 		auto layer_end = &layout->commands[layout->first_layer_start];
@@ -540,6 +966,13 @@ bool renderer_render(struct renderer *r, struct backend_base *backend,
 	}
 	auto buffer_age =
 	    (use_damage || monitor_repaint) ? backend->ops.buffer_age(backend) : 0;
+	// Blur results are cached when we can find out what changed since the last frame.
+	bool cache_blur = blur_context != NULL && layout_manager_max_buffer_age(lm) > 0 &&
+	                  renderer_layout_has_blur(layout);
+	if (cache_blur) {
+		dynarr_resize(r->layer_damage, dynarr_len(layout->layers),
+		              pixman_region32_init, pixman_region32_fini);
+	}
 	if (buffer_age > 0 && global_debug_options.consistent_buffer_age &&
 	    buffer_age < r->max_buffer_age) {
 		int past_frame =
@@ -552,12 +985,23 @@ bool renderer_render(struct renderer *r, struct backend_base *backend,
 		pixman_region32_fini(&region);
 	}
 	if (buffer_age > 0 && (unsigned)buffer_age <= layout_manager_max_buffer_age(lm)) {
-		layout_manager_damage(lm, (unsigned)buffer_age, blur_size, &damage_region);
+		layout_manager_damage(
+		    lm, (unsigned)buffer_age, blur_size, &damage_region,
+		    cache_blur && buffer_age == 1 ? r->layer_damage : NULL);
+	}
+	if (cache_blur && buffer_age != 1) {
+		region_t scratch;
+		pixman_region32_init(&scratch);
+		layout_manager_damage(lm, 1, blur_size, &scratch, r->layer_damage);
+		pixman_region32_fini(&scratch);
 	}
+	renderer_update_blur_caches(r, backend, layout, cache_blur ? blur_context : NULL,
+	                            blur_size, last_frame_rendered);
 
 	dynarr_resize(r->culled_masks, layout->number_of_commands, pixman_region32_init,
 	              pixman_region32_fini);
-	commands_cull_with_damage(layout, &damage_region, blur_size, r->culled_masks);
+	commands_cull_with_damage(layout, &damage_region, blur_size, r->blur_cached,
+	                          r->culled_masks);
 
 	auto now = get_time_timespec();
 	*after_damage_us = (uint64_t)now.tv_sec * 1000000UL + (uint64_t)now.tv_nsec / 1000;
@@ -591,8 +1035,20 @@ bool renderer_render(struct renderer *r, struct backend_base *backend,
 		                       &r->monitor_repaint_region[past_frame]);
 	}
 
-	if (!backend_execute(backend, r->back_image, layout->number_of_commands,
-	                     layout->commands)) {
+	// In some cases we can render directly into the back buffer, and don't need the
+	// intermediate back_image. Several conditions need to be met: no dithered
+	// present, which needs the high precision back_image; no blur that has to be
+	// rendered, with blur we will render areas that's just for blur and can't be
+	// presented, and blur needs to read back what's rendered; no monitor repaint,
+	// which keeps copies of the back_image; and the back buffer isn't already on
+	// screen while we render into it.
+	bool direct = r->format == BACKEND_IMAGE_FORMAT_PIXMAP && !monitor_repaint &&
+	              !(backend->ops.quirks(backend) & BACKEND_QUIRK_FRONT_BUFFER) &&
+	              !renderer_needs_read_back(r, layout);
+	log_trace("Rendering %s", direct ? "directly into the back buffer"
+	                                 : "into the back image");
+	auto render_target = direct ? backend->ops.back_buffer(backend) : r->back_image;
+	if (!renderer_execute(r, backend, render_target, layout)) {
 		log_error("Failed to complete execution of the render commands");
 		return false;
 	}
@@ -617,8 +1073,11 @@ bool renderer_render(struct renderer *r, struct backend_base *backend,
 		backend->ops.blit(backend, (ivec2){}, r->back_image, &blit);
 	}
 
-	backend->ops.copy_area_quantize(backend, (ivec2){}, backend->ops.back_buffer(backend),
-	                                r->back_image, &damage_region);
+	if (!direct) {
+		backend->ops.copy_area_quantize(backend, (ivec2){},
+		                                backend->ops.back_buffer(backend),
+		                                r->back_image, &damage_region);
+	}
 
 	if (global_debug_options.consistent_buffer_age) {
 		region_t region;
@@ -641,5 +1100,6 @@ bool renderer_render(struct renderer *r, struct backend_base *backend,
 	pixman_region32_fini(&damage_region);
 
 	r->frame_index = (r->frame_index + 1) % r->max_buffer_age;
+	r->last_frame_rendered = true;
 	return true;
 }
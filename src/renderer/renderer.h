@@ -10,6 +10,7 @@
 struct renderer;
 struct layout_manager;
 struct backend_base;
+struct backend_command;
 struct command_builder;
 struct shader_info;
 typedef struct image_handle *image_handle;
@@ -28,3 +29,9 @@ bool renderer_render(struct renderer *r, struct backend_base *backend,
                      bool force_blend, bool blur_frame, bool inactive_dim_fixed,
                      double max_brightness, const struct x_monitors *monitors,
                      const struct shader_info *shaders, uint64_t *after_damage_us);
+/// Fill in the source image of `cmd`, which draws a slice of a nine-slice shadow of a
+/// window with `corner_radius`, with the shadow tiles for that corner radius. The
+/// tiles are generated if they are not cached yet. Returns false if that fails.
+bool renderer_prepare_shadow_slice(struct renderer *r, struct backend_base *backend,
+                                   unsigned int corner_radius,
+                                   struct backend_command *cmd);
@@ -283,3 +283,87 @@ void render_statistics_destroy(struct render_statistics *rs) {
 	rolling_window_destroy(&rs->render_times);
 	rolling_quantile_destroy(&rs->render_time_quantile);
 }
+
+const char *const frame_timing_stage_names[NUM_OF_FRAME_TIMING_STAGES] = {
+    [FRAME_TIMING_STAGE_UPDATES] = "handle_pending_updates",
+    [FRAME_TIMING_STAGE_PREPROCESS] = "paint_preprocess",
+    [FRAME_TIMING_STAGE_DAMAGE] = "damage",
+    [FRAME_TIMING_STAGE_RENDER] = "render",
+    [FRAME_TIMING_STAGE_GPU] = "gpu",
+};
+
+static void frame_timing_ring_write(struct frame_timing_ring *ring, uint64_t frame,
+                                    const struct frame_timing *timing) {
+	auto slot = &ring->slots[(frame - 1) % FRAME_TIMING_RING_SIZE];
+	auto seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->timing = *timing;
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+void frame_timing_ring_push(struct frame_timing_ring *ring,
+                            const uint32_t stage_us[NUM_OF_FRAME_TIMING_STAGES]) {
+	uint64_t frame = atomic_load_explicit(&ring->head, memory_order_relaxed) + 1;
+	struct frame_timing timing = {.frame = frame};
+	memcpy(timing.stage_us, stage_us, sizeof(timing.stage_us));
+	frame_timing_ring_write(ring, frame, &timing);
+	atomic_store_explicit(&ring->head, frame, memory_order_release);
+}
+
+void frame_timing_ring_set_gpu_time(struct frame_timing_ring *ring, uint32_t gpu_us) {
+	uint64_t frame = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (frame == 0) {
+		return;
+	}
+	// We are the only writer, so the slot can't change under us.
+	auto timing = ring->slots[(frame - 1) % FRAME_TIMING_RING_SIZE].timing;
+	timing.stage_us[FRAME_TIMING_STAGE_GPU] = gpu_us;
+	frame_timing_ring_write(ring, frame, &timing);
+}
+
+unsigned frame_timing_ring_snapshot(struct frame_timing_ring *ring,
+                                    struct frame_timing *out, unsigned max) {
+	uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	uint64_t count = min2(head, min2((uint64_t)max, (uint64_t)FRAME_TIMING_RING_SIZE));
+	unsigned n = 0;
+	for (uint64_t frame = head - count + 1; frame <= head; frame++) {
+		auto slot = &ring->slots[(frame - 1) % FRAME_TIMING_RING_SIZE];
+		auto seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq % 2 != 0) {
+			continue;
+		}
+		out[n] = slot->timing;
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq ||
+		    out[n].frame != frame) {
+			// Overwritten while we were reading
+			continue;
+		}
+		n++;
+	}
+	return n;
+}
+
+TEST_CASE(frame_timing_ring_test) {
+	static struct frame_timing_ring ring;
+	struct frame_timing out[FRAME_TIMING_RING_SIZE];
+	TEST_EQUAL(frame_timing_ring_snapshot(&ring, out, FRAME_TIMING_RING_SIZE), 0);
+
+	for (uint32_t i = 0; i < (uint32_t)FRAME_TIMING_RING_SIZE + 10; i++) {
+		uint32_t stages[NUM_OF_FRAME_TIMING_STAGES] = {i, i, i, i, FRAME_TIMING_UNKNOWN};
+		frame_timing_ring_push(&ring, stages);
+	}
+	frame_timing_ring_set_gpu_time(&ring, 42);
+
+	auto n = frame_timing_ring_snapshot(&ring, out, 4);
+	TEST_EQUAL(n, 4);
+	TEST_EQUAL(out[0].frame, FRAME_TIMING_RING_SIZE + 7);
+	TEST_EQUAL(out[3].stage_us[FRAME_TIMING_STAGE_UPDATES], FRAME_TIMING_RING_SIZE + 9);
+	TEST_EQUAL(out[2].stage_us[FRAME_TIMING_STAGE_GPU], FRAME_TIMING_UNKNOWN);
+	TEST_EQUAL(out[3].stage_us[FRAME_TIMING_STAGE_GPU], 42);
+
+	n = frame_timing_ring_snapshot(&ring, out, FRAME_TIMING_RING_SIZE);
+	TEST_EQUAL(n, FRAME_TIMING_RING_SIZE);
+	TEST_EQUAL(out[0].frame, 11);
+}
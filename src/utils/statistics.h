@@ -4,7 +4,9 @@
 #pragma once
 
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "compiler.h"
@@ -124,3 +126,57 @@ unsigned int render_statistics_get_budget(struct render_statistics *rs);
 /// Return the measured vblank interval in microseconds. Returns 0 if not enough
 /// samples have been collected yet.
 unsigned int render_statistics_get_vblank_time(struct render_statistics *rs);
+
+enum frame_timing_stage {
+	/// `handle_pending_updates`
+	FRAME_TIMING_STAGE_UPDATES,
+	/// `paint_preprocess`
+	FRAME_TIMING_STAGE_PREPROCESS,
+	/// Layout, render command generation and damage calculation
+	FRAME_TIMING_STAGE_DAMAGE,
+	/// Issuing the render commands to the backend
+	FRAME_TIMING_STAGE_RENDER,
+	/// Time the backend took to finish rendering, as reported by `last_render_time`
+	FRAME_TIMING_STAGE_GPU,
+	NUM_OF_FRAME_TIMING_STAGES,
+};
+
+extern const char *const frame_timing_stage_names[NUM_OF_FRAME_TIMING_STAGES];
+
+/// Number of frames kept in a `struct frame_timing_ring`, must be a power of 2.
+#define FRAME_TIMING_RING_SIZE (256)
+/// Stage time value used when the time for a stage is not known.
+#define FRAME_TIMING_UNKNOWN UINT32_MAX
+
+struct frame_timing {
+	/// Sequence number of the frame, starting from 1.
+	uint64_t frame;
+	/// Time spent in each stage, in microseconds, or `FRAME_TIMING_UNKNOWN`.
+	uint32_t stage_us[NUM_OF_FRAME_TIMING_STAGES];
+};
+
+/// Fixed size ring buffer of the timings of the most recent frames.
+///
+/// There can only be one writer, but any number of readers, which can be on different
+/// threads. Neither side ever blocks: each slot is protected by a sequence counter, and
+/// a reader simply skips slots that were being written to while it was reading.
+struct frame_timing_ring {
+	struct {
+		/// Odd while the slot is being written to.
+		atomic_uint seq;
+		struct frame_timing timing;
+	} slots[FRAME_TIMING_RING_SIZE];
+	/// Total number of frames ever pushed.
+	atomic_uint_fast64_t head;
+};
+
+/// Record timings of a new frame. The GPU time is usually not known at this point, it
+/// can be filled in later with `frame_timing_ring_set_gpu_time`.
+void frame_timing_ring_push(struct frame_timing_ring *ring,
+                            const uint32_t stage_us[NUM_OF_FRAME_TIMING_STAGES]);
+/// Set the GPU time of the most recently pushed frame.
+void frame_timing_ring_set_gpu_time(struct frame_timing_ring *ring, uint32_t gpu_us);
+/// Copy out the timings of at most `max` most recent frames, oldest first. Returns the
+/// number of frames copied.
+unsigned frame_timing_ring_snapshot(struct frame_timing_ring *ring,
+                                    struct frame_timing *out, unsigned max);
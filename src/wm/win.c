@@ -65,15 +65,11 @@ static const double ROUNDED_PERCENT = 0.05;
 // dependencies have changed. The c2 rules are kind of already calculated this way, we
 // should unify the rest of the computed states. This would simplify the code as well.
 
-static void
-win_update_prop_shadow_raw(struct x_connection *c, struct atom *atoms, struct win *w);
-static bool win_update_prop_shadow(struct x_connection *c, struct atom *atoms, struct win *w);
+static void win_update_prop_shadow(session_t *ps, struct win *w);
 /**
  * Update leader of a window.
  */
-static xcb_window_t
-win_get_leader_property(struct x_connection *c, struct atom *atoms, xcb_window_t wid,
-                        bool detect_transient, bool detect_client_leader);
+static void win_update_leader(session_t *ps, struct win *w, xcb_window_t client);
 
 /// Generate a "no corners" region function, from a function that returns the
 /// region via a region_t pointer argument. Corners of the window will be removed from
@@ -187,6 +183,7 @@ static inline void win_release_pixmap(backend_t *base, struct win *w) {
 		xcb_pixmap_t pixmap = XCB_NONE;
 		pixmap = base->ops.release_image(base, w->win_image);
 		w->win_image = NULL;
+		w->win_image_size = (ivec2){};
 		if (pixmap != XCB_NONE) {
 			xcb_free_pixmap(base->c->c, pixmap);
 		}
@@ -226,18 +223,207 @@ void win_release_saved_win_image(backend_t *base, struct win *w) {
 	}
 }
 
+/// A request for a new named pixmap of a window. NameWindowPixmap is followed by a
+/// GetGeometry of the new pixmap, which tells us the pixmap's size, and also whether
+/// naming it succeeded. So a window can be rebound without blocking on either.
+struct win_pixmap_request {
+	struct x_async_request_base base;
+	session_t *ps;
+	xcb_window_t wid;
+	xcb_pixmap_t pixmap;
+	ivec2 size;
+	/// The reply has arrived, the pixmap is ready to be bound.
+	bool ready;
+};
+
+static void win_handle_pixmap_reply(struct x_connection *c,
+                                    struct x_async_request_base *req_base,
+                                    const xcb_raw_generic_event_t *reply_or_error) {
+	auto req = (struct win_pixmap_request *)req_base;
+	if (reply_or_error == NULL) {
+		// Shutting down
+		free(req);
+		return;
+	}
+
+	auto ps = req->ps;
+	auto cursor = wm_find(ps->wm, req->wid);
+	auto w = cursor != NULL ? wm_ref_deref(cursor) : NULL;
+	bool failed = reply_or_error->response_type == 0;
+	if (w == NULL || w->pending_pixmap != req) {
+		// The window is gone, or a newer pixmap has been requested for it.
+		if (!failed) {
+			xcb_free_pixmap(c->c, req->pixmap);
+		}
+		free(req);
+		return;
+	}
+
+	if (failed) {
+		log_debug("Failed to get named pixmap for window %#010x (%s): %s. "
+		          "Retaining its current window image",
+		          req->wid, w->name,
+		          x_strerror(c, (xcb_generic_error_t *)reply_or_error));
+		w->pending_pixmap = NULL;
+		w->save_win_image_on_rebind = false;
+		free(req);
+		return;
+	}
+
+	auto r = (const xcb_get_geometry_reply_t *)reply_or_error;
+	req->size = (ivec2){.width = r->width, .height = r->height};
+	req->ready = true;
+	// The pixmap is bound before the next frame is rendered, not here, so the
+	// backend is never touched while a frame might be in flight.
+	queue_redraw(ps);
+}
+
+/// Forget about the pending pixmap request of `w`, if any.
+static void win_drop_pending_pixmap(struct x_connection *c, struct win *w) {
+	auto req = w->pending_pixmap;
+	w->pending_pixmap = NULL;
+	w->save_win_image_on_rebind = false;
+	if (req != NULL && req->ready) {
+		xcb_free_pixmap(c->c, req->pixmap);
+		free(req);
+	}
+	// Otherwise the request is still waiting for its reply, it will notice it's
+	// been dropped and free itself.
+}
+
 void win_release_images(struct backend_base *backend, struct win *w) {
 	// We don't want to decide what we should do if the image we want to
 	// release is stale (do we clear the stale flags or not?) But if we are
 	// not releasing any images anyway, we don't care about the stale flags.
 	assert(w->win_image == NULL || !win_check_flags_all(w, WIN_FLAGS_PIXMAP_STALE));
 
+	win_drop_pending_pixmap(backend->c, w);
 	win_release_pixmap(backend, w);
 	win_release_shadow(backend, w);
 	win_release_mask(backend, w);
 	win_release_saved_win_image(backend, w);
 }
 
+struct win_update_request;
+/// Apply the reply to a `win_update_request` to `w`. `reply` is NULL if the request
+/// failed. Returns true if factors of the window changed.
+typedef bool (*win_update_fn)(session_t *ps, struct win *w,
+                              const struct win_update_request *req, const void *reply);
+
+/// An async request for some raw window state, e.g. a property or the bounding shape.
+/// The window is updated by `apply` when the reply arrives, so fetching window states
+/// never blocks rendering.
+struct win_update_request {
+	struct x_async_request_base base;
+	session_t *ps;
+	/// ID of the frame window, used to find the window again when the reply arrives.
+	xcb_window_t wid;
+	/// The window the request is sent for, might be the client window.
+	xcb_window_t target;
+	/// The property requested, if this is a get property request.
+	xcb_atom_t property;
+	/// ID of the c2 tracked property, if this request is sent for c2.
+	unsigned int c2_id;
+	/// A request sent right after this one, whose result is only needed depending
+	/// on the result of this one. e.g. WM_NAME is only used when _NET_WM_NAME is not
+	/// set. Both are sent at the same time so no extra round trip is needed, and
+	/// since replies arrive in order, `next` is still pending when `apply` is called.
+	struct win_update_request *next;
+	/// `apply` won't be called for this request, because the previous request in
+	/// the chain already provided what we need.
+	bool resolved;
+	win_update_fn apply;
+};
+
+static void win_handle_update_reply(struct x_connection *c,
+                                    struct x_async_request_base *req_base,
+                                    const xcb_raw_generic_event_t *reply_or_error) {
+	auto req = (struct win_update_request *)req_base;
+	if (reply_or_error == NULL) {
+		// Shutting down
+		free(req);
+		return;
+	}
+
+	auto ps = req->ps;
+	auto cursor = wm_find(ps->wm, req->wid);
+	auto w = cursor != NULL ? wm_ref_deref(cursor) : NULL;
+	if (w == NULL || w->state == WSTATE_DESTROYED) {
+		// The window is gone, or the window ID has been reused and the new window
+		// isn't managed yet.
+		free(req);
+		return;
+	}
+
+	bool changed = false;
+	if (!req->resolved) {
+		const void *reply = reply_or_error;
+		if (reply_or_error->response_type == 0) {
+			log_debug("Failed to update window %#010x (%s) from window %#010x: %s",
+			          req->wid, w->name, req->target,
+			          x_strerror(c, (xcb_generic_error_t *)reply_or_error));
+			reply = NULL;
+		}
+		changed = req->apply(ps, w, req, reply);
+	}
+	free(req);
+
+	// The window ID could have been reused by a window that didn't send this
+	// request, so don't trust the counter blindly.
+	if (w->pending_property_replies > 0) {
+		w->pending_property_replies--;
+	}
+	if (w->awaiting_properties && w->pending_property_replies == 0) {
+		log_debug("Properties of window %#010x (%s) have arrived", win_id(w), w->name);
+		w->awaiting_properties = false;
+		changed = true;
+	}
+	if (changed) {
+		win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
+		ps->pending_updates = true;
+		queue_redraw(ps);
+	}
+}
+
+/// Create a request for `w`, the caller needs to send it and set `base.sequence`.
+static struct win_update_request *
+win_update_request_new(session_t *ps, struct win *w, xcb_window_t target, win_update_fn apply) {
+	auto req = ccalloc(1, struct win_update_request);
+	req->base.callback = win_handle_update_reply;
+	req->ps = ps;
+	req->wid = win_id(w);
+	req->target = target;
+	req->apply = apply;
+	w->pending_property_replies++;
+	return req;
+}
+
+static void win_update_request_send(session_t *ps, struct win_update_request *req,
+                                    unsigned int sequence) {
+	req->base.sequence = sequence;
+	x_await_request(&ps->c, &req->base);
+}
+
+/// Request `property` of window `target` for `w`, `apply` is called with the reply.
+static struct win_update_request *
+win_get_property_async(session_t *ps, struct win *w, xcb_window_t target, xcb_atom_t property,
+                       xcb_atom_t type, uint32_t long_length, win_update_fn apply) {
+	auto req = win_update_request_new(ps, w, target, apply);
+	req->property = property;
+	x_async_get_property(&ps->c, target, property, type, 0, long_length, &req->base);
+	return req;
+}
+
+/// Set `*field` to a copy of `value`, returns true if it changed.
+static bool win_set_string_field(char **field, const char *value) {
+	if (*field == NULL ? value == NULL : (value != NULL && strcmp(*field, value) == 0)) {
+		return false;
+	}
+	free(*field);
+	*field = value != NULL ? strdup(value) : NULL;
+	return true;
+}
+
 /// Returns true if the `prop` property is stale, as well as clears the stale
 /// flag.
 static bool win_fetch_and_unset_property_stale(struct win *w, xcb_atom_t prop);
@@ -245,25 +431,21 @@ static bool win_fetch_and_unset_property_stale(struct win *w, xcb_atom_t prop);
 /// stale flags.
 static void win_clear_all_properties_stale(struct win *w);
 
-/**
- * Reread opacity property of a window.
- */
-bool win_update_opacity_prop(struct x_connection *c, struct atom *atoms, struct win *w,
-                             bool detect_client_opacity) {
+static bool win_apply_opacity_prop(session_t *ps attr_unused, struct win *w,
+                                   const struct win_update_request *req, const void *reply) {
+	auto prop = x_get_prop_from_reply(reply, XCB_ATOM_CARDINAL, 32);
+	if (prop.nitems == 0 && req->next != NULL) {
+		// Not set on the frame, the client opacity will be used
+		return false;
+	}
+	if (req->next != NULL) {
+		req->next->resolved = true;
+	}
+
 	bool old_has_opacity_prop = w->has_opacity_prop;
 	auto old_opacity = w->opacity_prop;
-	// get frame opacity first
-	w->has_opacity_prop =
-	    wid_get_opacity_prop(c, atoms, win_id(w), OPAQUE, &w->opacity_prop);
-
-	if (!w->has_opacity_prop && detect_client_opacity) {
-		// didn't find opacity prop on the frame, try to get client opacity
-		auto client_win = wm_ref_client_of(w->tree_ref);
-		if (client_win != NULL) {
-			w->has_opacity_prop = wid_get_opacity_prop(
-			    c, atoms, wm_ref_win_id(client_win), OPAQUE, &w->opacity_prop);
-		}
-	}
+	w->has_opacity_prop = prop.nitems > 0;
+	w->opacity_prop = w->has_opacity_prop ? *prop.c32 : OPAQUE;
 
 	if (w->has_opacity_prop) {
 		return !old_has_opacity_prop || w->opacity_prop != old_opacity;
@@ -271,61 +453,70 @@ bool win_update_opacity_prop(struct x_connection *c, struct atom *atoms, struct
 	return old_has_opacity_prop;
 }
 
+/**
+ * Reread opacity property of a window.
+ */
+static void win_update_opacity_prop(session_t *ps, struct win *w) {
+	// get frame opacity first
+	auto frame = win_get_property_async(ps, w, win_id(w),
+	                                    ps->atoms->a_NET_WM_WINDOW_OPACITY,
+	                                    XCB_ATOM_CARDINAL, 1, win_apply_opacity_prop);
+
+	auto client_win = win_client_id(w, /*fallback_to_self=*/false);
+	if (ps->o.detect_client_opacity && client_win != XCB_NONE) {
+		// in case there is no opacity prop on the frame, get client opacity
+		frame->next = win_get_property_async(ps, w, client_win,
+		                                     ps->atoms->a_NET_WM_WINDOW_OPACITY,
+		                                     XCB_ATOM_CARDINAL, 1, win_apply_opacity_prop);
+	}
+}
+
 // TODO(yshui) make WIN_FLAGS_FACTOR_CHANGED more fine-grained, or find a better
 // alternative
 //             way to do all this.
 
-/// Fetch new window properties from the X server, and run appropriate updates.
-/// Might set WIN_FLAGS_FACTOR_CHANGED
+/// Request new window properties from the X server. Appropriate updates are run when
+/// the replies arrive, which might set WIN_FLAGS_FACTOR_CHANGED.
 static void win_update_properties(session_t *ps, struct win *w) {
 	// we cannot receive property change when window has been destroyed
 	assert(w->state != WSTATE_DESTROYED);
 
 	if (win_fetch_and_unset_property_stale(w, ps->atoms->a_NET_WM_WINDOW_TYPE)) {
-		if (win_update_wintype(&ps->c, ps->atoms, w)) {
-			win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
-		}
+		win_update_wintype(ps, w);
 	}
 
-	if (win_fetch_and_unset_property_stale(w, ps->atoms->a_NET_WM_WINDOW_OPACITY) &&
-	    win_update_opacity_prop(&ps->c, ps->atoms, w, ps->o.detect_client_opacity)) {
-		win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
+	if (win_fetch_and_unset_property_stale(w, ps->atoms->a_NET_WM_WINDOW_OPACITY)) {
+		win_update_opacity_prop(ps, w);
 	}
 
 	if (win_fetch_and_unset_property_stale(w, ps->atoms->a_NET_FRAME_EXTENTS)) {
 		auto client_win = win_client_id(w, /*fallback_to_self=*/false);
-		win_update_frame_extents(&ps->c, ps->atoms, w, client_win);
+		win_update_frame_extents(ps, w, client_win);
 	}
 
 	if (win_fetch_and_unset_property_stale(w, ps->atoms->aWM_NAME) ||
 	    win_fetch_and_unset_property_stale(w, ps->atoms->a_NET_WM_NAME)) {
-		if (win_update_name(&ps->c, ps->atoms, w) == 1) {
-			win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
-		}
+		win_update_name(ps, w);
 	}
 
 	if (win_fetch_and_unset_property_stale(w, ps->atoms->aWM_CLASS)) {
-		if (win_update_class(&ps->c, ps->atoms, w)) {
-			win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
-		}
+		win_update_class(ps, w);
 	}
 
 	if (win_fetch_and_unset_property_stale(w, ps->atoms->aWM_WINDOW_ROLE)) {
-		if (win_update_role(&ps->c, ps->atoms, w) == 1) {
-			win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
-		}
+		win_update_role(ps, w);
 	}
 
 	if (win_fetch_and_unset_property_stale(w, ps->atoms->a_COMPTON_SHADOW)) {
-		if (win_update_prop_shadow(&ps->c, ps->atoms, w)) {
-			win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
-		}
+		win_update_prop_shadow(ps, w);
 	}
 
 	if (win_fetch_and_unset_property_stale(w, ps->atoms->a_NET_WM_STATE)) {
-		if (win_update_prop_fullscreen(&ps->c, ps->atoms, w)) {
-			win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
-		}
+		win_update_prop_fullscreen(ps, w);
+	}
+
+	if (win_fetch_and_unset_property_stale(w, ps->atoms->a_NET_WM_BYPASS_COMPOSITOR)) {
+		win_update_prop_bypass_compositor(ps, w);
 	}
 
 	if (ps->o.track_leader &&
@@ -333,10 +524,7 @@ static void win_update_properties(session_t *ps, struct win *w) {
 	     win_fetch_and_unset_property_stale(w, ps->atoms->aWM_TRANSIENT_FOR) ||
 	     win_fetch_and_unset_property_stale(w, XCB_ATOM_WM_HINTS))) {
 		auto client_win = win_client_id(w, /*fallback_to_self=*/true);
-		auto new_leader = win_get_leader_property(&ps->c, ps->atoms, client_win,
-		                                          ps->o.detect_transient,
-		                                          ps->o.detect_client_leader);
-		wm_ref_set_leader(ps->wm, w->tree_ref, new_leader);
+		win_update_leader(ps, w, client_win);
 	}
 
 	win_clear_all_properties_stale(w);
@@ -391,7 +579,7 @@ void win_process_primary_flags(session_t *ps, struct win *w) {
 		if (win_check_flags_all(w, WIN_FLAGS_SIZE_STALE)) {
 			win_on_win_size_change(w, ps->o.shadow_offset_x,
 			                       ps->o.shadow_offset_y, ps->o.shadow_radius);
-			win_update_bounding_shape(&ps->c, w, ps->o.detect_rounded_corners);
+			win_update_bounding_shape(ps, w);
 			win_clear_flags(w, WIN_FLAGS_SIZE_STALE);
 
 			// Window shape/size changed, invalidate the images we built
@@ -412,6 +600,11 @@ void win_process_primary_flags(session_t *ps, struct win *w) {
 		win_update_properties(ps, w);
 		win_clear_flags(w, WIN_FLAGS_PROPERTY_STALE);
 	}
+
+	if (w->pending_property_replies == 0) {
+		// Nothing was requested for the window, there is nothing to wait for.
+		w->awaiting_properties = false;
+	}
 }
 
 /// Handle secondary flags. These flags are set during the processing of primary flags.
@@ -471,51 +664,81 @@ void win_process_secondary_flags(session_t *ps, struct win *w) {
 	}
 }
 
+/// Bind the pixmap from the pending pixmap request of `w` as its new window image.
+static void win_bind_pending_pixmap(session_t *ps, struct win *w) {
+	auto req = w->pending_pixmap;
+	w->pending_pixmap = NULL;
+	log_debug("New named pixmap for %#010x (%s) : %#010x", win_id(w), w->name,
+	          req->pixmap);
+
+	if (w->save_win_image_on_rebind) {
+		win_release_saved_win_image(ps->backend_data, w);
+		w->saved_win_image = w->win_image;
+		w->win_image = NULL;
+		w->win_image_size = (ivec2){};
+		w->save_win_image_on_rebind = false;
+	} else {
+		// Must release images first, otherwise breaks NVIDIA driver
+		win_release_pixmap(ps->backend_data, w);
+	}
+	w->win_image = ps->backend_data->ops.bind_pixmap(
+	    ps->backend_data, req->pixmap, req->size, x_get_visual_info(&ps->c, w->a.visual));
+	if (!w->win_image) {
+		log_error("Failed to bind pixmap");
+		xcb_free_pixmap(ps->c.c, req->pixmap);
+		win_set_flags(w, WIN_FLAGS_PIXMAP_ERROR);
+	} else {
+		w->win_image_size = req->size;
+		// Damage that arrived before the new pixmap was drawn with the old one.
+		pixman_region32_union_rect(&w->damaged, &w->damaged, 0, 0,
+		                           (uint)w->widthb, (uint)w->heightb);
+	}
+	win_mark_layout_dirty(w);
+	free(req);
+}
+
 void win_process_image_flags(session_t *ps, struct win *w) {
 	// Assert that the MAPPED flag is already handled.
 	assert(!win_check_flags_all(w, WIN_FLAGS_MAPPED));
 
-	if (w->state != WSTATE_MAPPED || !win_check_flags_any(w, WIN_FLAGS_PIXMAP_STALE)) {
-		// 1. Flags of invisible windows are processed when they are mapped
-		// 2. We don't need to update window image if pixmap is not stale
+	if (w->state != WSTATE_MAPPED) {
+		// Flags of invisible windows are processed when they are mapped
 		return;
 	}
 
-	if (win_check_flags_all(w, WIN_FLAGS_PIXMAP_ERROR) || !ps->redirected) {
-		// 1. We have previously failed to bind the pixmap, don't try again.
-		// 2. If we aren't redirected, window images will be refreshed upon
-		//    redirection anyway.
+	if (win_check_flags_any(w, WIN_FLAGS_PIXMAP_STALE)) {
 		win_clear_flags(w, WIN_FLAGS_PIXMAP_STALE);
-		return;
-	}
+		if (win_check_flags_all(w, WIN_FLAGS_PIXMAP_ERROR) || !ps->redirected) {
+			// 1. We have previously failed to bind the pixmap, don't try
+			//    again.
+			// 2. If we aren't redirected, window images will be refreshed
+			//    upon redirection anyway.
+			w->save_win_image_on_rebind = false;
+			return;
+		}
 
-	// Image needs to be updated, update it.
-	win_clear_flags(w, WIN_FLAGS_PIXMAP_STALE);
+		// Image needs to be updated. Request a new pixmap, and keep using the
+		// current window image until it arrives. If the window is not mapped
+		// anymore, naming the pixmap fails, and we keep the current image too,
+		// since we might still need it for rendering.
+		bool save_win_image = w->save_win_image_on_rebind;
+		win_drop_pending_pixmap(&ps->c, w);
+		w->save_win_image_on_rebind = save_win_image;
 
-	// Check to make sure the window is still mapped, otherwise we won't be able to
-	// rebind pixmap after releasing it, yet we might still need the pixmap for
-	// rendering.
-	auto pixmap = x_new_id(&ps->c);
-	auto e = xcb_request_check(
-	    ps->c.c, xcb_composite_name_window_pixmap_checked(ps->c.c, win_id(w), pixmap));
-	if (e != NULL) {
-		log_debug("Failed to get named pixmap for window %#010x(%s): %s. "
-		          "Retaining its current window image",
-		          win_id(w), w->name, x_strerror(&ps->c, e));
-		free(e);
-		return;
+		auto req = ccalloc(1, struct win_pixmap_request);
+		req->base.callback = win_handle_pixmap_reply;
+		req->ps = ps;
+		req->wid = win_id(w);
+		req->pixmap = x_new_id(&ps->c);
+		x_set_error_action_ignore(
+		    &ps->c, xcb_composite_name_window_pixmap(ps->c.c, win_id(w), req->pixmap));
+		req->base.sequence = xcb_get_geometry(ps->c.c, req->pixmap).sequence;
+		x_await_request(&ps->c, &req->base);
+		w->pending_pixmap = req;
 	}
 
-	log_debug("New named pixmap for %#010x (%s) : %#010x", win_id(w), w->name, pixmap);
-
-	// Must release images first, otherwise breaks NVIDIA driver
-	win_release_pixmap(ps->backend_data, w);
-	w->win_image = ps->backend_data->ops.bind_pixmap(
-	    ps->backend_data, pixmap, x_get_visual_info(&ps->c, w->a.visual));
-	if (!w->win_image) {
-		log_error("Failed to bind pixmap");
-		xcb_free_pixmap(ps->c.c, pixmap);
-		win_set_flags(w, WIN_FLAGS_PIXMAP_ERROR);
+	if (w->pending_pixmap != NULL && w->pending_pixmap->ready) {
+		win_bind_pending_pixmap(ps, w);
 	}
 }
 
@@ -556,91 +779,82 @@ static bool attr_pure win_has_rounded_corners(const struct win *w) {
 	return false;
 }
 
-int win_update_name(struct x_connection *c, struct atom *atoms, struct win *w) {
+static bool win_apply_name(session_t *ps, struct win *w,
+                           const struct win_update_request *req, const void *reply) {
 	char **strlst = NULL;
 	int nstr = 0;
-	auto client_win = win_client_id(w, /*fallback_to_self=*/true);
 
-	if (!(wid_get_text_prop(c, atoms, client_win, atoms->a_NET_WM_NAME, &strlst, &nstr))) {
-		log_debug("(%#010x): _NET_WM_NAME unset, falling back to WM_NAME.", client_win);
-
-		if (!wid_get_text_prop(c, atoms, client_win, atoms->aWM_NAME, &strlst, &nstr)) {
-			log_debug("Unsetting window name for %#010x", client_win);
-			free(w->name);
-			w->name = NULL;
-			return -1;
+	if (reply == NULL || !x_get_text_prop_from_reply(ps->atoms, req->target, req->property,
+	                                                 reply, &strlst, &nstr)) {
+		if (req->next != NULL) {
+			log_debug("(%#010x): _NET_WM_NAME unset, falling back to WM_NAME.",
+			          req->target);
+			return false;
 		}
+		log_debug("Unsetting window name for %#010x", req->target);
+		return win_set_string_field(&w->name, NULL);
 	}
-
-	int ret = 0;
-	if (!w->name || strcmp(w->name, strlst[0]) != 0) {
-		ret = 1;
-		free(w->name);
-		w->name = strdup(strlst[0]);
+	if (req->next != NULL) {
+		req->next->resolved = true;
 	}
 
+	bool changed = win_set_string_field(&w->name, strlst[0]);
 	free(strlst);
 
-	log_debug("(%#010x): client = %#010x, name = \"%s\", ret = %d", win_id(w),
-	          client_win, w->name, ret);
-	return ret;
+	log_debug("(%#010x): client = %#010x, name = \"%s\", changed = %d", win_id(w),
+	          req->target, w->name, changed);
+	return changed;
 }
 
-int win_update_role(struct x_connection *c, struct atom *atoms, struct win *w) {
-	char **strlst = NULL;
-	int nstr = 0;
+void win_update_name(session_t *ps, struct win *w) {
 	auto client_win = win_client_id(w, /*fallback_to_self=*/true);
+	auto req = win_get_property_async(ps, w, client_win, ps->atoms->a_NET_WM_NAME,
+	                                  XCB_ATOM_ANY, UINT32_MAX, win_apply_name);
+	req->next = win_get_property_async(ps, w, client_win, ps->atoms->aWM_NAME,
+	                                   XCB_ATOM_ANY, UINT32_MAX, win_apply_name);
+}
 
-	if (!wid_get_text_prop(c, atoms, client_win, atoms->aWM_WINDOW_ROLE, &strlst, &nstr)) {
-		return -1;
-	}
+static bool win_apply_role(session_t *ps, struct win *w,
+                           const struct win_update_request *req, const void *reply) {
+	char **strlst = NULL;
+	int nstr = 0;
 
-	int ret = 0;
-	if (!w->role || strcmp(w->role, strlst[0]) != 0) {
-		ret = 1;
-		free(w->role);
-		w->role = strdup(strlst[0]);
+	if (reply == NULL || !x_get_text_prop_from_reply(ps->atoms, req->target, req->property,
+	                                                 reply, &strlst, &nstr)) {
+		return false;
 	}
 
+	bool changed = win_set_string_field(&w->role, strlst[0]);
 	free(strlst);
 
-	log_trace("(%#010x): client = %#010x, role = \"%s\", ret = %d", win_id(w),
-	          client_win, w->role, ret);
-	return ret;
+	log_trace("(%#010x): client = %#010x, role = \"%s\", changed = %d", win_id(w),
+	          req->target, w->role, changed);
+	return changed;
 }
 
-/**
- * Check if a window is bounding-shaped.
- */
-static inline bool win_bounding_shaped(struct x_connection *c, xcb_window_t wid) {
-	xcb_shape_query_extents_reply_t *reply;
-	bool bounding_shaped;
-	reply = xcb_shape_query_extents_reply(c->c, xcb_shape_query_extents(c->c, wid), NULL);
-	bounding_shaped = reply && reply->bounding_shaped;
-	free(reply);
-
-	return bounding_shaped;
+void win_update_role(session_t *ps, struct win *w) {
+	auto client_win = win_client_id(w, /*fallback_to_self=*/true);
+	win_get_property_async(ps, w, client_win, ps->atoms->aWM_WINDOW_ROLE, XCB_ATOM_ANY,
+	                       UINT32_MAX, win_apply_role);
 }
 
 static uint32_t
-wid_get_prop_window_types(struct x_connection *c, struct atom *atoms, xcb_window_t wid) {
-	winprop_t prop =
-	    x_get_prop(c, wid, atoms->a_NET_WM_WINDOW_TYPE, 32L, XCB_ATOM_ATOM, 32);
+win_window_types_from_reply(session_t *ps, const xcb_get_property_reply_t *reply) {
+	winprop_t prop = x_get_prop_from_reply(reply, XCB_ATOM_ATOM, 32);
 
 	static_assert(NUM_WINTYPES <= 32, "too many window types");
 
 	uint32_t ret = 0;
 	for (unsigned i = 0; i < prop.nitems; ++i) {
 		for (wintype_t j = 1; j < NUM_WINTYPES; ++j) {
-			if (get_atom_with_nul(atoms, WINTYPES[j].atom, c->c) == prop.atom[i]) {
+			if (get_atom_with_nul(ps->atoms, WINTYPES[j].atom, ps->c.c) ==
+			    prop.atom[i]) {
 				ret |= (1 << j);
 				break;
 			}
 		}
 	}
 
-	free_winprop(&prop);
-
 	return ret;
 }
 
@@ -743,6 +957,7 @@ static double win_calc_opacity_target(session_t *ps, const struct win *w, bool f
 /// Finish the unmapping of a window (e.g. after fading has finished).
 /// Doesn't free `w`
 void unmap_win_finish(session_t *ps, struct win *w) {
+	win_drop_pending_pixmap(&ps->c, w);
 	// We are in unmap_win, this window definitely was viewable
 	if (ps->backend_data) {
 		// Only the pixmap needs to be freed and reacquired when mapping.
@@ -776,14 +991,11 @@ static void win_update_dim(session_t *ps, struct win *w, bool focused) {
 	}
 }
 
-/**
- * Reread _COMPTON_SHADOW property from a window.
- *
- * The property must be set on the outermost window, usually the WM frame.
- */
-void win_update_prop_shadow_raw(struct x_connection *c, struct atom *atoms, struct win *w) {
-	winprop_t prop =
-	    x_get_prop(c, win_id(w), atoms->a_COMPTON_SHADOW, 1, XCB_ATOM_CARDINAL, 32);
+static bool win_apply_prop_shadow(session_t *ps attr_unused, struct win *w,
+                                  const struct win_update_request *req attr_unused,
+                                  const void *reply) {
+	long long attr_shadow_old = w->prop_shadow;
+	winprop_t prop = x_get_prop_from_reply(reply, XCB_ATOM_CARDINAL, 32);
 
 	if (!prop.nitems) {
 		w->prop_shadow = -1;
@@ -791,7 +1003,17 @@ void win_update_prop_shadow_raw(struct x_connection *c, struct atom *atoms, stru
 		w->prop_shadow = *prop.c32;
 	}
 
-	free_winprop(&prop);
+	return w->prop_shadow != attr_shadow_old;
+}
+
+/**
+ * Reread _COMPTON_SHADOW property from a window.
+ *
+ * The property must be set on the outermost window, usually the WM frame.
+ */
+static void win_update_prop_shadow(session_t *ps, struct win *w) {
+	win_get_property_async(ps, w, win_id(w), ps->atoms->a_COMPTON_SHADOW,
+	                       XCB_ATOM_CARDINAL, 1, win_apply_prop_shadow);
 }
 
 /**
@@ -820,37 +1042,49 @@ static void win_determine_shadow(session_t *ps, struct win *w) {
 	}
 }
 
-/**
- * Reread _COMPTON_SHADOW property from a window and update related
- * things.
- */
-static bool win_update_prop_shadow(struct x_connection *c, struct atom *atoms, struct win *w) {
-	long long attr_shadow_old = w->prop_shadow;
-	win_update_prop_shadow_raw(c, atoms, w);
-	return w->prop_shadow != attr_shadow_old;
-}
-
-/**
- * Update window EWMH fullscreen state.
- */
-bool win_update_prop_fullscreen(struct x_connection *c, const struct atom *atoms,
-                                struct win *w) {
-	auto prop = x_get_prop(c, win_client_id(w, /*fallback_to_self=*/true),
-	                       atoms->a_NET_WM_STATE, 12, XCB_ATOM_ATOM, 0);
+static bool win_apply_prop_fullscreen(session_t *ps, struct win *w,
+                                      const struct win_update_request *req attr_unused,
+                                      const void *reply) {
+	auto prop = x_get_prop_from_reply(reply, XCB_ATOM_ATOM, 0);
 	bool is_fullscreen = false;
 	for (uint32_t i = 0; i < prop.nitems; i++) {
-		if (prop.atom[i] == atoms->a_NET_WM_STATE_FULLSCREEN) {
+		if (prop.atom[i] == ps->atoms->a_NET_WM_STATE_FULLSCREEN) {
 			is_fullscreen = true;
 			break;
 		}
 	}
-	free_winprop(&prop);
 
 	bool changed = w->is_ewmh_fullscreen != is_fullscreen;
 	w->is_ewmh_fullscreen = is_fullscreen;
 	return changed;
 }
 
+static bool win_apply_prop_bypass_compositor(session_t *ps attr_unused, struct win *w,
+                                             const struct win_update_request *req attr_unused,
+                                             const void *reply) {
+	auto prop = x_get_prop_from_reply(reply, XCB_ATOM_CARDINAL, 32);
+	bool bypass_compositor = prop.nitems && *prop.c32 == 1;
+	bool changed = w->prop_bypass_compositor != bypass_compositor;
+	w->prop_bypass_compositor = bypass_compositor;
+	return changed;
+}
+
+/// Reread _NET_WM_BYPASS_COMPOSITOR property from the client window.
+static void win_update_prop_bypass_compositor(session_t *ps, struct win *w) {
+	win_get_property_async(ps, w, win_client_id(w, /*fallback_to_self=*/true),
+	                       ps->atoms->a_NET_WM_BYPASS_COMPOSITOR, XCB_ATOM_CARDINAL, 1,
+	                       win_apply_prop_bypass_compositor);
+}
+
+/**
+ * Update window EWMH fullscreen state.
+ */
+void win_update_prop_fullscreen(session_t *ps, struct win *w) {
+	win_get_property_async(ps, w, win_client_id(w, /*fallback_to_self=*/true),
+	                       ps->atoms->a_NET_WM_STATE, XCB_ATOM_ATOM, 12,
+	                       win_apply_prop_fullscreen);
+}
+
 static void win_determine_clip_shadow_above(session_t *ps, struct win *w) {
 	bool should_crop =
 	    (ps->o.wintype_option[index_of_lowest_one(w->window_types)].clip_shadow_above ||
@@ -986,6 +1220,27 @@ win_update_rule(struct session *ps, struct win *w, const c2_condition *rule, boo
 	return false;
 }
 
+static bool win_apply_c2_property(session_t *ps, struct win *w,
+                                  const struct win_update_request *req, const void *reply) {
+	c2_window_state_update_from_reply(ps->c2_state, &w->c2_state, req->c2_id, reply,
+	                                  ps->c.c);
+	return true;
+}
+
+struct win_c2_fetch_context {
+	session_t *ps;
+	struct win *w;
+};
+
+static void win_fetch_c2_property(void *data, xcb_window_t window, xcb_atom_t property,
+                                  unsigned int id) {
+	struct win_c2_fetch_context *ctx = data;
+	auto req = win_get_property_async(ctx->ps, ctx->w, window, property,
+	                                  XCB_GET_PROPERTY_TYPE_ANY, UINT32_MAX,
+	                                  win_apply_c2_property);
+	req->c2_id = id;
+}
+
 /**
  * Function to be called on window data changes.
  *
@@ -993,15 +1248,19 @@ win_update_rule(struct session *ps, struct win *w, const c2_condition *rule, boo
  */
 void win_on_factor_change(session_t *ps, struct win *w) {
 	auto wid = win_client_id(w, /*fallback_to_self=*/true);
-	bool inspect = (ps->o.inspect_win != XCB_NONE && win_id(w) == ps->o.inspect_win) ||
-	               ps->o.inspect_monitor;
+	// Only inspect the window once all of its properties have arrived.
+	bool inspect = ((ps->o.inspect_win != XCB_NONE && win_id(w) == ps->o.inspect_win) ||
+	                ps->o.inspect_monitor) &&
+	               !w->awaiting_properties;
 	log_debug("Window %#010x, client %#010x (%s) factor change", win_id(w), wid, w->name);
-	c2_window_state_update(ps->c2_state, &w->c2_state, ps->c.c, wid, win_id(w));
+	c2_window_state_update(ps->c2_state, &w->c2_state, wid, win_id(w),
+	                       win_fetch_c2_property,
+	                       &(struct win_c2_fetch_context){.ps = ps, .w = w});
 	// Focus and is_fullscreen needs to be updated first, as other rules might depend
 	// on the focused state of the window
 	win_update_is_fullscreen(ps, w);
 
-	if (ps->o.inspect_monitor) {
+	if (inspect && ps->o.inspect_monitor) {
 		printf("Window %#010x (Client %#010x):\n======\n\n", win_id(w),
 		       win_client_id(w, /*fallback_to_self=*/true));
 	}
@@ -1118,33 +1377,77 @@ void win_on_win_size_change(struct win *w, int shadow_offset_x, int shadow_offse
 	assert(w->state == WSTATE_MAPPED);
 }
 
-/**
- * Update window type.
- */
-bool win_update_wintype(struct x_connection *c, struct atom *atoms, struct win *w) {
+static bool win_apply_wintype(session_t *ps, struct win *w,
+                              const struct win_update_request *req, const void *reply) {
 	const uint32_t wtypes_old = w->window_types;
-	auto wid = win_client_id(w, /*fallback_to_self=*/true);
-
-	// Detect window type here
-	w->window_types = wid_get_prop_window_types(c, atoms, wid);
+	auto window_types = win_window_types_from_reply(ps, reply);
 
 	// Conform to EWMH standard, if _NET_WM_WINDOW_TYPE is not present, take
 	// override-redirect windows or windows without WM_TRANSIENT_FOR as
 	// _NET_WM_WINDOW_TYPE_NORMAL, otherwise as _NET_WM_WINDOW_TYPE_DIALOG.
-	if (w->window_types == 0) {
-		if (w->a.override_redirect ||
-		    !wid_has_prop(c->c, wid, atoms->aWM_TRANSIENT_FOR)) {
-			w->window_types = (1 << WINTYPE_NORMAL);
-		} else {
-			w->window_types = (1 << WINTYPE_DIALOG);
+	if (window_types == 0) {
+		if (req->next != NULL) {
+			// Decided by the WM_TRANSIENT_FOR reply
+			return false;
 		}
+		window_types = (1 << WINTYPE_NORMAL);
+	} else if (req->next != NULL) {
+		req->next->resolved = true;
 	}
 
+	w->window_types = window_types;
 	log_debug("Window (%#010x) has type %#x", win_id(w), w->window_types);
+	return w->window_types != wtypes_old;
+}
 
+static bool win_apply_wintype_transient(session_t *ps attr_unused, struct win *w,
+                                        const struct win_update_request *req attr_unused,
+                                        const void *reply) {
+	const uint32_t wtypes_old = w->window_types;
+	const xcb_get_property_reply_t *r = reply;
+	if (r != NULL && r->type != XCB_NONE) {
+		w->window_types = (1 << WINTYPE_DIALOG);
+	} else {
+		w->window_types = (1 << WINTYPE_NORMAL);
+	}
+
+	log_debug("Window (%#010x) has type %#x", win_id(w), w->window_types);
 	return w->window_types != wtypes_old;
 }
 
+/**
+ * Update window type.
+ */
+void win_update_wintype(session_t *ps, struct win *w) {
+	auto wid = win_client_id(w, /*fallback_to_self=*/true);
+	if (w->window_types == 0) {
+		// Rules can be evaluated before the reply arrives, but they need a window
+		// type.
+		w->window_types = (1 << WINTYPE_NORMAL);
+	}
+
+	// Detect window type here
+	auto req = win_get_property_async(ps, w, wid, ps->atoms->a_NET_WM_WINDOW_TYPE,
+	                                  XCB_ATOM_ATOM, 32, win_apply_wintype);
+	if (!w->a.override_redirect) {
+		req->next = win_get_property_async(ps, w, wid, ps->atoms->aWM_TRANSIENT_FOR,
+		                                   XCB_ATOM_ANY, 0, win_apply_wintype_transient);
+	}
+}
+
+static bool win_apply_client_attributes(session_t *ps, struct win *w,
+                                        const struct win_update_request *req attr_unused,
+                                        const void *reply) {
+	if (reply == NULL) {
+		return false;
+	}
+
+	const xcb_get_window_attributes_reply_t *r = reply;
+	auto old_client_pictfmt = w->client_pictfmt;
+	w->client_pictfmt = x_get_pictform_for_visual(&ps->c, r->visual);
+	return w->client_pictfmt != old_client_pictfmt;
+}
+
 /**
  * Update window after its client window changed.
  *
@@ -1158,35 +1461,29 @@ void win_on_client_update(session_t *ps, struct win *w) {
 		return;
 	}
 
-	win_update_wintype(&ps->c, ps->atoms, w);
+	win_update_wintype(ps, w);
 
 	xcb_window_t client_win_id = win_client_id(w, /*fallback_to_self=*/true);
 	// Get frame widths. The window is in damaged area already.
-	win_update_frame_extents(&ps->c, ps->atoms, w, client_win_id);
+	win_update_frame_extents(ps, w, client_win_id);
 
 	// Get window group
 	if (ps->o.track_leader) {
-		auto new_leader = win_get_leader_property(&ps->c, ps->atoms, client_win_id,
-		                                          ps->o.detect_transient,
-		                                          ps->o.detect_client_leader);
-		wm_ref_set_leader(ps->wm, w->tree_ref, new_leader);
+		win_update_leader(ps, w, client_win_id);
 	}
 
 	// Get window name and class if we are tracking them
-	win_update_name(&ps->c, ps->atoms, w);
-	win_update_class(&ps->c, ps->atoms, w);
-	win_update_role(&ps->c, ps->atoms, w);
+	win_update_name(ps, w);
+	win_update_class(ps, w);
+	win_update_role(ps, w);
+	win_update_prop_bypass_compositor(ps, w);
 
 	// Update everything related to conditions
 	win_set_flags(w, WIN_FLAGS_FACTOR_CHANGED);
 
-	auto r = XCB_AWAIT(xcb_get_window_attributes, &ps->c, client_win_id);
-	if (!r) {
-		return;
-	}
-
-	w->client_pictfmt = x_get_pictform_for_visual(&ps->c, r->visual);
-	free(r);
+	auto req = win_update_request_new(ps, w, client_win_id, win_apply_client_attributes);
+	win_update_request_send(
+	    ps, req, xcb_get_window_attributes(ps->c.c, client_win_id).sequence);
 }
 
 /**
@@ -1330,7 +1627,7 @@ struct win *win_maybe_allocate(session_t *ps, struct wm_ref *cursor,
 	    ps->atoms->a_NET_WM_NAME,        ps->atoms->aWM_CLASS,
 	    ps->atoms->aWM_WINDOW_ROLE,      ps->atoms->a_COMPTON_SHADOW,
 	    ps->atoms->aWM_CLIENT_LEADER,    ps->atoms->aWM_TRANSIENT_FOR,
-	    ps->atoms->a_NET_WM_STATE,
+	    ps->atoms->a_NET_WM_STATE,       ps->atoms->a_NET_WM_BYPASS_COMPOSITOR,
 	};
 	win_set_properties_stale(new, init_stale_props, ARR_SIZE(init_stale_props));
 	c2_window_state_init(ps->c2_state, &new->c2_state);
@@ -1341,80 +1638,142 @@ struct win *win_maybe_allocate(session_t *ps, struct wm_ref *cursor,
 	return new;
 }
 
+/// Set the leader found by the leader property requests, and skip the rest of them.
+static bool win_set_leader(session_t *ps, struct win *w,
+                           const struct win_update_request *req, xcb_window_t leader) {
+	for (auto i = req->next; i != NULL; i = i->next) {
+		i->resolved = true;
+	}
+	log_debug("window %#010x: leader %#010x", req->target, leader);
+	wm_ref_set_leader(ps->wm, w->tree_ref, leader);
+	return true;
+}
+
+/// The leader request `req` didn't find a leader, leave it to the next one, or unset
+/// the leader if this was the last one.
+static bool
+win_leader_not_found(session_t *ps, struct win *w, const struct win_update_request *req) {
+	if (req->next != NULL) {
+		return false;
+	}
+	return win_set_leader(ps, w, req, XCB_NONE);
+}
+
+static bool win_apply_leader_transient(session_t *ps, struct win *w,
+                                       const struct win_update_request *req,
+                                       const void *reply) {
+	auto prop = x_get_prop_from_reply(reply, XCB_ATOM_WINDOW, 32);
+	if (prop.nitems == 0) {
+		// Not a transient window, the WM_HINTS request is not needed
+		auto hints = req->next;
+		hints->resolved = true;
+		return win_leader_not_found(ps, w, hints);
+	}
+
+	xcb_window_t leader = *prop.c32;
+	log_debug("Leader via WM_TRANSIENT_FOR of window %#010x: %#010x", req->target, leader);
+	if (leader == ps->c.screen_info->root || leader == XCB_NONE) {
+		// If WM_TRANSIENT_FOR is set to NONE or the root window, use the
+		// window group leader, which is decided by the WM_HINTS request.
+		//
+		// Ref:
+		// https://specifications.freedesktop.org/wm-spec/wm-spec-1.5.html#idm44981516332096
+		return false;
+	}
+	return win_set_leader(ps, w, req, leader);
+}
+
+static bool win_apply_leader_hints(session_t *ps, struct win *w,
+                                   const struct win_update_request *req, const void *reply) {
+	auto prop = x_get_prop_from_reply(reply, XCB_ATOM_WM_HINTS, 32);
+	if (prop.nitems >= 9 && prop.c32[8] != XCB_NONE) {        // 9-th member is window_group
+		log_debug("Leader via WM_HINTS of window %#010x: %#010x", req->target,
+		          prop.c32[8]);
+		return win_set_leader(ps, w, req, prop.c32[8]);
+	}
+	return win_leader_not_found(ps, w, req);
+}
+
+static bool win_apply_leader_client_leader(session_t *ps, struct win *w,
+                                           const struct win_update_request *req,
+                                           const void *reply) {
+	auto prop = x_get_prop_from_reply(reply, XCB_ATOM_WINDOW, 32);
+	xcb_window_t leader = prop.nitems ? *prop.c32 : XCB_NONE;
+	log_debug("Leader via WM_CLIENT_LEADER of window %#010x: %#010x", req->target, leader);
+	return win_set_leader(ps, w, req, leader);
+}
+
 /**
  * Update leader of a window.
+ *
+ * All the properties that might be needed are requested together, and the replies
+ * are checked in order, the first one that gives a leader wins.
  */
-static xcb_window_t
-win_get_leader_property(struct x_connection *c, struct atom *atoms, xcb_window_t wid,
-                        bool detect_transient, bool detect_client_leader) {
-	xcb_window_t leader = XCB_NONE;
-	bool exists = false;
+static void win_update_leader(session_t *ps, struct win *w, xcb_window_t client) {
+	struct win_update_request *last = NULL;
 
 	// Read the leader properties
-	if (detect_transient) {
-		leader = wid_get_prop_window(c, wid, atoms->aWM_TRANSIENT_FOR, &exists);
-		log_debug("Leader via WM_TRANSIENT_FOR of window %#010x: %#010x", wid, leader);
-		if (exists && (leader == c->screen_info->root || leader == XCB_NONE)) {
-			// If WM_TRANSIENT_FOR is set to NONE or the root window, use the
-			// window group leader.
-			//
-			// Ref:
-			// https://specifications.freedesktop.org/wm-spec/wm-spec-1.5.html#idm44981516332096
-			auto prop = x_get_prop(c, wid, XCB_ATOM_WM_HINTS, INT_MAX,
-			                       XCB_ATOM_WM_HINTS, 32);
-			if (prop.nitems >= 9) {        // 9-th member is window_group
-				leader = prop.c32[8];
-				log_debug("Leader via WM_HINTS of window %#010x: %#010x",
-				          wid, leader);
-			} else {
-				leader = XCB_NONE;
-			}
-			free_winprop(&prop);
+	if (ps->o.detect_transient) {
+		auto transient =
+		    win_get_property_async(ps, w, client, ps->atoms->aWM_TRANSIENT_FOR,
+		                           XCB_ATOM_WINDOW, 1, win_apply_leader_transient);
+		transient->next = win_get_property_async(ps, w, client, XCB_ATOM_WM_HINTS,
+		                                         XCB_ATOM_WM_HINTS, 9,
+		                                         win_apply_leader_hints);
+		last = transient->next;
+	}
+
+	if (ps->o.detect_client_leader) {
+		auto client_leader =
+		    win_get_property_async(ps, w, client, ps->atoms->aWM_CLIENT_LEADER,
+		                           XCB_ATOM_WINDOW, 1, win_apply_leader_client_leader);
+		if (last != NULL) {
+			last->next = client_leader;
 		}
+		last = client_leader;
 	}
 
-	if (detect_client_leader && leader == XCB_NONE) {
-		leader = wid_get_prop_window(c, wid, atoms->aWM_CLIENT_LEADER, &exists);
-		log_debug("Leader via WM_CLIENT_LEADER of window %#010x: %#010x", wid, leader);
+	if (last == NULL) {
+		wm_ref_set_leader(ps->wm, w->tree_ref, XCB_NONE);
 	}
-
-	log_debug("window %#010x: leader %#010x", wid, leader);
-	return leader;
 }
 
-/**
- * Retrieve the <code>WM_CLASS</code> of a window and update its
- * <code>win</code> structure.
- */
-bool win_update_class(struct x_connection *c, struct atom *atoms, struct win *w) {
+static bool win_apply_class(session_t *ps, struct win *w,
+                            const struct win_update_request *req, const void *reply) {
 	char **strlst = NULL;
 	int nstr = 0;
-	auto client_win = win_client_id(w, /*fallback_to_self=*/true);
-
-	// Free and reset old strings
-	free(w->class_instance);
-	free(w->class_general);
-	w->class_instance = NULL;
-	w->class_general = NULL;
 
 	// Retrieve the property string list
-	if (!wid_get_text_prop(c, atoms, client_win, atoms->aWM_CLASS, &strlst, &nstr)) {
-		return false;
+	if (reply == NULL || !x_get_text_prop_from_reply(ps->atoms, req->target, req->property,
+	                                                 reply, &strlst, &nstr)) {
+		bool changed = w->class_instance != NULL || w->class_general != NULL;
+		free(w->class_instance);
+		free(w->class_general);
+		w->class_instance = NULL;
+		w->class_general = NULL;
+		return changed;
 	}
 
 	// Copy the strings if successful
-	w->class_instance = strdup(strlst[0]);
-
-	if (nstr > 1) {
-		w->class_general = strdup(strlst[1]);
-	}
+	bool changed = win_set_string_field(&w->class_instance, strlst[0]);
+	changed |= win_set_string_field(&w->class_general, nstr > 1 ? strlst[1] : NULL);
 
 	free(strlst);
 
 	log_trace("(%#010x): client = %#010x, instance = \"%s\", general = \"%s\"",
-	          win_id(w), client_win, w->class_instance, w->class_general);
+	          win_id(w), req->target, w->class_instance, w->class_general);
 
-	return true;
+	return changed;
+}
+
+/**
+ * Retrieve the <code>WM_CLASS</code> of a window and update its
+ * <code>win</code> structure.
+ */
+void win_update_class(session_t *ps, struct win *w) {
+	auto client_win = win_client_id(w, /*fallback_to_self=*/true);
+	win_get_property_async(ps, w, client_win, ps->atoms->aWM_CLASS, XCB_ATOM_ANY,
+	                       UINT32_MAX, win_apply_class);
 }
 
 /**
@@ -1440,45 +1799,40 @@ void win_extents(const struct win *w, region_t *res) {
 
 gen_by_val(win_extents);
 
-/**
- * Update the out-dated bounding shape of a window.
- *
- * Mark the window shape as updated
- */
-void win_update_bounding_shape(struct x_connection *c, struct win *w,
-                               bool detect_rounded_corners) {
-	// We don't handle property updates of non-visible windows until they are
-	// mapped.
-	assert(w->state == WSTATE_MAPPED);
+static bool win_apply_bounding_shaped(session_t *ps, struct win *w,
+                                      const struct win_update_request *req,
+                                      const void *reply) {
+	const xcb_shape_query_extents_reply_t *r = reply;
+	bool was_shaped = w->bounding_shaped;
+	w->bounding_shaped = r != NULL && r->bounding_shaped;
+	if (w->bounding_shaped) {
+		// The bounding region is updated by the rectangles reply
+		return false;
+	}
 
-	pixman_region32_clear(&w->bounding_shape);
-	// Start with the window rectangular region
+	req->next->resolved = true;
 	win_get_region_local(w, &w->bounding_shape);
-
-	if (c->e.has_shape) {
-		w->bounding_shaped = win_bounding_shaped(c, win_id(w));
+	if (!was_shaped) {
+		return false;
 	}
+	win_release_mask(ps->backend_data, w);
+	win_release_shadow(ps->backend_data, w);
+	return true;
+}
 
-	// Only request for a bounding region if the window is shaped
-	// (while loop is used to avoid goto, not an actual loop)
-	while (w->bounding_shaped) {
-		/*
-		 * if window doesn't exist anymore,  this will generate an error
-		 * as well as not generate a region.
-		 */
-
-		xcb_shape_get_rectangles_reply_t *r = xcb_shape_get_rectangles_reply(
-		    c->c, xcb_shape_get_rectangles(c->c, win_id(w), XCB_SHAPE_SK_BOUNDING),
-		    NULL);
-
-		if (!r) {
-			break;
-		}
+static bool win_apply_bounding_shape(session_t *ps, struct win *w,
+                                     const struct win_update_request *req attr_unused,
+                                     const void *reply) {
+	// Start with the window rectangular region
+	win_get_region_local(w, &w->bounding_shape);
 
+	// If window doesn't exist anymore, the request would have failed, in which case
+	// we don't have a bounding region.
+	if (reply != NULL) {
+		auto r = (xcb_shape_get_rectangles_reply_t *)reply;
 		xcb_rectangle_t *xrects = xcb_shape_get_rectangles_rectangles(r);
 		int nrects = xcb_shape_get_rectangles_rectangles_length(r);
 		rect_t *rects = from_x_rects(nrects, xrects);
-		free(r);
 
 		region_t br;
 		pixman_region32_init_rects(&br, rects, nrects);
@@ -1497,51 +1851,99 @@ void win_update_bounding_shape(struct x_connection *c, struct win *w,
 		// rectangle
 		pixman_region32_intersect(&w->bounding_shape, &w->bounding_shape, &br);
 		pixman_region32_fini(&br);
-		break;
 	}
 
-	if (w->bounding_shaped && detect_rounded_corners) {
+	if (ps->o.detect_rounded_corners) {
 		w->rounded_corners = win_has_rounded_corners(w);
 	}
+
+	// The mask and the shadow are built from the bounding shape
+	win_release_mask(ps->backend_data, w);
+	win_release_shadow(ps->backend_data, w);
+	return true;
 }
 
 /**
- * Retrieve frame extents from a window.
+ * Update the out-dated bounding shape of a window.
+ *
+ * The new shape is requested from the X server, and applied when the replies arrive.
  */
-void win_update_frame_extents(struct x_connection *c, struct atom *atoms, struct win *w,
-                              xcb_window_t client) {
-	if (client == XCB_NONE) {
-		w->frame_extents = (margin_t){0};
+void win_update_bounding_shape(session_t *ps, struct win *w) {
+	// We don't handle property updates of non-visible windows until they are
+	// mapped.
+	assert(w->state == WSTATE_MAPPED);
+
+	if (w->bounding_shaped) {
+		// Keep using the old shape until the new one arrives, but it must not be
+		// bigger than the window.
+		region_t window_region;
+		pixman_region32_init(&window_region);
+		win_get_region_local(w, &window_region);
+		pixman_region32_intersect(&w->bounding_shape, &w->bounding_shape,
+		                          &window_region);
+		pixman_region32_fini(&window_region);
+	} else {
+		win_get_region_local(w, &w->bounding_shape);
+	}
+
+	if (!ps->c.e.has_shape) {
 		return;
 	}
 
-	winprop_t prop =
-	    x_get_prop(c, client, atoms->a_NET_FRAME_EXTENTS, 4L, XCB_ATOM_CARDINAL, 32);
+	// Only the rectangles of shaped windows are used, but they are requested
+	// right away to save a round trip.
+	auto wid = win_id(w);
+	auto extents = win_update_request_new(ps, w, wid, win_apply_bounding_shaped);
+	win_update_request_send(ps, extents, xcb_shape_query_extents(ps->c.c, wid).sequence);
+	extents->next = win_update_request_new(ps, w, wid, win_apply_bounding_shape);
+	win_update_request_send(
+	    ps, extents->next,
+	    xcb_shape_get_rectangles(ps->c.c, wid, XCB_SHAPE_SK_BOUNDING).sequence);
+}
 
-	if (prop.nitems == 4) {
-		int extents[4];
-		for (int i = 0; i < 4; i++) {
-			if (prop.c32[i] > (uint32_t)INT_MAX) {
-				log_warn("Your window manager sets a absurd "
-				         "_NET_FRAME_EXTENTS value (%u), "
-				         "ignoring it.",
-				         prop.c32[i]);
-				memset(extents, 0, sizeof(extents));
-				break;
-			}
-			extents[i] = (int)prop.c32[i];
-		}
+static bool win_apply_frame_extents(session_t *ps attr_unused, struct win *w,
+                                    const struct win_update_request *req attr_unused,
+                                    const void *reply) {
+	winprop_t prop = x_get_prop_from_reply(reply, XCB_ATOM_CARDINAL, 32);
+	if (prop.nitems != 4) {
+		return false;
+	}
 
-		w->frame_extents.left = extents[0];
-		w->frame_extents.right = extents[1];
-		w->frame_extents.top = extents[2];
-		w->frame_extents.bottom = extents[3];
+	int extents[4];
+	for (int i = 0; i < 4; i++) {
+		if (prop.c32[i] > (uint32_t)INT_MAX) {
+			log_warn("Your window manager sets a absurd "
+			         "_NET_FRAME_EXTENTS value (%u), "
+			         "ignoring it.",
+			         prop.c32[i]);
+			memset(extents, 0, sizeof(extents));
+			break;
+		}
+		extents[i] = (int)prop.c32[i];
 	}
 
+	auto old_frame_extents = w->frame_extents;
+	w->frame_extents.left = extents[0];
+	w->frame_extents.right = extents[1];
+	w->frame_extents.top = extents[2];
+	w->frame_extents.bottom = extents[3];
+
 	log_trace("(%#010x): %d, %d, %d, %d", win_id(w), w->frame_extents.left,
 	          w->frame_extents.right, w->frame_extents.top, w->frame_extents.bottom);
+	return memcmp(&old_frame_extents, &w->frame_extents, sizeof(margin_t)) != 0;
+}
 
-	free_winprop(&prop);
+/**
+ * Retrieve frame extents from a window.
+ */
+void win_update_frame_extents(session_t *ps, struct win *w, xcb_window_t client) {
+	if (client == XCB_NONE) {
+		w->frame_extents = (margin_t){0};
+		return;
+	}
+
+	win_get_property_async(ps, w, client, ps->atoms->a_NET_FRAME_EXTENTS,
+	                       XCB_ATOM_CARDINAL, 4, win_apply_frame_extents);
 }
 
 /// Finish the destruction of a window (e.g. after fading has finished).
@@ -1690,6 +2092,13 @@ static bool win_advance_animation(struct win *w, double delta_t,
 		auto elapsed_slot =
 		    script_elapsed_slot(w->running_animation_instance->script);
 		w->running_animation_instance->memory[elapsed_slot] += delta_t;
+		if (w->occluded && !win_animation_can_move(w)) {
+			// The window is fully covered by other windows, and its
+			// animation can't move it into view, so nothing of the animation
+			// is visible. Just keep track of time without evaluating the
+			// script.
+			return script_instance_is_finished(w->running_animation_instance);
+		}
 		auto result =
 		    script_instance_evaluate(w->running_animation_instance, (void *)win_ctx);
 		if (result != SCRIPT_EVAL_OK) {
@@ -1701,6 +2110,33 @@ static bool win_advance_animation(struct win *w, double delta_t,
 	return true;
 }
 
+bool win_animation_can_move(const struct win *w) {
+	static const enum win_script_output outputs[] = {
+	    WIN_SCRIPT_OFFSET_X, WIN_SCRIPT_OFFSET_Y,   WIN_SCRIPT_SCALE_X,
+	    WIN_SCRIPT_SCALE_Y,  WIN_SCRIPT_CROP_X,     WIN_SCRIPT_CROP_Y,
+	    WIN_SCRIPT_CROP_WIDTH, WIN_SCRIPT_CROP_HEIGHT,
+	};
+	if (w->running_animation_instance == NULL) {
+		return false;
+	}
+	for (size_t i = 0; i < ARR_SIZE(outputs); i++) {
+		if (w->running_animation.output_indices[outputs[i]] >= 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+double win_animation_time_left(const struct win *w) {
+	if (w->running_animation_instance == NULL) {
+		return 0;
+	}
+	auto instance = w->running_animation_instance;
+	auto left = instance->memory[script_total_duration_slot(instance->script)] -
+	            instance->memory[script_elapsed_slot(instance->script)];
+	return max2(left, 0.);
+}
+
 bool win_process_animation_and_state_change(struct session *ps, struct win *w, double delta_t) {
 	// If the window hasn't ever been damaged yet, it won't be rendered in this frame.
 	// Or if it doesn't have a image bound, it won't be rendered either. (This can
@@ -1717,6 +2153,9 @@ bool win_process_animation_and_state_change(struct session *ps, struct win *w, d
 	auto win_ctx = win_script_context_prepare(ps, w);
 	bool geometry_changed = !win_geometry_eq(w->previous.g, w->g);
 	auto old_state = w->previous.state;
+	if (old_state != w->state || geometry_changed || w->previous.opacity != w->opacity) {
+		win_mark_layout_dirty(w);
+	}
 
 	w->previous.state = w->state;
 	w->previous.opacity = w->opacity;
@@ -1856,8 +2295,9 @@ bool win_process_animation_and_state_change(struct session *ps, struct win *w, d
 				pixman_region32_fini(&copy_region);
 			}
 		} else {
-			w->saved_win_image = w->win_image;
-			w->win_image = NULL;
+			// The new pixmap is fetched asynchronously, keep drawing the old
+			// image until it arrives, then move it aside for the animation.
+			w->save_win_image_on_rebind = true;
 		}
 		w->saved_win_image_scale = (vec2){
 		    .x = win_ctx.width / win_ctx.width_before,
@@ -2058,6 +2498,9 @@ void win_map_start(struct session *ps, struct win *w) {
 	w->mode = win_calc_mode(w);
 
 	w->state = WSTATE_MAPPED;
+	// Properties are requested when WIN_FLAGS_CLIENT_STALE is handled, don't paint
+	// the window until they arrive.
+	w->awaiting_properties = true;
 	win_set_flags(
 	    w, WIN_FLAGS_PIXMAP_STALE | WIN_FLAGS_CLIENT_STALE | WIN_FLAGS_FACTOR_CHANGED);
 
@@ -2080,6 +2523,7 @@ void win_set_flags(struct win *w, uint64_t flags) {
 	}
 
 	w->flags |= flags;
+	win_mark_layout_dirty(w);
 }
 
 /// Clear flags on a window. Some sanity checks are performed
@@ -2168,20 +2612,7 @@ void win_update_is_fullscreen(const session_t *ps, struct win *w) {
 
 /**
  * Check if a window has BYPASS_COMPOSITOR property set
- *
- * TODO(yshui) cache this property
  */
-bool win_is_bypassing_compositor(const session_t *ps, const struct win *w) {
-	bool ret = false;
-	auto wid = win_client_id(w, /*fallback_to_self=*/true);
-
-	auto prop = x_get_prop(&ps->c, wid, ps->atoms->a_NET_WM_BYPASS_COMPOSITOR, 1L,
-	                       XCB_ATOM_CARDINAL, 32);
-
-	if (prop.nitems && *prop.c32 == 1) {
-		ret = true;
-	}
-
-	free_winprop(&prop);
-	return ret;
+bool win_is_bypassing_compositor(const session_t *ps attr_unused, const struct win *w) {
+	return w->prop_bypass_compositor;
 }
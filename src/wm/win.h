@@ -27,6 +27,7 @@
 struct backend_base;
 typedef struct session session_t;
 struct wm_cursor;
+struct win_pixmap_request;
 
 #define wm_stack_foreach(wm, i)                                                          \
 	for (struct wm_ref * (i) = wm_ref_topmost_child(wm_root_ref(wm)); (i);           \
@@ -89,6 +90,15 @@ struct win {
 	/// backend data attached to this window. Only available when
 	/// `state` is not UNMAPPED
 	image_handle win_image;
+	/// Size of the pixmap bound to `win_image`. After the window is resized, this
+	/// differs from the window size until the new pixmap arrives. Zero if unknown.
+	ivec2 win_image_size;
+	/// The request for a new named pixmap of this window, if one has been sent and
+	/// not yet bound.
+	struct win_pixmap_request *pending_pixmap;
+	/// Move `win_image` into `saved_win_image` when the pending pixmap is bound,
+	/// instead of releasing it, because an animation wants the old image.
+	bool save_win_image_on_rebind;
 	/// The old window image before the window image is refreshed. This is used for
 	/// animation, and is only kept alive for the duration of the animation.
 	image_handle saved_win_image;
@@ -119,6 +129,16 @@ struct win {
 	bool ever_damaged;
 	/// Whether the window was damaged after last paint.
 	bool pixmap_damaged;
+	/// Whether the window received a DamageNotify, and its damage region hasn't
+	/// been requested from the X server yet.
+	bool damage_pending;
+	/// Whether the window is waiting for the properties requested when it was mapped.
+	/// It is not painted until they arrive, so it is never shown with window rules
+	/// matched against incomplete properties.
+	bool awaiting_properties;
+	/// Number of property, shape and attribute requests sent for this window whose
+	/// replies haven't arrived yet.
+	unsigned int pending_property_replies;
 	/// Damage of the window.
 	xcb_damage_damage_t damage;
 	/// bitmap for properties which needs to be updated
@@ -131,6 +151,10 @@ struct win {
 	region_t bounding_shape;
 	/// Window flags. Definitions above.
 	uint64_t flags;
+	/// Incremented every time something that affects how this window is laid out
+	/// changes. The layout manager uses this to decide whether it can reuse the
+	/// layer it computed for this window in the previous frame.
+	uint64_t layout_generation;
 	/// Cached width/height of the window including border.
 	int widthb, heightb;
 	/// Whether the window is bounding-shaped.
@@ -139,6 +163,11 @@ struct win {
 	bool rounded_corners;
 	/// Whether this window is to be painted.
 	bool to_paint;
+	/// Whether this window is fully covered by opaque windows above it, as of the last
+	/// frame. Covered windows are not laid out, and their animations are not
+	/// evaluated unless they can move the window into view, see `paint_preprocess`
+	/// and `win_animation_can_move`.
+	bool occluded;
 	/// Whether this window is in open/close state.
 	bool in_openclose;
 
@@ -158,6 +187,8 @@ struct win {
 	char *role;
 	/// Whether the window sets the EWMH fullscreen property.
 	bool is_ewmh_fullscreen;
+	/// Whether the window sets _NET_WM_BYPASS_COMPOSITOR to 1.
+	bool prop_bypass_compositor;
 	/// Whether the window should be considered fullscreen. Based on
 	/// `is_ewmh_fullscreen`, or the windows spatial relation with the
 	/// root window. Which one is used is determined by user configuration.
@@ -364,6 +395,12 @@ static inline bool win_geometry_eq(struct win_geometry a, struct win_geometry b)
 /// or if the window's states just changed and there is no animation defined for this
 /// state change.
 bool win_process_animation_and_state_change(struct session *ps, struct win *w, double delta_t);
+/// How many seconds are left until the running animation of the window finishes. 0 if
+/// there is no animation running.
+double win_animation_time_left(const struct win *w);
+/// Whether the running animation of the window changes its position, scale or crop, so
+/// it might bring the window into view while it is covered.
+bool win_animation_can_move(const struct win *w);
 double win_animatable_get(const struct win *w, enum win_script_output output);
 void win_process_primary_flags(session_t *ps, struct win *w);
 void win_process_secondary_flags(session_t *ps, struct win *w);
@@ -466,6 +503,11 @@ bool win_is_mapped_in_x(const struct win *w);
 void win_set_flags(struct win *w, uint64_t flags);
 /// Clear flags on a window. Some sanity checks are performed
 void win_clear_flags(struct win *w, uint64_t flags);
+/// Mark the layer of this window as out of date, so it will be recomputed for the
+/// next frame.
+static inline void win_mark_layout_dirty(struct win *w) {
+	w->layout_generation++;
+}
 /// Returns true if any of the flags in `flags` is set
 bool win_check_flags_any(struct win *w, uint64_t flags);
 /// Returns true if all of the flags in `flags` are set
@@ -497,25 +539,23 @@ win_geometry_from_get_geometry(const xcb_get_geometry_reply_t *g) {
 /// changes.
 /// Returns true if the geometry has changed, false otherwise.
 bool win_set_pending_geometry(struct win *w, struct win_geometry g);
-bool win_update_wintype(struct x_connection *c, struct atom *atoms, struct win *w);
+/// Request the window type of a window, the window is updated when the reply arrives.
+void win_update_wintype(session_t *ps, struct win *w);
 /**
- * Retrieve frame extents from a window.
+ * Request frame extents of a window, the window is updated when the reply arrives.
  */
-void win_update_frame_extents(struct x_connection *c, struct atom *atoms, struct win *w,
-                              xcb_window_t client);
+void win_update_frame_extents(session_t *ps, struct win *w, xcb_window_t client);
 /**
- * Retrieve the <code>WM_CLASS</code> of a window and update its
- * <code>win</code> structure.
+ * Request the <code>WM_CLASS</code> of a window, its <code>win</code> structure is
+ * updated when the reply arrives.
  */
-bool win_update_class(struct x_connection *c, struct atom *atoms, struct win *w);
-int win_update_role(struct x_connection *c, struct atom *atoms, struct win *w);
-int win_update_name(struct x_connection *c, struct atom *atoms, struct win *w);
+void win_update_class(session_t *ps, struct win *w);
+void win_update_role(session_t *ps, struct win *w);
+void win_update_name(session_t *ps, struct win *w);
 void win_on_win_size_change(struct win *w, int shadow_offset_x, int shadow_offset_y,
                             int shadow_radius);
-void win_update_bounding_shape(struct x_connection *c, struct win *w,
-                               bool detect_rounded_corners);
-bool win_update_prop_fullscreen(struct x_connection *c, const struct atom *atoms,
-                                struct win *w);
+void win_update_bounding_shape(session_t *ps, struct win *w);
+void win_update_prop_fullscreen(session_t *ps, struct win *w);
 
 static inline attr_unused void win_set_property_stale(struct win *w, xcb_atom_t prop) {
 	return win_set_properties_stale(w, (xcb_atom_t[]){prop}, 1);
@@ -781,3 +781,22 @@ struct wm_ref *wm_new_mock_window(struct wm *wm, xcb_window_t wid) {
 void wm_free_mock_window(struct wm * /*wm*/, struct wm_ref *cursor) {
 	free(to_tree_node_mut(cursor));
 }
+struct wm_ref *wm_new_mock_root(struct wm *wm, xcb_window_t wid) {
+	auto node = wm_tree_new_window(&wm->tree, wid);
+	wm_tree_add_window(&wm->tree, node);
+	wm_tree_attach(&wm->tree, node, NULL);
+	node->tree_queried = true;
+	return (struct wm_ref *)&node->siblings;
+}
+struct wm_ref *wm_new_mock_toplevel(struct wm *wm, xcb_window_t wid) {
+	BUG_ON_NULL(wm->tree.root);
+	auto node = wm_tree_new_window(&wm->tree, wid);
+	wm_tree_add_window(&wm->tree, node);
+	wm_tree_attach(&wm->tree, node, wm->tree.root);
+	node->tree_queried = true;
+	// Mock windows are not driven by X events, nobody is going to consume the
+	// tree changes.
+	while (wm_dequeue_change(wm).type != WM_TREE_CHANGE_NONE) {
+	}
+	return (struct wm_ref *)&node->siblings;
+}
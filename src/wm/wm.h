@@ -226,3 +226,9 @@ bool wm_is_consistent(const struct wm *wm);
 
 struct wm_ref *wm_new_mock_window(struct wm *wm, xcb_window_t wid);
 void wm_free_mock_window(struct wm *wm, struct wm_ref *cursor);
+/// Create a root window for `wm` without going through the import process. For use where
+/// there is no X server, e.g. in benchmarks.
+struct wm_ref *wm_new_mock_root(struct wm *wm, xcb_window_t wid);
+/// Create a toplevel window on top of the stack, `wm_new_mock_root` must have been called
+/// first. Tree changes caused by this are discarded.
+struct wm_ref *wm_new_mock_toplevel(struct wm *wm, xcb_window_t wid);
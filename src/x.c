@@ -4,6 +4,7 @@
 #include <stdalign.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <X11/Xlib-xcb.h>
 #include <X11/Xutil.h>
@@ -26,6 +27,7 @@
 #include "common.h"
 #include "compiler.h"
 #include "log.h"
+#include "recorder.h"
 #include "region.h"
 #include "utils/kernel.h"
 #include "utils/misc.h"
@@ -406,21 +408,32 @@ winprop_t x_get_prop_with_offset(const struct x_connection *c, xcb_window_t w, x
 	                     to_u32_checked(length)),
 	    NULL);
 
-	if (r && xcb_get_property_value_length(r) &&
+	auto ret = x_get_prop_from_reply(r, rtype, rformat);
+	if (ret.ptr == NULL) {
+		free(r);
+	} else {
+		ret.r = r;
+	}
+	return ret;
+}
+
+winprop_t x_get_prop_from_reply(const xcb_get_property_reply_t *r, xcb_atom_t rtype,
+                                int rformat) {
+	auto reply = (xcb_get_property_reply_t *)r;
+	if (r && xcb_get_property_value_length(reply) &&
 	    (rtype == XCB_GET_PROPERTY_TYPE_ANY || r->type == rtype) &&
 	    (!rformat || r->format == rformat) &&
 	    (r->format == 8 || r->format == 16 || r->format == 32)) {
-		auto len = xcb_get_property_value_length(r);
+		auto len = xcb_get_property_value_length(reply);
 		return (winprop_t){
-		    .ptr = xcb_get_property_value(r),
+		    .ptr = xcb_get_property_value(reply),
 		    .nitems = (ulong)(len / (r->format / 8)),
 		    .type = r->type,
 		    .format = r->format,
-		    .r = r,
+		    .r = NULL,
 		};
 	}
 
-	free(r);
 	return (winprop_t){
 	    .ptr = NULL, .nitems = 0, .type = XCB_GET_PROPERTY_TYPE_ANY, .format = 0};
 }
@@ -463,27 +476,33 @@ bool wid_get_text_prop(struct x_connection *c, struct atom *atoms, xcb_window_t
 		return false;
 	}
 
+	bool ret = x_get_text_prop_from_reply(atoms, wid, prop, r, pstrlst, pnstr);
+	free(r);
+	return ret;
+}
+
+bool x_get_text_prop_from_reply(struct atom *atoms, xcb_window_t wid, xcb_atom_t prop,
+                                const xcb_get_property_reply_t *r, char ***pstrlst,
+                                int *pnstr) {
 	if (r->type == XCB_ATOM_NONE) {
-		free(r);
 		return false;
 	}
 
 	if (!x_is_type_string(atoms, r->type)) {
 		log_warn("Text property %d of window %#010x has unsupported type: %d",
 		         prop, wid, r->type);
-		free(r);
 		return false;
 	}
 
 	if (r->format != 8) {
 		log_warn("Text property %d of window %#010x has unexpected format: %d",
 		         prop, wid, r->format);
-		free(r);
 		return false;
 	}
 
-	uint32_t length = to_u32_checked(xcb_get_property_value_length(r));
-	void *data = xcb_get_property_value(r);
+	auto reply = (xcb_get_property_reply_t *)r;
+	uint32_t length = to_u32_checked(xcb_get_property_value_length(reply));
+	void *data = xcb_get_property_value(reply);
 	unsigned int nstr = 0;
 	uint32_t current_offset = 0;
 	while (current_offset < length) {
@@ -499,7 +518,6 @@ bool wid_get_text_prop(struct x_connection *c, struct atom *atoms, xcb_window_t
 		strlst[0] = "";
 		*pnstr = 1;
 		*pstrlst = strlst;
-		free(r);
 		return true;
 	}
 
@@ -510,7 +528,7 @@ bool wid_get_text_prop(struct x_connection *c, struct atom *atoms, xcb_window_t
 	}
 
 	char *strlst = buf + sizeof(char *) * nstr;
-	memcpy(strlst, xcb_get_property_value(r), length);
+	memcpy(strlst, data, length);
 	strlst[length] = '\0';        // X strings aren't guaranteed to be null terminated
 
 	char **ret = buf;
@@ -524,7 +542,6 @@ bool wid_get_text_prop(struct x_connection *c, struct atom *atoms, xcb_window_t
 
 	*pnstr = to_int_checked(nstr);
 	*pstrlst = ret;
-	free(r);
 	return true;
 }
 
@@ -712,15 +729,8 @@ x_create_picture_with_visual(struct x_connection *c, int w, int h, xcb_visualid_
 	                                     valuemask, attr);
 }
 
-bool x_fetch_region(struct x_connection *c, xcb_xfixes_region_t r, pixman_region32_t *res) {
-	xcb_generic_error_t *e = NULL;
-	xcb_xfixes_fetch_region_reply_t *xr =
-	    xcb_xfixes_fetch_region_reply(c->c, xcb_xfixes_fetch_region(c->c, r), &e);
-	if (!xr) {
-		log_error_x_error(c, e, "Failed to fetch rectangles");
-		return false;
-	}
-
+bool x_region_from_fetch_reply(const xcb_xfixes_fetch_region_reply_t *xr,
+                               pixman_region32_t *res) {
 	int nrect = xcb_xfixes_fetch_region_rectangles_length(xr);
 	auto b = ccalloc(nrect, pixman_box32_t);
 	xcb_rectangle_t *xrect = xcb_xfixes_fetch_region_rectangles(xr);
@@ -732,6 +742,19 @@ bool x_fetch_region(struct x_connection *c, xcb_xfixes_region_t r, pixman_region
 	}
 	bool ret = pixman_region32_init_rects(res, b, nrect);
 	free(b);
+	return ret;
+}
+
+bool x_fetch_region(struct x_connection *c, xcb_xfixes_region_t r, pixman_region32_t *res) {
+	xcb_generic_error_t *e = NULL;
+	xcb_xfixes_fetch_region_reply_t *xr =
+	    xcb_xfixes_fetch_region_reply(c->c, xcb_xfixes_fetch_region(c->c, r), &e);
+	if (!xr) {
+		log_error_x_error(c, e, "Failed to fetch rectangles");
+		return false;
+	}
+
+	bool ret = x_region_from_fetch_reply(xr, res);
 	free(xr);
 	return ret;
 }
@@ -1098,6 +1121,7 @@ static void x_handle_update_monitors_reply(struct x_connection *c,
 		xcb_randr_monitor_info_t *mi = monitor_info_it.data;
 		pixman_region32_init_rect(&m->regions[i++], mi->x, mi->y, mi->width, mi->height);
 	}
+	m->generation++;
 }
 
 void x_update_monitors_async(struct x_connection *c, struct x_monitors *m) {
@@ -1128,6 +1152,30 @@ static inline void x_ingest_event(struct x_connection *c, xcb_generic_event_t *e
 
 static const xcb_raw_generic_event_t no_reply_success = {.response_type = 1};
 
+/// Record a message we received from the X server, if recording is enabled.
+static void x_record_message(struct x_connection *c, enum event_trace_record_type type,
+                             uint32_t sequence, const xcb_raw_generic_event_t *msg) {
+	if (c->recorder == NULL) {
+		return;
+	}
+	// Replies and generic events have variable length, everything else is 32 bytes.
+	uint32_t extra = 0;
+	uint8_t kind = msg->response_type & 0x7f;
+	if (kind == 1 || kind == XCB_GE_GENERIC) {
+		extra = ((const xcb_generic_reply_t *)msg)->length * 4;
+	}
+	auto payload = (char *)event_recorder_reserve(c->recorder, type, sequence, 32 + extra);
+	if (payload == NULL) {
+		return;
+	}
+	memcpy(payload, msg, 32);
+	if (extra != 0) {
+		// For events, xcb inserts `full_sequence` after the first 32 bytes.
+		const char *rest = (const char *)msg + (kind == 1 ? 32 : 36);
+		memcpy(payload + 32, rest, extra);
+	}
+}
+
 /// Complete all pending async requests that "come before" the given event.
 static void x_complete_async_requests(struct x_connection *c, xcb_generic_event_t *e) {
 	auto seq = x_widen_sequence(c, e->full_sequence);
@@ -1156,6 +1204,9 @@ static void x_complete_async_requests(struct x_connection *c, xcb_generic_event_
 		}
 		c->latest_completed_request = i->sequence;
 		list_remove(&i->siblings);
+		if (reply_or_error != &no_reply_success) {
+			x_record_message(c, EVENT_TRACE_RECORD_REPLY, i->sequence, reply_or_error);
+		}
 		i->callback(c, i, reply_or_error);
 		if (reply_or_error != &no_reply_success) {
 			free((void *)reply_or_error);
@@ -1164,7 +1215,11 @@ static void x_complete_async_requests(struct x_connection *c, xcb_generic_event_
 }
 
 static bool x_feed_event(struct x_connection *c, xcb_generic_event_t *e) {
+	// Replies to requests before `e` were received before it, so they are
+	// recorded first.
 	x_complete_async_requests(c, e);
+	x_record_message(c, EVENT_TRACE_RECORD_EVENT, e->full_sequence,
+	                 (xcb_raw_generic_event_t *)e);
 	x_ingest_event(c, e);
 
 	if (e->response_type != 0) {
@@ -21,6 +21,7 @@
 
 typedef struct session session_t;
 struct atom;
+struct event_recorder;
 
 /// Structure representing Window property value.
 typedef struct winprop {
@@ -124,12 +125,16 @@ struct x_connection {
 	/// events. The only problem, if no events are coming, we will be stuck
 	/// indefinitely, so we have to make our own events.
 	uint32_t event_sync;
+	/// If not NULL, every event and async reply we receive is recorded here.
+	struct event_recorder *recorder;
 };
 
 /// Monitor info
 struct x_monitors {
 	int count;
 	region_t *regions;
+	/// Incremented every time the monitor information is updated.
+	uint64_t generation;
 };
 
 #define XCB_AWAIT_VOID(func, conn, ...)                                                   \
@@ -267,6 +272,12 @@ void x_connection_init_xcb(struct x_connection *c, xcb_connection_t *conn, int s
 winprop_t x_get_prop_with_offset(const struct x_connection *c, xcb_window_t w, xcb_atom_t atom,
                                  int offset, int length, xcb_atom_t rtype, int rformat);
 
+/// Interpret the reply to a get property request, like `x_get_prop_with_offset` does.
+/// The returned `winprop_t` points into `r` and doesn't own it, so it must not outlive
+/// `r`, and `r` is not freed by `free_winprop`.
+winprop_t x_get_prop_from_reply(const xcb_get_property_reply_t *r, xcb_atom_t rtype,
+                                int rformat);
+
 /**
  * Wrapper of wid_get_prop_adv().
  */
@@ -295,6 +306,11 @@ bool wid_get_opacity_prop(struct x_connection *c, struct atom *atoms, xcb_window
  */
 bool wid_get_text_prop(struct x_connection *c, struct atom *atoms, xcb_window_t wid,
                        xcb_atom_t prop, char ***pstrlst, int *pnstr);
+/// Same as `wid_get_text_prop`, but with the text taken from the reply `r` to a get
+/// property request. `wid` and `prop` are only used for logging.
+bool x_get_text_prop_from_reply(struct atom *atoms, xcb_window_t wid, xcb_atom_t prop,
+                                const xcb_get_property_reply_t *r, char ***pstrlst,
+                                int *pnstr);
 
 static inline bool x_is_type_string(struct atom *atoms, xcb_atom_t type) {
 	return type == XCB_ATOM_STRING || type == atoms->aUTF8_STRING ||
@@ -345,6 +361,9 @@ x_create_picture_with_visual(struct x_connection *, int w, int h, xcb_visualid_t
 
 /// Fetch a X region and store it in a pixman region
 bool x_fetch_region(struct x_connection *, xcb_xfixes_region_t r, region_t *res);
+/// Convert the reply of a XFixes FetchRegion request into a pixman region. `res` is
+/// initialized by this function.
+bool x_region_from_fetch_reply(const xcb_xfixes_fetch_region_reply_t *xr, region_t *res);
 
 /// Set an X region to a pixman region
 bool x_set_region(struct x_connection *c, xcb_xfixes_region_t dst, const region_t *src);